@@ -1,30 +1,45 @@
 #include "Action_GIGIST.h"
 #include "GIGIST_six_corr.h"
+#include "StringRoutines.h"
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 
 /**
  * Standard constructor
  */
 Action_GIGist::Action_GIGist() :
-#ifdef CUDA
-NBindex_c_(nullptr),
-molecule_c_(nullptr),
-paramsLJ_c_(nullptr),
-result_w_c_(nullptr),
-result_s_c_(nullptr),
-result_O_c_(nullptr),
-result_N_c_(nullptr),
-#endif
 list_(nullptr),
 top_(nullptr),
 dict_(DataDictionary()),
-datafile_(nullptr),
-dxfile_(nullptr),
-febissWaterfile_(nullptr),
 wrongNumberOfAtoms_(false)
 {}
 
+/**
+ * Inserts a suffix in front of the file extension, so that the files of
+ * additional grids do not overwrite the files of the first grid.
+ * @param name: The file name.
+ * @param suffix: The suffix to add, may be empty.
+ * @return: The new file name.
+ */
+static std::string addFileSuffix(const std::string &name, const std::string &suffix)
+{
+  if (suffix.empty()) {
+    return name;
+  }
+  // out.dat.gz becomes out_1.dat.gz.
+  const std::string compression{ CompressedBuffer::compressionSuffix(name) };
+  if (!compression.empty()) {
+    return addFileSuffix(name.substr(0, name.size() - compression.size()), suffix) + compression;
+  }
+  std::string::size_type dot{ name.find_last_of('.') };
+  std::string::size_type slash{ name.find_last_of('/') };
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return name + suffix;
+  }
+  return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
 /**
  * The help function.
  */
@@ -32,13 +47,91 @@ void Action_GIGist::Help() const {
   mprintf("     Usage:\n"
           "    griddim [dimx dimy dimz]   Defines the dimension of the grid.\n"
           "    <gridcntr [x y z]>         Defines the center of the grid, default [0 0 0].\n"
+          "    <gridmask [mask] <pad 3>>  Instead of griddim, fits the grid around the atoms in mask\n"
+          "                               in the first frame, with pad Angstrom of space around them.\n"
+          "    <prepass [n]>              Crops gridmask grids to the solvent density of the first n frames.\n"
+          "    <refine [levels]>          Adds grids with 2, 4, ... times finer spacing, which only cover the\n"
+          "                               voxels whose prepass density or density gradient is high.\n"
+          "    <refinedens 1.5>           Density relative to bulk above which a voxel is refined.\n"
+          "    <refinegrad 1.0>           Density difference between the octants of a voxel (relative to bulk)\n"
+          "                               above which it is refined.\n"
+          "    <refineout>                Writes the _dens and _norm sets of every grid and its refinement grids\n"
+          "                               resampled to the finest spacing (refined_<set>.dx).\n"
+          "    <pairmatrix [file]>        Writes the Eww between pairs of voxels to a binary file (not with cuda).\n"
+          "    <paircut 6.0>              Only voxel pairs closer than paircut Angstrom are stored.\n"
+          "    <residence [file]>         Writes mean residence times and survival per voxel.\n"
+          "    <resmax 20>                Length of the survival function in frames.\n"
+          "    <deterministic>            Bit-identical results for any number of OpenMP threads.\n"
+          "    <flush 100>                Frames summed in single precision before they are added to the\n"
+          "                               double precision totals of the energies and dipoles.\n"
+          "    <densityonly>              Only bins the solvent atoms for the population and g_ files (dx is\n"
+          "                               always written), no energies, entropies or dipoles.\n"
+          "    <splitpop 1000>            Voxels with at least this population split their entropy\n"
+          "                               calculation over all threads.\n"
+          "    <query [file]>             Writes the values of the voxels listed in file (one voxel index\n"
+          "                               or x y z point per line) for every grid to queryout.\n"
+          "    <queryout query.dat>       Output file of query.\n"
+          "    <queryonly>                Only calculates the entropy of the queried voxels, skips out and FEBISS.\n"
+          "    <keep>                     Keeps grids and samples in memory after run for the Python module\n"
+          "                               (python/gigist_module.cpp).\n"
+          "    <proximity [width]>        Sums and averages every grid over the voxels in bins of width\n"
+          "                               (Angstrom) of the distance to the nearest solute atom, written to\n"
+          "                               proxout, the distances to proximity.dx.\n"
+          "    <proxmax 10.0>             Largest distance of the bins.\n"
+          "    <proxavg>                  Averages the distances over all frames instead of the first frame.\n"
+          "    <proxout proximity.dat>    Output file of proximity.\n"
+          "    <progressive [stride]>     Calculates the entropies from every stride-th frame first and halves\n"
+          "                               the stride for voxels that need refinement; the fraction of frames\n"
+          "                               used is the last column of out and entropy_fraction.dx.\n"
+          "    <progerr 0.1>              Refines voxels whose entropy has a larger standard error (kcal/mol).\n"
+          "    <progdg [energy]>          Refines voxels with a larger |Esw - TdSsix| (kcal/mol per voxel).\n"
+          "    <progprox [distance]>      Refines voxels closer to the solute (Angstrom, needs proximity).\n"
+          "    <bootstrap [replicates]>   Block bootstrap standard errors of the entropies, energies and\n"
+          "                               densities, written to se_<name>.dx. Keeps the sums of every block\n"
+          "                               of every voxel in memory.\n"
+          "    <bootblock 100>            Frames per block, longer than the correlation time of the solvent.\n"
+          "    <bootseed 1>               Seed of the drawn blocks.\n"
+          "    <backend [cpu|tiled|reference|pme|cuda]> Energy calculation: threaded CPU (default without\n"
+          "                               CUDA), tiled CPU for large systems, scalar reference, particle mesh\n"
+          "                               Ewald or GPU (default with CUDA).\n"
+          "    <pmecut 9.0>               Real space cutoff of pme, also used for the Lennard-Jones energy.\n"
+          "    <pmespacing 1.0>           Maximum grid spacing of pme.\n"
+          "    <pmeorder 4>               B-spline order of pme.\n"
+          "    <align [mask] <ref [ref]>> Fits mask onto the reference (first frame without ref) before\n"
+          "                               binning. Replaces a preceding rms action, energies are not affected.\n"
           "    <temp 300>                 Defines the temperature of the simulation.\n"
           "    <gridspacn 0.5>            Defines the grid spacing\n"
           "    <refdens 0.0329>           Defines the reference density for the water model.\n"
+          "                               With species, one comma separated value per species.\n"
           "    <febiss 104.57>            Activates FEBISS placement with given ideal water angle (only available for water)\n"
+          "    <sites [file]>             Writes hydration sites of any solvent to a pdb file, the B-factor is\n"
+          "                               the free energy of one molecule (parallel alternative to febiss).\n"
+          "    <sitethresh 2.0>           Density relative to bulk a site has to exceed.\n"
+          "    <siteradius 1.5>           Largest shell radius in Angstrom for the free energy of a site.\n"
           "    <out \"out.dat\">          Defines the name of the output file.\n"
           "    <dx>                       Set to write out dx files. Population is always written.\n"
+          "    <mrc>                      Also writes every dx file as binary MRC/CCP4 map (.mrc).\n"
+          "    <mrcstack [file]>          Writes all grids written as dx into one MRC volume stack, the\n"
+          "                               names of the volumes are stored in the extended header.\n"
+          "    <compress [gz|zst]>        Compresses the dx and MRC files, out, pairmatrix and mrcstack are\n"
+          "                               compressed if their names end in .gz or .zst. Blocks are\n"
+          "                               compressed in parallel.\n"
           "    <solventStart [n]>         Sets the first solvent as the nth molecule (necessary for CHCl3).\n"
+          "    <species [res1,res2,...]>  Analyses every listed solvent residue as its own species.\n"
+          "  griddim, gridcntr and gridspacn can be repeated to analyse several grids in a\n"
+          "  single pass. The n-th gridcntr and gridspacn belong to the n-th griddim, the\n"
+          "  energies are only calculated once per frame. Output of additional grids is\n"
+          "  written to files with the suffix _<n> (e.g., out_1.dat, population_1.dx).\n"
+          "  gridmask grids are placed after all griddim grids. Their size is only known once\n"
+          "  the first frame (or the first n frames with prepass) is read, these frames are\n"
+          "  kept in memory and processed as soon as the grid is fitted.\n"
+          "  With refine, every grid gets one refinement grid per level with the suffix\n"
+          "  _r<level>, placed after the prepass. Voxels outside of the refined region of\n"
+          "  such a grid stay empty.\n"
+          "  With species, every grid is split into one channel per solvent species,\n"
+          "  identified by the residue name of the first atom of each molecule. Each\n"
+          "  channel has its own center atom, densities and reference density and its\n"
+          "  output carries the residue name as suffix (e.g., out_MEOH.dat).\n"
 
           "  The griddimensions must be set in integer values and have to be larger than 0.\n"
           "  The greatest advantage, stems from the fact that this code is parallelized\n"
@@ -57,12 +150,7 @@ void Action_GIGist::Help() const {
           "#    Lazaridis, J. Phys. Chem. B 102, 3531–3541 (1998)\n");
 }
 
-Action_GIGist::~Action_GIGist() {
-  // The GPU memory should already be freed, but just in case...
-  #ifdef CUDA
-  freeGPUMemory();
-  #endif
-}
+Action_GIGist::~Action_GIGist() {}
 
 /*****
  * @brief Calculate the start of the grid.
@@ -70,11 +158,11 @@ Action_GIGist::~Action_GIGist() {
  * Calculates the start of the grid, using the center, stepsize in each
  * dimension and the voxel Size.
  */
-void Action_GIGist::calcGridStart() noexcept
+void Action_GIGist::calcGridStart(GistGrid &grid) noexcept
 {
-  info_.grid.start.SetVec(info_.grid.center[0] - (info_.grid.dimensions[0] * 0.5) * info_.grid.voxelSize, 
-                          info_.grid.center[1] - (info_.grid.dimensions[1] * 0.5) * info_.grid.voxelSize,
-                          info_.grid.center[2] - (info_.grid.dimensions[2] * 0.5) * info_.grid.voxelSize);
+  grid.info.start.SetVec(grid.info.center[0] - (grid.info.dimensions[0] * 0.5) * grid.info.voxelSize, 
+                         grid.info.center[1] - (grid.info.dimensions[1] * 0.5) * grid.info.voxelSize,
+                         grid.info.center[2] - (grid.info.dimensions[2] * 0.5) * grid.info.voxelSize);
 }
 
 /*****
@@ -83,11 +171,11 @@ void Action_GIGist::calcGridStart() noexcept
  * Calculates the end of the grid, using the center, stepsize in each
  * dimension and the voxel Size.
  */
-void Action_GIGist::calcGridEnd() noexcept
+void Action_GIGist::calcGridEnd(GistGrid &grid) noexcept
 {
-  info_.grid.end.SetVec(info_.grid.center[0] + info_.grid.dimensions[0] * info_.grid.voxelSize, 
-                        info_.grid.center[1] + info_.grid.dimensions[1] * info_.grid.voxelSize,
-                        info_.grid.center[2] + info_.grid.dimensions[2] * info_.grid.voxelSize);
+  grid.info.end.SetVec(grid.info.center[0] + grid.info.dimensions[0] * grid.info.voxelSize, 
+                       grid.info.center[1] + grid.info.dimensions[1] * grid.info.voxelSize,
+                       grid.info.center[2] + grid.info.dimensions[2] * grid.info.voxelSize);
 }
 
 /*****
@@ -99,7 +187,6 @@ void Action_GIGist::calcGridEnd() noexcept
 void Action_GIGist::getSystemInfo(ArgList &argList)
 {
   info_.system.temperature = argList.getKeyDouble("temp", 300.0);
-  info_.system.rho0 = argList.getKeyDouble("refdens", 0.0329);
   info_.system.nFrames = 0;
 }
 
@@ -115,40 +202,120 @@ void Action_GIGist::getGistSettings(ArgList &argList)
   info_.gist.neighborCutoff = argList.getKeyDouble("neighbour", 3.5);
   info_.gist.neighborCutoff *= info_.gist.neighborCutoff;
   info_.gist.calcEnergy = !(argList.hasKey("skipE"));
+  info_.gist.densityOnly = argList.hasKey("densityonly");
+  if (info_.gist.densityOnly) {
+    info_.gist.calcEnergy = false;
+  }
   info_.gist.writeDx = argList.hasKey("dx");
+  info_.gist.writeMrc = argList.hasKey("mrc");
+  info_.gist.mrcStack = argList.GetStringKey("mrcstack");
+  info_.gist.outFile = argList.GetStringKey("out", "out.dat");
+  std::string compress{ argList.GetStringKey("compress") };
+  if (!compress.empty()) {
+    info_.gist.compressSuffix = "." + compress;
+  }
   info_.gist.doorder = argList.hasKey("doorder");
   info_.gist.useCOM = argList.hasKey("com");
   info_.gist.febiss = argList.hasKey("febiss");
   info_.gist.idealWaterAngle_ = argList.getKeyDouble("febiss_angle", 104.57);
+  info_.gist.prepassFrames = argList.getKeyInt("prepass", 0);
+  info_.gist.refineLevels = argList.getKeyInt("refine", 0);
+  info_.gist.refineDensity = argList.getKeyDouble("refinedens", 1.5);
+  info_.gist.refineGradient = argList.getKeyDouble("refinegrad", 1.0);
+  info_.gist.refineOut = argList.hasKey("refineout");
+  info_.gist.pairFile = argList.GetStringKey("pairmatrix");
+  info_.gist.pairCutoff = argList.getKeyDouble("paircut", 6.0);
+  info_.gist.residenceFile = argList.GetStringKey("residence");
+  info_.gist.residenceMax = argList.getKeyInt("resmax", 20);
+  info_.gist.deterministic = argList.hasKey("deterministic");
+  info_.gist.flushInterval = argList.getKeyInt("flush", 100);
+  info_.gist.splitPopulation = argList.getKeyInt("splitpop", 1000);
+  info_.gist.sitesFile = argList.GetStringKey("sites");
+  info_.gist.siteThreshold = argList.getKeyDouble("sitethresh", 2.0);
+  info_.gist.siteRadius = argList.getKeyDouble("siteradius", 1.5);
+  info_.gist.queryFile = argList.GetStringKey("query");
+  info_.gist.queryOut = argList.GetStringKey("queryout", "query.dat");
+  info_.gist.queryOnly = argList.hasKey("queryonly");
+  info_.gist.keep = argList.hasKey("keep");
+  info_.gist.proximityWidth = argList.getKeyDouble("proximity", 0.0);
+  info_.gist.proximityMax = argList.getKeyDouble("proxmax", 10.0);
+  info_.gist.proximityAverage = argList.hasKey("proxavg");
+  info_.gist.proximityFile = argList.GetStringKey("proxout", "proximity.dat");
+  info_.gist.progressiveStride = argList.getKeyInt("progressive", 1);
+  info_.gist.progressiveError = argList.getKeyDouble("progerr", 0.1);
+  info_.gist.progressiveDG = argList.getKeyDouble("progdg", 0.0);
+  info_.gist.progressiveProximity = argList.getKeyDouble("progprox", 0.0);
+  info_.gist.bootstrapReplicates = argList.getKeyInt("bootstrap", 0);
+  info_.gist.bootstrapBlock = argList.getKeyInt("bootblock", 100);
+  info_.gist.bootstrapSeed = argList.getKeyInt("bootseed", 1);
+#ifdef CUDA
+  info_.gist.backend = argList.GetStringKey("backend", "cuda");
+#else
+  info_.gist.backend = argList.GetStringKey("backend", "cpu");
+#endif
+  info_.gist.energyOptions.cutoff = argList.getKeyDouble("pmecut", 9.0);
+  info_.gist.energyOptions.gridSpacing = argList.getKeyDouble("pmespacing", 1.0);
+  info_.gist.energyOptions.order = argList.getKeyInt("pmeorder", 4);
 }
 
 /*****
  * @brief Grid Calculation.
  * 
- * Builds the grid structure from the settings of the user and then creates
- * the logical concepts.
+ * Builds the grid structures from the settings of the user and then creates
+ * the logical concepts. Every griddim keyword defines a new grid, the
+ * n-th gridcntr and gridspacn keywords belong to the n-th grid. Afterwards,
+ * every gridmask keyword defines a grid fitted to the given atoms.
  */
 bool Action_GIGist::buildGrid(ArgList &argList)
 {
-  info_.grid.voxelSize = argList.getKeyDouble("gridspacn", 0.5);
-  info_.grid.voxelVolume = info_.grid.voxelSize * info_.grid.voxelSize * info_.grid.voxelSize;
-
-  if (argList.Contains("griddim")) {
-    ArgList dimArgs = argList.GetNstringKey("griddim", 3);
-    info_.grid.dimensions[0] = dimArgs.getNextInteger(-1.0);
-    info_.grid.dimensions[1] = dimArgs.getNextInteger(-1.0);
-    info_.grid.dimensions[2] = dimArgs.getNextInteger(-1.0);
-    if ( (info_.grid.dimensions[0] <= 0) || 
-          (info_.grid.dimensions[1] <= 0) || 
-          (info_.grid.dimensions[2] <= 0) ) {
-      mprinterr("Error: griddimension must be positive integers (non zero).\n\n");
+  if (!argList.Contains("griddim") && !argList.Contains("gridmask")) {
+    mprinterr("Error: Dimensions must be set!\n\n");
+    return false;
+  }
+  double voxelSize{ 0.5 };
+  while (argList.Contains("griddim")) {
+    // Grids without their own spacing use the spacing of the previous grid.
+    voxelSize = argList.getKeyDouble("gridspacn", voxelSize);
+    if (!buildSingleGrid(argList, voxelSize)) {
       return false;
     }
-    info_.grid.nVoxels = info_.grid.dimensions[0] * info_.grid.dimensions[1] * info_.grid.dimensions[2];
-  } else {
-    mprinterr("Error: Dimensions must be set!\n\n");
+  }
+  while (argList.Contains("gridmask")) {
+    voxelSize = argList.getKeyDouble("gridspacn", voxelSize);
+    if (!buildMaskGrid(argList, voxelSize)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*****
+ * @brief Builds the next grid from the argument list.
+ * 
+ * @param argList The argument list of the user.
+ * @param voxelSize The grid spacing of this grid.
+ * @return true on success, false if the dimensions are not valid.
+ */
+bool Action_GIGist::buildSingleGrid(ArgList &argList, double voxelSize)
+{
+  GistGrid grid{};
+  if (!grids_.empty()) {
+    grid.suffix = "_" + std::to_string(grids_.size());
+  }
+  grid.info.voxelSize = voxelSize;
+  grid.info.voxelVolume = grid.info.voxelSize * grid.info.voxelSize * grid.info.voxelSize;
+
+  ArgList dimArgs = argList.GetNstringKey("griddim", 3);
+  grid.info.dimensions[0] = dimArgs.getNextInteger(-1.0);
+  grid.info.dimensions[1] = dimArgs.getNextInteger(-1.0);
+  grid.info.dimensions[2] = dimArgs.getNextInteger(-1.0);
+  if ( (grid.info.dimensions[0] <= 0) || 
+        (grid.info.dimensions[1] <= 0) || 
+        (grid.info.dimensions[2] <= 0) ) {
+    mprinterr("Error: griddimension must be positive integers (non zero).\n\n");
     return false;
   }
+  grid.info.nVoxels = grid.info.dimensions[0] * grid.info.dimensions[1] * grid.info.dimensions[2];
 
   double x = 0, y = 0, z = 0;
   if (argList.Contains("gridcntr")) {
@@ -159,419 +326,1015 @@ bool Action_GIGist::buildGrid(ArgList &argList)
   } else {
     mprintf("Warning: No grid center specified, defaulting to origin!\n\n");
   }
-  info_.grid.center.SetVec(x, y, z);
+  grid.info.center.SetVec(x, y, z);
 
-  calcGridStart();
-  calcGridEnd();
+  calcGridStart(grid);
+  calcGridEnd(grid);
 
+  grids_.push_back(std::move(grid));
   return true;
 }
 
-/***
- * Document in header FILE!
+/*****
+ * @brief Builds the next grid from a gridmask keyword.
+ * 
+ * The center and dimensions of such a grid are only set in fitGridToMask,
+ * once the coordinates of the masked atoms are known.
  * 
+ * @param argList The argument list of the user.
+ * @param voxelSize The grid spacing of this grid.
+ * @return true on success, false if the mask or padding are not valid.
  */
-bool Action_GIGist::analyzeInfo(ArgList &argList)
+bool Action_GIGist::buildMaskGrid(ArgList &argList, double voxelSize)
 {
-  getSystemInfo(argList);
-  getGistSettings(argList);
-  bool ret{ buildGrid(argList) };
-  #ifdef CUDA
-  if (info_.gist.doorder && !info_.gist.calcEnergy) {
-    mprinterr("Error: For CUDA code, if energy is not calculated, order parameter cannot be calculated.");
-    ret = false;
+  GistGrid grid{};
+  if (!grids_.empty()) {
+    grid.suffix = "_" + std::to_string(grids_.size());
   }
-  #endif
-  return ret;
+  grid.info.voxelSize = voxelSize;
+  grid.info.voxelVolume = grid.info.voxelSize * grid.info.voxelSize * grid.info.voxelSize;
+  grid.info.dimensions = {{ 0, 0, 0 }};
+
+  std::string maskString{ argList.GetStringKey("gridmask") };
+  if (maskString.empty() || grid.fitMask.SetMaskString(maskString)) {
+    mprinterr("Error: gridmask needs a valid atom mask.\n\n");
+    return false;
+  }
+  grid.fitPad = argList.getKeyDouble("pad", 3.0);
+  if (grid.fitPad < 0) {
+    mprinterr("Error: The padding of gridmask must not be negative.\n\n");
+    return false;
+  }
+  grid.pending = true;
+  gridsPending_ = true;
+
+  grids_.push_back(std::move(grid));
+  return true;
 }
 
 /*****
- * @brief Print citation and info.
+ * @brief Places a gridmask grid around the masked atoms.
+ * 
+ * The grid covers the bounding box of the masked atoms, extended by the
+ * padding on every side.
+ * 
+ * @param grid The pending grid.
+ * @param frame The frame holding the coordinates of the masked atoms.
  */
-void Action_GIGist::printCitationInfo() const noexcept
+void Action_GIGist::fitGridToMask(GistGrid &grid, const Frame &frame)
 {
-  mprintf("Center: %g %g %g, Dimensions %d %d %d\n"
-    "  When using this GIST implementation please cite:\n"
-    "#    Johannes Kraml, Anna S. Kamenik, Franz Waibl, Michael Schauperl, Klaus R. Liedl, JCTC (2019)\n"
-    "#    Steven Ramsey, Crystal Nguyen, Romelia Salomon-Ferrer, Ross C. Walker, Michael K. Gilson, and Tom Kurtzman\n"
-    "#      J. Comp. Chem. 37 (21) 2016\n"
-    "#    Crystal Nguyen, Michael K. Gilson, and Tom Young, arXiv:1108.4876v1 (2011)\n"
-    "#    Crystal N. Nguyen, Tom Kurtzman Young, and Michael K. Gilson,\n"
-    "#      J. Chem. Phys. 137, 044101 (2012)\n"
-    "#    Lazaridis, J. Phys. Chem. B 102, 3531–3541 (1998)\n",
-    info_.grid.center[0],
-    info_.grid.center[1],
-    info_.grid.center[2],
-    static_cast<int>( info_.grid.dimensions[0] ),
-    static_cast<int>( info_.grid.dimensions[1] ),
-    static_cast<int>( info_.grid.dimensions[2] ) 
-  );
+  calcAlignment(frame);
+  Vec3 minXYZ{ atomXYZ(frame, *grid.fitMask.begin()) };
+  Vec3 maxXYZ{ minXYZ };
+  for (AtomMask::const_iterator atom = grid.fitMask.begin(); atom != grid.fitMask.end(); ++atom) {
+    Vec3 xyz{ atomXYZ(frame, *atom) };
+    for (int i = 0; i < 3; ++i) {
+      minXYZ[i] = std::min(minXYZ[i], xyz[i]);
+      maxXYZ[i] = std::max(maxXYZ[i], xyz[i]);
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    double extent{ maxXYZ[i] - minXYZ[i] + 2 * grid.fitPad };
+    grid.info.dimensions[i] = std::max(1, static_cast<int>( std::ceil(extent / grid.info.voxelSize) ));
+  }
+  grid.info.center = (minXYZ + maxXYZ) / 2.0;
+  grid.info.nVoxels = grid.info.dimensions[0] * grid.info.dimensions[1] * grid.info.dimensions[2];
+  mprintf("GIST: Grid%s fitted to '%s': center %g %g %g, dimensions %d %d %d\n",
+          grid.suffix.c_str(), grid.fitMask.MaskString(),
+          grid.info.center[0], grid.info.center[1], grid.info.center[2],
+          grid.info.dimensions[0], grid.info.dimensions[1], grid.info.dimensions[2]);
 }
 
 /*****
- * @brief Prepare the variables for the calculation on the GPU.
+ * @brief Crops a fitted gridmask grid to the solvent density of the prepass.
  * 
- * The different variables are set and prepared (i.e., memory allocated), so
- * that the calculation on the GPU can be performed without any problems.
+ * All solvent atoms of the buffered frames are binned onto the fitted grid,
+ * the grid is then shrunk to the bounding box of the occupied voxels. Empty
+ * regions, e.g. inside a protein or a membrane, are thereby removed from the
+ * border of the grid.
+ * 
+ * @param grid The fitted grid.
  */
-bool Action_GIGist::prepareGPUCalc(ActionSetup &setup) {
-#ifdef CUDA
-  if (info_.gist.calcEnergy) {
-    NonbondParmType nb{ setup.Top().Nonbond() };
-    NBIndex_ = nb.NBindex();
-    numberAtomTypes_ = nb.Ntypes();
-    for (unsigned int i = 0; i < nb.NBarray().size(); ++i) {
-      lJParamsA_.push_back( (float) nb.NBarray().at(i).A() );
-      lJParamsB_.push_back( (float) nb.NBarray().at(i).B() );
-    }
-
-    try {
-      allocateCuda_GIGIST(((void**)&NBindex_c_), NBIndex_.size() * sizeof(int));
-      allocateCuda_GIGIST((void**)&result_w_c_, info_.system.numberAtoms * sizeof(float));
-      allocateCuda_GIGIST((void**)&result_s_c_, info_.system.numberAtoms * sizeof(float));
-      allocateCuda_GIGIST((void**)&result_O_c_, info_.system.numberAtoms * 4 * sizeof(int));
-      allocateCuda_GIGIST((void**)&result_N_c_, info_.system.numberAtoms * sizeof(int));
-    } catch (CudaException &e) {
-      mprinterr("Error: Could not allocate memory on GPU!\n");
-      freeGPUMemory();
-      return false;
-    }
-    try {
-      copyToGPU();
-    } catch (CudaException &e) {
-      return false;
+void Action_GIGist::cropGridToDensity(GistGrid &grid)
+{
+  std::array<int, 3> low{ grid.info.dimensions };
+  std::array<int, 3> high{{ -1, -1, -1 }};
+  Vec3 start{ grid.info.center[0] - (grid.info.dimensions[0] * 0.5) * grid.info.voxelSize,
+              grid.info.center[1] - (grid.info.dimensions[1] * 0.5) * grid.info.voxelSize,
+              grid.info.center[2] - (grid.info.dimensions[2] * 0.5) * grid.info.voxelSize };
+  for (const Frame &frame : prepassBuffer_) {
+    calcAlignment(frame);
+    for (int atom = 0; atom < info_.system.numberAtoms; ++atom) {
+      if (!solvent_[atom]) {
+        continue;
+      }
+      Vec3 xyz{ atomXYZ(frame, atom) };
+      std::array<int, 3> idx{};
+      bool inside{ true };
+      for (int i = 0; i < 3 && inside; ++i) {
+        idx[i] = static_cast<int>( std::floor((xyz[i] - start[i]) / grid.info.voxelSize) );
+        inside = idx[i] >= 0 && idx[i] < grid.info.dimensions[i];
+      }
+      if (inside) {
+        for (int i = 0; i < 3; ++i) {
+          low[i] = std::min(low[i], idx[i]);
+          high[i] = std::max(high[i], idx[i]);
+        }
+      }
     }
   }
-#endif
-  return true;
+  if (high[0] == -1) {
+    mprintf("Warning: No solvent found on grid%s during the prepass, the grid is not cropped.\n",
+            grid.suffix.c_str());
+    return;
+  }
+
+  int fittedVoxels{ grid.info.nVoxels };
+  for (int i = 0; i < 3; ++i) {
+    grid.info.dimensions[i] = high[i] - low[i] + 1;
+    grid.info.center[i] = start[i] + (low[i] + high[i] + 1) * 0.5 * grid.info.voxelSize;
+  }
+  grid.info.nVoxels = grid.info.dimensions[0] * grid.info.dimensions[1] * grid.info.dimensions[2];
+  mprintf("GIST: Prepass over %d frames cropped grid%s to center %g %g %g, dimensions %d %d %d\n"
+          "      %d instead of %d voxels (%.1f%% saved).\n",
+          static_cast<int>( prepassBuffer_.size() ), grid.suffix.c_str(),
+          grid.info.center[0], grid.info.center[1], grid.info.center[2],
+          grid.info.dimensions[0], grid.info.dimensions[1], grid.info.dimensions[2],
+          grid.info.nVoxels, fittedVoxels,
+          100.0 * (fittedVoxels - grid.info.nVoxels) / fittedVoxels);
 }
 
 /*****
- * @brief Resize the vectors needed for the calculation.
+ * @brief Decides which data sets are written as grid files.
+ * 
+ * @param set The index of the data set in dict_.
+ * @return true for the population and, with dx, for all final sets.
  */
-void Action_GIGist::resizeVectors()
+bool Action_GIGist::writesGridFile(unsigned int set) const
 {
-  if (info_.gist.febiss) {
-    hVectors_.resize( info_.grid.nVoxels );
-  }
-  centersAndRotations_.resize(info_.grid.nVoxels, info_.system.numberSolvent * info_.system.nFrames);
+  return set == 0 || (info_.gist.writeDx && isFinalSet(set));
 }
 
 /*****
- * @brief Create the needed datafiles and datasets.
- * 
- * This function creates the neceesary datasets, as well as datafiles. For the
- * datasets, there are multiple different datasets, basically for the energies,
- * the entropies, the dipole moments, neighbors, etc., as well as the densities
- * for each atom of the solvent.
+ * @brief Decides which data sets hold final values.
  * 
- * @param argList The argument list that was given by the user
- * @param actionInit The action initialization object
+ * @param set The index of the data set in dict_.
+ * @return false for the sums that are only used during the calculation.
  */
-void Action_GIGist::createDatasets(ArgList &argList, ActionInit &actionInit)
+bool Action_GIGist::isFinalSet(unsigned int set) const
 {
-  std::string outfilename{argList.GetStringKey("out", "out.dat")};
-  datafile_ = actionInit.DFL().AddCpptrajFile( outfilename, "GIST output" );
+  const std::string name{ dict_.getElement(set) };
+  return name.compare("Eww") != 0 &&
+    name.compare("Esw") != 0 &&
+    name.compare("dipole_xtemp") != 0 &&
+    name.compare("dipole_ytemp") != 0 &&
+    name.compare("dipole_ztemp") != 0 &&
+    name.compare("order") != 0 &&
+    name.compare("neighbour") != 0;
+}
 
-  std::string dsname{ actionInit.DSL().GenerateDefaultName("GIST") };
-  result_ = std::vector<DataSet_3D *>(dict_.size());
-  for (unsigned int i = 0; i < dict_.size(); ++i) {
-    result_.at(i) = (DataSet_3D*)actionInit.DSL().AddSet(DataSet::GRID_FLT, MetaData(dsname, dict_.getElement(i)));
-    result_.at(i)->Allocate_N_C_D(
-      info_.grid.dimensions[0],
-      info_.grid.dimensions[1],
-      info_.grid.dimensions[2],
-      info_.grid.center,
-      info_.grid.voxelSize
+/*****
+ * @brief Allocates the data sets and vectors of a grid, once its dimensions are set.
+ * 
+ * @param grid The grid to allocate.
+ */
+void Action_GIGist::allocateGrid(GistGrid &grid)
+{
+  calcGridStart(grid);
+  calcGridEnd(grid);
+  for (DataSet_3D *set : grid.result) {
+    set->Allocate_N_C_D(
+      grid.info.dimensions[0],
+      grid.info.dimensions[1],
+      grid.info.dimensions[2],
+      grid.info.center,
+      grid.info.voxelSize
     );
-
-    if (
-        ( info_.gist.writeDx &&
-          dict_.getElement(i).compare("Eww") != 0 && 
-          dict_.getElement(i).compare("Esw") != 0 &&
-          dict_.getElement(i).compare("dipole_xtemp") != 0 && 
-          dict_.getElement(i).compare("dipole_ytemp") != 0 &&
-          dict_.getElement(i).compare("dipole_ztemp") != 0 &&
-          dict_.getElement(i).compare("order") != 0 && 
-          dict_.getElement(i).compare("neighbour") != 0 ) ||
-        i == 0 
-       ) 
-    {
-      DataFile *file = actionInit.DFL().AddDataFile(dict_.getElement(i) + ".dx");
-      file->AddDataSet(result_.at(i));
-    }
   }
   if (info_.gist.febiss) {
-    this->febissWaterfile_ = actionInit.DFL().AddCpptrajFile( "febiss-waters.pdb", "GIST output");
+    grid.hVectors.resize( grid.info.nVoxels );
+  }
+  grid.centersAndRotations.resize(grid.info.nVoxels, info_.system.numberSolvent);
+  grid.points.resize(grid.info.nVoxels, 0);
+  if (!info_.gist.residenceFile.empty()) {
+    grid.residence.resize(grid.info.nVoxels, info_.gist.residenceMax);
+  }
+  grid.sums.resize(grid.info.nVoxels, N_SUMS, info_.gist.flushInterval);
+  grid.resultV.clear();
+  prepDensityGrids();
+  if (info_.gist.densityOnly) {
+    resizeDensity(grid);
   }
 }
 
 /*****
- * @brief Adds atom type information into the different vectors.
+ * @brief Fits all pending gridmask grids and processes the buffered frames.
  * 
- * This function adds the charges, atom types, masses and to which molecule a
- * given atom belongs to the appropriate vectors.
- * 
- * @param atom The atom for which the information should be extracted
+ * @return Action::ERR if one of the buffered frames failed, Action::OK otherwise.
  */
-void Action_GIGist::addAtomType(const Atom &atom)
+Action::RetType Action_GIGist::finishPendingGrids()
 {
-  molecule_.push_back(atom.MolNum());
-  charges_.push_back(atom.Charge());
-  atomTypes_.push_back(atom.TypeIndex());
-  masses_.push_back(atom.Mass());
-}
+  for (GistGrid &grid : grids_) {
+    if (grid.pending && grid.refineBase == -1) {
+      fitGridToMask(grid, prepassBuffer_.front());
+      if (info_.gist.prepassFrames > 0) {
+        cropGridToDensity(grid);
+      }
+      allocateGrid(grid);
+      grid.pending = false;
+    }
+  }
+  refineGrids();
+  gridsPending_ = false;
 
+  Action::RetType ret{ Action::OK };
+  for (const Frame &frame : prepassBuffer_) {
+    if (processFrame(frame) != Action::OK) {
+      ret = Action::ERR;
+    }
+  }
+  std::vector<Frame>().swap(prepassBuffer_);
+  return ret;
+}
 
 /*****
- * @brief From a given molecule get all atom information needed.
+ * @brief Adds the refinement grids of every grid.
  * 
- * This function finds all the different parameters needed for the GIST
- * calculation. Predominatntly, this function adds the different solvent
- * specific informations about the atom. But also atom type information is
- * added.
+ * Every grid gets one refinement grid per level, with half the spacing of
+ * the level above. These grids are pending until the octree of their base
+ * grid is built from the prepass.
  * 
- * @param setup The setup object, where setup stuff is safed.
- * @param mol The molecule for which the atoms should be added
- * @param firstRound A few informations are only needed for the first round,
- *                so that some things can be skipped during the other rounds.
+ * @return false if refine is used without prepass.
  */
-void Action_GIGist::setAtomInformation(
-  const ActionSetup &setup,
-  const Molecule& mol,
-  bool firstRound
-)
+bool Action_GIGist::buildRefinementGrids()
 {
-  int nAtoms{ mol.NumAtoms() };
-
-  for (int i = 0; i < nAtoms; ++i) {
-    addAtomType(setup.Top()[mol.MolUnit().Front() + i]);
-    // Check if the molecule is a solvent, either by the topology parameters or because force was set.
-    if ( (mol.IsSolvent() && info_.gist.solventStart == -1) 
-            || (( info_.gist.solventStart > -1 ) 
-                        && 
-                ( setup.Top()[mol.MolUnit().Front()].MolNum() >= info_.gist.solventStart ))
-    ) {
-
-      std::string aName{ setup.Top()[mol.MolUnit().Front() + i].ElementName() };
-      
-      // Check if dictionary already holds an entry for the atoms name, if not add it to
-      // the dictionary, if yes, add 1 to the correct solvent atom counter.
-      if (! (dict_.contains(aName)) ) {
-        dict_.add(aName);
-        solventAtomCounter_.push_back(1);
-      } else if (firstRound) {
-        solventAtomCounter_.at(dict_.getIndex(aName) - result_.size()) += 1;
-      }
-      // Check for the centerSolventAtom (which in this easy approximation is either C or O)
-      if ( weight(aName) < weight(info_.gist.centerAtom) ) {
-        info_.gist.centerAtom = setup.Top()[mol.MolUnit().Front() + i].ElementName();
-        info_.gist.centerIdx = i; // Assumes the same order of atoms.
-        info_.gist.centerType = setup.Top()[mol.MolUnit().Front() + i].TypeIndex();
-      }
-      // Set solvent to true
-      solvent_[mol.MolUnit().Front() + i] = true;
-    } else {
-      solvent_[mol.MolUnit().Front() + i] = false;
+  if (info_.gist.refineLevels <= 0) {
+    return true;
+  }
+  if (info_.gist.prepassFrames <= 0) {
+    mprinterr("Error: refine needs the density of a prepass, set prepass [n].\n");
+    return false;
+  }
+  const int nBase{ static_cast<int>( grids_.size() ) };
+  for (int g = 0; g < nBase; ++g) {
+    for (int level = 1; level <= info_.gist.refineLevels; ++level) {
+      GistGrid grid{};
+      grid.species = grids_[g].species;
+      grid.suffix = grids_[g].suffix + "_r" + std::to_string(level);
+      grid.info.voxelSize = grids_[g].info.voxelSize / (1 << level);
+      grid.info.voxelVolume = grid.info.voxelSize * grid.info.voxelSize * grid.info.voxelSize;
+      grid.info.dimensions = {{ 0, 0, 0 }};
+      grid.refineBase = g;
+      grid.refineLevel = level;
+      grid.pending = true;
+      grids_.push_back(std::move(grid));
     }
   }
+  gridsPending_ = true;
+  return true;
 }
 
 /*****
- * @brief Goes over all molecules and sets the appropriate information for this
- * molecule.
- * 
- * Compared to the atom function, this function does not really change much by
- * itself, but simply goes over all the different molecules and hands the
- * different molecules to the atom function.
+ * @brief Builds the octrees of the base grids and places the refinement grids.
  * 
- * @param setup The action setup object for setting up the GIST calculation
+ * The center atoms of the buffered frames give the density of every octree
+ * cell, see AdaptiveOctree.
  */
-void Action_GIGist::setMoleculeInformation(ActionSetup &setup)
+void Action_GIGist::refineGrids()
 {
-  bool firstRound{ true };
-
-  // Save different values, which depend on the molecules and/or atoms.
-  for (auto mol = setup.Top().MolStart(); 
-       mol != setup.Top().MolEnd(); ++mol) {
-    setAtomInformation(setup, *(mol.base()), firstRound);
-    if ((mol->IsSolvent() && info_.gist.solventStart == -1) || 
-          (
-            ( info_.gist.solventStart > -1 ) 
-            && 
-            ( setup.Top()[mol->MolUnit().Front()].MolNum() >= info_.gist.solventStart )
-          )
-    ) {
-      firstRound = false;
+  if (info_.gist.refineLevels <= 0) {
+    return;
+  }
+  for (GistGrid &base : grids_) {
+    if (base.refineBase != -1) {
+      continue;
+    }
+    const SolventSpecies &species = species_.at(base.species);
+    std::vector<AdaptiveOctree::Point> points{};
+    for (const Frame &frame : prepassBuffer_) {
+      calcAlignment(frame);
+      for (int atom = 0; atom < info_.system.numberAtoms; ++atom) {
+        if (atomElement_[atom] != species.centerElement || molSpecies_[molecule_[atom]] != base.species) {
+          continue;
+        }
+        Vec3 xyz{ atomXYZ(frame, atom) };
+        points.push_back({{ (xyz[0] - base.info.start[0]) / base.info.voxelSize,
+                            (xyz[1] - base.info.start[1]) / base.info.voxelSize,
+                            (xyz[2] - base.info.start[2]) / base.info.voxelSize }});
+      }
+    }
+    base.octree.resize(base.info.dimensions[0], base.info.dimensions[1], base.info.dimensions[2],
+                       info_.gist.refineLevels);
+    double bulk{ prepassBuffer_.size() * species.rho0 * base.info.voxelVolume };
+    base.octree.build(points, bulk, info_.gist.refineDensity, info_.gist.refineGradient);
+  }
+  for (GistGrid &grid : grids_) {
+    if (grid.pending) {
+      fitRefinementGrid(grid);
+      allocateGrid(grid);
+      grid.pending = false;
     }
   }
 }
 
-
 /*****
- * @brief Prepares the density grids
+ * @brief Places a refinement grid on the bounding box of the refined cells.
  * 
- * Before this was changed, only water could be analyzed, so this stuff did
- * not need to be dynamically managed. Since I changed that, this must also be
- * changed, so that this is now dynamically allocated.
+ * @param grid The pending refinement grid.
  */
-void Action_GIGist::prepDensityGrids()
+void Action_GIGist::fitRefinementGrid(GistGrid &grid)
 {
-  // Add results for the different solvent atoms.
-  for (unsigned int i = 0; i < (dict_.size() - result_.size()); ++i) {
-    resultV_.push_back(
-      std::vector<double>(
-        info_.grid.dimensions[0] *
-        info_.grid.dimensions[1] *
-        info_.grid.dimensions[2]
-      )
-    );
+  const GistGrid &base = grids_.at(grid.refineBase);
+  const int parentLevel{ grid.refineLevel - 1 };
+  AdaptiveOctree::Index low{}, high{};
+  bool empty{ !base.octree.bounds(parentLevel, low, high) };
+  if (empty) {
+    mprintf("Warning: No voxel of grid%s is refined on level %d, grid%s stays empty.\n",
+            base.suffix.c_str(), grid.refineLevel, grid.suffix.c_str());
+    low = {{ 0, 0, 0 }};
+    high = {{ 0, 0, 0 }};
   }
+  for (int i = 0; i < 3; ++i) {
+    grid.info.dimensions[i] = 2 * (high[i] - low[i] + 1);
+    grid.info.center[i] = base.info.start[i] + (2 * low[i] + 0.5 * grid.info.dimensions[i]) * grid.info.voxelSize;
+  }
+  grid.info.nVoxels = grid.info.dimensions[0] * grid.info.dimensions[1] * grid.info.dimensions[2];
+  grid.activeVoxels.assign(grid.info.nVoxels, 0);
+  int nActive{ 0 };
+  for (int voxel = 0; voxel < grid.info.nVoxels && !empty; ++voxel) {
+    int i{ voxel / (grid.info.dimensions[1] * grid.info.dimensions[2]) };
+    int j{ (voxel / grid.info.dimensions[2]) % grid.info.dimensions[1] };
+    int k{ voxel % grid.info.dimensions[2] };
+    if (base.octree.refined(parentLevel, low[0] + i / 2, low[1] + j / 2, low[2] + k / 2)) {
+      grid.activeVoxels[voxel] = 1;
+      ++nActive;
+    }
+  }
+  mprintf("GIST: Refinement grid%s (spacing %g): center %g %g %g, dimensions %d %d %d,\n"
+          "      %d active voxels (%d voxels at this spacing for grid%s).\n",
+          grid.suffix.c_str(), grid.info.voxelSize,
+          grid.info.center[0], grid.info.center[1], grid.info.center[2],
+          grid.info.dimensions[0], grid.info.dimensions[1], grid.info.dimensions[2],
+          nActive, base.info.nVoxels << (3 * grid.refineLevel), base.suffix.c_str());
 }
 
 /*****
- * @brief Prepares the quaternion calculation
- * 
- * This function analyzes the molecule and picks appropriate atoms for the 
- * quaternion construction needed for the GIST calculations.
- * 
- * @param frame The frame is needed, because for the calculation the
- *              coordinates are needed.
+ * @return false for voxels of a refinement grid outside of the refined cells.
  */
-void Action_GIGist::prepQuaternion(ActionFrame &frame)
+bool Action_GIGist::activeVoxel(const GistGrid &grid, long voxel) const
 {
-  for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
-      int moleculeLength = mol->MolUnit().Back() - mol->MolUnit().Front() + 1;
-      if (moleculeLength < 3)
-         continue;
-      if ((mol->IsSolvent() && info_.gist.solventStart == -1 ) || 
-        (
-          ( info_.gist.solventStart > -1 ) &&
-          ( top_->operator[](mol->MolUnit().Front()).MolNum() >= info_.gist.solventStart )
-          )
-      ) {
-        quat_indices_ = calcQuaternionIndices(mol->MolUnit().Front(), mol->MolUnit().Back(), frame.Frm().XYZ(mol->MolUnit().Front()));
-        break;
-      }
-    }
+  return grid.activeVoxels.empty() || grid.activeVoxels[voxel];
 }
 
-
 /**
- * Initialize the GIST calculation by setting up the users input.
- * @param argList: The argument list of the user.
- * @param actionInit: The action initialization object.
- * @return: Action::OK on success and Action::ERR on error.
+ * Splits a comma separated list.
+ * @param list: The list as given by the user.
+ * @return: The single entries, empty if the list was empty.
  */
-Action::RetType Action_GIGist::Init(ArgList &argList, ActionInit &actionInit, int test) {
-#if defined MPI
-  if (actionInit.TrajComm().Size() > 1) {
-    mprinterr("Error: GIST cannot yet be used with MPI parallelization.\n"
-              "       Maximum allowed processes is 1, you used %d.\n",
-              actionInit.TrajComm().Size());
-    return Action::ERR;
+static std::vector<std::string> splitCommaList(const std::string &list)
+{
+  std::vector<std::string> ret{};
+  if (list.empty()) {
+    return ret;
   }
-#endif
-  
-  // Get Infos
-  if (! analyzeInfo(argList) ) {
-    return Action::ERR;
+  std::string::size_type start{ 0 };
+  std::string::size_type comma{ list.find(',') };
+  while (comma != std::string::npos) {
+    ret.push_back(list.substr(start, comma - start));
+    start = comma + 1;
+    comma = list.find(',', start);
   }
-  
-  // Imaging
-  image_.InitImaging( true );
-  resizeVectors();
-  createDatasets(argList, actionInit);
-  printCitationInfo();
-  
-  return Action::OK;
+  ret.push_back(list.substr(start));
+  return ret;
 }
 
-/**
- * Setup for the GIST calculation. Does everything involving the Topology file.
- * @param setup: The setup object of the cpptraj code libraries.
- * @return: Action::OK on success, Action::ERR otherwise.
+/*****
+ * @brief Reads the solvent species and their reference densities.
+ * 
+ * Without the species keyword, a single species without name is used, which
+ * holds all solvent molecules. Otherwise every grid is split into one channel
+ * per species, so grids_ has to be complete when this is called.
+ * 
+ * @param argList The argument list of the user.
+ * @return false if the reference densities do not match the species.
  */
-Action::RetType Action_GIGist::Setup(ActionSetup &setup) {
-  solventAtomCounter_ = std::vector<int>();
-  // Setup imaging and topology parsing.
-  image_.SetupImaging( setup.CoordInfo().TrajBox().HasBox() );
-
-  // Save topology and topology related values
-  top_             = setup.TopAddress();
-  info_.system.numberAtoms = setup.Top().Natom();
-  info_.system.numberSolvent   = setup.Top().Nsolvent();
-  //solvent_ = std::make_unique<bool []>(info_.system.numberAtoms);
-  solvent_ = std::unique_ptr<bool []>(new bool[info_.system.numberAtoms]);
-
-  setMoleculeInformation(setup);
-
-  prepDensityGrids();
-
-  if (!prepareGPUCalc(setup)) {
-    return Action::ERR;
+bool Action_GIGist::getSpecies(ArgList &argList)
+{
+  std::vector<std::string> names{ splitCommaList(argList.GetStringKey("species")) };
+  std::vector<std::string> densities{ splitCommaList(argList.GetStringKey("refdens")) };
+  if (names.empty()) {
+    names.push_back("");
+  }
+  if (densities.size() > 1 && densities.size() != names.size()) {
+    mprinterr("Error: Got %d reference densities for %d solvent species.\n",
+              static_cast<int>( densities.size() ), static_cast<int>( names.size() ));
+    return false;
   }
 
-  return Action::OK;
-}
-
-
-
-Action_GIGist::TestObj Action_GIGist::calcBoxParameters(const ActionFrame &frame)
-{
-  // Setting up Image type here, don't know why this is necessary at all...
-  if (image_.ImagingEnabled()) {
-      image_.SetImageType( frame.Frm().BoxCrd().Is_X_Aligned_Ortho() );
+  species_.clear();
+  for (unsigned int s = 0; s < names.size(); ++s) {
+    SolventSpecies sp{};
+    sp.name = names[s];
+    sp.rho0 = 0.0329;
+    if (!densities.empty()) {
+      sp.rho0 = convertToDouble(densities.at(densities.size() == 1 ? 0 : s));
+    }
+    species_.push_back(sp);
   }
-  Matrix_3x3 ucell_m{}, recip_m{};
-  std::unique_ptr<float[]> recip;
-  std::unique_ptr<float[]> ucell;;
-  int boxinfo{};
-  // Check Boxinfo and write the necessary data into recip, ucell and boxinfo.
-  switch(image_.ImagingType()) {
-    case ImageOption::NONORTHO:
-      recip = std::unique_ptr<float[]>(new float[9]);
-      ucell = std::unique_ptr<float[]>(new float[9]);
-      ucell_m = frame.Frm().BoxCrd().UnitCell();
-      recip_m = frame.Frm().BoxCrd().FracCell();
-      //frame.Frm().BoxCrd().ToRecip(ucell_m, recip_m);
-      for (int i = 0; i < 9; ++i) {
-        ucell[i] = static_cast<float>( ucell_m.Dptr()[i] );
-        recip[i] = static_cast<float>( recip_m.Dptr()[i] );
-      }
-      boxinfo = 2;
-      break;
-    case ImageOption::ORTHO:
-      recip = std::unique_ptr<float[]>(new float[9]);
-      for (int i = 0; i < 3; ++i) {
-        recip[i] = static_cast<float>( frame.Frm().BoxCrd().XyzPtr()[i] );
+
+  if (!species_.front().name.empty()) {
+    std::vector<GistGrid> channels{};
+    for (const GistGrid &grid : grids_) {
+      for (unsigned int s = 0; s < species_.size(); ++s) {
+        channels.push_back(grid);
+        channels.back().species = s;
+        channels.back().suffix += "_" + species_[s].name;
       }
-      ucell = nullptr;
-      boxinfo = 1;
-      break;
-    case ImageOption::NO_IMAGE:
-      recip = nullptr;
-      ucell = nullptr;
-      boxinfo = 0;
-      break;
-    default:
-      throw "Error: Unexpected box information found.";
+    }
+    grids_.swap(channels);
   }
-  TestObj test;
-  test.recip.swap(recip);
-  test.ucell.swap(ucell);
-  test.boxinfo = boxinfo;
-
-  return test;
+  return true;
 }
 
-void Action_GIGist::calcHVectors(
-  int voxel,
-  int headAtomIndex,
-  const std::vector<Vec3> &molAtomCoords)
-{
-  Vec3 X;
-  Vec3 Y;
+/***
+ * Document in header FILE!
+ * 
+ */
+bool Action_GIGist::analyzeInfo(ArgList &argList)
+{
+  getSystemInfo(argList);
+  getGistSettings(argList);
+  bool ret{ buildGrid(argList) };
+  ret = getSpecies(argList) && ret;
+  ret = ret && buildRefinementGrids();
+  energy_ = GistEnergy::createBackend(info_.gist.backend, info_.gist.energyOptions);
+  if (!energy_) {
+    std::string names{};
+    for (const std::string &name : GistEnergy::backendNames()) {
+      names += " " + name;
+    }
+    mprinterr("Error: Unknown energy backend '%s', available are:%s.\n", info_.gist.backend.c_str(), names.c_str());
+    return false;
+  }
+  if (!info_.gist.pairFile.empty() && !energy_->supportsPairs()) {
+    mprintf("Warning: The %s backend does not calculate the voxel-pair matrix, pairmatrix is ignored.\n",
+            energy_->name().c_str());
+    info_.gist.pairFile.clear();
+  }
+  if (!info_.gist.queryFile.empty()) {
+    ret = readQueryFile() && ret;
+  } else if (info_.gist.queryOnly) {
+    mprinterr("Error: queryonly needs a query file.\n");
+    ret = false;
+  }
+  if (info_.gist.densityOnly &&
+      (info_.gist.febiss || info_.gist.doorder || !info_.gist.sitesFile.empty() || !info_.gist.queryFile.empty() ||
+       !info_.gist.residenceFile.empty() || !info_.gist.pairFile.empty())) {
+    mprinterr("Error: densityonly cannot be combined with febiss, doorder, sites, query, residence or pairmatrix.\n");
+    return false;
+  }
+  if (!info_.gist.pairFile.empty() && !info_.gist.calcEnergy) {
+    mprintf("Warning: No energies are calculated with skipE, pairmatrix is ignored.\n");
+    info_.gist.pairFile.clear();
+  }
+  if (info_.gist.doorder && !info_.gist.calcEnergy) {
+    mprinterr("Error: The order parameter needs the nearest neighbours from the energy calculation.\n");
+    ret = false;
+  }
+  if (info_.gist.proximityWidth < 0.0 || (info_.gist.proximityWidth > 0.0 && info_.gist.proximityMax <= 0.0)) {
+    mprinterr("Error: proximity and proxmax have to be positive.\n");
+    ret = false;
+  }
+  if (info_.gist.progressiveStride < 1 || info_.gist.progressiveError < 0.0) {
+    mprinterr("Error: progressive has to be at least 1 and progerr must not be negative.\n");
+    ret = false;
+  }
+  if (info_.gist.progressiveProximity > 0.0 && info_.gist.proximityWidth <= 0.0) {
+    mprinterr("Error: progprox needs the distances of proximity.\n");
+    ret = false;
+  }
+  if (info_.gist.bootstrapReplicates == 1 || info_.gist.bootstrapReplicates < 0 || info_.gist.bootstrapBlock < 1) {
+    mprinterr("Error: bootstrap needs at least 2 replicates and bootblock at least 1 frame.\n");
+    ret = false;
+  }
+  if (info_.gist.bootstrapReplicates > 0 && info_.gist.densityOnly) {
+    mprinterr("Error: bootstrap needs the samples and energies, it cannot be combined with densityonly.\n");
+    ret = false;
+  }
+  for (const std::string &name : { info_.gist.compressSuffix, info_.gist.outFile, info_.gist.pairFile, info_.gist.mrcStack,
+                                   info_.gist.proximityFile }) {
+    if (!CompressedBuffer::supported(CompressedBuffer::formatOf(name))) {
+      mprinterr("Error: %s compression is not available, cpptraj has to be built with %s.\n",
+                name.c_str(), CompressedBuffer::formatOf(name) == CompressedBuffer::Format::GZIP ? "HASGZ" : "HASZSTD");
+      ret = false;
+    }
+  }
+  if (!info_.gist.compressSuffix.empty() &&
+      CompressedBuffer::formatOf(info_.gist.compressSuffix) == CompressedBuffer::Format::PLAIN) {
+    mprinterr("Error: Unknown compression '%s', available are gz and zst.\n", info_.gist.compressSuffix.c_str() + 1);
+    ret = false;
+  }
+  return ret;
+}
+
+/*****
+ * @brief Print citation and info.
+ */
+void Action_GIGist::printCitationInfo() const noexcept
+{
+  for (const GistGrid &grid : grids_) {
+    mprintf("Center: %g %g %g, Dimensions %d %d %d, Spacing %g\n",
+      grid.info.center[0],
+      grid.info.center[1],
+      grid.info.center[2],
+      static_cast<int>( grid.info.dimensions[0] ),
+      static_cast<int>( grid.info.dimensions[1] ),
+      static_cast<int>( grid.info.dimensions[2] ),
+      grid.info.voxelSize
+    );
+  }
+  mprintf(
+    "  When using this GIST implementation please cite:\n"
+    "#    Johannes Kraml, Anna S. Kamenik, Franz Waibl, Michael Schauperl, Klaus R. Liedl, JCTC (2019)\n"
+    "#    Steven Ramsey, Crystal Nguyen, Romelia Salomon-Ferrer, Ross C. Walker, Michael K. Gilson, and Tom Kurtzman\n"
+    "#      J. Comp. Chem. 37 (21) 2016\n"
+    "#    Crystal Nguyen, Michael K. Gilson, and Tom Young, arXiv:1108.4876v1 (2011)\n"
+    "#    Crystal N. Nguyen, Tom Kurtzman Young, and Michael K. Gilson,\n"
+    "#      J. Chem. Phys. 137, 044101 (2012)\n"
+    "#    Lazaridis, J. Phys. Chem. B 102, 3531–3541 (1998)\n"
+  );
+}
+
+/*****
+ * @brief Prepares the energy backend for the current topology.
+ * 
+ * Collects the charges, Lennard-Jones parameters and molecule information
+ * of all atoms. For the center atoms of the solvent species, the neighbours
+ * of the same type are counted.
+ * 
+ * @param top The topology of the system.
+ * @return false if the backend could not be set up.
+ */
+bool Action_GIGist::setupEnergyBackend(const Topology &top)
+{
+  GistEnergy::Topology energyTop{};
+  energyTop.charges.assign(charges_.begin(), charges_.end());
+  energyTop.types = atomTypes_;
+  energyTop.molecules = molecule_;
+  energyTop.solvent.resize(info_.system.numberAtoms);
+  energyTop.neighbourType.assign(info_.system.numberAtoms, -1);
+  for (int atom = 0; atom < info_.system.numberAtoms; ++atom) {
+    energyTop.solvent[atom] = solvent_[atom];
+    int sp{ molSpecies_.at(molecule_.at(atom)) };
+    if (sp != -1 && atomTypes_.at(atom) == species_.at(sp).centerType) {
+      energyTop.neighbourType[atom] = species_.at(sp).centerType;
+    }
+  }
+  const NonbondParmType &nb = top.Nonbond();
+  energyTop.nTypes = std::max(1, nb.Ntypes());
+  energyTop.ljA.assign(energyTop.nTypes * energyTop.nTypes, 0.0);
+  energyTop.ljB.assign(energyTop.nTypes * energyTop.nTypes, 0.0);
+  for (int i = 0; i < nb.Ntypes() * nb.Ntypes(); ++i) {
+    // Negative indices belong to 10-12 parameters, which are not used.
+    int index{ nb.NBindex().at(i) };
+    if (index >= 0) {
+      energyTop.ljA[i] = nb.NBarray().at(index).A();
+      energyTop.ljB[i] = nb.NBarray().at(index).B();
+    }
+  }
+  if (nb.Ntypes() == 0) {
+    energyTop.types.assign(info_.system.numberAtoms, 0);
+  }
+  energyTop.coulombFactor = Constants::ELECTOAMBER * Constants::ELECTOAMBER;
+  energyTop.neighbourCutoff2 = info_.gist.neighborCutoff;
+  if (!energy_->setup(energyTop)) {
+    mprinterr("Error: Could not set up the %s energy backend.\n", energy_->name().c_str());
+    return false;
+  }
+  mprintf("\tEnergies are calculated with the %s backend.\n", energy_->name().c_str());
+  return true;
+}
+
+/*****
+ * @brief Resize the vectors needed for the calculation.
+ */
+void Action_GIGist::resizeVectors()
+{
+  for (GistGrid &grid : grids_) {
+    if (info_.gist.febiss) {
+      grid.hVectors.resize( grid.info.nVoxels );
+    }
+    grid.centersAndRotations.resize(grid.info.nVoxels, info_.system.numberSolvent * info_.system.nFrames);
+    grid.points.resize(grid.info.nVoxels, 0);
+    if (!info_.gist.pairFile.empty()) {
+      #ifdef _OPENMP
+      grid.ewwPairs = VoxelPairMatrix(omp_get_max_threads());
+      #endif
+    }
+    if (!info_.gist.residenceFile.empty()) {
+      grid.residence.resize(grid.info.nVoxels, info_.gist.residenceMax);
+    }
+    grid.sums.resize(grid.info.nVoxels, N_SUMS, info_.gist.flushInterval);
+  }
+}
+
+/*****
+ * @brief Create the needed datafiles and datasets.
+ * 
+ * This function creates the neceesary datasets, as well as datafiles. For the
+ * datasets, there are multiple different datasets, basically for the energies,
+ * the entropies, the dipole moments, neighbors, etc., as well as the densities
+ * for each atom of the solvent.
+ * 
+ * @param actionInit The action initialization object
+ */
+void Action_GIGist::createDatasets(ActionInit &actionInit)
+{
+  for (GistGrid &grid : grids_) {
+    createGridDatasets(grid, info_.gist.outFile, actionInit);
+  }
+  if (!info_.gist.queryFile.empty()) {
+    queryOutfile_ = actionInit.DFL().AddCpptrajFile(info_.gist.queryOut, "GIST voxel query");
+  }
+}
+
+/*****
+ * @brief Create the datasets and datafiles of a single grid.
+ * 
+ * @param grid The grid for which the datasets are created.
+ * @param outfilename The name of the GIST output file.
+ * @param actionInit The action initialization object
+ */
+void Action_GIGist::createGridDatasets(GistGrid &grid, const std::string &outfilename, ActionInit &actionInit)
+{
+  grid.datafileName = addFileSuffix(outfilename, grid.suffix);
+
+  std::string dsname{ actionInit.DSL().GenerateDefaultName("GIST") };
+  grid.result = std::vector<DataSet_3D *>(dict_.size());
+  for (unsigned int i = 0; i < dict_.size(); ++i) {
+    grid.result.at(i) = (DataSet_3D*)actionInit.DSL().AddSet(DataSet::GRID_FLT, MetaData(dsname, dict_.getElement(i) + grid.suffix));
+    // gridmask grids are allocated once they are fitted.
+    if (!grid.pending) {
+      grid.result.at(i)->Allocate_N_C_D(
+        grid.info.dimensions[0],
+        grid.info.dimensions[1],
+        grid.info.dimensions[2],
+        grid.info.center,
+        grid.info.voxelSize
+      );
+    }
+
+    // Compressed grid files are written by writeCompressedDxFiles. densityonly
+    // and queryonly only fill the population.
+    if (writesGridFile(i) && info_.gist.compressSuffix.empty() &&
+        (!(info_.gist.densityOnly || info_.gist.queryOnly) || i == 0)) {
+      DataFile *file = actionInit.DFL().AddDataFile(dict_.getElement(i) + grid.suffix + ".dx");
+      file->AddDataSet(grid.result.at(i));
+    }
+  }
+  if (!info_.gist.residenceFile.empty()) {
+    grid.residenceFile = actionInit.DFL().AddCpptrajFile( addFileSuffix(info_.gist.residenceFile, grid.suffix), "GIST residence times" );
+  }
+  if (!info_.gist.sitesFile.empty()) {
+    grid.sitesFile = actionInit.DFL().AddCpptrajFile( addFileSuffix(info_.gist.sitesFile, grid.suffix), "GIST hydration sites" );
+  }
+  if (info_.gist.febiss) {
+    grid.febissWaterfile = actionInit.DFL().AddCpptrajFile( "febiss-waters" + grid.suffix + ".pdb", "GIST output");
+  }
+}
+
+/*****
+ * @brief Builds the template of a solvent species from one of its molecules.
+ * 
+ * This function finds all the solvent specific parameters needed for the
+ * GIST calculation: the elements of the species, how many atoms of each
+ * element a molecule holds and the center atom. Only molecules that differ
+ * from the template of their species are handed to this function, all others
+ * simply copy the element indices of the template.
+ * 
+ * @param top The topology the molecule belongs to.
+ * @param mol The molecule for which the atoms should be added
+ * @param species The solvent species of the molecule.
+ */
+void Action_GIGist::setAtomInformation(
+  const Topology &top,
+  const Molecule& mol,
+  int species
+)
+{
+  int nAtoms{ mol.NumAtoms() };
+  SolventSpecies &sp = species_.at(species);
+  bool newTemplate{ !sp.templateSet };
+  if (newTemplate) {
+    sp.templateElements.clear();
+    sp.templateIndices.clear();
+  }
+
+  for (int i = 0; i < nAtoms; ++i) {
+    const Atom &atom = top[mol.MolUnit().Front() + i];
+    std::string aName{ atom.ElementName() };
+    
+    // Check if the species already holds an entry for the atoms name, if not add it,
+    // if yes, add 1 to the correct solvent atom counter.
+    int elementIdx{ sp.elementIndex(aName) };
+    if (elementIdx == -1) {
+      elementIdx = sp.elements.size();
+      sp.elements.push_back(aName);
+      sp.atomCounter.push_back(1);
+    } else if (!sp.templateSet) {
+      sp.atomCounter.at(elementIdx) += 1;
+    }
+    // Check for the centerSolventAtom (which in this easy approximation is either C or O)
+    if ( weight(aName) < weight(sp.centerAtom) ) {
+      sp.centerAtom = aName;
+      sp.centerIdx = i; // Assumes the same order of atoms.
+      sp.centerType = atom.TypeIndex();
+    }
+    if (newTemplate) {
+      sp.templateElements.push_back(atom.Element());
+      sp.templateIndices.push_back(elementIdx);
+    }
+    atomElement_[mol.MolUnit().Front() + i] = elementIdx;
+  }
+  sp.templateSet = true;
+}
+
+/*****
+ * @brief Sets the per-atom arrays and the species of every molecule.
+ * 
+ * The per-atom arrays are sized once and filled in parallel. The species of
+ * the molecules are also found in parallel. Then, every solvent molecule is
+ * compared to the template of its species by the atomic elements, only the
+ * first molecule and molecules that differ need the element names. The
+ * species of every molecule is stored in molSpecies_.
+ * 
+ * @param setup The action setup object for setting up the GIST calculation
+ */
+void Action_GIGist::setMoleculeInformation(ActionSetup &setup)
+{
+  const Topology &top = setup.Top();
+  const int nAtoms{ top.Natom() };
+  const int nMolecules{ top.Nmol() };
+  for (SolventSpecies &sp : species_) {
+    sp.templateSet = false;
+    sp.atomCounter.assign(sp.elements.size(), 0);
+  }
+  molSpecies_.assign(nMolecules, -1);
+  molecule_.resize(nAtoms);
+  charges_.resize(nAtoms);
+  atomTypes_.resize(nAtoms);
+  masses_.resize(nAtoms);
+  atomElement_.assign(nAtoms, -1);
+
+  #pragma omp parallel
+  {
+  #pragma omp for nowait
+  for (int atom = 0; atom < nAtoms; ++atom) {
+    const Atom &a = top[atom];
+    molecule_[atom] = a.MolNum();
+    charges_[atom] = a.Charge();
+    atomTypes_[atom] = a.TypeIndex();
+    masses_[atom] = a.Mass();
+    solvent_[atom] = false;
+  }
+  #pragma omp for
+  for (int mol = 0; mol < nMolecules; ++mol) {
+    molSpecies_[mol] = findSpecies(top, *(top.MolStart() + mol));
+  }
+  }
+
+  // The templates depend on the order of the molecules, so this pass is
+  // serial. It only compares integers for molecules that match.
+  for (int m = 0; m < nMolecules; ++m) {
+    int species{ molSpecies_[m] };
+    if (species == -1) {
+      continue;
+    }
+    const Molecule &mol = *(top.MolStart() + m);
+    const SolventSpecies &sp = species_[species];
+    const int front{ mol.MolUnit().Front() };
+    bool matches{ sp.templateSet && static_cast<int>(sp.templateElements.size()) == mol.NumAtoms() };
+    for (int i = 0; matches && i < mol.NumAtoms(); ++i) {
+      matches = top[front + i].Element() == sp.templateElements[i];
+    }
+    if (matches) {
+      std::copy(sp.templateIndices.begin(), sp.templateIndices.end(), atomElement_.begin() + front);
+    } else {
+      setAtomInformation(top, mol, species);
+    }
+    std::fill(solvent_.get() + front, solvent_.get() + front + mol.NumAtoms(), true);
+  }
+  for (SolventSpecies &sp : species_) {
+    sp.centerElement = sp.elementIndex(sp.centerAtom);
+  }
+}
+
+/*****
+ * @brief Finds the solvent species of a molecule.
+ * 
+ * Without the species keyword, every solvent molecule (either by the topology
+ * parameters or because solventStart was set) belongs to the single species.
+ * Otherwise the residue name of the first atom decides the species.
+ * 
+ * @param top The topology the molecule belongs to.
+ * @param mol The molecule to be checked.
+ * @return The index into species_, -1 if the molecule is not analysed.
+ */
+int Action_GIGist::findSpecies(const Topology &top, const Molecule &mol) const
+{
+  const Atom &front = top[mol.MolUnit().Front()];
+  if (info_.gist.solventStart > -1 && front.MolNum() < info_.gist.solventStart) {
+    return -1;
+  }
+  if (species_.front().name.empty()) {
+    return (mol.IsSolvent() || info_.gist.solventStart > -1) ? 0 : -1;
+  }
+  std::string resName{ top.Res(front.ResNum()).Name().Truncated() };
+  for (unsigned int s = 0; s < species_.size(); ++s) {
+    if (species_[s].name == resName) {
+      return s;
+    }
+  }
+  return -1;
+}
+
+
+/*****
+ * @brief Prepares the density grids
+ * 
+ * Before this was changed, only water could be analyzed, so this stuff did
+ * not need to be dynamically managed. Since I changed that, this must also be
+ * changed, so that this is now dynamically allocated.
+ */
+void Action_GIGist::prepDensityGrids()
+{
+  // Add results for the different solvent atoms.
+  for (GistGrid &grid : grids_) {
+    for (unsigned int i = grid.resultV.size(); i < species_.at(grid.species).elements.size(); ++i) {
+      grid.resultV.push_back(
+        std::vector<double>(
+          grid.info.dimensions[0] *
+          grid.info.dimensions[1] *
+          grid.info.dimensions[2]
+        )
+      );
+    }
+  }
+}
+
+/*****
+ * @brief Prepares the quaternion calculation
+ * 
+ * This function analyzes the molecule and picks appropriate atoms for the 
+ * quaternion construction needed for the GIST calculations.
+ * 
+ * @param frame The frame is needed, because for the calculation the
+ *              coordinates are needed.
+ */
+void Action_GIGist::prepQuaternion(const Frame &frame)
+{
+  for (SolventSpecies &sp : species_) {
+    sp.quatIndices.clear();
+  }
+  for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
+      int moleculeLength = mol->MolUnit().Back() - mol->MolUnit().Front() + 1;
+      int species{ molSpecies_.at(mol - top_->MolStart()) };
+      if (moleculeLength < 3 || species == -1 || !species_.at(species).quatIndices.empty())
+         continue;
+      species_.at(species).quatIndices = calcQuaternionIndices(mol->MolUnit().Front(), mol->MolUnit().Back(), frame.XYZ(mol->MolUnit().Front()));
+    }
+}
+
+
+/**
+ * Initialize the GIST calculation by setting up the users input.
+ * @param argList: The argument list of the user.
+ * @param actionInit: The action initialization object.
+ * @return: Action::OK on success and Action::ERR on error.
+ */
+Action::RetType Action_GIGist::Init(ArgList &argList, ActionInit &actionInit, int test) {
+#if defined MPI
+  if (actionInit.TrajComm().Size() > 1) {
+    mprinterr("Error: GIST cannot yet be used with MPI parallelization.\n"
+              "       Maximum allowed processes is 1, you used %d.\n",
+              actionInit.TrajComm().Size());
+    return Action::ERR;
+  }
+#endif
+  
+  // Get Infos
+  if (! analyzeInfo(argList) ) {
+    return Action::ERR;
+  }
+  
+  if (! initAlignment(argList, actionInit) ) {
+    return Action::ERR;
+  }
+
+  // Imaging
+  image_.InitImaging( true );
+  resizeVectors();
+  createDatasets(actionInit);
+  printCitationInfo();
+  
+  return Action::OK;
+}
+
+/**
+ * Setup for the GIST calculation. Does everything involving the Topology file.
+ * @param setup: The setup object of the cpptraj code libraries.
+ * @return: Action::OK on success, Action::ERR otherwise.
+ */
+Action::RetType Action_GIGist::Setup(ActionSetup &setup) {
+  // Buffered frames belong to the previous topology.
+  if (!prepassBuffer_.empty() && finishPendingGrids() != Action::OK) {
+    return Action::ERR;
+  }
+  // Setup imaging and topology parsing.
+  image_.SetupImaging( setup.CoordInfo().TrajBox().HasBox() );
+
+  // Save topology and topology related values
+  top_             = setup.TopAddress();
+  info_.system.numberAtoms = setup.Top().Natom();
+  info_.system.numberSolvent   = setup.Top().Nsolvent();
+  //solvent_ = std::make_unique<bool []>(info_.system.numberAtoms);
+  solvent_ = std::unique_ptr<bool []>(new bool[info_.system.numberAtoms]);
+
+  setMoleculeInformation(setup);
+
+  prepDensityGrids();
+
+  if (! setupAlignment(setup.Top()) ) {
+    return Action::ERR;
+  }
+
+  for (GistGrid &grid : grids_) {
+    if (grid.pending) {
+      if (setup.Top().SetupIntegerMask(grid.fitMask)) {
+        return Action::ERR;
+      }
+      if (grid.fitMask.None()) {
+        mprinterr("Error: gridmask '%s' selects no atoms.\n", grid.fitMask.MaskString());
+        return Action::ERR;
+      }
+    }
+  }
+
+  if (info_.gist.densityOnly) {
+    setupDensityAtoms(setup.Top());
+  }
+
+  if (info_.gist.calcEnergy && !setupEnergyBackend(setup.Top())) {
+    return Action::ERR;
+  }
+
+  return Action::OK;
+}
+
+
+
+/**
+ * Sets the box of the energy calculation from the frame.
+ * @param frame: The current frame.
+ * @param box: Set to the box of the frame.
+ */
+void Action_GIGist::calcEnergyBox(const Frame &frame, GistEnergy::Box &box)
+{
+  // Setting up Image type here, don't know why this is necessary at all...
+  if (image_.ImagingEnabled()) {
+      image_.SetImageType( frame.BoxCrd().Is_X_Aligned_Ortho() );
+  }
+  box = GistEnergy::Box{};
+  switch(image_.ImagingType()) {
+    case ImageOption::NONORTHO:
+      for (int i = 0; i < 9; ++i) {
+        box.ucell[i] = frame.BoxCrd().UnitCell().Dptr()[i];
+        box.recip[i] = frame.BoxCrd().FracCell().Dptr()[i];
+      }
+      box.type = GistEnergy::BoxType::NONORTHO;
+      break;
+    case ImageOption::ORTHO:
+      for (int i = 0; i < 3; ++i) {
+        box.ucell[4 * i] = frame.BoxCrd().XyzPtr()[i];
+      }
+      box.type = GistEnergy::BoxType::ORTHO;
+      break;
+    case ImageOption::NO_IMAGE:
+      box.type = GistEnergy::BoxType::NONE;
+      break;
+    default:
+      throw BoxInfoException();
+  }
+}
+
+void Action_GIGist::calcHVectors(
+  GistGrid &grid,
+  int voxel,
+  int headAtomIndex,
+  const std::vector<Vec3> &molAtomCoords)
+{
+  Vec3 X;
+  Vec3 Y;
   bool setX = false;
   bool setY = false;
   if (info_.gist.febiss){
@@ -581,7 +1344,7 @@ void Action_GIGist::calcHVectors(
           Y.SetVec(molAtomCoords.at(i)[0] - molAtomCoords.at(headAtomIndex)[0], 
                     molAtomCoords.at(i)[1] - molAtomCoords.at(headAtomIndex)[1], 
                     molAtomCoords.at(i)[2] - molAtomCoords.at(headAtomIndex)[2]);
-          hVectors_.at(voxel).push_back(Y);
+          grid.hVectors.at(voxel).push_back(Y);
           Y.Normalize();
           setY = true;
         }
@@ -589,7 +1352,7 @@ void Action_GIGist::calcHVectors(
           X.SetVec(molAtomCoords.at(i)[0] - molAtomCoords.at(headAtomIndex)[0], 
                     molAtomCoords.at(i)[1] - molAtomCoords.at(headAtomIndex)[1], 
                     molAtomCoords.at(i)[2] - molAtomCoords.at(headAtomIndex)[2]);
-          hVectors_.at(voxel).push_back(X);
+          grid.hVectors.at(voxel).push_back(X);
           X.Normalize();
           setX = true;
         }
@@ -601,98 +1364,163 @@ void Action_GIGist::calcHVectors(
   }
 }
 
-std::tuple<Vec3, int> Action_GIGist::prepCom(const Molecule& mol, const ActionFrame& frame) {
+Vec3 Action_GIGist::prepCom(const Molecule& mol, const Frame &frame) {
   int mol_begin{ mol.MolUnit().Front() };
   int mol_end{ mol.MolUnit().Back() };
-  Vec3 com{ calcCenterOfMass(mol_begin, mol_end, frame.Frm().XYZ(mol_begin)) };
-  return { com, bin(mol_begin, mol_end, com, frame) };
+  // The center of mass is moved with the molecule, so it can be aligned afterwards.
+  return alignPoint(calcCenterOfMass(mol_begin, mol_end, frame.XYZ(mol_begin)));
+}
+
+/**
+ * Starts the calculation of GIST for a single frame. As long as gridmask grids
+ * are pending, the frames are only kept until the grids can be fitted.
+ * @param frameNum: The number of the frame.
+ * @param frame: The frame itself.
+ * @return: Action::ERR on error, Action::OK if everything ran smoothly.
+ */
+Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
+  if (gridsPending_) {
+    prepassBuffer_.push_back(frame.Frm());
+    if (static_cast<int>( prepassBuffer_.size() ) < std::max(1, info_.gist.prepassFrames)) {
+      return Action::OK;
+    }
+    return finishPendingGrids();
+  }
+  return processFrame(frame.Frm());
 }
 
-std::tuple<std::vector<DOUBLE_O_FLOAT>, 
-      std::vector<DOUBLE_O_FLOAT>,
-      std::vector<int>,
-      std::vector<int>
-> Action_GIGist::calcGPUEnergy(const ActionFrame &frame) 
+/**
+ * Collects the solvent atoms binned in densityonly mode and sizes the density
+ * accumulators of all allocated grids.
+ * @param top: The current topology.
+ */
+void Action_GIGist::setupDensityAtoms(const Topology &top)
 {
-  #ifdef CUDA
-  tEnergy_.Start();
-  std::vector<DOUBLE_O_FLOAT> eww_result;
-  std::vector<DOUBLE_O_FLOAT> esw_result;
-  std::vector<int> result_o( 4 * info_.system.numberAtoms );
-  std::vector<int> result_n( info_.system.numberAtoms );
-  if (info_.gist.calcEnergy){
-    auto boxParams{ calcBoxParameters(frame) };
-
-    // std::vector<int> result_o{ std::vector<int>(4 * info_.system.numberAtoms) };
-    // std::vector<int> result_n{ std::vector<int>(info_.system.numberAtoms) };
-    // TODO: Switch things around a bit and move the back copying to the end of the calculation.
-    //       Then the time needed to go over all waters and the calculations that come with that can
-    //       be hidden quite nicely behind the interaction energy calculation.
-    // Must create arrays from the vectors, does that by getting the address of the first element of the vector.
-    auto e_result{ 
-      doActionCudaEnergy_GIGIST(
-        frame.Frm().xAddress(),
-        NBindex_c_,
-        numberAtomTypes_,
-        paramsLJ_c_,
-        molecule_c_,
-        boxParams.boxinfo,
-        boxParams.recip.get(),
-        boxParams.ucell.get(),
-        info_.system.numberAtoms,
-        info_.gist.centerType,
-        info_.gist.neighborCutoff,
-        &(result_o[0]),
-        &(result_n[0]),
-        result_w_c_,
-        result_s_c_,
-        result_O_c_,
-        result_N_c_,
-        info_.gist.doorder) };
-    eww_result = std::move(e_result.eww);
-    esw_result = std::move(e_result.esw);
-
-    std::vector<std::vector<int>> order_indices{};
-
-    if (info_.gist.doorder) {
-      int counter{ 0 };
-      for (int i = 0; i < (4 * info_.system.numberAtoms); i += 4) {
-        ++counter;
-        std::vector<int> temp{};
-        for (unsigned int j = 0; j < 4; ++j) {
-          temp.push_back(result_o.at(i + j));
-        }
-        order_indices.push_back(temp);
+  densityAtoms_.assign(species_.size(), std::vector<DensityAtom>());
+  for (Topology::mol_iterator mol = top.MolStart(); mol < top.MolEnd(); ++mol) {
+    int sp{ molSpecies_.at(mol - top.MolStart()) };
+    if (sp == -1) {
+      continue;
+    }
+    const SolventSpecies &species = species_.at(sp);
+    for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
+      if (solvent_[atom]) {
+        bool center{ !info_.gist.useCOM && atom - mol->MolUnit().Front() == species.centerIdx };
+        densityAtoms_[sp].push_back({ atom, atomElement_[atom], center });
       }
     }
+  }
+  for (GistGrid &grid : grids_) {
+    if (!grid.pending) {
+      resizeDensity(grid);
+    }
+  }
+}
 
-    tEnergy_.Stop();
+/**
+ * Sizes the density accumulator of a grid, the counts are only reset if the
+ * grid or the number of elements changed.
+ */
+void Action_GIGist::resizeDensity(GistGrid &grid)
+{
+  int channels{ 1 + static_cast<int>( species_.at(grid.species).elements.size() ) };
+  if (grid.density.voxels() != grid.info.nVoxels || grid.density.channels() != channels) {
+    grid.density.resize(grid.info.nVoxels, channels, info_.gist.flushInterval);
   }
-  return { eww_result, esw_result, result_o, result_n };
-  #else
-  return {std::vector<DOUBLE_O_FLOAT>(), 
-    std::vector<DOUBLE_O_FLOAT>(),
-    std::vector<int>(),
-    std::vector<int>()};
-  #endif
 }
 
+/**
+ * Frame processing of the densityonly mode. The solvent atoms are binned in
+ * blocks, the voxel indices of a block are calculated first in a loop without
+ * branches, which vectorizes, and then added to the per-thread tiles.
+ * @param frame: The frame itself.
+ * @return: Action::OK
+ */
+Action::RetType Action_GIGist::processDensityFrame(const Frame &frame)
+{
+  const int BLOCK{ 256 };
+  info_.system.nFrames++;
+  calcAlignment(frame);
+  addProximity(frame);
+  // Alignment as a single rotation and shift, the identity without align.
+  const double identity[9]{ 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+  const double *rot{ align_ ? alignRot_.Dptr() : identity };
+  const Vec3 shift{ alignPoint(Vec3(0, 0, 0)) };
+  const double *xyz{ frame.xAddress() };
+
+  for (GistGrid &grid : grids_) {
+    const std::vector<DensityAtom> &atoms = densityAtoms_.at(grid.species);
+    const int nAtoms{ static_cast<int>( atoms.size() ) };
+    const double inv{ 1.0 / grid.info.voxelSize };
+    const double origin[3]{ grid.info.start[0], grid.info.start[1], grid.info.start[2] };
+    const int dims[3]{ grid.info.dimensions[0], grid.info.dimensions[1], grid.info.dimensions[2] };
+    #pragma omp parallel
+    {
+    int voxels[BLOCK];
+    #pragma omp for schedule(static)
+    for (int block = 0; block < nAtoms; block += BLOCK) {
+      const int n{ std::min(BLOCK, nAtoms - block) };
+      #pragma omp simd
+      for (int a = 0; a < n; ++a) {
+        const double *x{ xyz + 3 * atoms[block + a].atom };
+        double p[3];
+        for (int d = 0; d < 3; ++d) {
+          p[d] = (rot[3 * d] * x[0] + rot[3 * d + 1] * x[1] + rot[3 * d + 2] * x[2] + shift[d] - origin[d]) * inv;
+        }
+        int i{ static_cast<int>( std::floor(p[0]) ) };
+        int j{ static_cast<int>( std::floor(p[1]) ) };
+        int k{ static_cast<int>( std::floor(p[2]) ) };
+        bool inside{ p[0] >= 0 && p[1] >= 0 && p[2] >= 0 && i < dims[0] && j < dims[1] && k < dims[2] };
+        voxels[a] = inside ? (i * dims[1] + j) * dims[2] + k : -1;
+      }
+      for (int a = 0; a < n; ++a) {
+        if (voxels[a] != -1 && activeVoxel(grid, voxels[a])) {
+          const DensityAtom &atom = atoms[block + a];
+          grid.density.add(voxels[a], 1 + atom.element, 1.0);
+          if (atom.center) {
+            grid.density.add(voxels[a], 0, 1.0);
+          }
+        }
+      }
+    }
+    }
 
+    if (info_.gist.useCOM) {
+      const int nMol{ static_cast<int>( top_->Nmol() ) };
+      #pragma omp parallel for schedule(static)
+      for (int m = 0; m < nMol; ++m) {
+        if (molSpecies_[m] == grid.species) {
+          Vec3 com{ prepCom(*(top_->MolStart() + m), frame) };
+          size_t i{}, j{}, k{};
+          if (grid.result.at(dict_.getIndex("population"))->Bin().Calc(com[0], com[1], com[2], i, j, k)) {
+            long voxel{ grid.result.at(dict_.getIndex("population"))->CalcIndex(i, j, k) };
+            if (activeVoxel(grid, voxel)) {
+              grid.density.add(voxel, 0, 1.0);
+            }
+          }
+        }
+      }
+    }
+    grid.density.endFrame();
+  }
+  return Action::OK;
+}
 
 /**
- * Starts the calculation of GIST. Can use either CUDA, OPENMP or single thread code.
+ * Calculation of GIST on a single frame. Can use either CUDA, OPENMP or single thread code.
  * This function is actually way too long. Refactoring of this code might help with
  * readability.
- * @param frameNum: The number of the frame.
  * @param frame: The frame itself.
  * @return: Action::ERR on error, Action::OK if everything ran smoothly.
  */
-Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
+Action::RetType Action_GIGist::processFrame(const Frame &frame) {
+  if (info_.gist.densityOnly) {
+    return processDensityFrame(frame);
+  }
 
   info_.system.nFrames++;
-  std::vector<DOUBLE_O_FLOAT> eww_result{};
-  std::vector<DOUBLE_O_FLOAT> esw_result{};
-  std::vector<std::vector<int> > order_indices{};
+  calcAlignment(frame);
+  addProximity(frame);
 
   if (info_.gist.febiss && info_.system.nFrames == 1) {
     this->writeOutSolute(frame);
@@ -703,44 +1531,43 @@ Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
     prepQuaternion(frame);
   }
 
-  // CUDA necessary information
-  #ifdef CUDA
-
-  auto energyResults = calcGPUEnergy(frame);
-
-  eww_result = std::move(std::get<0>(energyResults));
-  esw_result = std::move(std::get<1>(energyResults));
-  #endif
+  if (!info_.gist.pairFile.empty()) {
+    assignPairVoxels(frame);
+  }
 
-  std::vector<bool> onGrid(info_.system.numberAtoms, false);
-  /*for (unsigned int i = 0; i < onGrid.size(); ++i) {
-    onGrid.at(i) = false;
-  }*/
+  // The voxels of every molecule (empty if it is on no grid) and its center
+  // atom, the energies are calculated afterwards for these molecules only.
+  std::vector<std::vector<int> > molVoxels(top_->Nmol());
+  std::vector<int> molCenter(top_->Nmol(), -1);
 
+  // In deterministic mode, the molecules are binned in their order in the topology,
+  // so that the samples are inserted in the same order for any number of threads.
   #if defined _OPENMP && defined CUDA
   tHead_.Start();
-  #pragma omp parallel for
+  #pragma omp parallel for if(!info_.gist.deterministic)
   #endif
   for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
-    if ((mol->IsSolvent() && info_.gist.solventStart == -1) || 
-      (
-        ( info_.gist.solventStart > -1 ) &&
-        ( top_->operator[](mol->MolUnit().Front()).MolNum() >= info_.gist.solventStart )
-      )
-    ) {
+    int sp{ molSpecies_.at(mol - top_->MolStart()) };
+    if (sp != -1) {
+      const SolventSpecies &species = species_.at(sp);
       int headAtomIndex{ -1 };
-      // Keep voxel at -1 if it is not possible to put it on the grid
-      int voxel{ -1 };
+      // Keep voxel at -1 if it is not possible to put it on the grid, one voxel per grid.
+      std::vector<int> voxels(grids_.size(), -1);
+      bool onAnyGrid{ false };
       std::vector<Vec3> molAtomCoords{};
       Vec3 com{ 0, 0, 0 };
       Vec3 coord{ 0, 0, 0 };
 
       // If center of mass should be used, use this part.
       if (info_.gist.useCOM) {
-        auto test = prepCom(*mol, frame);
-        com = std::get<0>(test);
+        com = prepCom(*mol, frame);
         coord = com;
-        voxel = std::get<1>(test);
+        for (unsigned int g = 0; g < grids_.size(); ++g) {
+          if (grids_[g].species == sp) {
+            voxels[g] = bin(grids_[g], mol->MolUnit().Front(), mol->MolUnit().Back(), com, frame);
+            onAnyGrid = onAnyGrid || voxels[g] != -1;
+          }
+        }
       }
       
 
@@ -751,41 +1578,40 @@ Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
         bool first{ true };
         if (solvent_[atom1]) { // Do we need that?
           // Save coords for later use.
-          const double *vec = frame.Frm().XYZ(atom1);
-          molAtomCoords.push_back(Vec3(vec));
+          Vec3 vec{ atomXYZ(frame, atom1) };
+          molAtomCoords.push_back(vec);
           // Check if atom is "Head" atom of the solvent
           // Could probably save some time here by writing head atom indices into an array.
           // TODO: When assuming fixed atom position in topology, should be very easy.
-          if ( !info_.gist.useCOM && std::string((*top_)[atom1].ElementName()).compare(info_.gist.centerAtom) == 0 && first ) {
-            // Try to bin atom1 onto the grid. If it is possible, get the index and keep working,
+          if ( !info_.gist.useCOM && atomElement_[atom1] == species.centerElement && first ) {
+            // Try to bin atom1 onto the grids. If it is possible, get the index and keep working,
             // if not, calculate the energies between all atoms to this point.
-            voxel = bin(mol->MolUnit().Front(), mol->MolUnit().Back(), vec, frame);
+            for (unsigned int g = 0; g < grids_.size(); ++g) {
+              if (grids_[g].species == sp) {
+                voxels[g] = bin(grids_[g], mol->MolUnit().Front(), mol->MolUnit().Back(), vec, frame);
+                onAnyGrid = onAnyGrid || voxels[g] != -1;
+              }
+            }
             coord = vec;
             headAtomIndex = atom1 - mol->MolUnit().Front();
             first = false;
           } else {
-            size_t bin_i{}, bin_j{}, bin_k{};
-            if ( result_.at(dict_.getIndex("population"))->Bin().Calc(vec[0], vec[1], vec[2], bin_i, bin_j, bin_k) 
-                    /*&& bin_i < dimensions_[0] && bin_j < dimensions_[1] && bin_k < dimensions_[2]*/) {
-              std::string aName{ top_->operator[](atom1).ElementName() };
-              long voxTemp{ result_.at(dict_.getIndex("population"))->CalcIndex(bin_i, bin_j, bin_k) };
-              #ifdef _OPENMP
-              #pragma omp critical
-              {
-              #endif
-              try{
-                resultV_.at(dict_.getIndex(aName) - result_.size()).at(voxTemp) += 1.0;
-              } catch(std::out_of_range e)
-              {
-                std::cout << std::setprecision(30) << (size_t)((vec[0] + 35.0f) / 0.5f) << ", " << vec[1] << ", " << vec[2] << '\n';
-                std::cout << result_.at(dict_.getIndex("population"))->Bin().Calc(vec[0], vec[1], vec[2], bin_i, bin_j, bin_k) << '\n';
-                std::cout << bin_i << " " << bin_j << " " << bin_k << '\n';
-                std::cout << voxTemp << '\n';
-                throw std::out_of_range("");
-              }
-              #ifdef _OPENMP
+            for (GistGrid &grid : grids_) {
+              size_t bin_i{}, bin_j{}, bin_k{};
+              if ( grid.species == sp && grid.result.at(dict_.getIndex("population"))->Bin().Calc(vec[0], vec[1], vec[2], bin_i, bin_j, bin_k) ) {
+                long voxTemp{ grid.result.at(dict_.getIndex("population"))->CalcIndex(bin_i, bin_j, bin_k) };
+                if (!activeVoxel(grid, voxTemp)) {
+                  continue;
+                }
+                #ifdef _OPENMP
+                #pragma omp critical
+                {
+                #endif
+                grid.resultV.at(atomElement_[atom1]).at(voxTemp) += 1.0;
+                #ifdef _OPENMP
+                }
+                #endif
               }
-              #endif
             }
           }
         }
@@ -796,9 +1622,13 @@ Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
 
       
 
-      if (voxel != -1) {
+      if (onAnyGrid) {
 
-        calcHVectors(voxel, headAtomIndex, molAtomCoords);
+        for (unsigned int g = 0; g < grids_.size(); ++g) {
+          if (voxels[g] != -1) {
+            calcHVectors(grids_[g], voxels[g], headAtomIndex, molAtomCoords);
+          }
+        }
 
         #if !defined _OPENMP
         tRot_.Start();
@@ -811,233 +1641,564 @@ Action::RetType Action_GIGist::DoAction(int frameNum, ActionFrame &frame) {
           quat = calcQuaternion(molAtomCoords, molAtomCoords.at(headAtomIndex), headAtomIndex);
         } else {
           // -1 Will never evaluate to true, so in the funciton it will have no consequence.
-          quat = calcQuaternion(molAtomCoords, com, quat_indices_);
-        }
-        //if (quat.initialized())
-        //{
-          #ifdef _OPENMP
-          #pragma omp critical
-          {
-          #endif
-          centersAndRotations_.push_back(voxel, {coord, quat, info_.system.nFrames});
-          #ifdef _OPENMP
-          }
-          #endif
-        //}
-        
-
-        #if !defined _OPENMP
-        tRot_.Stop();
-        #endif
-        
-  // If energies are already here, calculate the energies right away.
-  #ifdef CUDA
-        /* 
-        * Calculation of the order parameters
-        * Following formula:
-        * q = 1 - 3/8 * SUM[a>b]( cos(Thet[a,b]) + 1/3 )**2
-        * This, however, only makes sense for water, so please do not
-        * use it for any other solvent.
-        */
-        if (info_.gist.doorder) {
-          double sum{ 0 };
-          Vec3 cent{ frame.Frm().xAddress() + (mol->MolUnit().Front() + headAtomIndex) * 3 };
-          std::vector<Vec3> vectors{};
-          switch(image_.ImagingType()) {
-            case ImageOption::NONORTHO:
-            case ImageOption::ORTHO:
-              {
-                Matrix_3x3 ucell, recip;
-                ucell = frame.Frm().BoxCrd().UnitCell();
-                recip = frame.Frm().BoxCrd().FracCell();
-                //frame.Frm().BoxCrd().ToRecip(ucell, recip);
-                Vec3 vec(frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(0) * 3));
-                vectors.push_back( MinImagedVec(vec, cent, ucell, recip));
-                vec = Vec3(frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(1) * 3));
-                vectors.push_back( MinImagedVec(vec, cent, ucell, recip));
-                vec = Vec3(frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(2) * 3));
-                vectors.push_back( MinImagedVec(vec, cent, ucell, recip));
-                vec = Vec3(frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(3) * 3));
-                vectors.push_back( MinImagedVec(vec, cent, ucell, recip));
-              }
-              break;
-            default:
-              vectors.push_back( Vec3( frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(0) * 3) ) - cent );
-              vectors.push_back( Vec3( frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(1) * 3) ) - cent );
-              vectors.push_back( Vec3( frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(2) * 3) ) - cent );
-              vectors.push_back( Vec3( frame.Frm().xAddress() + (order_indices.at(mol->MolUnit().Front() + headAtomIndex).at(3) * 3) ) - cent );
-          }
-          
-          for (int i = 0; i < 3; ++i) {
-            for (int j = i + 1; j < 4; ++j) {
-              double cosThet{ (vectors.at(i) * vectors.at(j)) / sqrt(vectors.at(i).Magnitude2() * vectors.at(j).Magnitude2()) };
-              sum += (cosThet + 1.0/3) * (cosThet + 1.0/3);
-            }
-          }
-          #ifdef _OPENMP
-          #pragma omp critical
-          {
-          #endif
-          result_.at(dict_.getIndex("order"))->UpdateVoxel(voxel, 1.0 - (3.0/8.0) * sum);
-          #ifdef _OPENMP
-          }
-          #endif
+          quat = calcQuaternion(molAtomCoords, com, species.quatIndices);
         }
         #ifdef _OPENMP
         #pragma omp critical
         {
         #endif
-        result_.at(dict_.getIndex("neighbour"))->UpdateVoxel(voxel, std::get<3>(energyResults).at(mol->MolUnit().Front() + headAtomIndex));
+        for (unsigned int g = 0; g < grids_.size(); ++g) {
+          if (voxels[g] != -1) {
+            if (quat.initialized()) {
+              grids_[g].centersAndRotations.push_back(voxels[g], {coord, quat, info_.system.nFrames});
+            } else {
+              grids_[g].points.push_back(voxels[g], {coord, info_.system.nFrames});
+            }
+            if (grids_[g].residenceFile != nullptr) {
+              grids_[g].residence.update(mol - top_->MolStart(), voxels[g], info_.system.nFrames);
+            }
+          }
+        }
         #ifdef _OPENMP
         }
         #endif
-        // End of calculation of the order parameters
+        
 
-        #ifndef _OPENMP
-        tEadd_.Start();
-        #endif
-        #ifdef _OPENMP
-        #pragma omp critical
-        {
+        #if !defined _OPENMP
+        tRot_.Stop();
         #endif
-        // There is absolutely nothing to check here, as the solute can not be in place here.
-        for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
-          // Just adds up all the interaction energies for this voxel.
-          result_.at(dict_.getIndex("Eww"))->UpdateVoxel(voxel, static_cast<double>(eww_result.at(atom)));
-          result_.at(dict_.getIndex("Esw"))->UpdateVoxel(voxel, static_cast<double>(esw_result.at(atom)));
-        }
-        #ifdef _OPENMP
+        
+        molVoxels[mol - top_->MolStart()] = voxels;
+        if (headAtomIndex != -1) {
+          molCenter[mol - top_->MolStart()] = mol->MolUnit().Front() + headAtomIndex;
+        } else if (species.centerIdx != -1) {
+          molCenter[mol - top_->MolStart()] = mol->MolUnit().Front() + species.centerIdx;
         }
-        #endif
-        #ifndef _OPENMP
-        tEadd_.Stop();
-        #endif
+      }
+    }
+  }
+  
+  #if defined _OPENMP && defined CUDA
+  tHead_.Stop();
   #endif
+
+  if (info_.gist.calcEnergy) {
+    addEnergies(frame, molVoxels, molCenter);
+  }
+  for (GistGrid &grid : grids_) {
+    grid.sums.endFrame();
+  }
+  if (info_.gist.bootstrapReplicates > 0 && info_.system.nFrames % info_.gist.bootstrapBlock == 0) {
+    for (GistGrid &grid : grids_) {
+      recordBlock(grid);
+    }
+  }
+
+  if (!info_.gist.pairFile.empty()) {
+    for (GistGrid &grid : grids_) {
+      grid.ewwPairs.merge();
+    }
+  }
+
+  return Action::OK;
+}
+
+/**
+ * Calculates the energies of all molecules that are on a grid and adds them,
+ * the neighbour counts and the order parameters to the voxels. The energies
+ * of a molecule are the sums over its atoms.
+ * @param frame: The current frame.
+ * @param molVoxels: The voxels of every molecule, empty if it is on no grid.
+ * @param molCenter: The center atom of every molecule, -1 if there is none.
+ */
+void Action_GIGist::addEnergies(const Frame &frame, const std::vector<std::vector<int> > &molVoxels, const std::vector<int> &molCenter)
+{
+  std::vector<int> active{};
+  for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
+    if (!molVoxels[mol - top_->MolStart()].empty()) {
+      for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
+        active.push_back(atom);
       }
+    }
+  }
+  if (active.empty()) {
+    return;
+  }
 
-      // If CUDA is used, energy calculations are already done.
-  #ifndef CUDA
-      if (voxel != -1 ) {
-        std::vector<Vec3> nearestWaters(4);
-        // Use HUGE distances at the beginning. This is defined as 3.40282347e+38F.
-        double distances[4]{HUGE, HUGE, HUGE, HUGE};
-        // Needs to be fixed, one does not need to calculate all interactions each time.
-        for (int atom1 = mol->MolUnit().Front(); atom1 < mol->MolUnit().Back(); ++atom1) {
-          double eww{ 0 };
-          double esw{ 0 };
-  // OPENMP only over the inner loop
-
-          #pragma omp parallel for
-          for (unsigned int atom2 = 0; atom2 < info_.system.numberAtoms; ++atom2) {
-            if ( (*top_)[atom1].MolNum() != (*top_)[atom2].MolNum() ) {
-              tEadd_.Start();
-              double r_2{ calcDistanceSqrd(frame, atom1, atom2) };
-              double energy{ calcEnergy(r_2, atom1, atom2) };
-              tEadd_.Stop();
-              if (solvent_[atom2]) {
-                #pragma omp atomic
-                eww += energy;
-              } else {
-                #pragma omp atomic
-                esw += energy;
-              }
-              if (atomTypes_.at(atom1) == info_.gist.centerType &&
-                  atomTypes_.at(atom2) == info_.gist.centerType) {
-                if (r_2 < distances[0]) {
-                  distances[3] = distances[2];
-                  distances[2] = distances[1];
-                  distances[1] = distances[0];
-                  distances[0] = r_2;
-                  nearestWaters.at(3) = nearestWaters.at(2);
-                  nearestWaters.at(2) = nearestWaters.at(1);
-                  nearestWaters.at(1) = nearestWaters.at(0);
-                  nearestWaters.at(0) = Vec3(frame.Frm().XYZ(atom2)) - Vec3(frame.Frm().XYZ(atom1));
-                } else if (r_2 < distances[1]) {
-                  distances[3] = distances[2];
-                  distances[2] = distances[1];
-                  distances[1] = r_2;
-                  nearestWaters.at(3) = nearestWaters.at(2);
-                  nearestWaters.at(2) = nearestWaters.at(1);
-                  nearestWaters.at(1) = Vec3(frame.Frm().XYZ(atom2)) - Vec3(frame.Frm().XYZ(atom1));
-                } else if (r_2 < distances[2]) {
-                  distances[3] = distances[2];
-                  distances[2] = r_2;
-                  nearestWaters.at(3) = nearestWaters.at(2);
-                  nearestWaters.at(2) = Vec3(frame.Frm().XYZ(atom2)) - Vec3(frame.Frm().XYZ(atom1));
-                } else if (r_2 < distances[3]) {
-                  distances[3] = r_2;
-                  nearestWaters.at(3) = Vec3(frame.Frm().XYZ(atom2)) - Vec3(frame.Frm().XYZ(atom1));
-                }
-                if (r_2 < info_.gist.neighborCutoff) {
-                  #ifdef _OPENMP
-                  #pragma omp critical
-                  {
-                  #endif
-                  result_.at(dict_.getIndex("neighbour"))->UpdateVoxel(voxel, 1);
-                  #ifdef _OPENMP
-                  }
-                  #endif
-                }
-              }
-            }
-          }
-          double sum{ 0 };
-          for (int i = 0; i < 3; ++i) {
-            for (int j = i + 1; j < 4; ++j) {
-              double cosThet{ (nearestWaters.at(i) * nearestWaters.at(j)) / 
-                                sqrt(nearestWaters.at(i).Magnitude2() * nearestWaters.at(j).Magnitude2()) };
-              sum += (cosThet + 1.0/3) * (cosThet + 1.0/3);
-            }
-          }
-          #ifdef _OPENMP
-          #pragma omp critical
-          {
-          #endif
-          result_.at(dict_.getIndex("order"))->UpdateVoxel(voxel, 1.0 - (3.0/8.0) * sum);
-          eww /= 2.0;
-          result_.at(dict_.getIndex("Eww"))->UpdateVoxel(voxel, eww);
-          result_.at(dict_.getIndex("Esw"))->UpdateVoxel(voxel, esw);
-          #ifdef _OPENMP
-          }
-          #endif
+  energyCoords_.assign(frame.xAddress(), info_.system.numberAtoms);
+  calcEnergyBox(frame, energyCoords_.box);
+  GistEnergy::PairSink pairSink{};
+  if (!info_.gist.pairFile.empty()) {
+    // Every pair of molecules is visited from both sides.
+    pairSink = [this, &molVoxels](int atom1, int atom2, double energy) {
+      addVoxelPairs(molVoxels[molecule_[atom1]], molecule_[atom2], 0.5 * energy);
+    };
+  }
+  tEnergy_.Start();
+  energy_->calculate(energyCoords_, active, energyResult_, pairSink);
+  tEnergy_.Stop();
+
+  tEadd_.Start();
+  for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
+    const std::vector<int> &voxels = molVoxels[mol - top_->MolStart()];
+    if (voxels.empty()) {
+      continue;
+    }
+    double eww{ 0 };
+    double esw{ 0 };
+    for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
+      eww += energyResult_.eww[atom];
+      esw += energyResult_.esw[atom];
+    }
+    int center{ molCenter[mol - top_->MolStart()] };
+    int neighbours{ center == -1 ? 0 : energyResult_.neighbours[center] };
+    double order{ 0 };
+    bool hasOrder{ info_.gist.doorder && center != -1 && calcOrderParameter(frame, center, order) };
+    for (unsigned int g = 0; g < grids_.size(); ++g) {
+      if (voxels[g] != -1) {
+        grids_[g].sums.add(voxels[g], SUM_NEIGHBOUR, neighbours);
+        grids_[g].sums.add(voxels[g], SUM_EWW, eww);
+        grids_[g].sums.add(voxels[g], SUM_ESW, esw);
+        if (hasOrder) {
+          grids_[g].sums.add(voxels[g], SUM_ORDER, order);
         }
       }
-#endif
     }
   }
-  
-  #if defined _OPENMP && defined CUDA
-  tHead_.Stop();
-  #endif
+  tEadd_.Stop();
+}
+
+/**
+ * Calculation of the order parameter from the four nearest neighbours of
+ * the center atom, following the formula:
+ * q = 1 - 3/8 * SUM[a>b]( cos(Thet[a,b]) + 1/3 )**2
+ * This, however, only makes sense for water, so please do not
+ * use it for any other solvent.
+ * @param frame: The current frame.
+ * @param center: The center atom of the molecule.
+ * @param order: Set to the order parameter.
+ * @return: false if the center atom has fewer than four neighbours.
+ */
+bool Action_GIGist::calcOrderParameter(const Frame &frame, int center, double &order)
+{
+  Vec3 cent{ frame.XYZ(center) };
+  std::array<Vec3, GistEnergy::NEAREST> vectors{};
+  Matrix_3x3 ucell{ frame.BoxCrd().UnitCell() };
+  Matrix_3x3 recip{ frame.BoxCrd().FracCell() };
+  for (int i = 0; i < GistEnergy::NEAREST; ++i) {
+    int neighbour{ energyResult_.nearest[GistEnergy::NEAREST * center + i] };
+    if (neighbour == -1) {
+      return false;
+    }
+    Vec3 vec{ frame.XYZ(neighbour) };
+    if (image_.ImagingType() == ImageOption::NO_IMAGE) {
+      vectors[i] = vec - cent;
+    } else {
+      vectors[i] = MinImagedVec(vec, cent, ucell, recip);
+    }
+  }
+  double sum{ 0 };
+  for (int i = 0; i < 3; ++i) {
+    for (int j = i + 1; j < 4; ++j) {
+      double cosThet{ (vectors[i] * vectors[j]) / sqrt(vectors[i].Magnitude2() * vectors[j].Magnitude2()) };
+      sum += (cosThet + 1.0/3) * (cosThet + 1.0/3);
+    }
+  }
+  order = 1.0 - (3.0/8.0) * sum;
+  return true;
+}
+
+/**
+ * Reads the align keyword and prepares the reference.
+ * @param argList: The argument list of the user.
+ * @param actionInit: The action initialization object, holding the references.
+ * @return: false if the reference could not be set up.
+ */
+bool Action_GIGist::initAlignment(ArgList &argList, ActionInit &actionInit)
+{
+  if (!argList.Contains("align")) {
+    return true;
+  }
+  align_ = true;
+  std::string maskString{ argList.GetStringKey("align") };
+  if (maskString.empty() || alignMask_.SetMaskString(maskString)) {
+    mprinterr("Error: align needs a valid atom mask.\n");
+    return false;
+  }
+  ReferenceFrame REF{ actionInit.DSL().GetReferenceFrame(argList) };
+  if (REF.error()) {
+    return false;
+  }
+  if (REF.empty()) {
+    mprintf("GIST: Aligning '%s' onto the first frame.\n", alignMask_.MaskString());
+    return true;
+  }
+  AtomMask refMask{ maskString };
+  if (REF.Parm().SetupIntegerMask(refMask) || refMask.None()) {
+    mprinterr("Error: align mask '%s' selects no atoms in the reference.\n", maskString.c_str());
+    return false;
+  }
+  alignRef_.SetupFrameFromMask(refMask, REF.Parm().Atoms());
+  alignRef_.SetCoordinates(REF.Coord(), refMask);
+  alignRefTrans_ = alignRef_.CenterOnOrigin(false);
+  alignRefSet_ = true;
+  mprintf("GIST: Aligning '%s' onto the reference.\n", alignMask_.MaskString());
+  return true;
+}
+
+/**
+ * Sets up the align mask for a new topology.
+ * @param top: The topology.
+ * @return: false if the mask does not match the reference.
+ */
+bool Action_GIGist::setupAlignment(const Topology &top)
+{
+  if (!align_) {
+    return true;
+  }
+  if (top.SetupIntegerMask(alignMask_) || alignMask_.None()) {
+    mprinterr("Error: align mask '%s' selects no atoms.\n", alignMask_.MaskString());
+    return false;
+  }
+  if (alignRefSet_ && alignMask_.Nselected() != alignRef_.Natom()) {
+    mprinterr("Error: align mask selects %d atoms, but %d in the reference.\n",
+              alignMask_.Nselected(), alignRef_.Natom());
+    return false;
+  }
+  alignFrame_.SetupFrameFromMask(alignMask_, top.Atoms());
+  return true;
+}
+
+/**
+ * Calculates the transformation of the current frame onto the reference.
+ * Nothing is done to the frame itself, the transformation is applied when
+ * coordinates are read via atomXYZ. Without a reference, the first frame
+ * becomes the reference.
+ * @param frame: The current frame.
+ */
+void Action_GIGist::calcAlignment(const Frame &frame)
+{
+  if (!align_) {
+    return;
+  }
+  if (!alignRefSet_) {
+    alignRef_.SetupFrameFromMask(alignMask_, top_->Atoms());
+    alignRef_.SetCoordinates(frame, alignMask_);
+    alignRefTrans_ = alignRef_.CenterOnOrigin(false);
+    alignRefSet_ = true;
+  }
+  alignFrame_.SetCoordinates(frame, alignMask_);
+  alignFrame_.RMSD_CenteredRef(alignRef_, alignRot_, alignTgtTrans_, false);
+}
+
+/**
+ * @return: The coordinates of an atom, fitted onto the reference if align is used.
+ */
+Vec3 Action_GIGist::atomXYZ(const Frame &frame, int atom) const
+{
+  return alignPoint(Vec3(frame.XYZ(atom)));
+}
+
+/**
+ * Moves a point of the current frame onto the reference, if align is used.
+ * @param point: The point in the coordinates of the current frame.
+ * @return: The point in the coordinates of the reference.
+ */
+Vec3 Action_GIGist::alignPoint(const Vec3 &point) const
+{
+  if (!align_) {
+    return point;
+  }
+  return alignRot_ * (point + alignTgtTrans_) + alignRefTrans_;
+}
+
+/**
+ * Bins every molecule onto the grids for the voxel-pair matrix, without
+ * changing the populations. The center atom (or center of mass) is used, as
+ * in the main loop.
+ * @param frame: The current frame.
+ */
+void Action_GIGist::assignPairVoxels(const Frame &frame)
+{
+  for (GistGrid &grid : grids_) {
+    grid.pairVoxels.assign(top_->Nmol(), -1);
+  }
+  for (Topology::mol_iterator mol = top_->MolStart(); mol < top_->MolEnd(); ++mol) {
+    int molIdx = mol - top_->MolStart();
+    int sp{ molSpecies_.at(molIdx) };
+    if (sp == -1) {
+      continue;
+    }
+    Vec3 center{ 0, 0, 0 };
+    if (info_.gist.useCOM) {
+      center = prepCom(*mol, frame);
+    } else {
+      for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
+        if (atomElement_[atom] == species_.at(sp).centerElement) {
+          center = atomXYZ(frame, atom);
+          break;
+        }
+      }
+    }
+    for (GistGrid &grid : grids_) {
+      size_t bin_i{}, bin_j{}, bin_k{};
+      if (grid.species == sp &&
+          grid.result.at(dict_.getIndex("population"))->Bin().Calc(center[0], center[1], center[2], bin_i, bin_j, bin_k)) {
+        long voxel{ grid.result.at(dict_.getIndex("population"))->CalcIndex(bin_i, bin_j, bin_k) };
+        if (activeVoxel(grid, voxel)) {
+          grid.pairVoxels.at(molIdx) = voxel;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Adds a water-water pair energy to the voxel-pair matrices. Called from
+ * within the pair loop, so every thread writes to its own table.
+ * @param voxels: The voxels of the first molecule, one per grid.
+ * @param molecule: The molecule number of the second molecule.
+ * @param energy: The energy to add.
+ */
+void Action_GIGist::addVoxelPairs(const std::vector<int> &voxels, int molecule, double energy)
+{
+  #ifdef _OPENMP
+  int thread{ omp_get_thread_num() };
+  #else
+  int thread{ 0 };
+  #endif
+  for (unsigned int g = 0; g < grids_.size(); ++g) {
+    int voxel2{ voxels[g] == -1 ? -1 : grids_[g].pairVoxels.at(molecule) };
+    if (voxel2 == -1) {
+      continue;
+    }
+    std::array<int, 3> ijk1{ getVoxelVec(grids_[g], voxels[g]) };
+    std::array<int, 3> ijk2{ getVoxelVec(grids_[g], voxel2) };
+    double dist2{ 0 };
+    for (int i = 0; i < 3; ++i) {
+      double d{ (ijk1[i] - ijk2[i]) * grids_[g].info.voxelSize };
+      dist2 += d * d;
+    }
+    if (dist2 <= info_.gist.pairCutoff * info_.gist.pairCutoff) {
+      grids_[g].ewwPairs.add(thread, voxels[g], voxel2, energy);
+    }
+  }
+}
+
+/**
+ * Writes the residence times of a grid. For every voxel, the number of visits,
+ * the mean residence time and the survival function (the fraction of visits
+ * lasting at least t frames) are written. A visit ends as soon as the molecule
+ * is binned into a different voxel or is not binned in a frame.
+ * @param grid: The grid to write.
+ */
+void Action_GIGist::writeResidence(GistGrid &grid)
+{
+  grid.residence.finish();
+  grid.residenceFile->Printf("GIST residence times in frames, n_frames = %d\n", info_.system.nFrames);
+  grid.residenceFile->Printf("   voxel        x          y          z         visits     mean_residence");
+  for (int t = 1; t <= grid.residence.maxLength(); ++t) {
+    grid.residenceFile->Printf("  S(%d)", t);
+  }
+  grid.residenceFile->Printf("\n");
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    size_t i{}, j{}, k{};
+    grid.result.at(dict_.getIndex("population"))->ReverseIndex(voxel, i, j, k);
+    Vec3 coords{ grid.result.at(dict_.getIndex("population"))->Bin().Center(i, j, k) };
+    grid.residenceFile->Printf("%d %g %g %g %ld %g", voxel, coords[0], coords[1], coords[2],
+                               grid.residence.runs(voxel), grid.residence.meanResidence(voxel));
+    for (int t = 1; t <= grid.residence.maxLength(); ++t) {
+      grid.residenceFile->Printf(" %g", grid.residence.survival(voxel, t));
+    }
+    grid.residenceFile->Printf("\n");
+  }
+}
 
-  return Action::OK;
+/**
+ * Writes the voxel-pair matrix of a grid, averaged over all frames. The
+ * format is described in VoxelPairMatrix.h.
+ * @param grid: The grid to write.
+ */
+void Action_GIGist::writePairMatrix(const GistGrid &grid) const
+{
+  std::string name{ addFileSuffix(info_.gist.pairFile, grid.suffix) };
+  CompressedStream file{ name };
+  if (!grid.ewwPairs.writeBinary(file, grid.info.dimensions.data(), grid.info.voxelSize,
+                                 info_.system.nFrames, std::max(1, info_.system.nFrames)) || !file.close()) {
+    mprinterr("Error: Could not write the voxel-pair matrix to %s.\n", name.c_str());
+    return;
+  }
+  mprintf("Wrote %d voxel pairs to %s.\n", static_cast<int>( grid.ewwPairs.size() ), name.c_str());
 }
 
 /**
  * Post Processing is done here.
  */
 void Action_GIGist::Print() {
-  /* This is not called for two reasons
-   * 1) The RAM on the GPU is far less than the main memory
-   * 2) It does not speed up the calculation significantly enough
-   * However, this can be changed if wished for (It is not yet stable enough to be used)
-   * Tests are ongoing
-   */
-  #ifdef CUDA_UPDATED
-  std::vector<std::vector<float> > dTSTest = doActionCudaEntropy(waterCoordinates_, info_.grid,dimension[0], info_.grid,dimension[1],
-                                                              info_.grid,dimension[2], quaternions_, info_.system.temperature, info_.system.rho0, info_.system.nFrames);
-  #endif
+  // Fewer frames than requested for the prepass.
+  if (!prepassBuffer_.empty()) {
+    finishPendingGrids();
+  }
   mprintf("Processed %d frames.\nMoving on to entropy calculation.\n", info_.system.nFrames);
-  ProgressBar progBarEntropy(info_.grid.nVoxels);
+  for (GistGrid &grid : grids_) {
+    if (grids_.size() > 1) {
+      mprintf("Grid %s centered at %g %g %g:\n", grid.suffix.empty() ? "_0" : grid.suffix.c_str(),
+              grid.info.center[0], grid.info.center[1], grid.info.center[2]);
+    }
+    if (info_.gist.densityOnly) {
+      printDensityGrid(grid);
+      writeCompressedDxFiles(grid);
+      writeProximity(grid);
+      writeMrcFiles(grid);
+      continue;
+    }
+    // The last block is shorter.
+    if (info_.gist.bootstrapReplicates > 0 && info_.system.nFrames % info_.gist.bootstrapBlock != 0) {
+      recordBlock(grid);
+    }
+    finishSums(grid);
+    // The neighbour searches walk the samples voxel by voxel.
+    grid.centersAndRotations.compact();
+    grid.points.compact();
+    grid.samplesFrozen = true;
+    if (!info_.gist.queryOnly) {
+      printGrid(grid);
+      writeCompressedDxFiles(grid);
+      writeProximity(grid);
+      writeMrcFiles(grid);
+      calcBootstrapErrors(grid);
+    }
+  }
+  if (queryOutfile_ != nullptr) {
+    writeQuery();
+  }
+  if (info_.gist.refineOut) {
+    writeRefinedGrids();
+  }
+
+  mprintf("Timings:\n"
+          " Find Head Atom:   %8.3f\n"
+          " Add up Energy:    %8.3f\n"
+          " Calculate Dipole: %8.3f\n"
+          " Calculate Quat:   %8.3f\n"
+          " Calculate Energy: %8.3f\n\n",
+          tHead_.Total(),
+          tEadd_.Total(),
+          tDipole_.Total(),
+          tRot_.Total(),
+          tEnergy_.Total());
+  if (wrongNumberOfAtoms_)
+  {
+    mprintf("Warning: It seems you are having multiple solvents in your system.");
+  }
+  // Releases the memory of the energy backend, e.g., on the GPU.
+  energy_.reset();
+  if (info_.gist.keep) {
+    // The files of cpptraj are closed after run.
+    for (GistGrid &grid : grids_) {
+      grid.febissWaterfile = nullptr;
+      grid.sitesFile = nullptr;
+      grid.residenceFile = nullptr;
+    }
+    queryOutfile_ = nullptr;
+    top_ = nullptr;
+    kept().push_back(std::make_shared<Action_GIGist>(std::move(*this)));
+    mprintf("Kept the grids and samples of gigist for Python.\n");
+  }
+}
+
+/**
+ * Flushes the remaining frames of the accumulators and copies the sums into
+ * the data sets. Normalized values are calculated from the double precision
+ * sums, the data sets only hold the single precision copy.
+ * @param grid: The grid to finish.
+ */
+void Action_GIGist::finishSums(GistGrid &grid) {
+  grid.sums.flush();
+  const std::pair<const char *, SumChannel> sets[]{
+    { "Eww", SUM_EWW }, { "Esw", SUM_ESW }, { "neighbour", SUM_NEIGHBOUR }, { "order", SUM_ORDER },
+    { "dipole_xtemp", SUM_DIPOLE_X }, { "dipole_ytemp", SUM_DIPOLE_Y }, { "dipole_ztemp", SUM_DIPOLE_Z }
+  };
+  for (const auto &set : sets) {
+    DataSet_3D *data{ grid.result.at(dict_.getIndex(set.first)) };
+    for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+      data->UpdateVoxel(voxel, grid.sums.value(voxel, set.second));
+    }
+  }
+}
+
+/**
+ * Output of a grid in densityonly mode: the population and the densities of
+ * the solvent elements relative to the reference density.
+ * @param grid: The grid to process.
+ */
+void Action_GIGist::printDensityGrid(GistGrid &grid) {
+  const SolventSpecies &species = species_.at(grid.species);
+  grid.density.flush();
+  DataSet_3D *population{ grid.result.at(dict_.getIndex("population")) };
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    population->UpdateVoxel(voxel, grid.density.value(voxel, 0));
+    for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+      grid.resultV.at(i).at(voxel) = grid.density.value(voxel, 1 + i) /
+        (info_.system.nFrames * grid.info.voxelVolume * species.rho0 * species.atomCounter.at(i));
+    }
+  }
+
+  openDatafile(grid);
+  grid.datafile->Printf("GIST density output. rho0 = %g, n_frames = %d\n", species.rho0, info_.system.nFrames);
+  grid.datafile->Printf("   voxel        x          y          z         population");
+  for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+    grid.datafile->Printf("  g_%s  ", species.elements.at(i).c_str());
+  }
+  grid.datafile->Printf("\n");
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    Vec3 coords{ coordsFromIndex(grid, voxel) };
+    grid.datafile->Printf("%d %g %g %g %g", voxel, coords[0], coords[1], coords[2], (*population)[voxel]);
+    for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+      grid.datafile->Printf(" %g", grid.resultV.at(i).at(voxel));
+    }
+    grid.datafile->Printf("\n");
+  }
+  closeDatafile(grid);
+  for (int i = 0; i < static_cast<int>( grid.resultV.size() ); ++i) {
+    writeDxFile(grid, "g_" + species.elements.at(i) + grid.suffix + ".dx", grid.resultV.at(i));
+  }
+}
+
+/**
+ * Calculates the entropies and the normalized values of all voxels of a grid
+ * and stores them in its data sets.
+ * @param grid: The grid, once all frames are processed.
+ * @return: The number of concerning neighbours.
+ */
+int Action_GIGist::calcGridValues(GistGrid &grid) {
+  const SolventSpecies &species = species_.at(grid.species);
+  ProgressBar progBarEntropy(grid.info.nVoxels);
 
   
 #ifdef _OPENMP
   int curVox{ 0 };
   
 #endif
-    int concerningNeighbors{ 0 };
-  #pragma omp parallel for
-  for (int voxel = 0; voxel < info_.grid.nVoxels; ++voxel) {
+  int concerningNeighbors{ 0 };
+  // Counts of voxels queried before are replaced by those of the whole grid.
+  grid.nearestNeighborTransFailures = 0;
+  grid.nearestNeighborSixFailures = 0;
+  grid.nearestNeighborTotal = 0;
+  // Voxels with at least splitPopulation samples are calculated first, one
+  // after the other, with their samples split over all threads. Otherwise, a
+  // single crowded voxel keeps one thread busy long after all others finished.
+  std::map<int, VoxelValues> splitValues{};
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    if (grid.result.at(dict_.getIndex("population"))->operator[](voxel) >= info_.gist.splitPopulation) {
+      splitValues[voxel] = progressiveValues(grid, voxel, concerningNeighbors);
+    }
+  }
+  if (info_.gist.progressiveStride > 1) {
+    grid.entropyFraction.assign(grid.info.nVoxels, 1.0);
+  }
+  #pragma omp parallel for schedule(dynamic, 64) reduction(+:concerningNeighbors)
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
     // If _OPENMP is defined, the progress bar has to be updated critically,
     // to ensure the right addition.
 #ifndef _OPENMP
@@ -1046,373 +2207,774 @@ void Action_GIGist::Print() {
     #pragma omp critical
     progBarEntropy.Update( curVox++ );
 #endif
-    double dTSorient_norm   { 0.0 };
-    double dTStrans_norm    { 0.0 };
-    double dTSsix_norm      { 0.0 };
-    double dTSorient_dens   { 0.0 };
-    double dTStrans_dens    { 0.0 };
-    double dTSsix_dens      { 0.0 };
-    double Esw_norm         { 0.0 };
-    double Esw_dens         { 0.0 };
-    double Eww_norm         { 0.0 };
-    double Eww_dens         { 0.0 };
-    double order_norm       { 0.0 };
-    double neighbour_dens   { 0.0 };
-    double neighbour_norm   { 0.0 };
-    // Only calculate if there is actually water molecules at that position.
-    if (result_.at(dict_.getIndex("population"))->operator[](voxel) > 0) {
-      
-      double pop = result_.at(dict_.getIndex("population"))->operator[](voxel);
-      // Used for calcualtion of the Entropy on the GPU
-      #ifdef CUDA_UPDATED
-      dTSorient_norm          = dTSTest.at(1).at(voxel);
-      dTStrans_norm           = dTSTest.at(0).at(voxel);
-      dTSsix_norm             = dTSTest.at(2).at(voxel);
-      dTSorient_dens          = dTSorient_norm * pop / (this->nFrames_ * this->voxelVolume_);
-      dTStrans_dens           = dTStrans_norm * pop / (this->nFrames_ * this->voxelVolume_);
-      dTSsix_dens             = dTSsix_norm * pop / (this->nFrames_ * this->voxelVolume_);
-      #else
-      std::array<double, 2> dTSorient = calcOrientEntropy(voxel);
-      dTSorient_norm          = dTSorient.at(0);
-      dTSorient_dens          = dTSorient.at(1);
-      auto ret = calcTransEntropy(voxel);
-      concerningNeighbors += std::get<1>(ret);
-      std::array<double, 4> dTS = std::move(std::get<0>(ret));
-      dTStrans_norm           = dTS.at(0);
-      dTStrans_dens           = dTS.at(1);
-      dTSsix_norm             = dTS.at(2);
-      dTSsix_dens             = dTS.at(3);
-      #endif
-      
-      Esw_norm = result_.at(dict_.getIndex("Esw"))->operator[](voxel) / pop;
-      Esw_dens = result_.at(dict_.getIndex("Esw"))->operator[](voxel) / (info_.system.nFrames * info_.grid.voxelVolume);
-      Eww_norm = result_.at(dict_.getIndex("Eww"))->operator[](voxel) / pop;
-      Eww_dens = result_.at(dict_.getIndex("Eww"))->operator[](voxel) / (info_.system.nFrames * info_.grid.voxelVolume);
-      order_norm = result_.at(dict_.getIndex("order"))->operator[](voxel) / pop;
-      neighbour_norm = result_.at(dict_.getIndex("neighbour"))->operator[](voxel) / pop;
-      neighbour_dens = result_.at(dict_.getIndex("neighbour"))->operator[](voxel) / (info_.system.nFrames * info_.grid.voxelVolume);
+    auto split = splitValues.find(voxel);
+    VoxelValues values{ split != splitValues.end() ? split->second : progressiveValues(grid, voxel, concerningNeighbors) };
+    addNNFailures(grid, values);
+    if (!grid.entropyFraction.empty()) {
+      grid.entropyFraction[voxel] = values.fraction;
     }
 
-    
     // Calculate the final dipole values. The temporary data grid has to be used, as data
     // already saved cannot be updated.
-    double DPX{ result_.at(dict_.getIndex("dipole_xtemp"))->operator[](voxel) / (DEBYE * info_.system.nFrames * info_.grid.voxelVolume) };
-    double DPY{ result_.at(dict_.getIndex("dipole_ytemp"))->operator[](voxel) / (DEBYE * info_.system.nFrames * info_.grid.voxelVolume) };
-    double DPZ{ result_.at(dict_.getIndex("dipole_ztemp"))->operator[](voxel) / (DEBYE * info_.system.nFrames * info_.grid.voxelVolume) };
+    double DPX{ grid.sums.value(voxel, SUM_DIPOLE_X) / (DEBYE * info_.system.nFrames * grid.info.voxelVolume) };
+    double DPY{ grid.sums.value(voxel, SUM_DIPOLE_Y) / (DEBYE * info_.system.nFrames * grid.info.voxelVolume) };
+    double DPZ{ grid.sums.value(voxel, SUM_DIPOLE_Z) / (DEBYE * info_.system.nFrames * grid.info.voxelVolume) };
     double DPG{ sqrt( DPX * DPX + DPY * DPY + DPZ * DPZ ) };
-    result_.at(dict_.getIndex("dTStrans_norm"))->UpdateVoxel(voxel, dTStrans_norm);
-    result_.at(dict_.getIndex("dTStrans_dens"))->UpdateVoxel(voxel, dTStrans_dens);
-    result_.at(dict_.getIndex("dTSorient_norm"))->UpdateVoxel(voxel, dTSorient_norm);
-    result_.at(dict_.getIndex("dTSorient_dens"))->UpdateVoxel(voxel, dTSorient_dens);
-    result_.at(dict_.getIndex("dTSsix_norm"))->UpdateVoxel(voxel, dTSsix_norm);
-    result_.at(dict_.getIndex("dTSsix_dens"))->UpdateVoxel(voxel, dTSsix_dens);
-    result_.at(dict_.getIndex("order_norm"))->UpdateVoxel(voxel, order_norm);
-    result_.at(dict_.getIndex("neighbour_norm"))->UpdateVoxel(voxel, neighbour_norm);
-    result_.at(dict_.getIndex("neighbour_dens"))->UpdateVoxel(voxel, neighbour_dens);
+    grid.result.at(dict_.getIndex("dTStrans_norm"))->UpdateVoxel(voxel, values.dTStrans_norm);
+    grid.result.at(dict_.getIndex("dTStrans_dens"))->UpdateVoxel(voxel, values.dTStrans_dens);
+    grid.result.at(dict_.getIndex("dTSorient_norm"))->UpdateVoxel(voxel, values.dTSorient_norm);
+    grid.result.at(dict_.getIndex("dTSorient_dens"))->UpdateVoxel(voxel, values.dTSorient_dens);
+    grid.result.at(dict_.getIndex("dTSsix_norm"))->UpdateVoxel(voxel, values.dTSsix_norm);
+    grid.result.at(dict_.getIndex("dTSsix_dens"))->UpdateVoxel(voxel, values.dTSsix_dens);
+    grid.result.at(dict_.getIndex("order_norm"))->UpdateVoxel(voxel, values.order_norm);
+    grid.result.at(dict_.getIndex("neighbour_norm"))->UpdateVoxel(voxel, values.neighbour_norm);
+    grid.result.at(dict_.getIndex("neighbour_dens"))->UpdateVoxel(voxel, values.neighbour_dens);
 
     
-    result_.at(dict_.getIndex("Esw_norm"))->UpdateVoxel(voxel, Esw_norm);
-    result_.at(dict_.getIndex("Esw_dens"))->UpdateVoxel(voxel, Esw_dens);
-    result_.at(dict_.getIndex("Eww_norm"))->UpdateVoxel(voxel, Eww_norm);
-    result_.at(dict_.getIndex("Eww_dens"))->UpdateVoxel(voxel, Eww_dens);
+    grid.result.at(dict_.getIndex("Esw_norm"))->UpdateVoxel(voxel, values.Esw_norm);
+    grid.result.at(dict_.getIndex("Esw_dens"))->UpdateVoxel(voxel, values.Esw_dens);
+    grid.result.at(dict_.getIndex("Eww_norm"))->UpdateVoxel(voxel, values.Eww_norm);
+    grid.result.at(dict_.getIndex("Eww_dens"))->UpdateVoxel(voxel, values.Eww_dens);
     // Maybe there is a better way, I have to look that
-    result_.at(dict_.getIndex("dipole_x"))->UpdateVoxel(voxel, DPX);
-    result_.at(dict_.getIndex("dipole_y"))->UpdateVoxel(voxel, DPY);
-    result_.at(dict_.getIndex("dipole_z"))->UpdateVoxel(voxel, DPZ);
-    result_.at(dict_.getIndex("dipole_g"))->UpdateVoxel(voxel, DPG);
-    for (unsigned int i = 0; i < resultV_.size(); ++i) {
-      resultV_.at(i).at(voxel) /= (info_.system.nFrames * info_.grid.voxelVolume * info_.system.rho0 * solventAtomCounter_.at(i));
+    grid.result.at(dict_.getIndex("dipole_x"))->UpdateVoxel(voxel, DPX);
+    grid.result.at(dict_.getIndex("dipole_y"))->UpdateVoxel(voxel, DPY);
+    grid.result.at(dict_.getIndex("dipole_z"))->UpdateVoxel(voxel, DPZ);
+    grid.result.at(dict_.getIndex("dipole_g"))->UpdateVoxel(voxel, DPG);
+    for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+      grid.resultV.at(i).at(voxel) /= (info_.system.nFrames * grid.info.voxelVolume * species.rho0 * species.atomCounter.at(i));
     }
   }
+  throwIfSamePlace(grid);
+  grid.valuesDone = true;
+  return concerningNeighbors;
+}
+
+/**
+ * Entropy calculation, normalization and output of a single grid.
+ * @param grid: The grid to process.
+ */
+void Action_GIGist::printGrid(GistGrid &grid) {
+  const SolventSpecies &species = species_.at(grid.species);
+  int concerningNeighbors{ calcGridValues(grid) };
 
   if (info_.gist.febiss) {
-    if (info_.gist.centerAtom == "O" && solventAtomCounter_.size() == 2) {
-      placeFebissWaters();
+    if (species.centerAtom == "O" && species.atomCounter.size() == 2) {
+      placeFebissWaters(grid);
     } else {
       mprinterr("Error: FEBISS only works with water as solvent so far.\n");
     }
   }
+  if (grid.sitesFile != nullptr) {
+    findHydrationSites(grid);
+  }
 
   mprintf("Number of possible failures in Nearest-Neighbor search:\n");
   mprintf("Trans: %d (%.1f%); Six: %d (%.1f%); Total searches: %d;\n",
-          info_.gist.nearestNeighborTransFailures,
-          (double) info_.gist.nearestNeighborTransFailures / info_.gist.nearestNeighborTotal * 100.0,
-          info_.gist.nearestNeighborSixFailures,
-          (double) info_.gist.nearestNeighborSixFailures / info_.gist.nearestNeighborTotal * 100.0,
-          info_.gist.nearestNeighborTotal);
+          grid.nearestNeighborTransFailures,
+          (double) grid.nearestNeighborTransFailures / grid.nearestNeighborTotal * 100.0,
+          grid.nearestNeighborSixFailures,
+          (double) grid.nearestNeighborSixFailures / grid.nearestNeighborTotal * 100.0,
+          grid.nearestNeighborTotal);
 
   mprintf("Percent of concerning Neighbors:\n");
   mprintf("%d\n", concerningNeighbors );
+  if (!grid.entropyFraction.empty()) {
+    // Number of voxels per fraction and the share of the full calculation,
+    // which scales with the square of the samples.
+    std::map<double, int> voxelsPerFraction{};
+    double cost{ 0.0 };
+    int occupied{ 0 };
+    for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+      if (grid.result.at(dict_.getIndex("population"))->operator[](voxel) > 0) {
+        ++voxelsPerFraction[grid.entropyFraction[voxel]];
+        cost += grid.entropyFraction[voxel] * grid.entropyFraction[voxel];
+        ++occupied;
+      }
+    }
+    mprintf("Frame fractions of the entropies (occupied voxels):\n");
+    for (const auto &fraction : voxelsPerFraction) {
+      mprintf("  %8.4f: %d\n", fraction.first, fraction.second);
+    }
+    mprintf("Cost of the last subsamples relative to all frames: %.3f\n", occupied > 0 ? cost / occupied : 0.0);
+  }
 
   mprintf("Writing output:\n");
-  this->datafile_->Printf("GIST calculation output. rho0 = %g, n_frames = %d\n", info_.system.rho0, info_.system.nFrames);
-  this->datafile_->Printf("   voxel        x          y          z         population     dTSt_d(kcal/mol)  dTSt_n(kcal/mol)"
+  openDatafile(grid);
+  grid.datafile->Printf("GIST calculation output. rho0 = %g, n_frames = %d\n", species.rho0, info_.system.nFrames);
+  grid.datafile->Printf("   voxel        x          y          z         population     dTSt_d(kcal/mol)  dTSt_n(kcal/mol)"
                           "  dTSo_d(kcal/mol)  dTSo_n(kcal/mol)  dTSs_d(kcal/mol)  dTSs_n(kcal/mol)   "
                           "Esw_d(kcal/mol)   Esw_n(kcal/mol)   Eww_d(kcal/mol)   Eww_n(kcal/mol)    dipoleX    "
                           "dipoleY    dipoleZ    dipole    neighbour_d    neighbour_n    order_n  ");
   // Moved the densities to the back of the output file, so that the energies are always
   // at the same positions.
-  for (unsigned int i = result_.size(); i < dict_.size(); ++i) {
-    datafile_->Printf("  g_%s  ", dict_.getElement(i).c_str());
+  for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+    grid.datafile->Printf("  g_%s  ", species.elements.at(i).c_str());
   }
-  datafile_->Printf("\n");
+  if (!grid.entropyFraction.empty()) {
+    grid.datafile->Printf("  fraction");
+  }
+  grid.datafile->Printf("\n");
 
   // Final output, the DX files are done automatically by cpptraj
   // so only the standard GIST-format is done here
-  ProgressBar progBarIO(info_.grid.nVoxels);
-  for (int voxel = 0; voxel < info_.grid.nVoxels; ++voxel) {
+  ProgressBar progBarIO(grid.info.nVoxels);
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
     progBarIO.Update( voxel );
     size_t i{}, j{}, k{};
-    result_.at(dict_.getIndex("population"))->ReverseIndex(voxel, i, j, k);
-    Vec3 coords{ result_.at(dict_.getIndex("population"))->Bin().Center(i, j, k) };
-    datafile_->Printf("%d %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g", 
+    grid.result.at(dict_.getIndex("population"))->ReverseIndex(voxel, i, j, k);
+    Vec3 coords{ grid.result.at(dict_.getIndex("population"))->Bin().Center(i, j, k) };
+    grid.datafile->Printf("%d %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g", 
                             voxel, coords[0], coords[1], coords[2],
-                            result_.at(dict_.getIndex("population"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTStrans_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTStrans_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTSorient_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTSorient_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTSsix_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dTSsix_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("Esw_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("Esw_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("Eww_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("Eww_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dipole_x"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dipole_y"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dipole_z"))->operator[](voxel),
-                            result_.at(dict_.getIndex("dipole_g"))->operator[](voxel),
-                            result_.at(dict_.getIndex("neighbour_dens"))->operator[](voxel),
-                            result_.at(dict_.getIndex("neighbour_norm"))->operator[](voxel),
-                            result_.at(dict_.getIndex("order_norm"))->operator[](voxel)
+                            grid.result.at(dict_.getIndex("population"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTStrans_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTStrans_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTSorient_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTSorient_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTSsix_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dTSsix_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("Esw_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("Esw_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("Eww_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("Eww_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dipole_x"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dipole_y"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dipole_z"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("dipole_g"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("neighbour_dens"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("neighbour_norm"))->operator[](voxel),
+                            grid.result.at(dict_.getIndex("order_norm"))->operator[](voxel)
                             );
-    for (unsigned int i = 0; i < resultV_.size(); ++i) {
-      datafile_->Printf(" %g", resultV_.at(i).at(voxel));
+    for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+      grid.datafile->Printf(" %g", grid.resultV.at(i).at(voxel));
+    }
+    if (!grid.entropyFraction.empty()) {
+      grid.datafile->Printf(" %g", grid.entropyFraction[voxel]);
     }
-    datafile_->Printf("\n");
+    grid.datafile->Printf("\n");
+  }
+  closeDatafile(grid);
+  if (!grid.entropyFraction.empty()) {
+    writeDxFile(grid, "entropy_fraction" + grid.suffix + ".dx", grid.entropyFraction);
+  }
+  if (!info_.gist.pairFile.empty()) {
+    writePairMatrix(grid);
+  }
+  if (grid.residenceFile != nullptr) {
+    writeResidence(grid);
   }
   // The atom densities of the solvent compared to the reference density.
   if (info_.gist.writeDx) {
-    for (int i = 0; i < static_cast<int>( resultV_.size() ); ++i) {
-      writeDxFile("g_" + dict_.getElement(result_.size() + i) + ".dx", resultV_.at(i));
+    for (int i = 0; i < static_cast<int>( grid.resultV.size() ); ++i) {
+      writeDxFile(grid, "g_" + species.elements.at(i) + grid.suffix + ".dx", grid.resultV.at(i));
     }
   }
+}
+
+/**
+ * Calculates the entropies and normalized energies of a single voxel.
+ * @param grid: The grid the voxel belongs to.
+ * @param voxel: The index of the voxel.
+ * @param concerningNeighbors: Increased by the number of concerning neighbours
+ *                             found in the translational entropy calculation.
+ * @param stride: The entropies use the samples of every stride-th frame.
+ * @return: The values of the voxel, all zero for an empty voxel.
+ */
+Action_GIGist::VoxelValues Action_GIGist::calcVoxelValues(GistGrid &grid, int voxel, int &concerningNeighbors, int stride) {
+  VoxelValues values{};
+  values.population = grid.result.at(dict_.getIndex("population"))->operator[](voxel);
+  // Only calculate if there is actually water molecules at that position.
+  // Nothing is calculated for empty voxels, so no frames are used.
+  if (values.population <= 0) {
+    values.fraction = 0.0;
+    return values;
+  }
+  values.fraction = 1.0 / stride;
+  double pop{ values.population };
+  double norm{ info_.system.nFrames * grid.info.voxelVolume };
+  FrameSubset subset{};
+  subset.stride = stride;
+  concerningNeighbors += calcEntropy(grid, voxel, values, subset);
+
+  values.Esw_norm = grid.sums.value(voxel, SUM_ESW) / pop;
+  values.Esw_dens = grid.sums.value(voxel, SUM_ESW) / norm;
+  values.Eww_norm = grid.sums.value(voxel, SUM_EWW) / pop;
+  values.Eww_dens = grid.sums.value(voxel, SUM_EWW) / norm;
+  values.order_norm = grid.sums.value(voxel, SUM_ORDER) / pop;
+  values.neighbour_norm = grid.sums.value(voxel, SUM_NEIGHBOUR) / pop;
+  values.neighbour_dens = grid.sums.value(voxel, SUM_NEIGHBOUR) / norm;
+  return values;
+}
 
+/**
+ * Calculates the values of a voxel from progressively more frames: starting
+ * with every progressiveStride-th frame, the stride is halved as long as the
+ * voxel needs refinement. Without progressive, all frames are used at once.
+ * @param concerningNeighbors: Increased by the concerning neighbours of the
+ *                             final subsample only.
+ */
+Action_GIGist::VoxelValues Action_GIGist::progressiveValues(GistGrid &grid, int voxel, int &concerningNeighbors) {
+  int stride{ info_.gist.progressiveStride };
+  int levelNeighbors{ 0 };
+  VoxelValues values{ calcVoxelValues(grid, voxel, levelNeighbors, stride) };
+  while (stride > 1 && needsRefinement(grid, voxel, values)) {
+    stride /= 2;
+    levelNeighbors = 0;
+    values = calcVoxelValues(grid, voxel, levelNeighbors, stride);
+  }
+  concerningNeighbors += levelNeighbors;
+  return values;
+}
 
-  mprintf("Timings:\n"
-          " Find Head Atom:   %8.3f\n"
-          " Add up Energy:    %8.3f\n"
-          " Calculate Dipole: %8.3f\n"
-          " Calculate Quat:   %8.3f\n"
-          " Calculate Energy: %8.3f\n\n",
-          tHead_.Total(),
-          tEadd_.Total(),
-          tDipole_.Total(),
-          tRot_.Total(),
-          tEnergy_.Total());
-  if (wrongNumberOfAtoms_)
-  {
-    mprintf("Warning: It seems you are having multiple solvents in your system.");
+/**
+ * A voxel is refined if its entropy is uncertain, if it contributes much to
+ * the free energy or if it is close to the solute. As there is no bulk
+ * reference for Eww, the contribution is estimated as (Esw - TdSsix) of
+ * the voxel, both vanish in the bulk.
+ */
+bool Action_GIGist::needsRefinement(const GistGrid &grid, int voxel, const VoxelValues &values) const {
+  if (values.dTS_error > info_.gist.progressiveError) {
+    return true;
   }
-  #ifdef CUDA
-  freeGPUMemory();
-  #endif
+  if (info_.gist.progressiveDG > 0.0 &&
+      std::abs(values.Esw_dens - values.dTSsix_dens) * grid.info.voxelVolume > info_.gist.progressiveDG) {
+    return true;
+  }
+  return info_.gist.progressiveProximity > 0.0 && grid.proximityFrames > 0 &&
+         grid.proximity[voxel] / grid.proximityFrames < info_.gist.progressiveProximity;
+}
+
+bool Action_GIGist::queryVoxel(int gridIndex, int voxel, VoxelValues &values) {
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() )) {
+    return false;
+  }
+  GistGrid &grid = grids_[gridIndex];
+  if (grid.pending || voxel < 0 || voxel >= grid.info.nVoxels) {
+    return false;
+  }
+  if (grid.valuesDone) {
+    values = storedValues(grid, voxel);
+    return true;
+  }
+  values = grid.queryCache.get(voxel, [&](int v) {
+    int concerningNeighbors{ 0 };
+    VoxelValues calculated{ calcVoxelValues(grid, v, concerningNeighbors) };
+    throwIfSamePlace(grid);
+    addNNFailures(grid, calculated);
+    return calculated;
+  });
+  return true;
 }
 
 /**
- * Calculate the Van der Waals and electrostatic energy.
- * @param r_2: The squared distance between atom 1 and atom 2.
- * @param a1: The first atom.
- * @param a2: The second atom.
- * @return: The interaction energy between the two atoms.
+ * Reads the values of a voxel back from the data sets, once calcGridValues
+ * filled them. The standard error of the entropy is not stored and stays 0.
  */
-double Action_GIGist::calcEnergy(double r_2, int a1, int a2) {
-  r_2 = 1 / r_2;
-  return calcElectrostaticEnergy(r_2, a1, a2) + calcVdWEnergy(r_2, a1, a2);
+Action_GIGist::VoxelValues Action_GIGist::storedValues(const GistGrid &grid, int voxel) const {
+  const auto value = [&](const char *name) -> double {
+    return grid.result.at(dict_.getIndex(name))->operator[](voxel);
+  };
+  VoxelValues values{};
+  values.population = value("population");
+  values.dTStrans_norm = value("dTStrans_norm");
+  values.dTStrans_dens = value("dTStrans_dens");
+  values.dTSorient_norm = value("dTSorient_norm");
+  values.dTSorient_dens = value("dTSorient_dens");
+  values.dTSsix_norm = value("dTSsix_norm");
+  values.dTSsix_dens = value("dTSsix_dens");
+  values.Esw_norm = value("Esw_norm");
+  values.Esw_dens = value("Esw_dens");
+  values.Eww_norm = value("Eww_norm");
+  values.Eww_dens = value("Eww_dens");
+  values.order_norm = value("order_norm");
+  values.neighbour_norm = value("neighbour_norm");
+  values.neighbour_dens = value("neighbour_dens");
+  if (!grid.entropyFraction.empty()) {
+    values.fraction = grid.entropyFraction[voxel];
+  }
+  return values;
+}
+
+bool Action_GIGist::queryPoint(int gridIndex, const Vec3 &point, VoxelValues &values) {
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() ) || grids_[gridIndex].pending) {
+    return false;
+  }
+  const int voxel{ pointVoxel(grids_[gridIndex], {{ point[0], point[1], point[2] }}) };
+  return voxel >= 0 && queryVoxel(gridIndex, voxel, values);
 }
 
 /**
- * Calculate the squared distance between two atoms.
- * @param frm: The frame for which to calculate the distance.
- * @param a1: The first atom for the calculation.
- * @param a2: The second atom for the calculation.
- * @return: The squared distance between the two atoms.
+ * @return: The voxel of the grid containing the point, -1 if there is none.
  */
-double Action_GIGist::calcDistanceSqrd(const ActionFrame &frm, int a1, int a2) {
-    Matrix_3x3 ucell{}, recip{};
-    double dist{ 0.0 };
-    Vec3 vec1{frm.Frm().XYZ(a1)};
-    Vec3 vec2{frm.Frm().XYZ(a2)};
-    switch( image_.ImagingType() ) {
-        case ImageOption::NONORTHO:
-            ucell = frm.Frm().BoxCrd().UnitCell();
-            recip = frm.Frm().BoxCrd().FracCell();
-            dist = DIST2_ImageNonOrtho(vec1, vec2, ucell, recip);
-            break;
-        case ImageOption::ORTHO:
-            dist = DIST2_ImageOrtho(vec1, vec2, frm.Frm().BoxCrd());
-            break;
-        case ImageOption::NO_IMAGE:
-            dist = DIST2_NoImage(vec1, vec2);
-            break;
-        default:
-            throw BoxInfoException();
+int Action_GIGist::pointVoxel(const GistGrid &grid, const std::array<double, 3> &point) const {
+  return VoxelQuery::voxelOf(grid.info.dimensions, {{ grid.info.start[0], grid.info.start[1], grid.info.start[2] }},
+                             grid.info.voxelSize, point);
+}
+
+std::vector<std::shared_ptr<Action_GIGist> > &Action_GIGist::kept() {
+  static std::vector<std::shared_ptr<Action_GIGist> > actions{};
+  return actions;
+}
+
+bool Action_GIGist::gridGeometry(int gridIndex, std::array<int, 3> &dims, std::array<double, 3> &origin,
+                                 double &spacing) const {
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() ) || grids_[gridIndex].pending) {
+    return false;
+  }
+  const GistGrid &grid = grids_[gridIndex];
+  Vec3 griddim{ grid.info.dimensions.data() };
+  Vec3 corner{ grid.info.center - griddim * (0.5 * grid.info.voxelSize) };
+  dims = grid.info.dimensions;
+  origin = {{ corner[0], corner[1], corner[2] }};
+  spacing = grid.info.voxelSize;
+  return true;
+}
+
+std::vector<std::string> Action_GIGist::arrayNames(int gridIndex) const {
+  std::vector<std::string> names{};
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() ) || grids_[gridIndex].pending) {
+    return names;
+  }
+  const GistGrid &grid = grids_[gridIndex];
+  for (unsigned int i = 0; i < dict_.size(); ++i) {
+    names.push_back(dict_.getElement(i));
+  }
+  for (const std::string &element : species_.at(grid.species).elements) {
+    names.push_back("g_" + element);
+  }
+  if (grid.samplesFrozen) {
+    for (const char *name : { "rotor_center", "rotor_quaternion", "rotor_frame", "rotor_start", "rotor_end",
+                              "point_center", "point_frame", "point_start", "point_end" }) {
+      names.push_back(name);
+    }
+  }
+  if (!grid.febissSites.empty()) {
+    names.push_back("febiss");
+  }
+  if (!grid.entropyFraction.empty()) {
+    names.push_back("entropy_fraction");
+  }
+  for (const auto &errors : grid.bootstrapErrors) {
+    names.push_back("se_" + errors.first);
+  }
+  return names;
+}
+
+bool Action_GIGist::array(int gridIndex, const std::string &name, ArrayView &view) const {
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() ) || grids_[gridIndex].pending) {
+    return false;
+  }
+  const GistGrid &grid = grids_[gridIndex];
+  const std::vector<std::size_t> shape{ static_cast<std::size_t>( grid.info.dimensions[0] ),
+                                        static_cast<std::size_t>( grid.info.dimensions[1] ),
+                                        static_cast<std::size_t>( grid.info.dimensions[2] ) };
+  const int set{ dict_.getIndex(name) };
+  if (set != -1) {
+    // GRID_FLT data sets store the voxels contiguously in dx order.
+    DataSet_GridFlt *data{ static_cast<DataSet_GridFlt *>( grid.result.at(set) ) };
+    view = ArrayView::contiguous(&(*data)[0], shape);
+    return true;
+  }
+  const SolventSpecies &species = species_.at(grid.species);
+  if (name.compare(0, 2, "g_") == 0) {
+    int element{ species.elementIndex(name.substr(2)) };
+    if (element == -1) {
+      return false;
+    }
+    view = ArrayView::contiguous(grid.resultV.at(element).data(), shape);
+    return true;
+  }
+  if (name == "febiss" && !grid.febissSites.empty()) {
+    view = ArrayView::contiguous(grid.febissSites.data(), { grid.febissSites.size() / 10, 10 });
+    return true;
+  }
+  if (name == "entropy_fraction" && !grid.entropyFraction.empty()) {
+    view = ArrayView::contiguous(grid.entropyFraction.data(), shape);
+    return true;
+  }
+  if (name.compare(0, 3, "se_") == 0) {
+    auto errors = grid.bootstrapErrors.find(name.substr(3));
+    if (errors == grid.bootstrapErrors.end()) {
+      return false;
     }
-    return dist;
+    view = ArrayView::contiguous(errors->second.data(), shape);
+    return true;
+  }
+  if (!grid.samplesFrozen) {
+    return false;
+  }
+  // The samples, stored as records of the LinkedCellGrid, voxel by voxel.
+  using Rotor = std::pair<int, VecAndQuat>;
+  using Point = std::pair<int, VecAndFrame>;
+  static_assert(sizeof(Quaternion<DOUBLE_O_FLOAT>) == 4 * sizeof(DOUBLE_O_FLOAT), "Quaternion is not packed");
+  const std::size_t nRotors{ grid.centersAndRotations.getTotalDataSize() };
+  const std::size_t nPoints{ grid.points.getTotalDataSize() };
+  const std::size_t nVoxels{ static_cast<std::size_t>( grid.info.nVoxels ) };
+  if (name == "rotor_center") {
+    view = ArrayView::field<double>(grid.centersAndRotations.data(), nRotors,
+                                    [](const Rotor &r) { return std::get<0>(r.second).Dptr(); }, 3);
+  } else if (name == "rotor_quaternion") {
+    view = ArrayView::field<DOUBLE_O_FLOAT>(grid.centersAndRotations.data(), nRotors,
+                                            [](const Rotor &r) { return &std::get<1>(r.second)[0]; }, 4);
+  } else if (name == "rotor_frame") {
+    view = ArrayView::field<int>(grid.centersAndRotations.data(), nRotors,
+                                 [](const Rotor &r) { return &std::get<2>(r.second); });
+  } else if (name == "rotor_start") {
+    view = ArrayView::contiguous(grid.centersAndRotations.startIndices().data(), { nVoxels });
+  } else if (name == "rotor_end") {
+    view = ArrayView::contiguous(grid.centersAndRotations.endIndices().data(), { nVoxels });
+  } else if (name == "point_center") {
+    view = ArrayView::field<double>(grid.points.data(), nPoints, [](const Point &p) { return p.second.first.Dptr(); }, 3);
+  } else if (name == "point_frame") {
+    view = ArrayView::field<int>(grid.points.data(), nPoints, [](const Point &p) { return &p.second.second; });
+  } else if (name == "point_start") {
+    view = ArrayView::contiguous(grid.points.startIndices().data(), { nVoxels });
+  } else if (name == "point_end") {
+    view = ArrayView::contiguous(grid.points.endIndices().data(), { nVoxels });
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool Action_GIGist::calculateEntropy(int gridIndex) {
+  if (gridIndex < 0 || gridIndex >= static_cast<int>( grids_.size() ) || info_.gist.densityOnly) {
+    return false;
+  }
+  GistGrid &grid = grids_[gridIndex];
+  if (!grid.samplesFrozen) {
+    return false;
+  }
+  if (!grid.valuesDone) {
+    calcGridValues(grid);
+  }
+  return true;
+}
+
+bool Action_GIGist::placeFebiss(int gridIndex) {
+  if (!info_.gist.febiss || !calculateEntropy(gridIndex)) {
+    return false;
+  }
+  GistGrid &grid = grids_[gridIndex];
+  const SolventSpecies &species = species_.at(grid.species);
+  if (species.centerAtom != "O" || species.atomCounter.size() != 2) {
+    mprinterr("Error: FEBISS only works with water as solvent so far.\n");
+    return false;
+  }
+  if (grid.febissSites.empty()) {
+    placeFebissWaters(grid);
+  }
+  return true;
 }
 
 /**
- * Calculate the electrostatic energy between two atoms, as
- * follows from:
- * E(el) = q1 * q2 / r
- * @param r_2_i: The inverse of the squared distance between the atoms.
- * @param a1: The atom index of atom 1.
- * @param a2: The atom index of atom 2.
- * @return: The electrostatic energy.
+ * Reads the query file. Every line holds either a voxel index or the x, y
+ * and z coordinates of a point, empty lines and lines starting with # are
+ * skipped.
+ * @return: false if the file cannot be read or contains a malformed line.
  */
-double Action_GIGist::calcElectrostaticEnergy(double r_2_i, int a1, int a2) {
-    //double q1 = top_->operator[](a1).Charge();
-    //double q2 = top_->operator[](a2).Charge();
-    double q1{ charges_.at(a1) };
-    double q2{ charges_.at(a2) };
-    return q1 * Constants::ELECTOAMBER * q2 * Constants::ELECTOAMBER * sqrt(r_2_i);
+bool Action_GIGist::readQueryFile() {
+  std::ifstream file(info_.gist.queryFile);
+  if (!file) {
+    mprinterr("Error: Could not open query file '%s'.\n", info_.gist.queryFile.c_str());
+    return false;
+  }
+  int badLine{ 0 };
+  if (!VoxelQuery::read(file, queryEntries_, badLine)) {
+    mprinterr("Error: Line %d of '%s' is neither a voxel index nor x y z coordinates.\n",
+              badLine, info_.gist.queryFile.c_str());
+    return false;
+  }
+  mprintf("Read %d query entries from %s.\n", static_cast<int>( queryEntries_.size() ), info_.gist.queryFile.c_str());
+  return true;
 }
 
 /**
- * Calculate the van der Waals interaction energy between
- * two different atoms, as follows:
- * E(vdw) = A / (r ** 12) - B / (r ** 6)
- * Be aware that the inverse is used, as to calculate faster.
- * @param r_2_i: The inverse of the squared distance between the two atoms.
- * @param a1: The atom index of atom1.
- * @param a2: The atom index of atom2.
- * @return: The VdW interaction energy.
+ * Writes the values of all voxels of the query file, for every grid.
  */
-double Action_GIGist::calcVdWEnergy(double r_2_i, int a1, int a2) {
-    // Attention, both r_6 and r_12 are actually inverted. This is very ok, and makes the calculation faster.
-    // However, it is not noted, thus it could be missleading
-    double r_6{ r_2_i * r_2_i * r_2_i };
-    double r_12{ r_6 * r_6 };
-    NonbondType const &params = top_->GetLJparam(a1, a2);
-    return params.A() * r_12 - params.B() * r_6;
+void Action_GIGist::writeQuery() {
+  queryOutfile_->Printf("# grid  voxel        x          y          z         population     dTSt_n(kcal/mol)"
+                        "  dTSo_n(kcal/mol)  dTSs_n(kcal/mol)   Esw_n(kcal/mol)   Eww_n(kcal/mol)"
+                        "  dTSt_d(kcal/mol)  dTSo_d(kcal/mol)  dTSs_d(kcal/mol)   Esw_d(kcal/mol)   Eww_d(kcal/mol)"
+                        "    neighbour_n    order_n\n");
+  int outside{ 0 };
+  for (int g = 0; g < static_cast<int>( grids_.size() ); ++g) {
+    const DataSet_3D *population{ grids_[g].result.at(dict_.getIndex("population")) };
+    for (const VoxelQuery::Entry &entry : queryEntries_) {
+      const int voxel{ entry.voxel >= 0 ? entry.voxel : pointVoxel(grids_[g], entry.point) };
+      VoxelValues values{};
+      if (!queryVoxel(g, voxel, values)) {
+        ++outside;
+        continue;
+      }
+      size_t i{}, j{}, k{};
+      population->ReverseIndex(voxel, i, j, k);
+      Vec3 coords{ population->Bin().Center(i, j, k) };
+      queryOutfile_->Printf("%d %d %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g\n",
+                            g, voxel, coords[0], coords[1], coords[2], values.population,
+                            values.dTStrans_norm, values.dTSorient_norm, values.dTSsix_norm,
+                            values.Esw_norm, values.Eww_norm,
+                            values.dTStrans_dens, values.dTSorient_dens, values.dTSsix_dens,
+                            values.Esw_dens, values.Eww_dens,
+                            values.neighbour_norm, values.order_norm);
+    }
+  }
+  if (outside > 0) {
+    mprintf("Warning: %d query entries are not on a grid and were skipped.\n", outside);
+  }
 }
 
 /**
- * Calculate the orientational entropy of the water atoms
- * in a given voxel.
+ * Calculates the orientational, translational and six dimensional entropy of
+ * a voxel in a single pass over its samples. The samples of the same voxel
+ * are candidates for all three nearest neighbours, so every candidate is
+ * loaded once and its quaternion distance is shared by the orientational and
+ * six dimensional neighbour. Only the six dimensional search continues into
+ * the surrounding layers of voxels. Rotors and point particles (ions) are
+ * stored separately, the orientational and six dimensional entropy only use
+ * rotors, the translational entropy uses both. The translational and six
+ * dimensional entropy are zero for voxels at the border of the grid.
+ * @param grid: The grid the voxel belongs to.
  * @param voxel: The index of the voxel.
- * @return: The entropy of the water molecules in that voxel.
+ * @param values: The dTS values and the nearest neighbour counts are set.
+ * @param subset: Only the samples of these frames are used, for themselves
+ *                and as neighbours, weighted by the weight of their frame.
+ *                The values per molecule are those of the subset. The
+ *                densities of a stride are scaled to all molecules of the
+ *                voxel, those of drawn blocks to the frames drawn.
+ * @return: The number of concerning neighbours.
  */
-std::array<double, 2> Action_GIGist::calcOrientEntropy(int voxel) {
-  std::array<double, 2> ret{};
-  int nwtotal = this->result_.at(this->dict_.getIndex("population"))->operator[](voxel);
-  if(nwtotal < 2) {
-    return ret;
+int Action_GIGist::calcEntropy(GistGrid &grid, int voxel, VoxelValues &values, const FrameSubset &subset) {
+  const int nwtotal = grid.result.at(dict_.getIndex("population"))->operator[](voxel);
+  const bool border{ voxelIsAtGridBorder(grid, voxel) };
+  const double rho0{ species_.at(grid.species).rho0 };
+  std::vector<const VecAndQuat *> rotors{};
+  std::vector<const VecAndFrame *> points{};
+  voxelSamples(grid, voxel, rotors, points, subset);
+  const int nRotors{ static_cast<int>( rotors.size() ) };
+  const int nSamples{ nRotors + static_cast<int>( points.size() ) };
+  // Weights of the samples and the weighted number of molecules.
+  std::vector<int> weights(nSamples);
+  int wRotors{ 0 };
+  int wSamples{ 0 };
+  for (int i = 0; i < nSamples; ++i) {
+    weights[i] = subset.weight(i < nRotors ? std::get<2>(*rotors[i]) : points[i - nRotors]->second);
+    wSamples += weights[i];
+    if (i < nRotors) {
+      wRotors += weights[i];
+    }
+  }
+  // Frames the neighbours are searched in, molecules the entropies are
+  // averaged over and the factor scaling the molecules of the subset to all
+  // frames.
+  const int nFrames{ subset.distinctFrames(info_.system.nFrames) };
+  const int nTrans{ subset.all() ? nwtotal : wSamples };
+  double densityScale{ 1.0 };
+  if (!subset.blockWeights.empty()) {
+    densityScale = static_cast<double>(info_.system.nFrames) / std::max(1, subset.weightedFrames(info_.system.nFrames));
+  } else if (subset.stride > 1 && nRotors > 0) {
+    int allRotors{ 0 };
+    auto cell = grid.centersAndRotations.at(voxel);
+    for (auto quat = cell.begin(); quat != cell.end(); ++quat) {
+      ++allRotors;
+    }
+    densityScale = static_cast<double>(allRotors) / nRotors;
   }
-  double dTSo_n{ 0.0 };
-  int water_count{ 0 };
-  for (const VecAndQuat& quat : centersAndRotations_.at(voxel)) {
+  // The log terms of every sample, summed in order afterwards, so that the
+  // result is the same with and without splitting the voxel over threads.
+  std::vector<double> orientTerms(nRotors, 0.0);
+  std::vector<char> orientFound(nRotors, 0);
+  std::vector<double> transTerms(nSamples, 0.0);
+  std::vector<double> sixTerms(nRotors, 0.0);
+  int concerningNeighbors{ 0 };
+  int transFailures{ 0 };
+  int sixFailures{ 0 };
+  int searches{ 0 };
+  // dTStrans uses all solvents, dTSsix does not use ions.
+  const int nw_six{ wRotors };
+  bool samePlace{ false };
+  #pragma omp parallel for schedule(dynamic, 16) reduction(+:concerningNeighbors, transFailures, sixFailures, searches) reduction(||:samePlace) if(nwtotal >= info_.gist.splitPopulation)
+  for (int i = 0; i < nSamples; ++i) {
+    if (i >= nRotors) {
+      if (border) {
+        continue;
+      }
+      double NNd{ pointNearestNeighbor(grid, *points[i - nRotors], voxel, subset) };
+      if (NNd <= 0) {
+        samePlace = true;
+        continue;
+      }
+      // There is no six dimensional neighbour to count as a failure.
+      updateNNFailureCount(grid, NNd, 0.0, transFailures, sixFailures);
+      ++searches;
+      if (NNd < HUGE) {
+        transTerms[i] = log(std::pow(NNd, 1.5) * nFrames * 4 * Constants::PI * rho0 / 3.0);
+      }
+      continue;
+    }
+    const VecAndQuat &quat = *rotors[i];
     double NNr{ HUGE };
-    for (const VecAndQuat& quat2 : centersAndRotations_.at(voxel)) {
-      if (&quat == &quat2) {
+    double NNd{ HUGE };
+    double NNs{ HUGE };
+    int nnFrame{ 0 };
+    for (int j = 0; j < nRotors; ++j) {
+      if (i == j) {
         continue;
       }
-
-      if ( std::get<1>(quat).initialized() && std::get<1>(quat2).initialized() )
-      {
-         double rR{ std::get<1>(quat).distance(std::get<1>(quat2)) };
-         if ( (rR < NNr) ) {
-           NNr = rR;
-         }
-       }
+      const VecAndQuat &quat2 = *rotors[j];
+      double rR{ std::get<1>(quat).distance(std::get<1>(quat2)) };
+      double dd{ (std::get<0>(quat) - std::get<0>(quat2)).Magnitude2() };
+      if (rR < NNr) {
+        NNr = rR;
+      }
+      if (dd < NNd) {
+        NNd = dd;
+      }
+      double ds{ rR * rR + dd };
+      if (ds < NNs) {
+        NNs = ds;
+        nnFrame = std::get<2>(quat2);
+      }
     }
     if (NNr < HUGE) {
-      ++water_count;
+      orientFound[i] = 1;
       /* dTSo_n += log(NNr * NNr * NNr / (3.0 * Constants::TWOPI)); */
-      dTSo_n += log((NNr - sin(NNr)) / Constants::PI);
+      orientTerms[i] = log((NNr - sin(NNr)) / Constants::PI);
+    }
+    if (border) {
+      continue;
+    }
+
+    for (const VecAndFrame *point : points) {
+      NNd = std::min(NNd, (std::get<0>(quat) - point->first).Magnitude2());
+    }
+    int frameDistance{ std::abs(nnFrame - std::get<2>(quat)) };
+    if (NNs > 0) {
+      // Not found in the voxel itself, continue with the surrounding layers.
+      std::tuple<double, double, int> distances{ sixEntropyNearestNeighbor( grid, quat, voxel, 1, NNd, NNs, subset ) };
+      NNd = std::get<0>( distances );
+      NNs = std::get<1>( distances );
+      frameDistance = std::get<2>( distances );
+    }
+    if ( std::abs( frameDistance ) <= 3 ) {
+        concerningNeighbors++;
+    }
+    NNd = sqrt(NNd);
+    if (NNd <= 0) {
+        // Exceptions must not leave a parallel region, see throwIfSamePlace.
+        samePlace = true;
+        continue;
+    }
+    updateNNFailureCount(grid, NNd*NNd, NNs, transFailures, sixFailures);
+    ++searches;
+    if (NNd < HUGE){
+      // For both, the number of frames is used as the number of measurements.
+      // The third power of NNd has to be taken, since NNd is only power 1.
+      transTerms[i] = log(NNd * NNd * NNd * nFrames * 4 * Constants::PI * rho0 / 3.0);
+      // NNs is used to the power of 6, since it is already power of 2, only the third power
+      // has to be calculated.
+      double sixVol = NNs * NNs * NNs * nFrames * Constants::PI * rho0 / 48.0;
+      sixVol /= sixVolumeCorrFactor(NNs);
+      sixTerms[i] = log(sixVol);
     }
   }
-  dTSo_n += water_count * log(water_count);
-  dTSo_n = Constants::GASK_KCAL * info_.system.temperature * (dTSo_n / water_count + Constants::EULER_MASC);
-  ret.at(0) = dTSo_n;
-  ret.at(1) = dTSo_n * water_count / (info_.system.nFrames * info_.grid.voxelVolume);
-  return ret;
+  if (samePlace) {
+    #pragma omp atomic
+    ++grid.samePlaceVoxels;
+  }
+  values.nnSearches = searches;
+  values.nnTransFailures = transFailures;
+  values.nnSixFailures = sixFailures;
+
+  double norm{ info_.system.nFrames * grid.info.voxelVolume };
+  if (nwtotal >= 2) {
+    double dTSo_n{ 0.0 };
+    int water_count{ 0 };
+    int wWater{ 0 };
+    for (int i = 0; i < nRotors; ++i) {
+      if (orientFound[i]) {
+        ++water_count;
+        wWater += weights[i];
+        dTSo_n += weights[i] * orientTerms[i];
+      }
+    }
+    // Without rotors in the subset, e.g., a voxel of ions.
+    if (wWater > 0) {
+      dTSo_n += wWater * log(water_count);
+      dTSo_n = Constants::GASK_KCAL * info_.system.temperature * (dTSo_n / wWater + Constants::EULER_MASC);
+      values.dTSorient_norm = dTSo_n;
+      values.dTSorient_dens = dTSo_n * wWater * densityScale / norm;
+    }
+  }
+  double trans{ 0.0 };
+  double six{ 0.0 };
+  for (int i = 0; i < nSamples; ++i) {
+    trans += weights[i] * transTerms[i];
+  }
+  for (int i = 0; i < nRotors; ++i) {
+    six += weights[i] * sixTerms[i];
+  }
+  if (trans != 0) {
+    values.dTStrans_norm = Constants::GASK_KCAL * info_.system.temperature * (trans / nTrans + Constants::EULER_MASC);
+    values.dTStrans_dens = values.dTStrans_norm * (subset.blockWeights.empty() ? nwtotal : wSamples * densityScale) / norm;
+  }
+  if (six != 0) {
+    values.dTSsix_norm = Constants::GASK_KCAL * info_.system.temperature * (six / nw_six + Constants::EULER_MASC);
+    values.dTSsix_dens = values.dTSsix_norm * nw_six * densityScale / norm;
+  }
+  // The spread of the log terms of the molecules gives the standard error of
+  // their mean, i.e., of the entropy per molecule.
+  const std::vector<double> &terms{ six != 0 ? sixTerms : transTerms };
+  if (six != 0 || trans != 0) {
+    double sum{ 0.0 };
+    double sumSquares{ 0.0 };
+    int n{ 0 };
+    for (double term : terms) {
+      if (term != 0) {
+        sum += term;
+        sumSquares += term * term;
+        ++n;
+      }
+    }
+    if (n < 2) {
+      values.dTS_error = HUGE;
+    } else {
+      const double variance{ std::max(0.0, (sumSquares - sum * sum / n) / (n - 1)) };
+      values.dTS_error = Constants::GASK_KCAL * info_.system.temperature * sqrt(variance / n);
+    }
+  } else if (nwtotal > 0 && !border) {
+    values.dTS_error = HUGE;
+  }
+  return concerningNeighbors;
 }
 
 /**
- * Calculate the translational entropy.
- * @param voxel: The voxel for which to calculate the translational entropy.
- * @return: A vector type object, holding the values for the translational
- *          entropy, as well as the six integral entropy.
+ * Collects pointers to the rotors and point particles of a voxel, in the
+ * order they were added, only of the frames in subset.
  */
-std::pair<std::array<double, 4>, int> Action_GIGist::calcTransEntropy(int voxel) {
-  // Will hold dTStrans (norm, dens) and dTSsix (norm, dens)
-  std::array<double, 4> ret{};
-  if ( voxelIsAtGridBorder(voxel) ) {
-    return { ret, 0 };
-  }
-  int concerningNeighbors{ 0 };
-  // dTStrans uses all solvents => use nwtotal
-  // dTSsix does not use ions => count separately
-  int nwtotal = (*this->result_.at(this->dict_.getIndex("population")))[voxel];
-  int nw_six{ 0 };
-  for (const VecAndQuat& quat : centersAndRotations_.at(voxel)) {
-    if ( std::get<1>(quat).initialized() ) {
-        // the current molecule has rotational degrees of freedom, i.e., it's not an ion.
-        ++nw_six;
-    }
-    std::tuple<double, double, int> distances{ sixEntropyNearestNeighbor( quat, voxel, 0 ) };
-    double NNd = std::get<0>( distances );
-    double NNs = std::get<1>( distances );
-    if ( std::abs( std::get<2>( distances ) ) <= 3 ) {
-        concerningNeighbors++;
-    }
-    /* if ( std::abs( std::get<2>(distances) ) == 0 ) { */
-    /*     mprintf("Something might be wrong!\n"); */
-    /* } */
-    NNd = sqrt(NNd);
-    if (NNd <= 0) {
-        throw "Error: 2 molecules seem to be at the same place";
-    }
-    updateNNFailureCount(NNd*NNd, NNs);
-    if (NNd < HUGE){
-      // For both, the number of frames is used as the number of measurements.
-      // The third power of NNd has to be taken, since NNd is only power 1.
-      ret.at(0) += log(NNd * NNd * NNd * info_.system.nFrames * 4 * Constants::PI * info_.system.rho0 / 3.0);
-      // NNs is used to the power of 6, since it is already power of 2, only the third power
-      // has to be calculated.
-      if ( std::get<1>(quat).initialized() ) {
-        double sixVol = NNs * NNs * NNs * info_.system.nFrames * Constants::PI * info_.system.rho0 / 48.0;
-        sixVol /= sixVolumeCorrFactor(NNs);
-        ret.at(2) += log(sixVol);
-      }
+void Action_GIGist::voxelSamples(GistGrid &grid, int voxel, std::vector<const VecAndQuat *> &rotors, std::vector<const VecAndFrame *> &points, const FrameSubset &subset) {
+  for (const VecAndQuat &quat : grid.centersAndRotations.at(voxel)) {
+    if (subset.weight(std::get<2>(quat)) > 0) {
+      rotors.push_back(&quat);
     }
   }
-  if (ret.at(0) != 0) {
-    double dTSt_n{ Constants::GASK_KCAL * info_.system.temperature * (ret.at(0) / nwtotal + Constants::EULER_MASC) };
-    ret.at(0) = dTSt_n;
-    ret.at(1) = dTSt_n * nwtotal / (info_.system.nFrames * info_.grid.voxelVolume);
-  }
-  if (ret.at(2) != 0) {
-    double dTSs_n{ Constants::GASK_KCAL * info_.system.temperature * (ret.at(2) / nw_six + Constants::EULER_MASC) };
-    ret.at(2) = dTSs_n;
-    ret.at(3) = dTSs_n * nw_six / (info_.system.nFrames * info_.grid.voxelVolume);
+  for (const VecAndFrame &point : grid.points.at(voxel)) {
+    if (subset.weight(point.second) > 0) {
+      points.push_back(&point);
+    }
   }
-  return { ret, concerningNeighbors };
 }
 
 
-std::tuple<double, double, int> Action_GIGist::sixEntropyNearestNeighbor(
-    const VecAndQuat& quat,
-    int voxel,
-    int n_layers,
-    double NNd,
-    double NNs)
+/**
+ * Calls func for every voxel of a layer around a voxel, i.e., all voxels on
+ * the grid whose largest index distance to the voxel is n_layers.
+ */
+template<class Func>
+void Action_GIGist::forLayerVoxels(const GistGrid &grid, int voxel, int n_layers, Func func) const
 {
-  const std::array<int, 3> griddims{ info_.grid.dimensions };
+  const std::array<int, 3> griddims{ grid.info.dimensions };
   const std::array<int, 3> step{ griddims[2] * griddims[1], griddims[2], 1 };
-  const std::array<int, 3> xyz{ getVoxelVec(voxel) };
-  std::pair<int, int> nnFrames;
+  const std::array<int, 3> xyz{ getVoxelVec(grid, voxel) };
   for (int x = xyz[0] - n_layers; x <= xyz[0] + n_layers; ++x) {
     if ( x < 0 || x >= griddims[0] ) { continue; }
     bool x_is_border{ x == xyz[0] - n_layers || x == xyz[0] + n_layers };
@@ -1423,20 +2985,65 @@ std::tuple<double, double, int> Action_GIGist::sixEntropyNearestNeighbor(
         if ( z < 0 || z >= griddims[2] ) { continue; }
         bool z_is_border{ z == xyz[2] - n_layers || z == xyz[2] + n_layers };
         if ( !(x_is_border || y_is_border || z_is_border) ) { continue; }
-        int voxel2{ x * step[0] + y * step[1] + z * step[2] };
-        nnFrames = calcTransEntropyDist(voxel2, quat, NNd, NNs);
+        func(x * step[0] + y * step[1] + z * step[2]);
       }
     }
   }
-  double save_dist{ info_.grid.voxelSize * n_layers };
+}
+
+std::tuple<double, double, int> Action_GIGist::sixEntropyNearestNeighbor(
+    GistGrid& grid,
+    const VecAndQuat& quat,
+    int voxel,
+    int n_layers,
+    double NNd,
+    double NNs,
+    const FrameSubset &subset)
+{
+  std::pair<int, int> nnFrames;
+  forLayerVoxels(grid, voxel, n_layers, [&](int voxel2) {
+    nnFrames = calcTransEntropyDist(grid, voxel2, quat, NNd, NNs, subset);
+  });
+  double save_dist{ grid.info.voxelSize * n_layers };
   save_dist *= save_dist;
-  if (std::get<1>(quat).initialized() && NNs > save_dist) {
-    return sixEntropyNearestNeighbor(quat, voxel, n_layers + 1, NNd, NNs);
+  if (NNs > save_dist) {
+    return sixEntropyNearestNeighbor(grid, quat, voxel, n_layers + 1, NNd, NNs, subset);
   }
   int dist = std::abs(nnFrames.second - nnFrames.first);
   return {NNd, NNs, dist};
 }
 
+/**
+ * Translational nearest neighbour of a point particle, among the rotors and
+ * point particles. The layers around the voxel are searched until no closer
+ * neighbour can be found.
+ * @return: The squared distance, HUGE if there is no other sample.
+ */
+double Action_GIGist::pointNearestNeighbor(GistGrid &grid, const VecAndFrame &point, int voxel, const FrameSubset &subset)
+{
+  double NNd{ HUGE };
+  const int maxLayers{ *std::max_element(grid.info.dimensions.begin(), grid.info.dimensions.end()) };
+  for (int n_layers = 0; n_layers <= maxLayers; ++n_layers) {
+    forLayerVoxels(grid, voxel, n_layers, [&](int voxel2) {
+      for (const VecAndQuat &quat2 : grid.centersAndRotations.at(voxel2)) {
+        if (subset.weight(std::get<2>(quat2)) > 0) {
+          NNd = std::min(NNd, (point.first - std::get<0>(quat2)).Magnitude2());
+        }
+      }
+      for (const VecAndFrame &point2 : grid.points.at(voxel2)) {
+        if (&point != &point2 && subset.weight(point2.second) > 0) {
+          NNd = std::min(NNd, (point.first - point2.first).Magnitude2());
+        }
+      }
+    });
+    double save_dist{ grid.info.voxelSize * n_layers };
+    if (NNd <= save_dist * save_dist) {
+      break;
+    }
+  }
+  return NNd;
+}
+
 double Action_GIGist::sixVolumeCorrFactor(double NNs) const
 {
     double dbl_index = NNs / SIX_CORR_SPACING;
@@ -1448,24 +3055,23 @@ double Action_GIGist::sixVolumeCorrFactor(double NNs) const
     return interp;
 }
 
-std::array<int, 3> Action_GIGist::getVoxelVec(int voxel) const
+std::array<int, 3> Action_GIGist::getVoxelVec(const GistGrid &grid, int voxel) const
 {
   return {
-    voxel / ( info_.grid.dimensions[2] * info_.grid.dimensions[1] ),
-    (voxel / info_.grid.dimensions[2] ) % info_.grid.dimensions[1],
-    voxel % info_.grid.dimensions[2],
+    voxel / ( grid.info.dimensions[2] * grid.info.dimensions[1] ),
+    (voxel / grid.info.dimensions[2] ) % grid.info.dimensions[1],
+    voxel % grid.info.dimensions[2],
   };
 }
 
-bool Action_GIGist::voxelIsAtGridBorder(int voxel) const
+/**
+ * A voxel is at the border if it is on the faces of the grid or, on a
+ * refinement grid, next to a voxel outside of the refined cells, as no
+ * samples are binned there.
+ */
+bool Action_GIGist::voxelIsAtGridBorder(const GistGrid &grid, int voxel) const
 {
-  std::array<int, 3> xyz{ getVoxelVec(voxel) };
-  std::array<int, 3> dim{ info_.grid.dimensions };
-  return ( !(
-     xyz[0] > 0 && xyz[0] < dim[0] - 1 &&
-     xyz[1] > 0 && xyz[1] < dim[1] - 1 &&
-     xyz[2] > 0 && xyz[2] < dim[2] - 1
-  ) );
+  return AdaptiveOctree::atBorder(grid.info.dimensions, grid.activeVoxels, voxel);
 }
 
 /**
@@ -1478,53 +3084,84 @@ bool Action_GIGist::voxelIsAtGridBorder(int voxel) const
  *                is smaller, saves it here.
  * @param NNs: The lowest distance in angular space. If the calculated
  *                one is smaller, saves it here.
+ * @param subset: Only samples of these frames are neighbours.
  */
-std::pair<int, int> Action_GIGist::calcTransEntropyDist(int voxel2, const VecAndQuat& quat, double &NNd, double &NNs)
+std::pair<int, int> Action_GIGist::calcTransEntropyDist(GistGrid &grid, int voxel2, const VecAndQuat& quat, double &NNd, double &NNs, const FrameSubset &subset)
 {
   std::pair<int, int> frames{ std::get<2>(quat), 0 };
-  for (const VecAndQuat& quat2 : centersAndRotations_.at(voxel2)) {
-    if (&quat == &quat2){
+  // Only rotors are stored here, no need to check for ions.
+  for (const VecAndQuat& quat2 : grid.centersAndRotations.at(voxel2)) {
+    if (&quat == &quat2 || subset.weight(std::get<2>(quat2)) == 0){
       continue;
     }
-    /* double dd{ (std::get<0>(quat) - std::get<0>(quat2)).Magnitude2() }; */
-    /* if (dd < NNd) { */
-      /* NNd = dd; */
-    /* } */
-    if (std::get<1>(quat).initialized() && std::get<1>(quat2).initialized())
-    {
-      double dd{ (std::get<0>(quat) - std::get<0>(quat2)).Magnitude2() };
-      if (dd < NNd) {
+    double dd{ (std::get<0>(quat) - std::get<0>(quat2)).Magnitude2() };
+    if (dd < NNd) {
       NNd = dd;
+    }
+    if (dd < NNs) {
+      double rR{ std::get<1>( quat ).distance( std::get<1>(quat2) ) };
+      double ds{ rR * rR + dd };
+      if (ds < NNs) {
+          NNs = ds;
+          frames.second = std::get<2>( quat2 );
       }
-      if (dd < NNs) {
-        double rR{ std::get<1>( quat ).distance( std::get<1>(quat2) ) };
-        double ds{ rR * rR + dd };
-        if (ds < NNs) {
-            NNs = ds;
-            frames.second = std::get<2>( quat2 );
-        }
-      }
+    }
+  }
+  // Point particles are only translational neighbours.
+  for (const VecAndFrame &point : grid.points.at(voxel2)) {
+    if (subset.weight(point.second) == 0) {
+      continue;
+    }
+    double dd{ (std::get<0>(quat) - point.first).Magnitude2() };
+    if (dd < NNd) {
+      NNd = dd;
     }
   }
   return frames;
-} 
+}
+
+/**
+ * Throws the error of two molecules at the same place, if calcEntropy found
+ * any. calcEntropy runs inside parallel regions, which an exception must not
+ * leave, so this is called in serial code after them.
+ */
+void Action_GIGist::throwIfSamePlace(GistGrid &grid) {
+  if (grid.samePlaceVoxels > 0) {
+    grid.samePlaceVoxels = 0;
+    throw "Error: 2 molecules seem to be at the same place";
+  }
+}
 
 /**
- * updates nearestNeighborTransFailures, nearestNeighborSixFailures, and nearestNeighborTotal
+ * Counts the possible failures of a nearest neighbor search.
  * NNd_sqr and NNs_sqr should be squared nearest neighbor estimates.
  * if they are smaller than the grid spacing, they are guaranteed to be the smallest.
  * Otherwise increment failure counts.
  **/
-void Action_GIGist::updateNNFailureCount(double NNd_sqr, double NNs_sqr) {
-    double save_dist = info_.grid.voxelSize;
+void Action_GIGist::updateNNFailureCount(const GistGrid &grid, double NNd_sqr, double NNs_sqr, int &transFailures, int &sixFailures) const {
+    double save_dist = grid.info.voxelSize;
     save_dist *= save_dist;
     if (NNd_sqr > save_dist) {
-        ++info_.gist.nearestNeighborTransFailures;
+        ++transFailures;
     }
     if (NNs_sqr > save_dist) {
-        ++info_.gist.nearestNeighborSixFailures;
+        ++sixFailures;
     }
-    ++info_.gist.nearestNeighborTotal;
+}
+
+/**
+ * Adds the nearest neighbor searches of a voxel to nearestNeighborTransFailures,
+ * nearestNeighborSixFailures, and nearestNeighborTotal of its grid. Only the
+ * values that are kept are added, not those of coarser subsamples or of
+ * bootstrap replicates.
+ **/
+void Action_GIGist::addNNFailures(GistGrid &grid, const VoxelValues &values) {
+    #pragma omp atomic
+    grid.nearestNeighborTransFailures += values.nnTransFailures;
+    #pragma omp atomic
+    grid.nearestNeighborSixFailures += values.nnSixFailures;
+    #pragma omp atomic
+    grid.nearestNeighborTotal += values.nnSearches;
 }
 
 /**
@@ -1548,35 +3185,518 @@ int Action_GIGist::weight(std::string atom) {
   return 1000;
 }
 
+/**
+ * Writes every grid together with its refinement grids as uniform grids of
+ * the finest spacing. Every voxel takes the value of the finest grid that has
+ * it active. Only the intensive _dens and _norm sets are resampled, the
+ * counts of the coarser grids would have to be split.
+ */
+void Action_GIGist::writeRefinedGrids()
+{
+  const int levels{ info_.gist.refineLevels };
+  for (unsigned int g = 0; g < grids_.size(); ++g) {
+    const GistGrid &base = grids_[g];
+    if (base.refineBase != -1) {
+      continue;
+    }
+    // The refinement grids of every level and their first voxel in units of
+    // their own spacing.
+    std::vector<const GistGrid *> refined(levels + 1, nullptr);
+    std::vector<std::array<int, 3> > offsets(levels + 1);
+    for (const GistGrid &grid : grids_) {
+      if (grid.refineBase == static_cast<int>(g)) {
+        refined[grid.refineLevel] = &grid;
+        for (int i = 0; i < 3; ++i) {
+          offsets[grid.refineLevel][i] = static_cast<int>(
+            std::lround((grid.info.start[i] - base.info.start[i]) / grid.info.voxelSize));
+        }
+      }
+    }
+    GistGrid fine{};
+    fine.info.voxelSize = base.info.voxelSize / (1 << levels);
+    fine.info.center = base.info.center;
+    for (int i = 0; i < 3; ++i) {
+      fine.info.dimensions[i] = base.info.dimensions[i] << levels;
+    }
+    fine.info.nVoxels = fine.info.dimensions[0] * fine.info.dimensions[1] * fine.info.dimensions[2];
+    for (unsigned int set = 0; set < dict_.size(); ++set) {
+      const std::string name{ dict_.getElement(set) };
+      if (name.size() < 5 || (name.compare(name.size() - 5, 5, "_dens") != 0 &&
+                              name.compare(name.size() - 5, 5, "_norm") != 0)) {
+        continue;
+      }
+      std::vector<double> data(fine.info.nVoxels);
+      #pragma omp parallel for
+      for (int voxel = 0; voxel < fine.info.nVoxels; ++voxel) {
+        int ijk[3]{ voxel / (fine.info.dimensions[1] * fine.info.dimensions[2]),
+                    (voxel / fine.info.dimensions[2]) % fine.info.dimensions[1],
+                    voxel % fine.info.dimensions[2] };
+        const GistGrid *source{ &base };
+        int sourceVoxel{ ((ijk[0] >> levels) * base.info.dimensions[1] + (ijk[1] >> levels)) * base.info.dimensions[2] +
+                         (ijk[2] >> levels) };
+        for (int level = levels; level > 0; --level) {
+          const GistGrid *grid{ refined[level] };
+          int c[3];
+          bool inside{ grid != nullptr };
+          for (int i = 0; i < 3 && inside; ++i) {
+            c[i] = (ijk[i] >> (levels - level)) - offsets[level][i];
+            inside = c[i] >= 0 && c[i] < grid->info.dimensions[i];
+          }
+          if (inside) {
+            int index{ (c[0] * grid->info.dimensions[1] + c[1]) * grid->info.dimensions[2] + c[2] };
+            if (activeVoxel(*grid, index)) {
+              source = grid;
+              sourceVoxel = index;
+              break;
+            }
+          }
+        }
+        data[voxel] = source->result.at(set)->operator[](sourceVoxel);
+      }
+      writeDxFile(fine, "refined_" + name + base.suffix + ".dx", data);
+    }
+  }
+}
+
+/**
+ * Writes the grids of the dx files as MRC maps, each into its own file with
+ * mrc and all of them into one volume stack with mrcstack.
+ * @param grid: The grid, after its output was calculated.
+ */
+void Action_GIGist::writeMrcFiles(const GistGrid &grid)
+{
+  if (!info_.gist.writeMrc && info_.gist.mrcStack.empty()) {
+    return;
+  }
+  Vec3 griddim{ grid.info.dimensions.data() };
+  Vec3 corner{ grid.info.center - griddim * (0.5 * grid.info.voxelSize) };
+  const std::array<double, 3> origin{{ corner[0], corner[1], corner[2] }};
+  MrcFile stack{ grid.info.dimensions, origin, grid.info.voxelSize };
+  auto write = [](const MrcFile &mrc, const std::string &name) {
+    if (!mrc.write(name)) {
+      mprinterr("Error: Could not write %s.\n", name.c_str());
+    }
+  };
+
+  for (unsigned int i = 0; i < dict_.size(); ++i) {
+    if (!writesGridFile(i) || (info_.gist.densityOnly && i != 0)) {
+      continue;
+    }
+    const DataSet_3D *set{ grid.result.at(i) };
+    const std::string name{ dict_.getElement(i) + grid.suffix };
+    auto value = [set](std::size_t voxel) { return (*set)[voxel]; };
+    if (info_.gist.writeMrc) {
+      MrcFile single{ grid.info.dimensions, origin, grid.info.voxelSize };
+      single.add(name, value);
+      write(single, name + ".mrc" + info_.gist.compressSuffix);
+    }
+    if (!info_.gist.mrcStack.empty()) {
+      stack.add(name, value);
+    }
+  }
+  // The g_ files, as written by printGrid and printDensityGrid.
+  if (info_.gist.writeDx || info_.gist.densityOnly) {
+    const SolventSpecies &species = species_.at(grid.species);
+    for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+      const std::string name{ "g_" + species.elements.at(i) + grid.suffix };
+      if (info_.gist.writeMrc) {
+        MrcFile single{ grid.info.dimensions, origin, grid.info.voxelSize };
+        single.add(name, grid.resultV[i]);
+        write(single, name + ".mrc" + info_.gist.compressSuffix);
+      }
+      if (!info_.gist.mrcStack.empty()) {
+        stack.add(name, grid.resultV[i]);
+      }
+    }
+  }
+  if (stack.volumes() > 0) {
+    write(stack, addFileSuffix(info_.gist.mrcStack, grid.suffix));
+  }
+}
+
+/**
+ * Adds the distance of every voxel to the nearest solute atom to the
+ * distance fields of the grids, only for the first frame without proxavg.
+ * The transform runs on the grid padded by proxmax, so that solute atoms
+ * just outside of the grid count as well. Frames without solute atoms in
+ * that range are skipped.
+ * @param frame: The current frame.
+ */
+void Action_GIGist::addProximity(const Frame &frame)
+{
+  if (info_.gist.proximityWidth <= 0.0) {
+    return;
+  }
+  const int nAtoms{ info_.system.numberAtoms };
+  for (GistGrid &grid : grids_) {
+    if (grid.pending || (grid.proximityFrames > 0 && !info_.gist.proximityAverage)) {
+      continue;
+    }
+    const int pad{ static_cast<int>( std::ceil(info_.gist.proximityMax / grid.info.voxelSize) ) };
+    const std::array<int, 3> padded{{ grid.info.dimensions[0] + 2 * pad, grid.info.dimensions[1] + 2 * pad,
+                                      grid.info.dimensions[2] + 2 * pad }};
+    std::vector<int> atomVoxels(nAtoms, -1);
+    #pragma omp parallel for schedule(static)
+    for (int atom = 0; atom < nAtoms; ++atom) {
+      if (solvent_[atom]) {
+        continue;
+      }
+      Vec3 xyz{ atomXYZ(frame, atom) };
+      int ijk[3];
+      bool inside{ true };
+      for (int d = 0; d < 3 && inside; ++d) {
+        double x{ std::floor((xyz[d] - grid.info.start[d]) / grid.info.voxelSize) + pad };
+        inside = x >= 0 && x < padded[d];
+        ijk[d] = static_cast<int>( x );
+      }
+      if (inside) {
+        atomVoxels[atom] = (ijk[0] * padded[1] + ijk[1]) * padded[2] + ijk[2];
+      }
+    }
+    std::vector<int> seeds{};
+    for (int voxel : atomVoxels) {
+      if (voxel != -1) {
+        seeds.push_back(voxel);
+      }
+    }
+    if (seeds.empty()) {
+      continue;
+    }
+    std::vector<double> squared{ DistanceTransform::squared(padded, seeds) };
+    grid.proximity.resize(grid.info.nVoxels, 0.0);
+    const int ny{ grid.info.dimensions[1] }, nz{ grid.info.dimensions[2] };
+    #pragma omp parallel for schedule(static)
+    for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+      const int i{ voxel / (ny * nz) + pad }, j{ (voxel / nz) % ny + pad }, k{ voxel % nz + pad };
+      grid.proximity[voxel] += std::sqrt(squared[(static_cast<long>(i) * padded[1] + j) * padded[2] + k]) * grid.info.voxelSize;
+    }
+    ++grid.proximityFrames;
+  }
+}
+
+/**
+ * Writes the distance field of a grid and, for every bin of the distance,
+ * the number of voxels and the sum and average of all final data sets and
+ * densities over them. The quantities are summed in parallel, each in the
+ * order of the voxels.
+ * @param grid: The grid, after its output was calculated.
+ */
+void Action_GIGist::writeProximity(const GistGrid &grid)
+{
+  if (info_.gist.proximityWidth <= 0.0) {
+    return;
+  }
+  if (grid.proximityFrames == 0) {
+    mprintf("Warning: No solute atoms within proxmax of grid%s, no proximity output.\n", grid.suffix.c_str());
+    return;
+  }
+  const int nVoxels{ grid.info.nVoxels };
+  std::vector<double> distance(nVoxels);
+  for (int voxel = 0; voxel < nVoxels; ++voxel) {
+    distance[voxel] = grid.proximity[voxel] / grid.proximityFrames;
+  }
+  writeDxFile(grid, "proximity" + grid.suffix + ".dx", distance);
+
+  const int nBins{ static_cast<int>( std::ceil(info_.gist.proximityMax / info_.gist.proximityWidth - 1e-9) ) };
+  std::vector<int> bins(nVoxels, -1);
+  std::vector<int> counts(nBins, 0);
+  for (int voxel = 0; voxel < nVoxels; ++voxel) {
+    if (distance[voxel] < info_.gist.proximityMax && activeVoxel(grid, voxel)) {
+      bins[voxel] = std::min(nBins - 1, static_cast<int>( distance[voxel] / info_.gist.proximityWidth ));
+      ++counts[bins[voxel]];
+    }
+  }
+  std::vector<unsigned int> sets{};
+  std::vector<std::string> names{};
+  for (unsigned int i = 0; i < dict_.size(); ++i) {
+    if (isFinalSet(i) && (!info_.gist.densityOnly || i == 0)) {
+      sets.push_back(i);
+      names.push_back(dict_.getElement(i));
+    }
+  }
+  for (const std::string &element : species_.at(grid.species).elements) {
+    names.push_back("g_" + element);
+  }
+  const int nQuantities{ static_cast<int>( names.size() ) };
+  const int nSets{ static_cast<int>( sets.size() ) };
+  std::vector<std::vector<double> > sums(nQuantities, std::vector<double>(nBins, 0.0));
+  #pragma omp parallel for schedule(dynamic)
+  for (int q = 0; q < nQuantities; ++q) {
+    const DataSet_3D *set{ q < nSets ? grid.result.at(sets[q]) : nullptr };
+    const std::vector<double> *density{ q < nSets ? nullptr : &grid.resultV.at(q - nSets) };
+    for (int voxel = 0; voxel < nVoxels; ++voxel) {
+      if (bins[voxel] != -1) {
+        sums[q][bins[voxel]] += set != nullptr ? (*set)[voxel] : (*density)[voxel];
+      }
+    }
+  }
+
+  const std::string name{ addFileSuffix(info_.gist.proximityFile, grid.suffix) };
+  CompressedStream file{};
+  if (!file.open(name)) {
+    mprinterr("Error: Could not open %s for writing.\n", name.c_str());
+    return;
+  }
+  file.Printf("# GIST aggregates by the distance to the nearest solute atom (%s), n_frames = %d\n",
+              info_.gist.proximityAverage ? "average" : "first frame", info_.system.nFrames);
+  file.Printf("#   d_min   d_max  voxels");
+  for (const std::string &quantity : names) {
+    file.Printf("  %s_sum  %s_avg", quantity.c_str(), quantity.c_str());
+  }
+  file.Printf("\n");
+  for (int bin = 0; bin < nBins; ++bin) {
+    file.Printf("%g %g %d", bin * info_.gist.proximityWidth,
+                std::min(info_.gist.proximityMax, (bin + 1) * info_.gist.proximityWidth), counts[bin]);
+    for (int q = 0; q < nQuantities; ++q) {
+      file.Printf(" %g %g", sums[q][bin], counts[bin] > 0 ? sums[q][bin] / counts[bin] : 0.0);
+    }
+    file.Printf("\n");
+  }
+  if (!file.close()) {
+    mprinterr("Error: Could not write %s.\n", name.c_str());
+  }
+}
+
+/**
+ * Stores the sums of the frames since the last recorded block: population,
+ * energies, neighbours, order and element counts of every voxel.
+ * @param grid: The grid, at the end of a block of frames.
+ */
+void Action_GIGist::recordBlock(GistGrid &grid)
+{
+  const int nChannels{ N_BLOCK_CHANNELS + static_cast<int>( grid.resultV.size() ) };
+  const std::size_t size{ static_cast<std::size_t>( grid.info.nVoxels ) * nChannels };
+  const std::size_t offset{ grid.blockSums.size() };
+  grid.blockTotals.resize(size, 0.0);
+  grid.blockSums.resize(offset + size);
+  const DataSet_3D *population{ grid.result.at(dict_.getIndex("population")) };
+  #pragma omp parallel for
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    const std::size_t first{ static_cast<std::size_t>( voxel ) * nChannels };
+    const double totals[N_BLOCK_CHANNELS]{ (*population)[voxel], grid.sums.value(voxel, SUM_ESW),
+                                           grid.sums.value(voxel, SUM_EWW), grid.sums.value(voxel, SUM_NEIGHBOUR),
+                                           grid.sums.value(voxel, SUM_ORDER) };
+    for (int channel = 0; channel < nChannels; ++channel) {
+      const double total{ channel < N_BLOCK_CHANNELS ? totals[channel] : grid.resultV[channel - N_BLOCK_CHANNELS][voxel] };
+      grid.blockSums[offset + first + channel] = static_cast<float>( total - grid.blockTotals[first + channel] );
+      grid.blockTotals[first + channel] = total;
+    }
+  }
+}
+
+/**
+ * Block bootstrap of the normalized values of every voxel. Each replicate
+ * draws as many blocks of frames as recorded, with replacement. Energies,
+ * neighbours, order and densities are the sums of the drawn blocks, the
+ * entropies are calculated from the samples of the drawn frames, weighted by
+ * how often their block was drawn. Copies of a block are no neighbours of
+ * each other, the search runs on the distinct frames.
+ *
+ * All replicates share the samples and block sums, they only differ in the
+ * block weights. The voxels are distributed over the threads, every thread
+ * evaluates all replicates of its voxels, so the results do not depend on
+ * the number of threads. The standard deviations over the replicates are
+ * written to se_<name>.dx.
+ * @param grid: The grid, once all frames are processed.
+ */
+void Action_GIGist::calcBootstrapErrors(GistGrid &grid)
+{
+  if (info_.gist.bootstrapReplicates <= 0) {
+    return;
+  }
+  const SolventSpecies &species = species_.at(grid.species);
+  const int nChannels{ N_BLOCK_CHANNELS + static_cast<int>( grid.resultV.size() ) };
+  const std::size_t blockSize{ static_cast<std::size_t>( grid.info.nVoxels ) * nChannels };
+  const int nBlocks{ static_cast<int>( grid.blockSums.size() / blockSize ) };
+  if (nBlocks < 2) {
+    mprintf("Warning: Fewer than two blocks of %d frames, no bootstrap errors.\n", info_.gist.bootstrapBlock);
+    return;
+  }
+  const int nReplicates{ info_.gist.bootstrapReplicates };
+  BlockBootstrap bootstrap{ info_.system.nFrames, info_.gist.bootstrapBlock, static_cast<unsigned int>( info_.gist.bootstrapSeed ) };
+  std::vector<FrameSubset> replicates{};
+  std::vector<double> frames{};
+  for (int replicate = 0; replicate < nReplicates; ++replicate) {
+    replicates.push_back(bootstrap.replicate(replicate));
+    frames.push_back(replicates.back().weightedFrames(info_.system.nFrames));
+  }
+  mprintf("Bootstrap: %d replicates of %d blocks of %d frames.\n", nReplicates, nBlocks, info_.gist.bootstrapBlock);
+
+  std::vector<std::string> names{ "dTStrans_norm", "dTStrans_dens", "dTSorient_norm", "dTSorient_dens",
+                                  "dTSsix_norm", "dTSsix_dens", "Esw_norm", "Esw_dens", "Eww_norm", "Eww_dens",
+                                  "neighbour_norm", "neighbour_dens", "order_norm" };
+  for (const std::string &element : species.elements) {
+    names.push_back("g_" + element);
+  }
+  std::vector<std::vector<double> *> errors{};
+  for (const std::string &name : names) {
+    errors.push_back(&grid.bootstrapErrors[name]);
+    errors.back()->assign(grid.info.nVoxels, 0.0);
+  }
+  const DataSet_3D *population{ grid.result.at(dict_.getIndex("population")) };
+
+  auto bootstrapVoxel = [&](int voxel) {
+    if ((*population)[voxel] <= 0) {
+      return;
+    }
+    std::vector<std::vector<double> > values(names.size(), std::vector<double>(nReplicates, 0.0));
+    std::vector<double> sums(nChannels);
+    for (int replicate = 0; replicate < nReplicates; ++replicate) {
+      const std::vector<int> &weights = replicates[replicate].blockWeights;
+      std::fill(sums.begin(), sums.end(), 0.0);
+      for (int block = 0; block < nBlocks; ++block) {
+        if (weights[block] == 0) {
+          continue;
+        }
+        const float *blockSums{ &grid.blockSums[block * blockSize + static_cast<std::size_t>( voxel ) * nChannels] };
+        for (int channel = 0; channel < nChannels; ++channel) {
+          sums[channel] += weights[block] * static_cast<double>( blockSums[channel] );
+        }
+      }
+      const double pop{ sums[BLOCK_POPULATION] };
+      const double norm{ frames[replicate] * grid.info.voxelVolume };
+      // The nearest neighbour counts of the replicates are dropped with
+      // entropies, the grid only reports those of the final values.
+      VoxelValues entropies{};
+      if (pop > 0) {
+        calcEntropy(grid, voxel, entropies, replicates[replicate]);
+      }
+      const double perMolecule{ pop > 0 ? 1.0 / pop : 0.0 };
+      const double replicateValues[]{
+        entropies.dTStrans_norm, entropies.dTStrans_dens, entropies.dTSorient_norm, entropies.dTSorient_dens,
+        entropies.dTSsix_norm, entropies.dTSsix_dens, sums[BLOCK_ESW] * perMolecule, sums[BLOCK_ESW] / norm,
+        sums[BLOCK_EWW] * perMolecule, sums[BLOCK_EWW] / norm, sums[BLOCK_NEIGHBOUR] * perMolecule,
+        sums[BLOCK_NEIGHBOUR] / norm, sums[BLOCK_ORDER] * perMolecule
+      };
+      const int nValues{ static_cast<int>( sizeof(replicateValues) / sizeof(double) ) };
+      for (int i = 0; i < nValues; ++i) {
+        values[i][replicate] = replicateValues[i];
+      }
+      for (unsigned int i = 0; i < grid.resultV.size(); ++i) {
+        values[nValues + i][replicate] = sums[N_BLOCK_CHANNELS + i] / (norm * species.rho0 * species.atomCounter.at(i));
+      }
+    }
+    for (unsigned int i = 0; i < names.size(); ++i) {
+      (*errors[i])[voxel] = BlockBootstrap::standardError(values[i]);
+    }
+  };
+
+  // As in calcGridValues, crowded voxels split their samples over the threads.
+  ProgressBar progBar(grid.info.nVoxels);
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    if ((*population)[voxel] >= info_.gist.splitPopulation) {
+      bootstrapVoxel(voxel);
+    }
+  }
+#ifdef _OPENMP
+  int curVox{ 0 };
+#endif
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+#ifndef _OPENMP
+    progBar.Update( voxel );
+#else
+    #pragma omp critical
+    progBar.Update( curVox++ );
+#endif
+    if ((*population)[voxel] < info_.gist.splitPopulation) {
+      bootstrapVoxel(voxel);
+    }
+  }
+  throwIfSamePlace(grid);
+  for (unsigned int i = 0; i < names.size(); ++i) {
+    writeDxFile(grid, "se_" + names[i] + grid.suffix + ".dx", *errors[i]);
+  }
+}
+
+/**
+ * Opens the table of a grid, compressed according to its name. If it cannot
+ * be opened, the error is reported and the output to it is dropped.
+ * @param grid: The grid whose table is written.
+ * @return: false if the file could not be opened.
+ */
+bool Action_GIGist::openDatafile(GistGrid &grid)
+{
+  grid.datafile = std::make_shared<CompressedStream>();
+  if (!grid.datafile->open(grid.datafileName)) {
+    mprinterr("Error: Could not open %s for writing.\n", grid.datafileName.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Writes the rest of the table of a grid and closes it.
+ * @param grid: The grid whose table was written.
+ */
+void Action_GIGist::closeDatafile(GistGrid &grid)
+{
+  if (grid.datafile && !grid.datafile->close()) {
+    mprinterr("Error: Could not write %s.\n", grid.datafileName.c_str());
+  }
+  grid.datafile.reset();
+}
+
+/**
+ * With compress, the grid files of the data sets are written here instead
+ * of by cpptraj, which can neither compress in parallel nor write zstd.
+ * @param grid: The grid, after its output was calculated.
+ */
+void Action_GIGist::writeCompressedDxFiles(const GistGrid &grid)
+{
+  if (info_.gist.compressSuffix.empty()) {
+    return;
+  }
+  std::vector<double> data(grid.info.nVoxels);
+  for (unsigned int i = 0; i < dict_.size(); ++i) {
+    if (!writesGridFile(i) || (info_.gist.densityOnly && i != 0)) {
+      continue;
+    }
+    const DataSet_3D *set{ grid.result.at(i) };
+    for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+      data[voxel] = (*set)[voxel];
+    }
+    writeDxFile(grid, dict_.getElement(i) + grid.suffix + ".dx", data);
+  }
+}
+
 /**
  * Writes a dx file. The dx file is the same file as the cpptraj dx file, however,
  * this is under my complete control, cpptraj is not.
  * Still for most calculations, the cpptraj tool is used.
- * @param name: A string holding the name of the written file.
+ * @param name: A string holding the name of the written file, the extension
+ *              of compress is appended.
  * @param data: The data to write to the dx file.
  */
-void Action_GIGist::writeDxFile(std::string name, const std::vector<double> &data) {
-  std::ofstream file{};
-  file.open(name.c_str());
-  Vec3 griddim{ info_.grid.dimensions.data() };
-  Vec3 origin{ info_.grid.center - griddim * (0.5 * info_.grid.voxelSize) };
-  file << "object 1 class gridpositions counts " << info_.grid.dimensions[0] << " " << info_.grid.dimensions[1] << " " << info_.grid.dimensions[2] << "\n";
+void Action_GIGist::writeDxFile(const GistGrid &grid, std::string name, const std::vector<double> &data) {
+  name += info_.gist.compressSuffix;
+  CompressedStream file{};
+  if (!file.open(name)) {
+    mprinterr("Error: Could not open %s for writing.\n", name.c_str());
+    return;
+  }
+  Vec3 griddim{ grid.info.dimensions.data() };
+  Vec3 origin{ grid.info.center - griddim * (0.5 * grid.info.voxelSize) };
+  file << "object 1 class gridpositions counts " << grid.info.dimensions[0] << " " << grid.info.dimensions[1] << " " << grid.info.dimensions[2] << "\n";
   file << "origin " << origin[0] << " " << origin[1] << " " << origin[2] << "\n";
-  file << "delta " << info_.grid.voxelSize << " 0 0\n";
-  file << "delta 0 " << info_.grid.voxelSize << " 0\n";
-  file << "delta 0 0 " << info_.grid.voxelSize << "\n";
-  file << "object 2 class gridconnections counts " << info_.grid.dimensions[0] << " " << info_.grid.dimensions[1] << " " << info_.grid.dimensions[2] << "\n";
-  file << "object 3 class array type double rank 0 items " << info_.grid.nVoxels << " data follows" << "\n";
+  file << "delta " << grid.info.voxelSize << " 0 0\n";
+  file << "delta 0 " << grid.info.voxelSize << " 0\n";
+  file << "delta 0 0 " << grid.info.voxelSize << "\n";
+  file << "object 2 class gridconnections counts " << grid.info.dimensions[0] << " " << grid.info.dimensions[1] << " " << grid.info.dimensions[2] << "\n";
+  file << "object 3 class array type double rank 0 items " << grid.info.nVoxels << " data follows" << "\n";
   int i{ 0 };
-  while ( (i + 3) < static_cast<int>( info_.grid.nVoxels  )) {
+  while ( (i + 3) < static_cast<int>( grid.info.nVoxels  )) {
     file << data.at(i) << " " << data.at(i + 1) << " " << data.at(i + 2) << "\n";
     i +=3;
   }
-  while (i < static_cast<int>( info_.grid.nVoxels )) {
+  while (i < static_cast<int>( grid.info.nVoxels )) {
     file << data.at(i) << " ";
     i++;
   }
-  file << std::endl;
+  file << "\n";
+  if (!file.close()) {
+    mprinterr("Error: Could not write %s.\n", name.c_str());
+  }
 }
 
 /**
@@ -1608,31 +3728,33 @@ Vec3 Action_GIGist::calcCenterOfMass(int atom_begin, int atom_end, const double
  * @param frame: The current frame.
  * @return The voxel this frame was binned into. If binning was not succesfull, returns -1.
  */
-int Action_GIGist::bin(int begin, int end, const Vec3 &vec, const ActionFrame &frame) {
+int Action_GIGist::bin(GistGrid &grid, int begin, int end, const Vec3 &vec, const Frame &frame) {
   size_t bin_i{}, bin_j{}, bin_k{};
   // This is set to -1, if binning is not possible, the function will return a nonsensical value of -1, which can be tested.
   int voxel{ -1 };
-  if (result_.at(dict_.getIndex("population"))->Bin().Calc(vec[0], vec[1], vec[2], bin_i, bin_j, bin_k)
+  if (grid.result.at(dict_.getIndex("population"))->Bin().Calc(vec[0], vec[1], vec[2], bin_i, bin_j, bin_k)
       /*&& bin_i < dimensions_[0] && bin_j < dimensions_[1] && bin_k < dimensions_[2]*/)
   {
-    voxel = result_.at(dict_.getIndex("population"))->CalcIndex(bin_i, bin_j, bin_k);
-    
-    
+    voxel = grid.result.at(dict_.getIndex("population"))->CalcIndex(bin_i, bin_j, bin_k);
+    if (!activeVoxel(grid, voxel)) {
+      return -1;
+    }
 
     #ifdef _OPENMP
     #pragma omp critical
     {
     #endif
     
-      result_.at(dict_.getIndex("population"))->UpdateVoxel(voxel, 1.0);
+      grid.result.at(dict_.getIndex("population"))->UpdateVoxel(voxel, 1.0);
     if (!info_.gist.useCOM) {
-      resultV_.at(dict_.getIndex(info_.gist.centerAtom) - result_.size()).at(voxel) += 1.0;
+      const SolventSpecies &species = species_.at(grid.species);
+      grid.resultV.at(species.centerElement).at(voxel) += 1.0;
     }
     #ifdef _OPENMP
     }
     #endif
 
-    calcDipole(begin, end, voxel, frame);
+    calcDipole(grid, begin, end, voxel, frame);
 
   }
   return voxel;
@@ -1646,7 +3768,7 @@ int Action_GIGist::bin(int begin, int end, const Vec3 &vec, const ActionFrame &f
  * @param frame: The current frame.
  * @return Nothing at the moment
  */
-void Action_GIGist::calcDipole(int begin, int end, int voxel, const ActionFrame &frame) {
+void Action_GIGist::calcDipole(GistGrid &grid, int begin, int end, int voxel, const Frame &frame) {
   #if !defined _OPENMP && !defined CUDA
     tDipole_.Start();
 #endif
@@ -1655,23 +3777,17 @@ void Action_GIGist::calcDipole(int begin, int end, int voxel, const ActionFrame
     double DPZ{ 0 };
     for (int atoms = begin; atoms < end; ++atoms)
     {
-      const double *XYZ = frame.Frm().XYZ(atoms);
+      Vec3 XYZ{ atomXYZ(frame, atoms) };
       double charge{ charges_.at(atoms) };
       DPX += charge * XYZ[0];
       DPY += charge * XYZ[1];
       DPZ += charge * XYZ[2];
     }
 
-    #ifdef _OPENMP
-    #pragma omp critical
-    {
-    #endif
-    result_.at(dict_.getIndex("dipole_xtemp"))->UpdateVoxel(voxel, DPX);
-    result_.at(dict_.getIndex("dipole_ytemp"))->UpdateVoxel(voxel, DPY);
-    result_.at(dict_.getIndex("dipole_ztemp"))->UpdateVoxel(voxel, DPZ);
-    #ifdef _OPENMP
-    }
-    #endif
+    // Every thread adds into its own tiles, no synchronization needed.
+    grid.sums.add(voxel, SUM_DIPOLE_X, DPX);
+    grid.sums.add(voxel, SUM_DIPOLE_Y, DPY);
+    grid.sums.add(voxel, SUM_DIPOLE_Z, DPZ);
 #if !defined _OPENMP && !defined CUDA
     tDipole_.Stop();
 #endif
@@ -1850,67 +3966,27 @@ bool Action_GIGist::almostEqual(double input, double control)
 
 
 
-// Functions used when CUDA is specified.
-#ifdef CUDA
-
-/**
- * Frees all the Memory on the GPU.
- */
-void Action_GIGist::freeGPUMemory(void) {
-  freeCuda_GIGIST(NBindex_c_);
-  freeCuda_GIGIST(molecule_c_);
-  freeCuda_GIGIST(paramsLJ_c_);
-  freeCuda_GIGIST(result_w_c_);
-  freeCuda_GIGIST(result_s_c_);
-  freeCuda_GIGIST(result_O_c_);
-  freeCuda_GIGIST(result_N_c_);
-  NBindex_c_   = nullptr;
-  molecule_c_  = nullptr;
-  paramsLJ_c_  = nullptr;
-  result_w_c_= nullptr;
-  result_s_c_= nullptr;
-  result_O_c_  = nullptr;
-  result_N_c_  = nullptr;
-}
-
-/**
- * Copies data from the CPU to the GPU.
- * @throws: CudaException
- */
-void Action_GIGist::copyToGPU(void) {
-  try {
-    copyMemoryToDevice_GIGIST(&(NBIndex_[0]), NBindex_c_, NBIndex_.size() * sizeof(int));
-    copyMemoryToDeviceStruct_GIGIST(&(charges_[0]), &(atomTypes_[0]), solvent_.get(), &(molecule_[0]), info_.system.numberAtoms, &(molecule_c_),
-                              &(lJParamsA_[0]), &(lJParamsB_[0]), lJParamsA_.size(), &(paramsLJ_c_));
-  } catch (CudaException &ce) {
-    freeGPUMemory();
-    mprinterr("Error: Could not copy data to the device.\n");
-    throw ce;
-  } catch (std::exception &e) {
-    freeGPUMemory();
-    throw e;
-  }
-}
-#endif
-
 /**
  * @brief main function for FEBISS placement
  *
  */
-void Action_GIGist::placeFebissWaters(void) {
+void Action_GIGist::placeFebissWaters(GistGrid &grid) {
   mprintf("Transfering data for FEBISS placement\n");
-  determineGridShells();
+  grid.febissSites.clear();
+  determineGridShells(grid);
   /* calculate delta G and read density data */
   std::vector<double> deltaG;
   std::vector<double> relPop;
-  for (int voxel = 0; voxel < info_.grid.nVoxels; ++voxel) {
-    double dTSt = result_.at(dict_.getIndex("dTStrans_norm"))->operator[](voxel);
-    double dTSo = result_.at(dict_.getIndex("dTSorient_norm"))->operator[](voxel);
-    double esw = result_.at(dict_.getIndex("Esw_norm"))->operator[](voxel);
-    double eww = result_.at(dict_.getIndex("Eww_norm"))->operator[](voxel);
+  const SolventSpecies &species = species_.at(grid.species);
+  const int centerElement{ species.centerElement };
+  for (int voxel = 0; voxel < grid.info.nVoxels; ++voxel) {
+    double dTSt = grid.result.at(dict_.getIndex("dTStrans_norm"))->operator[](voxel);
+    double dTSo = grid.result.at(dict_.getIndex("dTSorient_norm"))->operator[](voxel);
+    double esw = grid.result.at(dict_.getIndex("Esw_norm"))->operator[](voxel);
+    double eww = grid.result.at(dict_.getIndex("Eww_norm"))->operator[](voxel);
     double value = esw + eww - dTSo - dTSt;
     deltaG.push_back(value);
-    relPop.push_back(resultV_.at(info_.gist.centerIdx).at(voxel));
+    relPop.push_back(grid.resultV.at(centerElement).at(voxel));
   }
   /* Place water to recover 95% of the original density */
   int waterToPosition = static_cast<int>(round(info_.system.numberSolvent * 0.95 / 3));
@@ -1925,24 +4001,24 @@ void Action_GIGist::placeFebissWaters(void) {
     maxDensityIterator = std::max_element(relPop.begin(), relPop.end());
     double densityValue = *(maxDensityIterator);
     int index = maxDensityIterator - relPop.begin();
-    Vec3 voxelCoords = coordsFromIndex(index);
+    Vec3 voxelCoords = coordsFromIndex(grid, index);
     /**
      * bin hvectors to grid
      * Currently this grid is hardcoded. It has 21 voxels in x, y, z direction.
      * The spacing is 0.1 A, so it stretches out exactly 1 A in each direction
      * and is centered on the placed oxygen. This grid allows for convenient and
      * fast binning of the relative vectors of the H atoms during the simulation
-     * which have been stored in hVectors_ as a std::vector of Vec3
+     * which have been stored in grid.hVectors as a std::vector of Vec3
      */
     std::vector<std::vector<std::vector<int>>> hGrid;
     int hDim = 21;
     setGridToZero(hGrid, hDim);
     std::vector<int> binnedHContainer;
     /* cycle relative H vectors */
-    for (unsigned int j = 0; j < hVectors_[index].size(); ++j) {
+    for (unsigned int j = 0; j < grid.hVectors[index].size(); ++j) {
       /* cycle x, y, z */
       for (int k = 0; k < 3; ++k) {
-        double tmpBin = hVectors_[index][j][k];
+        double tmpBin = grid.hVectors[index][j][k];
         tmpBin *= 10;
         tmpBin = std::round(tmpBin);
         tmpBin += 10;
@@ -1970,33 +4046,79 @@ void Action_GIGist::placeFebissWaters(void) {
     Vec3 h2 = coordsFromHGridPos(maximum2);
     /* increase included shells until enough density to subtract */
     int shellNum = 0;
-    int maxShellNum = shellcontainerKeys_.size() - 1;
+    int maxShellNum = grid.shellcontainerKeys.size() - 1;
     /* not enough density and not reached limit */
-    while (densityValue < 1 / (info_.grid.voxelVolume * info_.system.rho0) &&
+    while (densityValue < 1 / (grid.info.voxelVolume * species_.at(grid.species).rho0) &&
            shellNum < maxShellNum
     ) {
       densityValueOld = densityValue;
       ++shellNum;
       /* new density by having additional watershell */
-      densityValue = addWaterShell(densityValue, relPop, index, shellNum);
+      densityValue = addWaterShell(grid, densityValue, relPop, index, shellNum);
     }
     /* determine density weighted delta G with now reached density */
     double weightedDeltaG = assignDensityWeightedDeltaG(
-        index, shellNum, densityValue, densityValueOld, relPop, deltaG);
+        grid, index, shellNum, densityValue, densityValueOld, relPop, deltaG);
     int atomNumber = 3 * i + info_.system.numberSoluteAtoms; // running index in pdb file
     /* write new water to pdb */
-    writeFebissPdb(atomNumber, voxelCoords, h1, h2, weightedDeltaG);
+    if (grid.febissWaterfile != nullptr) {
+      writeFebissPdb(grid, atomNumber, voxelCoords, h1, h2, weightedDeltaG);
+    }
+    for (const Vec3 &atom : { voxelCoords, voxelCoords + h1, voxelCoords + h2 }) {
+      grid.febissSites.insert(grid.febissSites.end(), atom.Dptr(), atom.Dptr() + 3);
+    }
+    grid.febissSites.push_back(weightedDeltaG);
     /* subtract density in included shells */
-    subtractWater(relPop, index, shellNum, densityValue, densityValueOld);
+    subtractWater(grid, relPop, index, shellNum, densityValue, densityValueOld);
   } // cycle of placed water molecules
 }
 
+/**
+ * Finds the hydration sites of a grid and writes them to a pdb file, one
+ * center atom per site. The occupancy column holds the molecules used for the
+ * free energy (at most one), the B-factor column their free energy.
+ * @param grid: The grid, the entropies have to be calculated already.
+ */
+void Action_GIGist::findHydrationSites(GistGrid &grid) {
+  const SolventSpecies &species = species_.at(grid.species);
+  const int nVoxels{ grid.info.nVoxels };
+  std::vector<double> density(nVoxels);
+  std::vector<double> molecules(nVoxels);
+  std::vector<double> deltaG(nVoxels);
+  const DataSet_3D *population{ grid.result.at(dict_.getIndex("population")) };
+  #pragma omp parallel for
+  for (int voxel = 0; voxel < nVoxels; ++voxel) {
+    double pop{ (*population)[voxel] };
+    molecules[voxel] = pop / info_.system.nFrames;
+    density[voxel] = pop / (info_.system.nFrames * grid.info.voxelVolume * species.rho0);
+    deltaG[voxel] = grid.result.at(dict_.getIndex("Esw_norm"))->operator[](voxel) +
+                    grid.result.at(dict_.getIndex("Eww_norm"))->operator[](voxel) -
+                    grid.result.at(dict_.getIndex("dTSorient_norm"))->operator[](voxel) -
+                    grid.result.at(dict_.getIndex("dTStrans_norm"))->operator[](voxel);
+  }
+  HydrationSites finder{ grid.info.dimensions[0], grid.info.dimensions[1], grid.info.dimensions[2],
+                         info_.gist.siteRadius / grid.info.voxelSize };
+  std::vector<HydrationSites::Site> sites{ finder.find(density, molecules, deltaG, info_.gist.siteThreshold) };
+  mprintf("Found %d hydration sites with a density above %g.\n", static_cast<int>( sites.size() ), info_.gist.siteThreshold);
+
+  std::string resName{ species.name.empty() ? "HYD" : species.name.substr(0, 3) };
+  std::string element{ species.centerAtom.substr(0, 2) };
+  for (unsigned int s = 0; s < sites.size(); ++s) {
+    Vec3 coords{ coordsFromIndex(grid, sites[s].voxel) };
+    grid.sitesFile->Printf("HETATM%5d  %-3s %3s  %4d    %8.3f%8.3f%8.3f%6.2f%6.2f          %2s\n",
+                           s + 1, element.c_str(), resName.c_str(), (s + 1) % 10000,
+                           coords[0], coords[1], coords[2],
+                           sites[s].occupancy, sites[s].deltaG, element.c_str());
+  }
+  grid.sitesFile->Printf("END\n");
+}
+
 /**
  * @brief writes solute of given frame into pdb
  *
  * @argument actionFrame frame from which solute is written
  */
-void Action_GIGist::writeOutSolute(ActionFrame& frame) {
+void Action_GIGist::writeOutSolute(const Frame &frame) {
   std::vector<Vec3> soluteCoords;
   std::vector<std::string> soluteEle;
   for (Topology::mol_iterator mol = top_->MolStart();
@@ -2004,25 +4126,26 @@ void Action_GIGist::writeOutSolute(ActionFrame& frame) {
     if (!mol->IsSolvent()) {
       for (int atom = mol->MolUnit().Front(); atom < mol->MolUnit().Back(); ++atom) {
         info_.system.numberSoluteAtoms++;
-        const double *vec = frame.Frm().XYZ(atom);
-        soluteCoords.push_back(Vec3(vec));
+        soluteCoords.push_back(atomXYZ(frame, atom));
         soluteEle.push_back(top_->operator[](atom).ElementName());
       }
     }
   }
-  for (unsigned int i = 0; i < soluteCoords.size(); ++i) {
-    auto name = soluteEle[i].c_str();
-    febissWaterfile_->Printf(
-      "ATOM  %5d  %3s SOL     1    %8.3f%8.3f%8.3f%6.2f%7.2f          %2s\n",
-      i + 1,
-      name,
-      soluteCoords[i][0],
-      soluteCoords[i][1],
-      soluteCoords[i][2],
-      1.0,
-      0.0,
-      name
-    );
+  for (GistGrid &grid : grids_) {
+    for (unsigned int i = 0; i < soluteCoords.size(); ++i) {
+      auto name = soluteEle[i].c_str();
+      grid.febissWaterfile->Printf(
+        "ATOM  %5d  %3s SOL     1    %8.3f%8.3f%8.3f%6.2f%7.2f          %2s\n",
+        i + 1,
+        name,
+        soluteCoords[i][0],
+        soluteCoords[i][1],
+        soluteCoords[i][2],
+        1.0,
+        0.0,
+        name
+      );
+    }
   }
 }
 
@@ -2036,39 +4159,39 @@ void Action_GIGist::writeOutSolute(ActionFrame& frame) {
  * a list contains all keys in ascending order to systematically grow included
  * shells later in the algorithm
  */
-void Action_GIGist::determineGridShells(void) {
+void Action_GIGist::determineGridShells(GistGrid &grid) {
   /* determine center index */
   size_t centeri, centerj, centerk;
-  result_.at(dict_.getIndex("population"))->
-      Bin().Calc(info_.grid.center[0], info_.grid.center[1], info_.grid.center[2], centeri, centerj, centerk);
-  int centerIndex = result_.at(dict_.getIndex("population"))
+  grid.result.at(dict_.getIndex("population"))->
+      Bin().Calc(grid.info.center[0], grid.info.center[1], grid.info.center[2], centeri, centerj, centerk);
+  int centerIndex = grid.result.at(dict_.getIndex("population"))
       ->CalcIndex(centeri, centerj, centerk);
   /* do not use center_ because it does not align with a voxel but lies between voxels */
   /* however the first shell must be solely the voxel itself -> use coords from center voxel */
-  Vec3 centerCoords = coordsFromIndex(centerIndex);
-  for (int vox = 0; vox < info_.grid.nVoxels; ++vox) {
+  Vec3 centerCoords = coordsFromIndex(grid, centerIndex);
+  for (int vox = 0; vox < grid.info.nVoxels; ++vox) {
     /* determine squared distance */
-    Vec3 coords = coordsFromIndex(vox);
+    Vec3 coords = coordsFromIndex(grid, vox);
     Vec3 difference = coords - centerCoords;
     double distSquared = difference[0] * difference[0] +
                          difference[1] * difference[1] +
                          difference[2] * difference[2];
     /* find function of map returns last memory address of map if not found */
     /* if is entered if distance already present as key in map -> can be added */
-    if (shellcontainer_.find(distSquared) != shellcontainer_.end()) {
-      shellcontainer_[distSquared].push_back(vox-centerIndex);
+    if (grid.shellcontainer.find(distSquared) != grid.shellcontainer.end()) {
+      grid.shellcontainer[distSquared].push_back(vox-centerIndex);
     } else {
       /* create new entry in map */
       std::vector<int> indexDifference;
       indexDifference.push_back(vox-centerIndex);
-      shellcontainer_.insert(std::make_pair(distSquared, indexDifference));
+      grid.shellcontainer.insert(std::make_pair(distSquared, indexDifference));
     }
   }
   /* create list to store ascending keys */
-  shellcontainerKeys_.reserve(shellcontainer_.size());
-  std::map<double, std::vector<int>>::iterator it = shellcontainer_.begin();
-  while(it != shellcontainer_.end()) {
-    shellcontainerKeys_.push_back(it->first);
+  grid.shellcontainerKeys.reserve(grid.shellcontainer.size());
+  std::map<double, std::vector<int>>::iterator it = grid.shellcontainer.begin();
+  while(it != grid.shellcontainer.end()) {
+    grid.shellcontainerKeys.push_back(it->first);
     it++;
   }
 }
@@ -2079,15 +4202,15 @@ void Action_GIGist::determineGridShells(void) {
  * @argument index The index in the GIST grid
  * @return Vec3 coords at the voxel
  */
-Vec3 Action_GIGist::coordsFromIndex(const int index) {
+Vec3 Action_GIGist::coordsFromIndex(const GistGrid &grid, const int index) {
   size_t i, j, k;
-  result_.at(dict_.getIndex("population"))->ReverseIndex(index, i, j, k);
-  Vec3 coords = info_.grid.start;
+  grid.result.at(dict_.getIndex("population"))->ReverseIndex(index, i, j, k);
+  Vec3 coords = grid.info.start;
   /* the + 0.5 * size is necessary because of cpptraj's interprets start as corner of grid */
   /* and voxel coordinates are given for the center of the voxel -> hence the shift of half spacing */
-  coords[0] += (i + 0.5) * info_.grid.voxelSize;
-  coords[1] += (j + 0.5) * info_.grid.voxelSize;
-  coords[2] += (k + 0.5) * info_.grid.voxelSize;
+  coords[0] += (i + 0.5) * grid.info.voxelSize;
+  coords[1] += (j + 0.5) * grid.info.voxelSize;
+  coords[2] += (k + 0.5) * grid.info.voxelSize;
   return coords;
 }
 
@@ -2241,6 +4364,7 @@ Vec3 Action_GIGist::coordsFromHGridPos(const std::tuple<int, int, int, int>& pos
  * @return double density weighted Delta G
  */
 double Action_GIGist::assignDensityWeightedDeltaG(
+  GistGrid &grid,
   int index,
   int shellNum,
   double densityValue,
@@ -2253,12 +4377,12 @@ double Action_GIGist::assignDensityWeightedDeltaG(
   for (int i = 0; i < shellNum; ++i) {
     /* current shell */
     auto shell = std::make_shared<std::vector<int>>(
-        shellcontainer_[shellcontainerKeys_[i]]);
+        grid.shellcontainer[grid.shellcontainerKeys[i]]);
     /* cycle through current shell */
     for (unsigned int j = 0; j < (*shell).size(); ++j) {
       /* get index and check if inside the grid */
       int tmpIndex = index + (*shell)[j];
-      if (0 < tmpIndex && tmpIndex < static_cast<int>(info_.grid.nVoxels))
+      if (0 < tmpIndex && tmpIndex < static_cast<int>(grid.info.nVoxels))
         /* add density weighted delta G to value */
         value += relPop[tmpIndex] * deltaG[tmpIndex];
     }
@@ -2267,16 +4391,16 @@ double Action_GIGist::assignDensityWeightedDeltaG(
   /* Get percentage of how much of the last shell shall be accounted for */
   double percentage = 1.0;
   if (last_shell != 0.0)
-    percentage -= (densityValue - 1 / (info_.grid.voxelVolume * info_.system.rho0)) / last_shell;
+    percentage -= (densityValue - 1 / (grid.info.voxelVolume * species_.at(grid.species).rho0)) / last_shell;
   /* identical to above but only last shell and percentage */
   auto outerShell = std::make_shared<std::vector<int>>(
-      shellcontainer_[shellcontainerKeys_[shellNum]]);
+      grid.shellcontainer[grid.shellcontainerKeys[shellNum]]);
   for (unsigned int i = 0; i < (*outerShell).size(); ++i) {
     int tmpIndex = index + (*outerShell)[i];
-    if (0 < tmpIndex && tmpIndex < static_cast<int>(info_.grid.nVoxels))
+    if (0 < tmpIndex && tmpIndex < static_cast<int>(grid.info.nVoxels))
       value += percentage * relPop[tmpIndex] * deltaG[tmpIndex];
   }
-  return value * info_.grid.voxelVolume * info_.system.rho0;
+  return value * grid.info.voxelVolume * species_.at(grid.species).rho0;
 }
 
 /**
@@ -2289,14 +4413,14 @@ double Action_GIGist::assignDensityWeightedDeltaG(
  *
  * @return double density value with the new water shell
  */
-double Action_GIGist::addWaterShell(double& densityValue, const std::vector<double>& relPop, const int index, const int shellNum) {
+double Action_GIGist::addWaterShell(GistGrid &grid, double& densityValue, const std::vector<double>& relPop, const int index, const int shellNum) {
   /* get shell from map */
   auto newShell = std::make_shared<std::vector<int>>(
-      shellcontainer_[shellcontainerKeys_[shellNum]]
+      grid.shellcontainer[grid.shellcontainerKeys[shellNum]]
   );
   for (unsigned int i = 0; i < (*newShell).size(); ++i) {
     int tmpIndex = index + (*newShell)[i];
-    if (0 < tmpIndex && tmpIndex < static_cast<int>(info_.grid.nVoxels))
+    if (0 < tmpIndex && tmpIndex < static_cast<int>(grid.info.nVoxels))
       densityValue += relPop[tmpIndex];
   }
   return densityValue;
@@ -2313,6 +4437,7 @@ double Action_GIGist::addWaterShell(double& densityValue, const std::vector<doub
  */
 void Action_GIGist::subtractWater
 (
+  GistGrid &grid,
   std::vector<double>& relPop,
   int index,
   int shellNum,
@@ -2323,10 +4448,10 @@ void Action_GIGist::subtractWater
   /* cycle through all but the last shell */
   for (int i = 0; i < shellNum; ++i) {
     auto shell = std::make_shared<std::vector<int>>(
-        shellcontainer_[shellcontainerKeys_[i]]);
+        grid.shellcontainer[grid.shellcontainerKeys[i]]);
     for (unsigned int j = 0; j < (*shell).size(); ++j) {
       int tmpIndex = index + (*shell)[j];
-      if (0 < tmpIndex && tmpIndex < static_cast<int>(info_.grid.nVoxels))
+      if (0 < tmpIndex && tmpIndex < static_cast<int>(grid.info.nVoxels))
         /* remove all population from the voxel in the GIST grid */
         relPop[tmpIndex] = 0.0;
     }
@@ -2336,13 +4461,13 @@ void Action_GIGist::subtractWater
   double last_shell = densityValue - densityValueOld; // density in last shell
   double percentage = 1.0;
   if (last_shell != 0.0)
-    percentage -= (densityValue - 1 / (info_.grid.voxelVolume * info_.system.rho0)) / last_shell;
+    percentage -= (densityValue - 1 / (grid.info.voxelVolume * species_.at(grid.species).rho0)) / last_shell;
   /* identical to before but only last shell and percentage */
   auto outerShell = std::make_shared<std::vector<int>>(
-      shellcontainer_[shellcontainerKeys_[shellNum]]);
+      grid.shellcontainer[grid.shellcontainerKeys[shellNum]]);
   for (unsigned int i = 0; i < (*outerShell).size(); ++i) {
     int tmpIndex = index + (*outerShell)[i];
-    if (0 < tmpIndex && tmpIndex < static_cast<int>(info_.grid.nVoxels))
+    if (0 < tmpIndex && tmpIndex < static_cast<int>(grid.info.nVoxels))
       relPop[tmpIndex] -= percentage * relPop[tmpIndex];
   }
 }
@@ -2358,6 +4483,7 @@ void Action_GIGist::subtractWater
  */
 void Action_GIGist::writeFebissPdb
 (
+  const GistGrid &grid,
   const int atomNumber,
   const Vec3& voxelCoords,
   const Vec3& h1,
@@ -2368,7 +4494,7 @@ void Action_GIGist::writeFebissPdb
   Vec3 h1Coords = h1 + voxelCoords;
   Vec3 h2Coords = h2 + voxelCoords;
 
-  febissWaterfile_->Printf(
+  grid.febissWaterfile->Printf(
     "HETATM%5d    O FEB     1    %8.3f%8.3f%8.3f%6.2f%7.2f           O  \n",
     atomNumber+1,
     voxelCoords[0],
@@ -2378,7 +4504,7 @@ void Action_GIGist::writeFebissPdb
     deltaG
   );
 
-  febissWaterfile_->Printf(
+  grid.febissWaterfile->Printf(
     "HETATM%5d    H FEB     1    %8.3f%8.3f%8.3f%6.2f%7.2f           H  \n",
     atomNumber+2,
     h1Coords[0],
@@ -2388,7 +4514,7 @@ void Action_GIGist::writeFebissPdb
     deltaG
   );
 
-  febissWaterfile_->Printf(
+  grid.febissWaterfile->Printf(
     "HETATM%5d    H FEB     1    %8.3f%8.3f%8.3f%6.2f%7.2f           H  \n",
     atomNumber+3,
     h2Coords[0],
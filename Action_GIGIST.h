@@ -48,11 +48,19 @@
 #include "Quaternion.h"
 #include "ExceptionsGIST.h"
 #include "LinkedCellGrid.h"
-
-
-#ifdef CUDA
-#include "cuda_kernel_gist/GistCudaSetup.cuh"
-#endif
+#include "VoxelPairMatrix.h"
+#include "ResidenceTracker.h"
+#include "DeterministicReduction.h"
+#include "EnergyBackend.h"
+#include "HydrationSites.h"
+#include "TileAccumulator.h"
+#include "AdaptiveOctree.h"
+#include "MrcFile.h"
+#include "CompressedStream.h"
+#include "ArrayView.h"
+#include "DistanceTransform.h"
+#include "BlockBootstrap.h"
+#include "VoxelQuery.h"
 
 
 #ifdef _OPENMP
@@ -126,7 +134,7 @@ public:
    * Calculate the number of data sets.
    * @return: The size of the dictionary.
    */
-  unsigned int size( void ) {
+  unsigned int size( void ) const {
     return this->names.size();
   }
 
@@ -136,7 +144,7 @@ public:
    * @return: The index of the testString, or -1 if testString is
    *           not in the data sets.
    */
-  int getIndex(std::string testString) {
+  int getIndex(std::string testString) const {
     for (unsigned int i = 0; i < this->names.size(); ++i) {
       if (testString.compare(this->names.at(i)) == 0) {
         return i;
@@ -159,7 +167,7 @@ public:
    * @argument idx: The index at which the data set is present.
    * @return: The name of the data set.
    */
-  std::string getElement(int idx) {
+  std::string getElement(int idx) const {
     return this->names.at(idx);
   }
 
@@ -200,14 +208,107 @@ public:
   // In Action_GIGIST.cpp
   // line: 61
   ~Action_GIGist();
-private:
 
-  struct TestObj {
-    std::unique_ptr<float []> recip;
-    std::unique_ptr<float []> ucell;
-    int boxinfo;
+  /**
+   * The normalized thermodynamic values of a single voxel, as written to the
+   * output file. Densities are per frame and cubic Angstrom.
+   */
+  struct VoxelValues {
+    double population = 0.0;
+    double dTStrans_norm = 0.0;
+    double dTStrans_dens = 0.0;
+    double dTSorient_norm = 0.0;
+    double dTSorient_dens = 0.0;
+    double dTSsix_norm = 0.0;
+    double dTSsix_dens = 0.0;
+    double Esw_norm = 0.0;
+    double Esw_dens = 0.0;
+    double Eww_norm = 0.0;
+    double Eww_dens = 0.0;
+    double order_norm = 0.0;
+    double neighbour_norm = 0.0;
+    double neighbour_dens = 0.0;
+    // Standard error of the six dimensional (or, without rotors, the
+    // translational) entropy per molecule, HUGE for fewer than two samples,
+    // and the fraction of the frames the entropies were calculated from, 0
+    // for empty voxels.
+    double dTS_error = 0.0;
+    double fraction = 1.0;
+    // Nearest neighbour searches of the entropies and those that may have
+    // missed a closer neighbour, added to the grid by addNNFailures.
+    int nnSearches = 0;
+    int nnTransFailures = 0;
+    int nnSixFailures = 0;
   };
 
+  /**
+   * Calculates the values of a single voxel from the accumulated data, only
+   * valid once all frames are processed. The entropies are only calculated
+   * for the requested voxels and cached, so repeated queries are cheap. Once
+   * the whole grid is calculated, the stored values are returned instead.
+   * @param gridIndex: The grid, in the order the grids were defined.
+   * @param voxel: The index of the voxel in that grid.
+   * @param values: Set to the values of the voxel.
+   * @return: false if the grid or voxel does not exist.
+   */
+  bool queryVoxel(int gridIndex, int voxel, VoxelValues &values);
+
+  /**
+   * Same as queryVoxel, for the voxel containing a point.
+   * @param point: Coordinates in the frame of the grid.
+   * @return: false if the point is not on the grid.
+   */
+  bool queryPoint(int gridIndex, const Vec3 &point, VoxelValues &values);
+
+  // Takes over the state of an action whose output was written, see kept.
+  Action_GIGist(Action_GIGist &&) = default;
+
+  /**
+   * Actions run with keep. cpptraj deletes its actions after run, so such an
+   * action moves its grids, samples and settings into a new object, which
+   * stays here until it is erased. The Python module reads them.
+   */
+  static std::vector<std::shared_ptr<Action_GIGist> > &kept();
+
+  int gridCount() const { return static_cast<int>( grids_.size() ); }
+
+  /**
+   * The geometry of a grid, as in the dx files.
+   * @param origin: Set to the corner of the grid.
+   * @return: false if the grid does not exist or is not fitted yet.
+   */
+  bool gridGeometry(int gridIndex, std::array<int, 3> &dims, std::array<double, 3> &origin, double &spacing) const;
+
+  /**
+   * @return: The names of the arrays of a grid that array can return.
+   */
+  std::vector<std::string> arrayNames(int gridIndex) const;
+
+  /**
+   * A view of an array of a grid, without a copy. Grids (the data sets and
+   * the g_ densities) have the shape of the grid in dx order, the samples are
+   * only available once the output was written. The view is valid as long as
+   * the action and the data sets of cpptraj exist.
+   * @param name: One of arrayNames.
+   * @return: false if the grid or the array does not exist.
+   */
+  bool array(int gridIndex, const std::string &name, ArrayView &view) const;
+
+  /**
+   * Calculates the entropies and normalized values of all voxels of a grid,
+   * unless the output did already (e.g., not with queryonly).
+   * @return: false if the grid does not exist or not all frames are processed.
+   */
+  bool calculateEntropy(int gridIndex);
+
+  /**
+   * Places the FEBISS waters of a grid, unless the output did already. Their
+   * coordinates are the array febiss.
+   * @return: false if the grid does not exist or febiss was not requested.
+   */
+  bool placeFebiss(int gridIndex);
+private:
+
   // Inherited Functions
 
   // Is called as an initializer of the object
@@ -235,44 +336,32 @@ private:
 
   // Functions defined to make the programmers life easier
 
-  // In: Action_GIGIST.cpp
-  // line: 874
-  double calcEnergy(double, int, int);
-
-  // In: Action_GIGIST.cpp
-  // line: 839
-  double calcDistanceSqrd(const ActionFrame&, int, int);
-
-  // In: Action_GIGIST.cpp
-  // line: 917
-  double calcElectrostaticEnergy(double, int, int);
-
-  // In: Action_GIGIST.cpp
-  // line: 935
-  double calcVdWEnergy(double, int, int);
-
-  // In: Action_GIGIST.cpp
-  // line: 950
-  std::array<double, 2> calcOrientEntropy(int);
-
-  // In: Action_GIGIST.cpp
-  // line: 981
-  std::pair<std::array<double, 4>, int> calcTransEntropy(int);
+  // Holds everything that belongs to a single grid, defined further below.
+  struct GistGrid;
 
+  // Samples of rotors (center, orientation, frame) and point particles such
+  // as ions (center, frame).
   using VecAndQuat = std::tuple<Vec3, Quaternion<DOUBLE_O_FLOAT>, int>;
+  using VecAndFrame = std::pair<Vec3, int>;
+  void voxelSamples(GistGrid&, int, std::vector<const VecAndQuat *> &, std::vector<const VecAndFrame *> &, const FrameSubset & = FrameSubset());
+  template<class Func>
+  void forLayerVoxels(const GistGrid&, int voxel, int n_layers, Func func) const;
+  double pointNearestNeighbor(GistGrid&, const VecAndFrame&, int, const FrameSubset & = FrameSubset());
+  int calcEntropy(GistGrid &grid, int voxel, VoxelValues &values, const FrameSubset &subset = FrameSubset());
+  int calcGridValues(GistGrid &grid);
   // In: Action_GIGIST.cpp
   // line: 1064
-  std::pair<int, int> calcTransEntropyDist(int, const VecAndQuat&, double &, double &);
+  std::pair<int, int> calcTransEntropyDist(GistGrid&, int, const VecAndQuat&, double &, double &, const FrameSubset & = FrameSubset());
 
   // In: Action_GIGIST.cpp
   // line: 1379
-  std::tuple<double, double, int> sixEntropyNearestNeighbor(const VecAndQuat&, int, int, double = HUGE, double = HUGE);
+  std::tuple<double, double, int> sixEntropyNearestNeighbor(GistGrid&, const VecAndQuat&, int, int, double = HUGE, double = HUGE, const FrameSubset & = FrameSubset());
 
   // In: Action_GIGIST.cpp
   // line: 1406
-  std::array<int, 3> getVoxelVec(int voxel) const;
+  std::array<int, 3> getVoxelVec(const GistGrid&, int voxel) const;
 
-  bool voxelIsAtGridBorder(int) const;
+  bool voxelIsAtGridBorder(const GistGrid&, int) const;
 
   // In: Action_GIGIST.cpp
   // line: 1082
@@ -280,7 +369,7 @@ private:
 
   // In: Action_GIGIST.cpp
   // line: 1058
-  void writeDxFile(std::string, const std::vector<double> &);
+  void writeDxFile(const GistGrid&, std::string, const std::vector<double> &);
 
   // In: Action_GIGIST.cpp
   // line: 
@@ -288,11 +377,11 @@ private:
 
   // In: Action_GIGIST.cpp
   // line: 
-  int bin(int begin, int end, const Vec3 &vec, const ActionFrame &frame);
+  int bin(GistGrid &grid, int begin, int end, const Vec3 &vec, const Frame &frame);
 
   // In: Action_GIGIST.cpp
   // line: 
-  void calcDipole(int begin, int end, int voxel, const ActionFrame &frame);
+  void calcDipole(GistGrid &grid, int begin, int end, int voxel, const Frame &frame);
 
   // In: Action_GIGIST.cpp
   // line: 
@@ -305,58 +394,106 @@ private:
 
   std::vector<int> calcQuaternionIndices(int atom_begin, int atom_end, const double *coordinates);
 
-  void calcGridStart() noexcept;
-  void calcGridEnd() noexcept;
+  void calcGridStart(GistGrid &grid) noexcept;
+  void calcGridEnd(GistGrid &grid) noexcept;
   void printCitationInfo() const noexcept;
   bool analyzeInfo(ArgList &argList);
   void getSystemInfo(ArgList &argList);
   void getGistSettings(ArgList &argList);
   bool buildGrid(ArgList &argList);
-  bool prepareGPUCalc(ActionSetup &setup);
+  bool buildSingleGrid(ArgList &argList, double voxelSize);
+  bool buildMaskGrid(ArgList &argList, double voxelSize);
+  void fitGridToMask(GistGrid &grid, const Frame &frame);
+  void cropGridToDensity(GistGrid &grid);
+  void allocateGrid(GistGrid &grid);
+  Action::RetType finishPendingGrids();
+  bool buildRefinementGrids();
+  void refineGrids();
+  void fitRefinementGrid(GistGrid &grid);
+  bool activeVoxel(const GistGrid &grid, long voxel) const;
+  void writeRefinedGrids();
+  bool writesGridFile(unsigned int set) const;
+  bool isFinalSet(unsigned int set) const;
+  void addProximity(const Frame &frame);
+  void writeProximity(const GistGrid &grid);
+  void recordBlock(GistGrid &grid);
+  void calcBootstrapErrors(GistGrid &grid);
+  void writeMrcFiles(const GistGrid &grid);
+  bool openDatafile(GistGrid &grid);
+  void closeDatafile(GistGrid &grid);
+  void writeCompressedDxFiles(const GistGrid &grid);
+  Action::RetType processFrame(const Frame &frame);
+  Action::RetType processDensityFrame(const Frame &frame);
+  void setupDensityAtoms(const Topology &top);
+  void resizeDensity(GistGrid &grid);
+  void printDensityGrid(GistGrid &grid);
+  void assignPairVoxels(const Frame &frame);
+  void addVoxelPairs(const std::vector<int> &voxels, int molecule, double energy);
+  void writePairMatrix(const GistGrid &grid) const;
+  void writeResidence(GistGrid &grid);
+  bool initAlignment(ArgList &argList, ActionInit &actionInit);
+  bool setupAlignment(const Topology &top);
+  void calcAlignment(const Frame &frame);
+  Vec3 atomXYZ(const Frame &frame, int atom) const;
+  Vec3 alignPoint(const Vec3 &point) const;
+  bool getSpecies(ArgList &argList);
+  int findSpecies(const Topology &top, const Molecule &mol) const;
   void resizeVectors();
-  void createDatasets(ArgList &argList, ActionInit &actionInit);
+  void createDatasets(ActionInit &actionInit);
+  void createGridDatasets(GistGrid &grid, const std::string &outfilename, ActionInit &actionInit);
+  void printGrid(GistGrid &grid);
+  void finishSums(GistGrid &grid);
+  VoxelValues calcVoxelValues(GistGrid &grid, int voxel, int &concerningNeighbors, int stride = 1);
+  VoxelValues progressiveValues(GistGrid &grid, int voxel, int &concerningNeighbors);
+  bool needsRefinement(const GistGrid &grid, int voxel, const VoxelValues &values) const;
+  VoxelValues storedValues(const GistGrid &grid, int voxel) const;
+  int pointVoxel(const GistGrid &grid, const std::array<double, 3> &point) const;
+  bool readQueryFile();
+  void writeQuery();
   void setMoleculeInformation(ActionSetup &setup);
-  void addAtomType(const Atom &atom);
   void setAtomInformation(
-    const ActionSetup &setup,
+    const Topology &top,
     const Molecule& mol,
-    bool firstRound
+    int species
   );
   void prepDensityGrids();
-  void prepQuaternion(ActionFrame &frame);
-  TestObj calcBoxParameters(const ActionFrame &frame);
+  void prepQuaternion(const Frame &frame);
+  bool setupEnergyBackend(const Topology &top);
+  void calcEnergyBox(const Frame &frame, GistEnergy::Box &box);
+  void addEnergies(const Frame &frame, const std::vector<std::vector<int> > &molVoxels, const std::vector<int> &molCenter);
+  bool calcOrderParameter(const Frame &frame, int center, double &order);
   void calcHVectors(
+    GistGrid &grid,
     int voxel,
     int headAtomIndex,
     const std::vector<Vec3> &molAtomCoords);
-  std::tuple<Vec3, int> prepCom(const Molecule& mol, const ActionFrame& frame);
-  std::tuple<
-    std::vector<DOUBLE_O_FLOAT>, 
-    std::vector<DOUBLE_O_FLOAT>,
-    std::vector<int>,
-    std::vector<int>
-  > calcGPUEnergy(const ActionFrame &frame);
-
-  void updateNNFailureCount(double NNd_sqr, double NNs_sqr);
+  Vec3 prepCom(const Molecule& mol, const Frame & frame);
+
+  void updateNNFailureCount(const GistGrid &grid, double NNd_sqr, double NNs_sqr, int &transFailures, int &sixFailures) const;
+  void addNNFailures(GistGrid &grid, const VoxelValues &values);
+  void throwIfSamePlace(GistGrid &grid);
   double sixVolumeCorrFactor(double) const;
 
   // Functions defined for FEBISS implementation
 
   // In: Action_GIGIST.cpp
   // line: 1183
-  void placeFebissWaters(void);
+  void placeFebissWaters(GistGrid &grid);
+
+  // Parallel hydration sites of any species, see HydrationSites.
+  void findHydrationSites(GistGrid &grid);
 
   // In: Action_GIGIST.cpp
   // line: 1281
-  void writeOutSolute(ActionFrame&);
+  void writeOutSolute(const Frame&);
 
   // In: Action_GIGIST.cpp
   // line: 1311
-  void determineGridShells(void);
+  void determineGridShells(GistGrid &grid);
 
   // In: Action_GIGIST.cpp
   // line: 1351
-  Vec3 coordsFromIndex(const int);
+  Vec3 coordsFromIndex(const GistGrid&, const int);
 
   // In: Action_GIGIST.cpp
   // line: 1367
@@ -384,51 +521,28 @@ private:
 
   // In: Action_GIGIST.cpp
   // line: 1510
-  double assignDensityWeightedDeltaG(const int, const int, const double, const double, const std::vector<double>&, const std::vector<double>&);
+  double assignDensityWeightedDeltaG(GistGrid&, const int, const int, const double, const double, const std::vector<double>&, const std::vector<double>&);
 
   // In: Action_GIGIST.cpp
   // line: 1552
-  double addWaterShell(double&, const std::vector<double>&, const int, const int);
+  double addWaterShell(GistGrid&, double&, const std::vector<double>&, const int, const int);
 
   // In: Action_GIGIST.cpp
   // line: 1573
-  void subtractWater(std::vector<double> &, const int, const int, const double, const double);
+  void subtractWater(GistGrid&, std::vector<double> &, const int, const int, const double, const double);
 
   // In: Action_GIGIST.cpp
   // line: 1610
-  void writeFebissPdb(const int, const Vec3&, const Vec3&, const Vec3&, const double);
+  void writeFebissPdb(const GistGrid&, const int, const Vec3&, const Vec3&, const Vec3&, const double);
 
   
 
   // Necessary Variables
 
-  // For CUDA use, store some more elements
-#ifdef CUDA
-  std::vector<float> lJParamsA_;
-  std::vector<float> lJParamsB_;
-  std::vector<int> NBIndex_;
-  int numberAtomTypes_;
-
-  // Arrays on GPU
-  int *NBindex_c_;
-  void *molecule_c_;
-  void *paramsLJ_c_;
-  float *result_w_c_;
-  float *result_s_c_;
-  int *result_O_c_;
-  int *result_N_c_;
-
-  // CUDA only functions
-
-  // In: Action_GIGIST.cpp
-  // line: 1087
-  void freeGPUMemory();
-
-  // In: Action_GIGIST.cpp
-  // line: 1112
-  void copyToGPU();
-
-#endif
+  // Energy calculation, chosen with the backend keyword, and its per-frame buffers.
+  std::unique_ptr<GistEnergy::Backend> energy_;
+  GistEnergy::Coordinates energyCoords_;
+  GistEnergy::Result energyResult_;
 
   // Dataset pointer
   DataSetList *list_;
@@ -437,7 +551,6 @@ private:
   struct Info {
     struct System {
       double temperature = 0.0;
-      double rho0 = 0.0;
       int numberSolvent = 0;
       int numberAtoms = 0;
       int numberSoluteAtoms = 0;
@@ -445,12 +558,6 @@ private:
     } system;
     struct Gist {
       int solventStart = -1;
-      std::string centerAtom;
-      int centerIdx = -1;
-      int centerType = -1;
-      int nearestNeighborSixFailures = 0;
-      int nearestNeighborTransFailures = 0;
-      int nearestNeighborTotal = 0;
       double neighborCutoff = 0.0;
       bool calcEnergy = true;
       bool writeDx = true;
@@ -458,6 +565,73 @@ private:
       bool useCOM = false;
       bool febiss = false;
       double idealWaterAngle_ = 0.0;
+      // Number of frames used to crop gridmask grids, 0 for no prepass.
+      int prepassFrames = 0;
+      // Octree levels below every grid, refined where the prepass density or
+      // its gradient (both relative to bulk) exceeds the thresholds.
+      int refineLevels = 0;
+      double refineDensity = 1.5;
+      double refineGradient = 1.0;
+      // Writes the refined grids resampled to the finest spacing.
+      bool refineOut = false;
+      // Writes every grid file also as MRC map, and all grids of a grid into
+      // one MRC volume stack (empty for none).
+      bool writeMrc = false;
+      std::string mrcStack;
+      // The table, compressed if the name ends in .gz or .zst.
+      std::string outFile;
+      // Compression extension (".gz", ".zst") of the grid files gigist names
+      // itself, empty for plain files.
+      std::string compressSuffix;
+      // Output file of the voxel-pair Eww matrix, empty if it is not calculated.
+      std::string pairFile;
+      double pairCutoff = 0.0;
+      // Output file of the residence times, empty if they are not calculated.
+      std::string residenceFile;
+      int residenceMax = 20;
+      // Results do not depend on the number of threads.
+      bool deterministic = false;
+      // Output file of the hydration sites, empty if they are not searched,
+      // the density threshold (relative to bulk) and the shell radius in Angstrom.
+      std::string sitesFile;
+      double siteThreshold = 2.0;
+      double siteRadius = 1.5;
+      // Only bins the solvent atoms, without samples, quaternions and energies.
+      bool densityOnly = false;
+      // Frames between two flushes of the float accumulators into double precision.
+      int flushInterval = 100;
+      // Population from which the samples of a voxel are split over the threads.
+      int splitPopulation = 1000;
+      // Voxels written to queryOut, queryOnly skips the output of the full grid.
+      std::string queryFile;
+      std::string queryOut;
+      bool queryOnly = false;
+      // The action is moved to kept() after the output is written.
+      bool keep = false;
+      // Aggregates by the distance to the nearest solute atom in bins of
+      // proximityWidth (none if 0) up to proximityMax, in Angstrom. The
+      // distances are of the first frame or, with proximityAverage, averaged.
+      double proximityWidth = 0.0;
+      double proximityMax = 10.0;
+      bool proximityAverage = false;
+      std::string proximityFile;
+      // Entropies are first calculated from every progressiveStride-th frame
+      // (all frames if 1), the stride is halved for voxels whose standard
+      // error exceeds progressiveError (kcal/mol), whose |Esw - TdS| exceeds
+      // progressiveDG (kcal/mol per voxel, off if 0) or that are closer than
+      // progressiveProximity (Angstrom, off if 0) to the solute.
+      int progressiveStride = 1;
+      double progressiveError = 0.1;
+      double progressiveDG = 0.0;
+      double progressiveProximity = 0.0;
+      // Replicates of the block bootstrap (none if 0), frames per block and
+      // seed of the draws.
+      int bootstrapReplicates = 0;
+      int bootstrapBlock = 100;
+      int bootstrapSeed = 1;
+      // Name of the energy backend, see GistEnergy::createBackend.
+      std::string backend;
+      GistEnergy::Options energyOptions;
     } gist;
     struct Grid {
       double voxelSize = 0.0;
@@ -467,27 +641,169 @@ private:
       Vec3 center;
       Vec3 start;
       Vec3 end;
-    } grid;
+    };
   } info_;
 
+  // Channels of GistGrid::sums.
+  enum SumChannel { SUM_EWW, SUM_ESW, SUM_NEIGHBOUR, SUM_ORDER, SUM_DIPOLE_X, SUM_DIPOLE_Y, SUM_DIPOLE_Z, N_SUMS };
+  // Channels of GistGrid::blockSums, followed by the counts of the elements.
+  enum BlockChannel { BLOCK_POPULATION, BLOCK_ESW, BLOCK_EWW, BLOCK_NEIGHBOUR, BLOCK_ORDER, N_BLOCK_CHANNELS };
+
+  /**
+   * All data belonging to one grid. Several grids can be analysed in a
+   * single pass, the per-molecule energies, quaternions and dipoles are
+   * then only calculated once and binned into every grid.
+   */
+  struct GistGrid {
+    Info::Grid info;
+    // The solvent species binned into this grid, index into species_.
+    int species = 0;
+    // Appended to data set and file names, empty for the first grid.
+    std::string suffix;
+    // Atoms a gridmask grid is fitted to and the padding around them. Such a
+    // grid is pending until the first frame(s) are known.
+    AtomMask fitMask;
+    double fitPad = 0.0;
+    bool pending = false;
+    std::vector<DataSet_3D*> result;
+    std::vector<std::vector<double> > resultV;
+    // Samples of the rotors and of the molecules without orientation.
+    LinkedCellGrid<VecAndQuat> centersAndRotations;
+    LinkedCellGrid<VecAndFrame> points;
+    std::vector<std::vector<Vec3>> hVectors;
+    std::map<double, std::vector<int>> shellcontainer;
+    std::vector<double> shellcontainerKeys;
+    // The table (out), compressed according to its name, opened for output.
+    std::string datafileName;
+    std::shared_ptr<CompressedStream> datafile;
+    CpptrajFile *febissWaterfile = nullptr;
+    CpptrajFile *sitesFile = nullptr;
+    int nearestNeighborSixFailures = 0;
+    int nearestNeighborTransFailures = 0;
+    int nearestNeighborTotal = 0;
+    // Voxels whose entropy found two molecules at the same place. Counted
+    // inside the parallel regions, the error is thrown after them.
+    int samePlaceVoxels = 0;
+    // A refinement grid covers the refined octree cells of its base grid
+    // (index into grids_) one level above its own, only the voxels in such
+    // cells are active. Base grids hold the octree.
+    int refineBase = -1;
+    int refineLevel = 0;
+    std::vector<char> activeVoxels;
+    AdaptiveOctree octree;
+    // Eww between pairs of voxels and the voxel of every molecule in the current frame.
+    VoxelPairMatrix ewwPairs;
+    std::vector<int> pairVoxels;
+    ResidenceTracker residence;
+    CpptrajFile *residenceFile = nullptr;
+    // Per-voxel sums of the energies, neighbours, order and dipoles over all
+    // frames, indexed by SumChannel.
+    TileAccumulator sums;
+    // Population (channel 0) and element counts (1 + element) of densityonly.
+    TileAccumulator density;
+    // Voxels already evaluated by queryVoxel before calcGridValues ran.
+    VoxelCache<VoxelValues> queryCache;
+    // Set once the entropies of all voxels are calculated and once the
+    // samples are compacted for the neighbour searches.
+    bool valuesDone = false;
+    bool samplesFrozen = false;
+    // Placed FEBISS waters: oxygen, both hydrogens (x, y, z each) and the
+    // density weighted free energy.
+    std::vector<double> febissSites;
+    // Sum of the distances of every voxel to the nearest solute atom over
+    // the frames counted in proximityFrames.
+    std::vector<double> proximity;
+    int proximityFrames = 0;
+    // Fraction of the frames the entropies of every voxel were calculated
+    // from, only with progressive.
+    std::vector<double> entropyFraction;
+    // Sums of every block of bootstrapBlock frames, block after block, voxel
+    // after voxel, indexed by BlockChannel. The totals up to the last block
+    // recorded, and the bootstrap standard errors by the name of the grid.
+    std::vector<float> blockSums;
+    std::vector<double> blockTotals;
+    std::map<std::string, std::vector<double> > bootstrapErrors;
+  };
+  std::vector<GistGrid> grids_;
+
+  /**
+   * Template of a solvent species. Every species has its own center atom,
+   * quaternion definition and atom densities. Without the species keyword,
+   * there is a single species holding all solvent molecules.
+   */
+  struct SolventSpecies {
+    // Residue name of the species, empty if all solvent molecules are used.
+    std::string name;
+    double rho0 = 0.0;
+    std::string centerAtom;
+    int centerIdx = -1;
+    int centerType = -1;
+    // Set after the first molecule of this species was processed.
+    bool templateSet = false;
+    std::vector<int> quatIndices;
+    // Element names and the number of atoms of each element in one molecule.
+    std::vector<std::string> elements;
+    std::vector<int> atomCounter;
+    // Index of the center atom in elements.
+    int centerElement = -1;
+    // Atomic element and index into elements of every atom of the first
+    // molecule, molecules with the same elements copy the indices.
+    std::vector<Atom::AtomicElementType> templateElements;
+    std::vector<int> templateIndices;
+
+    int elementIndex(const std::string &element) const {
+      for (unsigned int i = 0; i < elements.size(); ++i) {
+        if (elements[i] == element) {
+          return i;
+        }
+      }
+      return -1;
+    }
+  };
+  std::vector<SolventSpecies> species_;
+  // Species index of every molecule, -1 if the molecule is not analysed.
+  std::vector<int> molSpecies_;
+
+  // Solvent atoms binned in densityonly mode, per species. Center atoms also
+  // count for the population, unless the center of mass is used.
+  struct DensityAtom {
+    int atom;
+    int element;
+    bool center;
+  };
+  std::vector<std::vector<DensityAtom> > densityAtoms_;
+
+  // Frames kept until all gridmask grids are fitted, these are processed afterwards.
+  std::vector<Frame> prepassBuffer_;
+  bool gridsPending_ = false;
+
+  // Entries of the query file, either a voxel index or a point
+  // (voxel -1), and the file they are written to.
+  std::vector<VoxelQuery::Entry> queryEntries_;
+  CpptrajFile *queryOutfile_ = nullptr;
+
+  // Fit of the solute onto a reference (align keyword). Only the coordinates
+  // that are actually used for binning are transformed, see atomXYZ.
+  bool align_ = false;
+  bool alignRefSet_ = false;
+  AtomMask alignMask_;
+  Frame alignRef_;
+  Frame alignFrame_;
+  Matrix_3x3 alignRot_;
+  Vec3 alignTgtTrans_;
+  Vec3 alignRefTrans_;
+
   // Topology Object
   Topology *top_;
   ImageOption image_;
 
-  // Defining the Grid
-  
-
-  // Vector to store the result
-  std::vector<DataSet_3D*> result_;
-  std::vector<std::vector<double> > resultV_;
-
-  LinkedCellGrid<VecAndQuat> centersAndRotations_;
   std::vector<DOUBLE_O_FLOAT> charges_;
   std::vector<int> molecule_;
   std::vector<int> atomTypes_;
   std::vector<double> masses_;
-
-  std::vector<int> quat_indices_;
+  // Index into the elements of its species of every solvent atom, -1 for
+  // all other atoms. Set once in Setup, so that frames do not compare names.
+  std::vector<int> atomElement_;
 
   // Is a usual array, as std::vector<bool> is actually not a vector storing boolean
   // values but a bit string with the boolean values encoded at each position.
@@ -497,16 +813,8 @@ private:
   int nSoluteAtoms_ = 0;
   double idealWaterAngle_ = 104.57;
 
-  std::vector<std::vector<Vec3>> hVectors_;
-  std::map<double, std::vector<int>> shellcontainer_;
-  std::vector<double> shellcontainerKeys_;
   DataDictionary dict_;
 
-  CpptrajFile *datafile_;
-  CpptrajFile *dxfile_;
-  CpptrajFile *febissWaterfile_;
-
-  std::vector<int> solventAtomCounter_;
   bool wrongNumberOfAtoms_;
 
   Timer tRot_;
@@ -0,0 +1,246 @@
+#ifndef ADAPTIVE_OCTREE_H
+#define ADAPTIVE_OCTREE_H
+
+#include <array>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Decides where a grid is refined. The cells of level 0 are the voxels of a
+ * base grid, every level halves the cell size, so a cell of level l has eight
+ * children on level l + 1. A cell is refined if the density relative to the
+ * bulk exceeds a threshold, or if the densities of its children differ by
+ * more than a threshold, i.e., at interfaces. Only children of refined cells
+ * are candidates on the next level.
+ *
+ * The points are given in units of base voxels relative to the grid corner.
+ * The flags of every level are stored densely, level l holding 8^l times the
+ * number of base voxels. Data is stored with the third index running fastest,
+ * as in the dx files.
+ */
+class AdaptiveOctree {
+public:
+  using Index = std::array<int, 3>;
+  using Point = std::array<double, 3>;
+
+  AdaptiveOctree(int nx = 0, int ny = 0, int nz = 0, int maxLevel = 0)
+  {
+    resize(nx, ny, nz, maxLevel);
+  }
+
+  /**
+   * Sets the base grid, all cells are unrefined afterwards.
+   * @param maxLevel: The finest level, cells of the levels 0 to maxLevel - 1
+   *                  can be refined.
+   */
+  void resize(int nx, int ny, int nz, int maxLevel)
+  {
+    m_base = Index{ { nx, ny, nz } };
+    m_refined.resize(maxLevel);
+    for (int level = 0; level < maxLevel; ++level) {
+      Index d{ dims(level) };
+      m_refined[level].assign(static_cast<std::size_t>(d[0]) * d[1] * d[2], 0);
+    }
+  }
+
+  int maxLevel() const { return static_cast<int>(m_refined.size()); }
+
+  /**
+   * @return: The number of cells along each axis on a level.
+   */
+  Index dims(int level) const
+  {
+    return Index{ { m_base[0] << level, m_base[1] << level, m_base[2] << level } };
+  }
+
+  /**
+   * Refines the cells.
+   * @param points: The points, e.g., solvent molecules of several frames.
+   * @param bulk: Number of points expected in one base voxel in the bulk.
+   * @param densityThreshold: Cells denser than this (relative to bulk) are refined.
+   * @param gradientThreshold: Cells whose children differ by more than this
+   *                           in their relative density are refined.
+   */
+  void build(const std::vector<Point> &points, double bulk, double densityThreshold, double gradientThreshold)
+  {
+    resize(m_base[0], m_base[1], m_base[2], maxLevel());
+    for (int level = 0; level < maxLevel(); ++level) {
+      const Index childDims{ dims(level + 1) };
+      const double scale{ static_cast<double>(1 << (level + 1)) };
+      // Points in the children of the candidate cells.
+      std::unordered_map<long, int> childCounts{};
+      for (const Point &point : points) {
+        Index child{};
+        if (!cellOf(point, scale, childDims, child)) {
+          continue;
+        }
+        Index parent{ { child[0] / 2, child[1] / 2, child[2] / 2 } };
+        if (level > 0 && !refined(level - 1, parent[0] / 2, parent[1] / 2, parent[2] / 2)) {
+          continue;
+        }
+        ++childCounts[linear(childDims, child)];
+      }
+      // The eight children of every cell holding points.
+      std::unordered_map<long, std::array<int, 8> > cells{};
+      const Index d{ dims(level) };
+      for (const auto &entry : childCounts) {
+        Index child{ unravel(childDims, entry.first) };
+        Index parent{ { child[0] / 2, child[1] / 2, child[2] / 2 } };
+        int octant{ (child[0] % 2) * 4 + (child[1] % 2) * 2 + child[2] % 2 };
+        auto cell = cells.find(linear(d, parent));
+        if (cell == cells.end()) {
+          cell = cells.insert({ linear(d, parent), std::array<int, 8>{} }).first;
+        }
+        cell->second[octant] = entry.second;
+      }
+      const double cellBulk{ bulk / std::pow(8.0, level) };
+      for (const auto &cell : cells) {
+        int total{ 0 };
+        int low{ cell.second[0] };
+        int high{ cell.second[0] };
+        for (int count : cell.second) {
+          total += count;
+          low = count < low ? count : low;
+          high = count > high ? count : high;
+        }
+        double density{ total / cellBulk };
+        double gradient{ (high - low) / (cellBulk / 8.0) };
+        if (density > densityThreshold || gradient > gradientThreshold) {
+          m_refined[level][cell.first] = 1;
+        }
+      }
+    }
+  }
+
+  /**
+   * @return: true if the cell of the level is refined, false for cells
+   *          outside of the grid.
+   */
+  bool refined(int level, int i, int j, int k) const
+  {
+    const Index d{ dims(level) };
+    if (level < 0 || level >= maxLevel() || i < 0 || j < 0 || k < 0 || i >= d[0] || j >= d[1] || k >= d[2]) {
+      return false;
+    }
+    return m_refined[level][linear(d, Index{ { i, j, k } })] != 0;
+  }
+
+  /**
+   * @return: The number of refined cells of a level.
+   */
+  int refinedCells(int level) const
+  {
+    int n{ 0 };
+    for (char flag : m_refined.at(level)) {
+      n += flag;
+    }
+    return n;
+  }
+
+  /**
+   * The bounding box of the refined cells of a level.
+   * @param low, high: The first and last refined cell along each axis.
+   * @return: false if no cell of the level is refined.
+   */
+  bool bounds(int level, Index &low, Index &high) const
+  {
+    const Index d{ dims(level) };
+    low = d;
+    high = Index{ { -1, -1, -1 } };
+    for (long cell = 0; cell < static_cast<long>(m_refined.at(level).size()); ++cell) {
+      if (m_refined[level][cell]) {
+        Index idx{ unravel(d, cell) };
+        for (int i = 0; i < 3; ++i) {
+          low[i] = idx[i] < low[i] ? idx[i] : low[i];
+          high[i] = idx[i] > high[i] ? idx[i] : high[i];
+        }
+      }
+    }
+    return high[0] != -1;
+  }
+
+  /**
+   * @return: The finest level whose cell holds the point, i.e., one more than
+   *          the deepest refined cell, -1 outside of the grid.
+   */
+  int leafLevel(const Point &point) const
+  {
+    Index base{};
+    if (!cellOf(point, 1.0, m_base, base)) {
+      return -1;
+    }
+    int level{ 0 };
+    while (level < maxLevel()) {
+      Index cell{};
+      cellOf(point, static_cast<double>(1 << level), dims(level), cell);
+      if (!refined(level, cell[0], cell[1], cell[2])) {
+        break;
+      }
+      ++level;
+    }
+    return level;
+  }
+
+  /**
+   * Whether a voxel of a refinement grid is at its border, i.e., on the faces
+   * of the grid or next to a voxel outside of the refined cells. Only active
+   * voxels hold samples, so the neighbour searches of such a voxel find
+   * nothing on its outer side.
+   * @param dims: The number of voxels along each axis.
+   * @param active: Flag of every voxel, all voxels are active if empty.
+   * @param voxel: Index of the voxel.
+   */
+  static bool atBorder(const Index &dims, const std::vector<char> &active, long voxel)
+  {
+    const Index idx{ unravel(dims, voxel) };
+    for (int i = 0; i < 3; ++i) {
+      if (idx[i] <= 0 || idx[i] >= dims[i] - 1) {
+        return true;
+      }
+    }
+    if (active.empty()) {
+      return false;
+    }
+    for (int di = -1; di <= 1; ++di) {
+      for (int dj = -1; dj <= 1; ++dj) {
+        for (int dk = -1; dk <= 1; ++dk) {
+          if (!active[linear(dims, Index{ { idx[0] + di, idx[1] + dj, idx[2] + dk } })]) {
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+private:
+  static long linear(const Index &d, const Index &idx)
+  {
+    return (static_cast<long>(idx[0]) * d[1] + idx[1]) * d[2] + idx[2];
+  }
+
+  static Index unravel(const Index &d, long cell)
+  {
+    return Index{ { static_cast<int>(cell / (static_cast<long>(d[1]) * d[2])),
+                    static_cast<int>((cell / d[2]) % d[1]),
+                    static_cast<int>(cell % d[2]) } };
+  }
+
+  static bool cellOf(const Point &point, double scale, const Index &d, Index &cell)
+  {
+    for (int i = 0; i < 3; ++i) {
+      double x{ std::floor(point[i] * scale) };
+      if (x < 0 || x >= d[i]) {
+        return false;
+      }
+      cell[i] = static_cast<int>(x);
+    }
+    return true;
+  }
+
+  Index m_base;
+  std::vector<std::vector<char> > m_refined;
+};
+
+#endif
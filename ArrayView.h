@@ -0,0 +1,101 @@
+#ifndef ARRAY_VIEW_H
+#define ARRAY_VIEW_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Describes memory owned by someone else as an n-dimensional array, in the
+ * terms of the Python buffer protocol (format character, shape and strides
+ * in bytes), so that it can be handed to NumPy without a copy.
+ *
+ * Besides plain contiguous arrays, a view can pick a field out of an array
+ * of records, e.g., the centers of the samples stored as tuples. The stride
+ * between elements is then the size of a record.
+ */
+struct ArrayView {
+  const void *data = nullptr;
+  // 'f' float, 'd' double, 'i' int.
+  char format = 'd';
+  std::size_t itemSize = 0;
+  std::vector<std::size_t> shape;
+  std::vector<std::ptrdiff_t> strides;
+
+  template<class T> static char formatOf();
+
+  /**
+   * A C-contiguous array, the last index runs fastest.
+   * @param data: The first element.
+   * @param shape: The extent along each axis.
+   */
+  template<class T>
+  static ArrayView contiguous(const T *data, const std::vector<std::size_t> &shape)
+  {
+    ArrayView view{};
+    view.data = data;
+    view.format = formatOf<T>();
+    view.itemSize = sizeof(T);
+    view.shape = shape;
+    view.strides.resize(shape.size());
+    std::ptrdiff_t stride{ static_cast<std::ptrdiff_t>(sizeof(T)) };
+    for (std::size_t axis = shape.size(); axis > 0; --axis) {
+      view.strides[axis - 1] = stride;
+      stride *= static_cast<std::ptrdiff_t>(shape[axis - 1]);
+    }
+    return view;
+  }
+
+  /**
+   * A field of every record in an array of records, shape (n) for a single
+   * value, (n, components) for consecutive values of the same type.
+   * @param records: The first record, nullptr if there are none.
+   * @param n: The number of records.
+   * @param field: Gives the address of the field in a record.
+   */
+  template<class T, class Record, class Field>
+  static ArrayView field(const Record *records, std::size_t n, Field field, std::size_t components = 1)
+  {
+    ArrayView view{};
+    view.format = formatOf<T>();
+    view.itemSize = sizeof(T);
+    view.shape.push_back(n);
+    view.strides.push_back(sizeof(Record));
+    if (components > 1) {
+      view.shape.push_back(components);
+      view.strides.push_back(sizeof(T));
+    }
+    if (records != nullptr && n > 0) {
+      view.data = field(*records);
+    }
+    return view;
+  }
+
+  std::size_t size() const
+  {
+    std::size_t n{ 1 };
+    for (std::size_t extent : shape) {
+      n *= extent;
+    }
+    return n;
+  }
+
+  /**
+   * @return: The element at an index, no bounds checks.
+   */
+  template<class T>
+  const T &at(const std::vector<std::size_t> &index) const
+  {
+    const char *address{ static_cast<const char *>(data) };
+    for (std::size_t axis = 0; axis < index.size(); ++axis) {
+      address += static_cast<std::ptrdiff_t>(index[axis]) * strides[axis];
+    }
+    return *reinterpret_cast<const T *>(address);
+  }
+};
+
+template<> inline char ArrayView::formatOf<float>() { return 'f'; }
+template<> inline char ArrayView::formatOf<double>() { return 'd'; }
+template<> inline char ArrayView::formatOf<int>() { return 'i'; }
+
+#endif
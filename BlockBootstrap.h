@@ -0,0 +1,152 @@
+#ifndef BLOCK_BOOTSTRAP_H
+#define BLOCK_BOOTSTRAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+/**
+ * The frames (counted from 1) an estimate is calculated from, each with a
+ * weight. Either every stride-th frame with weight one, or blocks of
+ * blockLength consecutive frames, weighted by the number of times the block
+ * was drawn. The default contains every frame once.
+ */
+struct FrameSubset {
+  int stride = 1;
+  int blockLength = 0;
+  std::vector<int> blockWeights;
+
+  bool all() const { return stride == 1 && blockWeights.empty(); }
+
+  /**
+   * @return: The weight of a frame, 0 if it is not part of the subset.
+   */
+  int weight(int frame) const
+  {
+    if (!blockWeights.empty()) {
+      const std::size_t block{ static_cast<std::size_t>( (frame - 1) / blockLength ) };
+      return block < blockWeights.size() ? blockWeights[block] : 0;
+    }
+    return stride == 1 || (frame - 1) % stride == 0 ? 1 : 0;
+  }
+
+  /**
+   * @return: The number of the first nFrames frames that are part of the
+   *          subset, regardless of their weight.
+   */
+  int distinctFrames(int nFrames) const
+  {
+    if (blockWeights.empty()) {
+      return nFrames > 0 ? (nFrames - 1) / stride + 1 : 0;
+    }
+    int frames{ 0 };
+    for (std::size_t block = 0; block < blockWeights.size(); ++block) {
+      if (blockWeights[block] > 0) {
+        frames += blockFrames(block, nFrames);
+      }
+    }
+    return frames;
+  }
+
+  /**
+   * @return: The sum of the weights of the first nFrames frames.
+   */
+  int weightedFrames(int nFrames) const
+  {
+    if (blockWeights.empty()) {
+      return distinctFrames(nFrames);
+    }
+    int frames{ 0 };
+    for (std::size_t block = 0; block < blockWeights.size(); ++block) {
+      frames += blockWeights[block] * blockFrames(block, nFrames);
+    }
+    return frames;
+  }
+
+private:
+  // The last block can be shorter.
+  int blockFrames(std::size_t block, int nFrames) const
+  {
+    const int first{ static_cast<int>( block ) * blockLength };
+    return std::max(0, std::min(blockLength, nFrames - first));
+  }
+};
+
+/**
+ * Moving block bootstrap over the frames of a trajectory. The frames are cut
+ * into consecutive blocks, long enough to hold the correlation of the
+ * samples, and every replicate draws as many blocks with replacement. The
+ * draws of a replicate only depend on the seed and its index, so replicates
+ * can be evaluated in any order and on any number of threads.
+ */
+class BlockBootstrap {
+public:
+  /**
+   * @param nFrames: The number of frames.
+   * @param blockLength: Frames per block, the last block may be shorter.
+   * @param seed: Seed of the draws.
+   */
+  BlockBootstrap(int nFrames, int blockLength, unsigned int seed)
+  : m_nFrames{ nFrames }
+  , m_blockLength{ std::max(1, blockLength) }
+  , m_seed{ seed }
+  {}
+
+  int blocks() const { return m_nFrames > 0 ? (m_nFrames - 1) / m_blockLength + 1 : 0; }
+
+  /**
+   * @return: The block of a frame, counted from 1.
+   */
+  int block(int frame) const { return (frame - 1) / m_blockLength; }
+
+  /**
+   * @return: The blocks drawn for a replicate, as the number of times each
+   *          block was drawn.
+   */
+  FrameSubset replicate(int index) const
+  {
+    FrameSubset subset{};
+    subset.blockLength = m_blockLength;
+    subset.blockWeights.assign(blocks(), 0);
+    if (blocks() == 0) {
+      return subset;
+    }
+    std::seed_seq seq{ m_seed, static_cast<unsigned int>( index ) };
+    std::mt19937 rng{ seq };
+    std::uniform_int_distribution<int> draw(0, blocks() - 1);
+    for (int i = 0; i < blocks(); ++i) {
+      ++subset.blockWeights[draw(rng)];
+    }
+    return subset;
+  }
+
+  /**
+   * @return: The standard deviation of the values of the replicates, i.e.,
+   *          the bootstrap standard error, 0 for fewer than two values.
+   */
+  static double standardError(const std::vector<double> &values)
+  {
+    const std::size_t n{ values.size() };
+    if (n < 2) {
+      return 0.0;
+    }
+    double mean{ 0.0 };
+    for (double value : values) {
+      mean += value;
+    }
+    mean /= n;
+    double squares{ 0.0 };
+    for (double value : values) {
+      squares += (value - mean) * (value - mean);
+    }
+    return std::sqrt(squares / (n - 1));
+  }
+
+private:
+  int m_nFrames;
+  int m_blockLength;
+  unsigned int m_seed;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef COMPRESSED_STREAM_H
+#define COMPRESSED_STREAM_H
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef HASGZ
+#include <zlib.h>
+#endif
+#ifdef HASZSTD
+#include <zstd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Buffer of CompressedStream. The output is collected in one block per
+ * thread, and once all blocks are full, they are compressed in parallel, each
+ * into its own gzip member or zstd frame, and written in order. Concatenated
+ * members and frames form valid files for the usual tools, and compression
+ * keeps up with the formatting of the output instead of running on a single
+ * core.
+ */
+class CompressedBuffer : public std::streambuf {
+public:
+  enum class Format { PLAIN, GZIP, ZSTD };
+
+  // Uncompressed bytes per block.
+  static constexpr int BLOCK_SIZE = 1 << 20;
+
+  /**
+   * @return: GZIP for names ending in .gz, ZSTD for .zst, PLAIN otherwise.
+   */
+  static Format formatOf(const std::string &name)
+  {
+    if (endsWith(name, ".gz")) {
+      return Format::GZIP;
+    }
+    if (endsWith(name, ".zst")) {
+      return Format::ZSTD;
+    }
+    return Format::PLAIN;
+  }
+
+  /**
+   * @return: false if the format was not compiled in (HASGZ, HASZSTD).
+   */
+  static bool supported(Format format)
+  {
+    switch (format) {
+      case Format::GZIP:
+#ifdef HASGZ
+        return true;
+#else
+        return false;
+#endif
+      case Format::ZSTD:
+#ifdef HASZSTD
+        return true;
+#else
+        return false;
+#endif
+      default:
+        return true;
+    }
+  }
+
+  /**
+   * @return: The compression extension of a name (e.g., ".gz"), empty for
+   *          plain files.
+   */
+  static std::string compressionSuffix(const std::string &name)
+  {
+    switch (formatOf(name)) {
+      case Format::GZIP:
+        return ".gz";
+      case Format::ZSTD:
+        return ".zst";
+      default:
+        return "";
+    }
+  }
+
+  ~CompressedBuffer()
+  {
+    close();
+  }
+
+  bool open(const std::string &name)
+  {
+    close();
+    m_format = formatOf(name);
+    m_failed = !supported(m_format);
+    if (m_failed) {
+      return false;
+    }
+    m_file.open(name.c_str(), std::ios::binary);
+    if (!m_file) {
+      m_failed = true;
+      return false;
+    }
+#ifdef _OPENMP
+    int nBlocks{ m_format == Format::PLAIN ? 1 : omp_get_max_threads() };
+#else
+    int nBlocks{ 1 };
+#endif
+    m_buffer.resize(static_cast<std::size_t>(nBlocks) * BLOCK_SIZE);
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+    return true;
+  }
+
+  /**
+   * Writes the remaining data and closes the file.
+   * @return: false if anything could not be compressed or written.
+   */
+  bool close()
+  {
+    if (m_file.is_open()) {
+      writeBuffer();
+      m_file.close();
+      m_failed = m_failed || m_file.fail();
+    }
+    setp(nullptr, nullptr);
+    std::vector<char>().swap(m_buffer);
+    return !m_failed;
+  }
+
+  bool failed() const { return m_failed; }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    if (!m_file.is_open()) {
+      return traits_type::eof();
+    }
+    writeBuffer();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return m_failed ? traits_type::eof() : traits_type::not_eof(ch);
+  }
+
+private:
+  static bool endsWith(const std::string &name, const std::string &end)
+  {
+    return name.size() >= end.size() && name.compare(name.size() - end.size(), end.size(), end) == 0;
+  }
+
+  // Compresses and writes everything in the buffer, then empties it.
+  void writeBuffer()
+  {
+    const std::size_t size{ static_cast<std::size_t>(pptr() - pbase()) };
+    if (m_format == Format::PLAIN) {
+      m_file.write(pbase(), size);
+    } else {
+      const int nBlocks{ static_cast<int>((size + BLOCK_SIZE - 1) / BLOCK_SIZE) };
+      std::vector<std::vector<char> > compressed(nBlocks);
+      bool failed{ false };
+      #pragma omp parallel for reduction(||:failed)
+      for (int b = 0; b < nBlocks; ++b) {
+        const std::size_t begin{ static_cast<std::size_t>(b) * BLOCK_SIZE };
+        const std::size_t length{ std::min<std::size_t>(BLOCK_SIZE, size - begin) };
+        failed = !compress(pbase() + begin, length, compressed[b]) || failed;
+      }
+      m_failed = m_failed || failed;
+      for (const std::vector<char> &block : compressed) {
+        m_file.write(block.data(), block.size());
+      }
+    }
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+  }
+
+  bool compress(const char *data, std::size_t size, std::vector<char> &out) const
+  {
+#ifdef HASGZ
+    if (m_format == Format::GZIP) {
+      z_stream stream{};
+      // 15 + 16: largest window with a gzip header.
+      if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+      }
+      out.resize(deflateBound(&stream, size));
+      stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+      stream.avail_in = static_cast<uInt>(size);
+      stream.next_out = reinterpret_cast<Bytef *>(out.data());
+      stream.avail_out = static_cast<uInt>(out.size());
+      int ret{ deflate(&stream, Z_FINISH) };
+      out.resize(stream.total_out);
+      deflateEnd(&stream);
+      return ret == Z_STREAM_END;
+    }
+#endif
+#ifdef HASZSTD
+    if (m_format == Format::ZSTD) {
+      out.resize(ZSTD_compressBound(size));
+      std::size_t length{ ZSTD_compress(out.data(), out.size(), data, size, 3) };
+      if (ZSTD_isError(length)) {
+        return false;
+      }
+      out.resize(length);
+      return true;
+    }
+#endif
+    (void)data;
+    (void)size;
+    (void)out;
+    return false;
+  }
+
+  Format m_format = Format::PLAIN;
+  bool m_failed = false;
+  std::ofstream m_file;
+  std::vector<char> m_buffer;
+};
+
+/**
+ * Output file stream, compressed according to the file name (.gz or .zst).
+ * Printf formats like CpptrajFile::Printf.
+ */
+class CompressedStream : public std::ostream {
+public:
+  CompressedStream() : std::ostream(nullptr)
+  {
+    rdbuf(&m_buffer);
+  }
+
+  explicit CompressedStream(const std::string &name) : CompressedStream()
+  {
+    open(name);
+  }
+
+  ~CompressedStream()
+  {
+    close();
+  }
+
+  /**
+   * @return: false if the file could not be opened or its compression is
+   *          not available.
+   */
+  bool open(const std::string &name)
+  {
+    clear();
+    if (!m_buffer.open(name)) {
+      setstate(std::ios::failbit);
+      return false;
+    }
+    return true;
+  }
+
+  bool close()
+  {
+    return m_buffer.close();
+  }
+
+  void Printf(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int length{ std::vsnprintf(nullptr, 0, format, copy) };
+    va_end(copy);
+    if (length > 0) {
+      m_line.resize(length + 1);
+      std::vsnprintf(m_line.data(), m_line.size(), format, args);
+      write(m_line.data(), length);
+    }
+    va_end(args);
+  }
+
+private:
+  CompressedBuffer m_buffer;
+  std::vector<char> m_line;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef DETERMINISTIC_REDUCTION_H
+#define DETERMINISTIC_REDUCTION_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/**
+ * Helpers for reductions whose result does not depend on the number of
+ * threads. Work is split into blocks of a fixed size, every block is reduced
+ * serially and the block results are combined in a fixed order.
+ */
+namespace DeterministicReduction {
+
+// Number of atoms handled by one block of the pair loop.
+constexpr int BLOCK_SIZE = 512;
+
+/**
+ * @return The number of blocks needed for n elements.
+ */
+inline int numberOfBlocks(int n)
+{
+  return (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/**
+ * Sums the values by a pairwise tree reduction. The order of the additions
+ * only depends on the number of values.
+ * @param values: The values to sum, e.g. the partial sums of the blocks.
+ * @param begin: The first value to use.
+ * @param end: One past the last value to use.
+ * @return The sum of the values.
+ */
+template<class T>
+T pairwiseSum(const std::vector<T> &values, std::size_t begin, std::size_t end)
+{
+  if (end <= begin) {
+    return T{};
+  }
+  if (end - begin == 1) {
+    return values[begin];
+  }
+  std::size_t mid{ begin + (end - begin) / 2 };
+  return pairwiseSum(values, begin, mid) + pairwiseSum(values, mid, end);
+}
+
+template<class T>
+T pairwiseSum(const std::vector<T> &values)
+{
+  return pairwiseSum(values, 0, values.size());
+}
+
+/**
+ * Keeps the K nearest neighbours. Ties in the distance are broken by the
+ * index, so the result does not depend on the order of insertion.
+ */
+template<int K>
+class NearestNeighbors {
+public:
+  NearestNeighbors()
+  {
+    m_distances.fill(std::numeric_limits<double>::max());
+    m_indices.fill(-1);
+  }
+
+  /**
+   * Inserts a neighbour, if it is closer than the current K-th neighbour.
+   * @param distance: The (squared) distance of the neighbour.
+   * @param index: The index of the neighbour.
+   */
+  void insert(double distance, int index)
+  {
+    if (!closer(distance, index, m_distances[K - 1], m_indices[K - 1])) {
+      return;
+    }
+    int pos{ K - 1 };
+    while (pos > 0 && closer(distance, index, m_distances[pos - 1], m_indices[pos - 1])) {
+      m_distances[pos] = m_distances[pos - 1];
+      m_indices[pos] = m_indices[pos - 1];
+      --pos;
+    }
+    m_distances[pos] = distance;
+    m_indices[pos] = index;
+  }
+
+  /**
+   * Inserts all neighbours of another list.
+   */
+  void merge(const NearestNeighbors &other)
+  {
+    for (int i = 0; i < K && other.m_indices[i] != -1; ++i) {
+      insert(other.m_distances[i], other.m_indices[i]);
+    }
+  }
+
+  /**
+   * @return The index of the i-th nearest neighbour, -1 if there are fewer
+   *         than i + 1 neighbours.
+   */
+  int index(int i) const { return m_indices[i]; }
+  double distance(int i) const { return m_distances[i]; }
+
+private:
+  static bool closer(double d1, int i1, double d2, int i2)
+  {
+    return d1 < d2 || (d1 == d2 && (i2 == -1 || i1 < i2));
+  }
+
+  std::array<double, K> m_distances;
+  std::array<int, K> m_indices;
+};
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef DISTANCE_TRANSFORM_H
+#define DISTANCE_TRANSFORM_H
+
+#include <array>
+#include <vector>
+
+/**
+ * Exact Euclidean distance transform of a grid after Felzenszwalb and
+ * Huttenlocher (Theory of Computing 8, 2012): the squared distance of every
+ * voxel center to the nearest seed voxel center, in units of voxels.
+ *
+ * The transform is separable, it runs along the third, the second and the
+ * first axis in turn. Every pass computes the lower envelope of parabolas on
+ * each line of the axis; the lines are independent and are distributed over
+ * the threads. Data is stored with the third index running fastest, as in
+ * the dx files.
+ */
+class DistanceTransform {
+public:
+  // Value of voxels without any seed on the grid.
+  static constexpr double FAR = 1e20;
+
+  /**
+   * @param dims: The number of voxels along each axis.
+   * @param seeds: The indices of the seed voxels, duplicates are allowed.
+   * @return: The squared distances, FAR or larger if there is no seed.
+   */
+  static std::vector<double> squared(const std::array<int, 3> &dims, const std::vector<int> &seeds)
+  {
+    const long n{ static_cast<long>(dims[0]) * dims[1] * dims[2] };
+    // A prvalue, binding FAR itself to a reference needs a definition in C++11.
+    std::vector<double> field(n, double{ FAR });
+    for (int seed : seeds) {
+      if (seed >= 0 && seed < n) {
+        field[seed] = 0.0;
+      }
+    }
+    const long strides[3]{ static_cast<long>(dims[1]) * dims[2], dims[2], 1 };
+    for (int axis = 2; axis >= 0; --axis) {
+      transformAxis(field, dims, strides, axis);
+    }
+    return field;
+  }
+
+private:
+  static void transformAxis(std::vector<double> &field, const std::array<int, 3> &dims, const long *strides, int axis)
+  {
+    const int length{ dims[axis] };
+    const int other1{ axis == 0 ? 1 : 0 };
+    const int other2{ axis == 2 ? 1 : 2 };
+    const int nLines{ dims[other1] * dims[other2] };
+    #pragma omp parallel
+    {
+    std::vector<double> f(length), d(length), z(length + 1);
+    std::vector<int> v(length);
+    #pragma omp for schedule(static)
+    for (int line = 0; line < nLines; ++line) {
+      const long first{ (line / dims[other2]) * strides[other1] + (line % dims[other2]) * strides[other2] };
+      for (int q = 0; q < length; ++q) {
+        f[q] = field[first + q * strides[axis]];
+      }
+      transformLine(f.data(), length, d.data(), v.data(), z.data());
+      for (int q = 0; q < length; ++q) {
+        field[first + q * strides[axis]] = d[q];
+      }
+    }
+    }
+  }
+
+  /**
+   * One dimensional transform d(q) = min_p (q - p)^2 + f(p).
+   * @param v, z: Scratch space for the parabolas of the envelope and their
+   *              boundaries, n and n + 1 elements.
+   */
+  static void transformLine(const double *f, int n, double *d, int *v, double *z)
+  {
+    int k{ 0 };
+    v[0] = 0;
+    z[0] = -FAR;
+    z[1] = FAR;
+    for (int q = 1; q < n; ++q) {
+      double s{ intersection(f, q, v[k]) };
+      while (s <= z[k]) {
+        --k;
+        s = intersection(f, q, v[k]);
+      }
+      ++k;
+      v[k] = q;
+      z[k] = s;
+      z[k + 1] = FAR;
+    }
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+      while (z[k + 1] < q) {
+        ++k;
+      }
+      const double dq{ static_cast<double>(q - v[k]) };
+      d[q] = dq * dq + f[v[k]];
+    }
+  }
+
+  // Where the parabolas rooted at q and p intersect.
+  static double intersection(const double *f, int q, int p)
+  {
+    return ((f[q] + static_cast<double>(q) * q) - (f[p] + static_cast<double>(p) * p)) / (2.0 * (q - p));
+  }
+};
+
+#endif
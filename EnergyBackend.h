@@ -0,0 +1,1200 @@
+#ifndef ENERGY_BACKEND_H
+#define ENERGY_BACKEND_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DeterministicReduction.h"
+#include "Fft.h"
+
+#ifdef CUDA
+#include "cuda_kernel_gist/GistCudaSetup.cuh"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Calculation of the per-atom interaction energies of a single frame.
+ *
+ * A backend gets the coordinates of all atoms (as separate x, y and z arrays)
+ * and the box, and returns for every requested atom the solvent-solvent and
+ * solute-solvent energy, the four nearest neighbours and the number of
+ * neighbours within the cutoff. All backends produce the same outputs, so the
+ * backend can be chosen at runtime.
+ */
+namespace GistEnergy {
+
+// Number of nearest neighbours stored per atom (for the order parameter).
+constexpr int NEAREST = 4;
+
+enum class BoxType { NONE, ORTHO, NONORTHO };
+
+/**
+ * The periodic box of a frame. For ORTHO boxes, the diagonal of ucell holds
+ * the box lengths. For NONORTHO boxes, the rows of ucell are the cell vectors
+ * and recip converts Cartesian into fractional coordinates.
+ */
+struct Box {
+  BoxType type = BoxType::NONE;
+  double ucell[9]{};
+  double recip[9]{};
+};
+
+/**
+ * Everything about the atoms that stays the same between frames.
+ */
+struct Topology {
+  // Charges in elementary charges, the electrostatic energy is
+  // coulombFactor * q1 * q2 / r.
+  std::vector<double> charges;
+  std::vector<int> types;
+  std::vector<int> molecules;
+  std::vector<char> solvent;
+  // Atom type counted as neighbour of each atom, -1 if no neighbours are
+  // needed for this atom. Only solvent atoms are counted as neighbours.
+  std::vector<int> neighbourType;
+  // Lennard-Jones parameters for every pair of types, nTypes * nTypes entries.
+  int nTypes = 0;
+  std::vector<double> ljA;
+  std::vector<double> ljB;
+  double coulombFactor = 332.0522173;
+  double neighbourCutoff2 = 0.0;
+
+  int nAtoms() const { return static_cast<int>( charges.size() ); }
+};
+
+/**
+ * Coordinates of a frame, stored as structure of arrays.
+ */
+struct Coordinates {
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> z;
+  Box box;
+
+  /**
+   * Copies interleaved coordinates (x1, y1, z1, x2, ...).
+   * @param xyz: The coordinates.
+   * @param nAtoms: The number of atoms.
+   */
+  void assign(const double *xyz, int nAtoms)
+  {
+    x.resize(nAtoms);
+    y.resize(nAtoms);
+    z.resize(nAtoms);
+    for (int i = 0; i < nAtoms; ++i) {
+      x[i] = xyz[3 * i];
+      y[i] = xyz[3 * i + 1];
+      z[i] = xyz[3 * i + 2];
+    }
+  }
+};
+
+/**
+ * Per-atom results of a frame. Only the entries of the requested atoms are
+ * guaranteed to be set, the other entries are zero.
+ */
+struct Result {
+  // Half of the interaction with all solvent atoms, as every solvent-solvent
+  // pair is counted from both sides.
+  std::vector<double> eww;
+  // Interaction with all solute atoms.
+  std::vector<double> esw;
+  // NEAREST entries per atom, -1 if there are fewer neighbours.
+  std::vector<int> nearest;
+  std::vector<int> neighbours;
+
+  void reset(int nAtoms)
+  {
+    eww.assign(nAtoms, 0.0);
+    esw.assign(nAtoms, 0.0);
+    nearest.assign(static_cast<std::size_t>(nAtoms) * NEAREST, -1);
+    neighbours.assign(nAtoms, 0);
+  }
+};
+
+/**
+ * Settings of the backends that need more than the topology.
+ */
+struct Options {
+  // Real space cutoff of the particle mesh Ewald sum.
+  double cutoff = 9.0;
+  // Maximum spacing of the charge grid and order of the B-splines.
+  double gridSpacing = 1.0;
+  int order = 4;
+  // Size of the real space term at the cutoff, determines the Ewald coefficient.
+  double tolerance = 1e-5;
+};
+
+/**
+ * Receives the full energy of every solvent-solvent pair (atom1 being one of
+ * the requested atoms). May be called from several threads at once.
+ */
+using PairSink = std::function<void(int atom1, int atom2, double energy)>;
+
+/**
+ * The squared distance of two atoms, using the minimum image convention.
+ * @param box: The periodic box.
+ * @param dx, dy, dz: The distance vector between the two atoms.
+ * @return: The squared minimum image distance.
+ */
+inline double minimumImage2(const Box &box, double dx, double dy, double dz)
+{
+  switch (box.type) {
+    case BoxType::ORTHO:
+      dx -= box.ucell[0] * std::rint(dx / box.ucell[0]);
+      dy -= box.ucell[4] * std::rint(dy / box.ucell[4]);
+      dz -= box.ucell[8] * std::rint(dz / box.ucell[8]);
+      return dx * dx + dy * dy + dz * dz;
+    case BoxType::NONORTHO:
+    {
+      // Wrap in fractional coordinates, then check the neighbouring images,
+      // as the wrapped image is not necessarily the closest one in skewed cells.
+      double f[3];
+      for (int i = 0; i < 3; ++i) {
+        f[i] = box.recip[3 * i] * dx + box.recip[3 * i + 1] * dy + box.recip[3 * i + 2] * dz;
+        f[i] -= std::rint(f[i]);
+      }
+      double best{ std::numeric_limits<double>::max() };
+      for (int a = -1; a <= 1; ++a) {
+        for (int b = -1; b <= 1; ++b) {
+          for (int c = -1; c <= 1; ++c) {
+            double g0{ f[0] + a }, g1{ f[1] + b }, g2{ f[2] + c };
+            double x{ g0 * box.ucell[0] + g1 * box.ucell[3] + g2 * box.ucell[6] };
+            double y{ g0 * box.ucell[1] + g1 * box.ucell[4] + g2 * box.ucell[7] };
+            double z{ g0 * box.ucell[2] + g1 * box.ucell[5] + g2 * box.ucell[8] };
+            best = std::min(best, x * x + y * y + z * z);
+          }
+        }
+      }
+      return best;
+    }
+    default:
+      return dx * dx + dy * dy + dz * dz;
+  }
+}
+
+/**
+ * Interface of all energy backends.
+ */
+class Backend {
+public:
+  virtual ~Backend() {}
+
+  virtual std::string name() const = 0;
+
+  /**
+   * Prepares the backend for a topology, called whenever the topology changes.
+   * @param top: The topology.
+   * @return: false if the backend can not be used.
+   */
+  virtual bool setup(const Topology &top)
+  {
+    m_top = top;
+    return true;
+  }
+
+  /**
+   * Calculates the energies of a frame.
+   * @param coords: The coordinates and box of the frame.
+   * @param active: The atoms for which results are needed.
+   * @param result: Resized to the number of atoms and filled.
+   * @param sink: Called for every solvent-solvent pair, if set.
+   */
+  virtual void calculate(const Coordinates &coords, const std::vector<int> &active, Result &result,
+                         const PairSink &sink = PairSink()) = 0;
+
+  /**
+   * @return: false if the backend never calls the pair sink.
+   */
+  virtual bool supportsPairs() const { return true; }
+
+protected:
+  double ljA(int atom1, int atom2) const { return m_top.ljA[m_top.types[atom1] * m_top.nTypes + m_top.types[atom2]]; }
+  double ljB(int atom1, int atom2) const { return m_top.ljB[m_top.types[atom1] * m_top.nTypes + m_top.types[atom2]]; }
+
+  Topology m_top;
+};
+
+/**
+ * Straightforward implementation, one pair at a time. Serves as the reference
+ * for the other backends.
+ */
+class ReferenceBackend : public Backend {
+public:
+  std::string name() const override { return "reference"; }
+
+  void calculate(const Coordinates &coords, const std::vector<int> &active, Result &result,
+                 const PairSink &sink = PairSink()) override
+  {
+    result.reset(m_top.nAtoms());
+    for (int atom1 : active) {
+      double eww{ 0 };
+      double esw{ 0 };
+      DeterministicReduction::NearestNeighbors<NEAREST> nearest{};
+      for (int atom2 = 0; atom2 < m_top.nAtoms(); ++atom2) {
+        if (m_top.molecules[atom1] == m_top.molecules[atom2]) {
+          continue;
+        }
+        double r_2{ minimumImage2(coords.box, coords.x[atom2] - coords.x[atom1],
+                                  coords.y[atom2] - coords.y[atom1], coords.z[atom2] - coords.z[atom1]) };
+        double r_6i{ 1.0 / (r_2 * r_2 * r_2) };
+        double energy{ m_top.coulombFactor * m_top.charges[atom1] * m_top.charges[atom2] / std::sqrt(r_2) +
+                       ljA(atom1, atom2) * r_6i * r_6i - ljB(atom1, atom2) * r_6i };
+        if (m_top.solvent[atom2]) {
+          eww += energy;
+          if (sink) {
+            sink(atom1, atom2, energy);
+          }
+          if (m_top.types[atom2] == m_top.neighbourType[atom1]) {
+            nearest.insert(r_2, atom2);
+            if (r_2 < m_top.neighbourCutoff2) {
+              result.neighbours[atom1] += 1;
+            }
+          }
+        } else {
+          esw += energy;
+        }
+      }
+      result.eww[atom1] = 0.5 * eww;
+      result.esw[atom1] = esw;
+      for (int i = 0; i < NEAREST; ++i) {
+        result.nearest[NEAREST * atom1 + i] = nearest.index(i);
+      }
+    }
+  }
+};
+
+/**
+ * Multithreaded CPU implementation. The requested atoms are distributed over
+ * the OpenMP threads, the partner atoms are handled in fixed blocks with
+ * pre-scaled charges and per-type parameter rows. Every atom is calculated by
+ * a single thread in a fixed order, so the results do not depend on the
+ * number of threads.
+ */
+class ThreadedBackend : public Backend {
+public:
+  std::string name() const override { return "cpu"; }
+
+  bool setup(const Topology &top) override
+  {
+    Backend::setup(top);
+    double scale{ std::sqrt(top.coulombFactor) };
+    m_charges.resize(top.nAtoms());
+    for (int i = 0; i < top.nAtoms(); ++i) {
+      m_charges[i] = top.charges[i] * scale;
+    }
+    return true;
+  }
+
+  void calculate(const Coordinates &coords, const std::vector<int> &active, Result &result,
+                 const PairSink &sink = PairSink()) override
+  {
+    result.reset(m_top.nAtoms());
+    switch (coords.box.type) {
+      case BoxType::ORTHO:
+        calculateBox<BoxType::ORTHO>(coords, active, result, sink);
+        break;
+      case BoxType::NONORTHO:
+        calculateBox<BoxType::NONORTHO>(coords, active, result, sink);
+        break;
+      default:
+        calculateBox<BoxType::NONE>(coords, active, result, sink);
+    }
+  }
+
+private:
+  template<BoxType TYPE>
+  void calculateBox(const Coordinates &coords, const std::vector<int> &active, Result &result, const PairSink &sink)
+  {
+    const int nAtoms{ m_top.nAtoms() };
+    const int nBlocks{ DeterministicReduction::numberOfBlocks(nAtoms) };
+    const double lx{ coords.box.ucell[0] }, ly{ coords.box.ucell[4] }, lz{ coords.box.ucell[8] };
+    const double ilx{ TYPE == BoxType::ORTHO ? 1.0 / lx : 0.0 };
+    const double ily{ TYPE == BoxType::ORTHO ? 1.0 / ly : 0.0 };
+    const double ilz{ TYPE == BoxType::ORTHO ? 1.0 / lz : 0.0 };
+    const int nActive{ static_cast<int>( active.size() ) };
+
+    #pragma omp parallel
+    {
+    std::vector<double> blockEww(nBlocks);
+    std::vector<double> blockEsw(nBlocks);
+    #pragma omp for schedule(dynamic, 8)
+    for (int a = 0; a < nActive; ++a) {
+      const int atom1{ active[a] };
+      const double x1{ coords.x[atom1] }, y1{ coords.y[atom1] }, z1{ coords.z[atom1] };
+      const double q1{ m_charges[atom1] };
+      const int mol1{ m_top.molecules[atom1] };
+      const int neighbourType{ m_top.neighbourType[atom1] };
+      const double *rowA{ &m_top.ljA[m_top.types[atom1] * m_top.nTypes] };
+      const double *rowB{ &m_top.ljB[m_top.types[atom1] * m_top.nTypes] };
+      DeterministicReduction::NearestNeighbors<NEAREST> nearest{};
+      int neighbours{ 0 };
+      for (int b = 0; b < nBlocks; ++b) {
+        double eww{ 0 };
+        double esw{ 0 };
+        const int blockEnd{ std::min((b + 1) * DeterministicReduction::BLOCK_SIZE, nAtoms) };
+        for (int atom2 = b * DeterministicReduction::BLOCK_SIZE; atom2 < blockEnd; ++atom2) {
+          if (m_top.molecules[atom2] == mol1) {
+            continue;
+          }
+          double dx{ coords.x[atom2] - x1 };
+          double dy{ coords.y[atom2] - y1 };
+          double dz{ coords.z[atom2] - z1 };
+          double r_2;
+          if (TYPE == BoxType::ORTHO) {
+            dx -= lx * std::rint(dx * ilx);
+            dy -= ly * std::rint(dy * ily);
+            dz -= lz * std::rint(dz * ilz);
+            r_2 = dx * dx + dy * dy + dz * dz;
+          } else if (TYPE == BoxType::NONORTHO) {
+            r_2 = minimumImage2(coords.box, dx, dy, dz);
+          } else {
+            r_2 = dx * dx + dy * dy + dz * dz;
+          }
+          const double r_2i{ 1.0 / r_2 };
+          const double r_6i{ r_2i * r_2i * r_2i };
+          const int type2{ m_top.types[atom2] };
+          const double energy{ q1 * m_charges[atom2] * std::sqrt(r_2i) + rowA[type2] * r_6i * r_6i - rowB[type2] * r_6i };
+          if (m_top.solvent[atom2]) {
+            eww += energy;
+            if (sink) {
+              sink(atom1, atom2, energy);
+            }
+            if (type2 == neighbourType) {
+              nearest.insert(r_2, atom2);
+              if (r_2 < m_top.neighbourCutoff2) {
+                ++neighbours;
+              }
+            }
+          } else {
+            esw += energy;
+          }
+        }
+        blockEww[b] = eww;
+        blockEsw[b] = esw;
+      }
+      result.eww[atom1] = 0.5 * DeterministicReduction::pairwiseSum(blockEww);
+      result.esw[atom1] = DeterministicReduction::pairwiseSum(blockEsw);
+      result.neighbours[atom1] = neighbours;
+      for (int i = 0; i < NEAREST; ++i) {
+        result.nearest[NEAREST * atom1 + i] = nearest.index(i);
+      }
+    }
+    }
+  }
+
+  // Charges multiplied by the square root of the Coulomb factor.
+  std::vector<double> m_charges;
+};
+
+/**
+ * Exact all-pairs sums with the two-dimensional decomposition of the CUDA
+ * kernel: the requested atoms (rows) and all atoms (columns) are cut into
+ * tiles, and the OpenMP threads work on whole row x column tiles. The column
+ * data of a tile is packed into contiguous arrays that stay in the cache while
+ * all rows of the tile pass over it, ROWS rows at a time with their sums kept
+ * in registers.
+ *
+ * Column tiles are the blocks of DeterministicReduction, and every row sums a
+ * tile in atom order. The partial sums of every row and tile are stored and
+ * combined afterwards in the same order as by ThreadedBackend, so both give
+ * identical results for any number of threads.
+ */
+class TiledBackend : public Backend {
+public:
+  // Number of requested atoms in a row tile and rows handled together.
+  static constexpr int ROW_TILE = 64;
+  static constexpr int ROWS = 4;
+
+  std::string name() const override { return "tiled"; }
+
+  bool setup(const Topology &top) override
+  {
+    Backend::setup(top);
+    double scale{ std::sqrt(top.coulombFactor) };
+    m_charges.resize(top.nAtoms());
+    for (int i = 0; i < top.nAtoms(); ++i) {
+      m_charges[i] = top.charges[i] * scale;
+    }
+    return true;
+  }
+
+  void calculate(const Coordinates &coords, const std::vector<int> &active, Result &result,
+                 const PairSink &sink = PairSink()) override
+  {
+    result.reset(m_top.nAtoms());
+    prepare(active);
+    switch (coords.box.type) {
+      case BoxType::ORTHO:
+        calculateBox<BoxType::ORTHO>(coords, active, sink);
+        break;
+      case BoxType::NONORTHO:
+        calculateBox<BoxType::NONORTHO>(coords, active, sink);
+        break;
+      default:
+        calculateBox<BoxType::NONE>(coords, active, sink);
+    }
+    const int nActive{ static_cast<int>( active.size() ) };
+    #pragma omp parallel for
+    for (int a = 0; a < nActive; ++a) {
+      const int atom1{ active[a] };
+      const std::size_t begin{ static_cast<std::size_t>(a) * m_nBlocks };
+      result.eww[atom1] = 0.5 * DeterministicReduction::pairwiseSum(m_eww, begin, begin + m_nBlocks);
+      result.esw[atom1] = DeterministicReduction::pairwiseSum(m_esw, begin, begin + m_nBlocks);
+      if (m_slot[a] == -1) {
+        continue;
+      }
+      DeterministicReduction::NearestNeighbors<NEAREST> nearest{};
+      int neighbours{ 0 };
+      for (int b = 0; b < m_nBlocks; ++b) {
+        const std::size_t cell{ static_cast<std::size_t>(m_slot[a]) * m_nBlocks + b };
+        nearest.merge(m_nearest[cell]);
+        neighbours += m_neighbours[cell];
+      }
+      result.neighbours[atom1] = neighbours;
+      for (int i = 0; i < NEAREST; ++i) {
+        result.nearest[NEAREST * atom1 + i] = nearest.index(i);
+      }
+    }
+  }
+
+private:
+  /**
+   * The column data of one tile, packed so that the inner loop reads
+   * contiguous memory only.
+   */
+  struct ColumnTile {
+    int begin = 0;
+    int size = 0;
+    double x[DeterministicReduction::BLOCK_SIZE];
+    double y[DeterministicReduction::BLOCK_SIZE];
+    double z[DeterministicReduction::BLOCK_SIZE];
+    double q[DeterministicReduction::BLOCK_SIZE];
+    int type[DeterministicReduction::BLOCK_SIZE];
+    int molecule[DeterministicReduction::BLOCK_SIZE];
+    char solvent[DeterministicReduction::BLOCK_SIZE];
+  };
+
+  /**
+   * Sizes the partial sums and gives every row that counts neighbours a slot
+   * for its per-tile neighbour lists.
+   */
+  void prepare(const std::vector<int> &active)
+  {
+    const int nActive{ static_cast<int>( active.size() ) };
+    m_nBlocks = DeterministicReduction::numberOfBlocks(m_top.nAtoms());
+    m_eww.assign(static_cast<std::size_t>(nActive) * m_nBlocks, 0.0);
+    m_esw.assign(static_cast<std::size_t>(nActive) * m_nBlocks, 0.0);
+    m_slot.assign(nActive, -1);
+    int nSlots{ 0 };
+    for (int a = 0; a < nActive; ++a) {
+      if (m_top.neighbourType[active[a]] != -1) {
+        m_slot[a] = nSlots++;
+      }
+    }
+    m_nearest.assign(static_cast<std::size_t>(nSlots) * m_nBlocks, DeterministicReduction::NearestNeighbors<NEAREST>());
+    m_neighbours.assign(static_cast<std::size_t>(nSlots) * m_nBlocks, 0);
+  }
+
+  template<BoxType TYPE>
+  void calculateBox(const Coordinates &coords, const std::vector<int> &active, const PairSink &sink)
+  {
+    const int nActive{ static_cast<int>( active.size() ) };
+    const int nRowTiles{ (nActive + ROW_TILE - 1) / ROW_TILE };
+    const int nBlocks{ m_nBlocks };
+
+    #pragma omp parallel
+    {
+    std::unique_ptr<ColumnTile> tile{ new ColumnTile() };
+    tile->begin = -1;
+    // Column tiles run in the outer loop, so that a thread mostly moves along
+    // the rows of a packed tile.
+    #pragma omp for collapse(2) schedule(dynamic)
+    for (int b = 0; b < nBlocks; ++b) {
+      for (int r = 0; r < nRowTiles; ++r) {
+        if (tile->begin != b * DeterministicReduction::BLOCK_SIZE) {
+          pack(coords, b, *tile);
+        }
+        const int rowEnd{ std::min((r + 1) * ROW_TILE, nActive) };
+        int a{ r * ROW_TILE };
+        for (; a + ROWS <= rowEnd; a += ROWS) {
+          tileRows<TYPE, ROWS>(coords, active, a, b, *tile, sink);
+        }
+        for (; a < rowEnd; ++a) {
+          tileRows<TYPE, 1>(coords, active, a, b, *tile, sink);
+        }
+      }
+    }
+    }
+  }
+
+  void pack(const Coordinates &coords, int b, ColumnTile &tile) const
+  {
+    tile.begin = b * DeterministicReduction::BLOCK_SIZE;
+    tile.size = std::min(DeterministicReduction::BLOCK_SIZE, m_top.nAtoms() - tile.begin);
+    for (int j = 0; j < tile.size; ++j) {
+      const int atom{ tile.begin + j };
+      tile.x[j] = coords.x[atom];
+      tile.y[j] = coords.y[atom];
+      tile.z[j] = coords.z[atom];
+      tile.q[j] = m_charges[atom];
+      tile.type[j] = m_top.types[atom];
+      tile.molecule[j] = m_top.molecules[atom];
+      tile.solvent[j] = m_top.solvent[atom];
+    }
+  }
+
+  /**
+   * Sums the interactions of N consecutive requested atoms with one column
+   * tile. Every row adds up the tile in atom order, as ThreadedBackend does.
+   * @param a: Index of the first row in active.
+   * @param b: Index of the column tile.
+   */
+  template<BoxType TYPE, int N>
+  void tileRows(const Coordinates &coords, const std::vector<int> &active, int a, int b,
+                const ColumnTile &tile, const PairSink &sink)
+  {
+    const double lx{ coords.box.ucell[0] }, ly{ coords.box.ucell[4] }, lz{ coords.box.ucell[8] };
+    const double ilx{ TYPE == BoxType::ORTHO ? 1.0 / lx : 0.0 };
+    const double ily{ TYPE == BoxType::ORTHO ? 1.0 / ly : 0.0 };
+    const double ilz{ TYPE == BoxType::ORTHO ? 1.0 / lz : 0.0 };
+    int atom1[N], mol1[N], neighbourType[N], neighbours[N];
+    double x1[N], y1[N], z1[N], q1[N], eww[N], esw[N];
+    const double *rowA[N];
+    const double *rowB[N];
+    DeterministicReduction::NearestNeighbors<NEAREST> nearest[N];
+    for (int n = 0; n < N; ++n) {
+      atom1[n] = active[a + n];
+      x1[n] = coords.x[atom1[n]];
+      y1[n] = coords.y[atom1[n]];
+      z1[n] = coords.z[atom1[n]];
+      q1[n] = m_charges[atom1[n]];
+      mol1[n] = m_top.molecules[atom1[n]];
+      neighbourType[n] = m_top.neighbourType[atom1[n]];
+      rowA[n] = &m_top.ljA[m_top.types[atom1[n]] * m_top.nTypes];
+      rowB[n] = &m_top.ljB[m_top.types[atom1[n]] * m_top.nTypes];
+      eww[n] = 0.0;
+      esw[n] = 0.0;
+      neighbours[n] = 0;
+    }
+    for (int j = 0; j < tile.size; ++j) {
+      const int type2{ tile.type[j] };
+      for (int n = 0; n < N; ++n) {
+        if (tile.molecule[j] == mol1[n]) {
+          continue;
+        }
+        double dx{ tile.x[j] - x1[n] };
+        double dy{ tile.y[j] - y1[n] };
+        double dz{ tile.z[j] - z1[n] };
+        double r_2;
+        if (TYPE == BoxType::ORTHO) {
+          dx -= lx * std::rint(dx * ilx);
+          dy -= ly * std::rint(dy * ily);
+          dz -= lz * std::rint(dz * ilz);
+          r_2 = dx * dx + dy * dy + dz * dz;
+        } else if (TYPE == BoxType::NONORTHO) {
+          r_2 = minimumImage2(coords.box, dx, dy, dz);
+        } else {
+          r_2 = dx * dx + dy * dy + dz * dz;
+        }
+        const double r_2i{ 1.0 / r_2 };
+        const double r_6i{ r_2i * r_2i * r_2i };
+        const double energy{ q1[n] * tile.q[j] * std::sqrt(r_2i) + rowA[n][type2] * r_6i * r_6i - rowB[n][type2] * r_6i };
+        if (tile.solvent[j]) {
+          eww[n] += energy;
+          if (sink) {
+            sink(atom1[n], tile.begin + j, energy);
+          }
+          if (type2 == neighbourType[n]) {
+            nearest[n].insert(r_2, tile.begin + j);
+            if (r_2 < m_top.neighbourCutoff2) {
+              ++neighbours[n];
+            }
+          }
+        } else {
+          esw[n] += energy;
+        }
+      }
+    }
+    for (int n = 0; n < N; ++n) {
+      const std::size_t cell{ static_cast<std::size_t>(a + n) * m_nBlocks + b };
+      m_eww[cell] = eww[n];
+      m_esw[cell] = esw[n];
+      if (m_slot[a + n] != -1) {
+        const std::size_t slot{ static_cast<std::size_t>(m_slot[a + n]) * m_nBlocks + b };
+        m_nearest[slot] = nearest[n];
+        m_neighbours[slot] = neighbours[n];
+      }
+    }
+  }
+
+  // Charges multiplied by the square root of the Coulomb factor.
+  std::vector<double> m_charges;
+  int m_nBlocks = 0;
+  // Partial sums of every requested atom and column tile.
+  std::vector<double> m_eww;
+  std::vector<double> m_esw;
+  // Per-tile neighbour lists and counts, only for rows that count neighbours.
+  std::vector<int> m_slot;
+  std::vector<DeterministicReduction::NearestNeighbors<NEAREST> > m_nearest;
+  std::vector<int> m_neighbours;
+};
+
+/**
+ * Ewald coefficient for which the real space term has decayed to the given
+ * tolerance at the cutoff, i.e., erfc(beta * cutoff) = tolerance.
+ * @param cutoff: The real space cutoff.
+ * @param tolerance: The tolerance, e.g., 1e-5.
+ * @return: The Ewald coefficient beta.
+ */
+inline double ewaldCoefficient(double cutoff, double tolerance)
+{
+  double low{ 0.0 };
+  double high{ 1.0 };
+  while (std::erfc(high * cutoff) > tolerance) {
+    high *= 2.0;
+  }
+  for (int i = 0; i < 100; ++i) {
+    double mid{ 0.5 * (low + high) };
+    if (std::erfc(mid * cutoff) > tolerance) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return 0.5 * (low + high);
+}
+
+/**
+ * Values of the cardinal B-spline of the given order at fraction + k, for
+ * k = 0, ..., order - 1.
+ * @param fraction: A value in [0, 1).
+ * @param order: The order of the spline, at least 2.
+ * @param weights: Set to the order values.
+ */
+inline void bsplineWeights(double fraction, int order, double *weights)
+{
+  weights[0] = fraction;
+  weights[1] = 1.0 - fraction;
+  for (int n = 3; n <= order; ++n) {
+    weights[n - 1] = 0.0;
+    for (int k = n - 1; k >= 0; --k) {
+      double x{ fraction + k };
+      double previous{ k == 0 ? 0.0 : weights[k - 1] };
+      weights[k] = (x * weights[k] + (n - x) * previous) / (n - 1);
+    }
+  }
+}
+
+/**
+ * Smooth particle mesh Ewald sum (Essmann et al., J. Chem. Phys. 103, 8577
+ * (1995)). The electrostatic potential at every requested atom is split into
+ * the part caused by the solvent and the part caused by the solute, so that
+ * Eww and Esw are periodic and not truncated. The real space part and the
+ * Lennard-Jones interaction are calculated with a cell list up to the cutoff,
+ * the reciprocal part with a single FFT, where the solvent charges are spread
+ * into the real part and the solute charges into the imaginary part of the
+ * grid. Interactions within a molecule are removed, as in the other backends.
+ * Non-periodic frames are handed to the threaded backend.
+ */
+class PmeBackend : public Backend {
+public:
+  PmeBackend(const Options &options = Options())
+  : m_options(options)
+  {}
+
+  std::string name() const override { return "pme"; }
+
+  bool supportsPairs() const override { return false; }
+
+  bool setup(const Topology &top) override
+  {
+    Backend::setup(top);
+    m_molAtoms.clear();
+    for (int atom = 0; atom < top.nAtoms(); ++atom) {
+      if (top.molecules[atom] >= static_cast<int>( m_molAtoms.size() )) {
+        m_molAtoms.resize(top.molecules[atom] + 1);
+      }
+      m_molAtoms[top.molecules[atom]].push_back(atom);
+    }
+    return m_options.order >= 2 && m_options.gridSpacing > 0.0 && m_fallback.setup(top);
+  }
+
+  void calculate(const Coordinates &coords, const std::vector<int> &active, Result &result,
+                 const PairSink &sink = PairSink()) override
+  {
+    if (coords.box.type == BoxType::NONE) {
+      m_fallback.calculate(coords, active, result, sink);
+      return;
+    }
+    Box box{ coords.box };
+    if (box.type == BoxType::ORTHO) {
+      for (int i = 0; i < 3; ++i) {
+        box.recip[4 * i] = 1.0 / box.ucell[4 * i];
+      }
+    }
+    // The minimum image convention only holds up to half of the smallest
+    // width of the cell.
+    double cutoff{ m_options.cutoff };
+    for (int d = 0; d < 3; ++d) {
+      cutoff = std::min(cutoff, 0.5 / recipLength(box, d));
+    }
+    const double beta{ ewaldCoefficient(cutoff, m_options.tolerance) };
+
+    result.reset(m_top.nAtoms());
+    m_potential.assign(2 * m_top.nAtoms(), 0.0);
+    reciprocal(coords, box, beta, active);
+    realSpace(coords, box, beta, cutoff, active, result);
+  }
+
+private:
+  static double recipLength(const Box &box, int d)
+  {
+    const double *row{ box.recip + 3 * d };
+    return std::sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]);
+  }
+
+  /**
+   * Fractional coordinates of an atom, wrapped into [0, 1).
+   */
+  static void fractional(const Coordinates &coords, const Box &box, int atom, double *s)
+  {
+    for (int d = 0; d < 3; ++d) {
+      s[d] = box.recip[3 * d] * coords.x[atom] + box.recip[3 * d + 1] * coords.y[atom] + box.recip[3 * d + 2] * coords.z[atom];
+      s[d] -= std::floor(s[d]);
+    }
+  }
+
+  /**
+   * Squared moduli of the Euler exponential splines, |b(m)|^2.
+   */
+  std::vector<double> bsplineModuli(int n) const
+  {
+    const int order{ m_options.order };
+    std::vector<double> values(order);
+    bsplineWeights(0.0, order, values.data());
+    std::vector<double> moduli(n);
+    for (int m = 0; m < n; ++m) {
+      std::complex<double> sum{};
+      for (int k = 0; k < order - 1; ++k) {
+        double angle{ 2.0 * M_PI * m * k / n };
+        sum += values[k + 1] * std::complex<double>(std::cos(angle), std::sin(angle));
+      }
+      moduli[m] = std::norm(sum) < 1e-10 ? -1.0 : 1.0 / std::norm(sum);
+    }
+    // Zeros only occur for odd orders, they are replaced by the neighbours.
+    for (int m = 0; m < n; ++m) {
+      if (moduli[m] < 0.0) {
+        moduli[m] = 0.5 * (moduli[(m + n - 1) % n] + moduli[(m + 1) % n]);
+      }
+    }
+    return moduli;
+  }
+
+  /**
+   * Reciprocal part of the potential at the requested atoms, including the
+   * self term, the removal of the intramolecular pairs and the neutralizing
+   * background of charged sources.
+   */
+  void reciprocal(const Coordinates &coords, const Box &box, double beta, const std::vector<int> &active)
+  {
+    const int order{ m_options.order };
+    int dims[3];
+    for (int d = 0; d < 3; ++d) {
+      const double *row{ box.ucell + 3 * d };
+      double length{ std::sqrt(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]) };
+      dims[d] = Fft3D::nextPowerOfTwo(std::max(order, static_cast<int>( std::ceil(length / m_options.gridSpacing) )));
+    }
+    if (dims[0] != m_fft.dim(0) || dims[1] != m_fft.dim(1) || dims[2] != m_fft.dim(2) || m_moduli[0].empty()) {
+      m_fft.resize(dims[0], dims[1], dims[2]);
+      for (int d = 0; d < 3; ++d) {
+        m_moduli[d] = bsplineModuli(dims[d]);
+      }
+    }
+
+    // Spread the charges, solvent into the real and solute into the imaginary part.
+    m_grid.assign(m_fft.size(), Fft3D::Complex());
+    double totalCharge[2]{ 0.0, 0.0 };
+    std::vector<double> weights(3 * order);
+    int first[3];
+    for (int atom = 0; atom < m_top.nAtoms(); ++atom) {
+      splineAt(coords, box, atom, dims, first, weights.data());
+      Fft3D::Complex charge{ m_top.solvent[atom] ? Fft3D::Complex(m_top.charges[atom], 0.0) : Fft3D::Complex(0.0, m_top.charges[atom]) };
+      totalCharge[m_top.solvent[atom] ? 0 : 1] += m_top.charges[atom];
+      for (int i = 0; i < order; ++i) {
+        int g1{ ((first[0] - i) % dims[0] + dims[0]) % dims[0] };
+        for (int j = 0; j < order; ++j) {
+          int g2{ ((first[1] - j) % dims[1] + dims[1]) % dims[1] };
+          double w12{ weights[i] * weights[order + j] };
+          for (int k = 0; k < order; ++k) {
+            int g3{ ((first[2] - k) % dims[2] + dims[2]) % dims[2] };
+            m_grid[(g1 * dims[1] + g2) * dims[2] + g3] += charge * (w12 * weights[2 * order + k]);
+          }
+        }
+      }
+    }
+
+    // Convolution with the Ewald kernel.
+    m_fft.forward(m_grid);
+    const double volume{ std::abs(
+      box.ucell[0] * (box.ucell[4] * box.ucell[8] - box.ucell[5] * box.ucell[7]) -
+      box.ucell[1] * (box.ucell[3] * box.ucell[8] - box.ucell[5] * box.ucell[6]) +
+      box.ucell[2] * (box.ucell[3] * box.ucell[7] - box.ucell[4] * box.ucell[6])) };
+    const double factor{ M_PI * M_PI / (beta * beta) };
+    #pragma omp parallel for
+    for (int m1 = 0; m1 < dims[0]; ++m1) {
+      int k1{ m1 <= dims[0] / 2 ? m1 : m1 - dims[0] };
+      for (int m2 = 0; m2 < dims[1]; ++m2) {
+        int k2{ m2 <= dims[1] / 2 ? m2 : m2 - dims[1] };
+        for (int m3 = 0; m3 < dims[2]; ++m3) {
+          int k3{ m3 <= dims[2] / 2 ? m3 : m3 - dims[2] };
+          double mx{ k1 * box.recip[0] + k2 * box.recip[3] + k3 * box.recip[6] };
+          double my{ k1 * box.recip[1] + k2 * box.recip[4] + k3 * box.recip[7] };
+          double mz{ k1 * box.recip[2] + k2 * box.recip[5] + k3 * box.recip[8] };
+          double m_2{ mx * mx + my * my + mz * mz };
+          double kernel{ 0.0 };
+          if (m1 != 0 || m2 != 0 || m3 != 0) {
+            kernel = std::exp(-factor * m_2) / (M_PI * volume * m_2) * m_moduli[0][m1] * m_moduli[1][m2] * m_moduli[2][m3];
+          }
+          m_grid[(m1 * dims[1] + m2) * dims[2] + m3] *= kernel;
+        }
+      }
+    }
+    m_fft.backward(m_grid);
+
+    const double self{ 2.0 * beta / std::sqrt(M_PI) };
+    const int nActive{ static_cast<int>( active.size() ) };
+    #pragma omp parallel
+    {
+    std::vector<double> atomWeights(3 * order);
+    int atomFirst[3];
+    #pragma omp for
+    for (int a = 0; a < nActive; ++a) {
+      const int atom{ active[a] };
+      splineAt(coords, box, atom, dims, atomFirst, atomWeights.data());
+      Fft3D::Complex potential{};
+      for (int i = 0; i < order; ++i) {
+        int g1{ ((atomFirst[0] - i) % dims[0] + dims[0]) % dims[0] };
+        for (int j = 0; j < order; ++j) {
+          int g2{ ((atomFirst[1] - j) % dims[1] + dims[1]) % dims[1] };
+          double w12{ atomWeights[i] * atomWeights[order + j] };
+          for (int k = 0; k < order; ++k) {
+            int g3{ ((atomFirst[2] - k) % dims[2] + dims[2]) % dims[2] };
+            potential += m_grid[(g1 * dims[1] + g2) * dims[2] + g3] * (w12 * atomWeights[2 * order + k]);
+          }
+        }
+      }
+      double *phi{ &m_potential[2 * atom] };
+      phi[0] += potential.real() - M_PI * totalCharge[0] / (beta * beta * volume);
+      phi[1] += potential.imag() - M_PI * totalCharge[1] / (beta * beta * volume);
+      // The atom itself and the atoms of its molecule are part of the reciprocal sum.
+      const int own{ m_top.solvent[atom] ? 0 : 1 };
+      phi[own] -= self * m_top.charges[atom];
+      for (int other : m_molAtoms[m_top.molecules[atom]]) {
+        if (other == atom) {
+          continue;
+        }
+        double r{ std::sqrt(minimumImage2(box, coords.x[other] - coords.x[atom], coords.y[other] - coords.y[atom],
+                                          coords.z[other] - coords.z[atom])) };
+        phi[own] -= m_top.charges[other] * std::erf(beta * r) / r;
+      }
+    }
+    }
+  }
+
+  /**
+   * First grid point and spline weights of an atom in every dimension.
+   */
+  void splineAt(const Coordinates &coords, const Box &box, int atom, const int *dims, int *first, double *weights) const
+  {
+    double s[3];
+    fractional(coords, box, atom, s);
+    for (int d = 0; d < 3; ++d) {
+      double u{ s[d] * dims[d] };
+      first[d] = static_cast<int>( std::floor(u) );
+      bsplineWeights(u - first[d], m_options.order, weights + d * m_options.order);
+    }
+  }
+
+  /**
+   * Real space part of the electrostatics and the Lennard-Jones energy, as
+   * well as the neighbours, from a cell list. Adds the potentials of the
+   * reciprocal part and fills the result.
+   */
+  void realSpace(const Coordinates &coords, const Box &box, double beta, double cutoff,
+                 const std::vector<int> &active, Result &result)
+  {
+    // Cells are at least as wide as the cutoff, so that only neighbouring cells are needed.
+    int nCells[3];
+    for (int d = 0; d < 3; ++d) {
+      nCells[d] = std::max(1, static_cast<int>( 1.0 / (recipLength(box, d) * cutoff) ));
+    }
+    std::vector<std::vector<int> > cells(nCells[0] * nCells[1] * nCells[2]);
+    std::vector<int> atomCell(m_top.nAtoms());
+    for (int atom = 0; atom < m_top.nAtoms(); ++atom) {
+      double s[3];
+      fractional(coords, box, atom, s);
+      int c[3];
+      for (int d = 0; d < 3; ++d) {
+        c[d] = std::min(nCells[d] - 1, static_cast<int>( s[d] * nCells[d] ));
+      }
+      atomCell[atom] = (c[0] * nCells[1] + c[1]) * nCells[2] + c[2];
+      cells[atomCell[atom]].push_back(atom);
+    }
+    // Offsets to the neighbouring cells, each cell only once for small cell counts.
+    std::vector<int> offsets[3];
+    for (int d = 0; d < 3; ++d) {
+      if (nCells[d] < 3) {
+        for (int o = 0; o < nCells[d]; ++o) {
+          offsets[d].push_back(o);
+        }
+      } else {
+        offsets[d] = { -1, 0, 1 };
+      }
+    }
+
+    const double cutoff2{ cutoff * cutoff };
+    const int nActive{ static_cast<int>( active.size() ) };
+    #pragma omp parallel for schedule(dynamic, 8)
+    for (int a = 0; a < nActive; ++a) {
+      const int atom1{ active[a] };
+      const int mol1{ m_top.molecules[atom1] };
+      const int cell{ atomCell[atom1] };
+      const int c[3]{ cell / (nCells[1] * nCells[2]), (cell / nCells[2]) % nCells[1], cell % nCells[2] };
+      double phi[2]{ m_potential[2 * atom1], m_potential[2 * atom1 + 1] };
+      double lj[2]{ 0.0, 0.0 };
+      DeterministicReduction::NearestNeighbors<NEAREST> nearest{};
+      int neighbours{ 0 };
+      for (int o1 : offsets[0]) {
+        int n1{ nCells[0] < 3 ? o1 : (c[0] + o1 + nCells[0]) % nCells[0] };
+        for (int o2 : offsets[1]) {
+          int n2{ nCells[1] < 3 ? o2 : (c[1] + o2 + nCells[1]) % nCells[1] };
+          for (int o3 : offsets[2]) {
+            int n3{ nCells[2] < 3 ? o3 : (c[2] + o3 + nCells[2]) % nCells[2] };
+            for (int atom2 : cells[(n1 * nCells[1] + n2) * nCells[2] + n3]) {
+              if (m_top.molecules[atom2] == mol1) {
+                continue;
+              }
+              double r_2{ minimumImage2(box, coords.x[atom2] - coords.x[atom1], coords.y[atom2] - coords.y[atom1],
+                                        coords.z[atom2] - coords.z[atom1]) };
+              if (r_2 >= cutoff2) {
+                continue;
+              }
+              double r{ std::sqrt(r_2) };
+              double r_6i{ 1.0 / (r_2 * r_2 * r_2) };
+              int source{ m_top.solvent[atom2] ? 0 : 1 };
+              phi[source] += m_top.charges[atom2] * std::erfc(beta * r) / r;
+              lj[source] += ljA(atom1, atom2) * r_6i * r_6i - ljB(atom1, atom2) * r_6i;
+              if (source == 0 && m_top.types[atom2] == m_top.neighbourType[atom1]) {
+                nearest.insert(r_2, atom2);
+                if (r_2 < m_top.neighbourCutoff2) {
+                  ++neighbours;
+                }
+              }
+            }
+          }
+        }
+      }
+      const double q1{ m_top.coulombFactor * m_top.charges[atom1] };
+      result.eww[atom1] = 0.5 * (q1 * phi[0] + lj[0]);
+      result.esw[atom1] = q1 * phi[1] + lj[1];
+      result.neighbours[atom1] = neighbours;
+      for (int i = 0; i < NEAREST; ++i) {
+        result.nearest[NEAREST * atom1 + i] = nearest.index(i);
+      }
+    }
+  }
+
+  Options m_options;
+  ThreadedBackend m_fallback;
+  // Atoms of every molecule, for the intramolecular correction.
+  std::vector<std::vector<int> > m_molAtoms;
+  Fft3D m_fft{};
+  std::vector<double> m_moduli[3];
+  std::vector<Fft3D::Complex> m_grid;
+  // Solvent and solute potential of every atom.
+  std::vector<double> m_potential;
+};
+
+#ifdef CUDA
+/**
+ * Adapter for the CUDA kernels. Holds the memory on the device for the
+ * lifetime of a topology. The kernels calculate all atoms, in single
+ * precision, and do not report single pairs. Neighbours are counted per
+ * atom against the neighbour type of its species, as on the CPU.
+ */
+class CudaBackend : public Backend {
+public:
+  ~CudaBackend() { freeMemory(); }
+
+  std::string name() const override { return "cuda"; }
+
+  bool supportsPairs() const override { return false; }
+
+  bool setup(const Topology &top) override
+  {
+    freeMemory();
+    Backend::setup(top);
+    m_hasNeighbours = false;
+    for (int type : top.neighbourType) {
+      m_hasNeighbours = m_hasNeighbours || type != -1;
+    }
+    // The dense parameter table is indexed directly.
+    std::vector<int> nbIndex(top.nTypes * top.nTypes);
+    std::vector<float> ljA(nbIndex.size());
+    std::vector<float> ljB(nbIndex.size());
+    for (unsigned int i = 0; i < nbIndex.size(); ++i) {
+      nbIndex[i] = i;
+      ljA[i] = static_cast<float>( top.ljA[i] );
+      ljB[i] = static_cast<float>( top.ljB[i] );
+    }
+    std::vector<float> charges(top.charges.begin(), top.charges.end());
+    std::vector<int> types(top.types);
+    std::vector<int> molecules(top.molecules);
+    std::vector<int> neighbourType(top.neighbourType);
+    std::unique_ptr<bool []> solvent(new bool[top.nAtoms()]);
+    for (int i = 0; i < top.nAtoms(); ++i) {
+      solvent[i] = top.solvent[i] != 0;
+    }
+    try {
+      allocateCuda_GIGIST((void**)&m_nbIndex, nbIndex.size() * sizeof(int));
+      allocateCuda_GIGIST((void**)&m_resultW, top.nAtoms() * sizeof(float));
+      allocateCuda_GIGIST((void**)&m_resultS, top.nAtoms() * sizeof(float));
+      allocateCuda_GIGIST((void**)&m_resultO, top.nAtoms() * NEAREST * sizeof(int));
+      allocateCuda_GIGIST((void**)&m_resultN, top.nAtoms() * sizeof(int));
+      allocateCuda_GIGIST((void**)&m_neighbourType, top.nAtoms() * sizeof(int));
+      copyMemoryToDevice_GIGIST(&(nbIndex[0]), m_nbIndex, nbIndex.size() * sizeof(int));
+      copyMemoryToDevice_GIGIST(&(neighbourType[0]), m_neighbourType, top.nAtoms() * sizeof(int));
+      copyMemoryToDeviceStruct_GIGIST(&(charges[0]), &(types[0]), solvent.get(), &(molecules[0]), top.nAtoms(),
+                                      &m_atoms, &(ljA[0]), &(ljB[0]), ljA.size(), &m_paramsLJ);
+    } catch (CudaException &e) {
+      freeMemory();
+      return false;
+    }
+    return true;
+  }
+
+  void calculate(const Coordinates &coords, const std::vector<int> &, Result &result,
+                 const PairSink & = PairSink()) override
+  {
+    const int nAtoms{ m_top.nAtoms() };
+    m_xyz.resize(3 * nAtoms);
+    for (int i = 0; i < nAtoms; ++i) {
+      m_xyz[3 * i] = coords.x[i];
+      m_xyz[3 * i + 1] = coords.y[i];
+      m_xyz[3 * i + 2] = coords.z[i];
+    }
+    // The kernels expect the box lengths in recip for orthorhombic boxes.
+    float recip[9]{};
+    float ucell[9]{};
+    int boxinfo{ 0 };
+    if (coords.box.type == BoxType::ORTHO) {
+      recip[0] = static_cast<float>( coords.box.ucell[0] );
+      recip[1] = static_cast<float>( coords.box.ucell[4] );
+      recip[2] = static_cast<float>( coords.box.ucell[8] );
+      boxinfo = 1;
+    } else if (coords.box.type == BoxType::NONORTHO) {
+      for (int i = 0; i < 9; ++i) {
+        recip[i] = static_cast<float>( coords.box.recip[i] );
+        ucell[i] = static_cast<float>( coords.box.ucell[i] );
+      }
+      boxinfo = 2;
+    }
+    result.reset(nAtoms);
+    // Neighbours are only found by the slower kernel.
+    EnergyReturn energies{ doActionCudaEnergy_GIGIST(
+      &(m_xyz[0]), m_nbIndex, m_top.nTypes, m_paramsLJ, m_atoms, boxinfo, recip, ucell, nAtoms,
+      m_neighbourType, static_cast<float>( m_top.neighbourCutoff2 ), &(result.nearest[0]), &(result.neighbours[0]),
+      m_resultW, m_resultS, m_resultO, m_resultN, m_hasNeighbours) };
+    for (int i = 0; i < nAtoms; ++i) {
+      result.eww[i] = energies.eww[i];
+      result.esw[i] = energies.esw[i];
+    }
+  }
+
+private:
+  void freeMemory()
+  {
+    freeCuda_GIGIST(m_nbIndex);
+    freeCuda_GIGIST(m_atoms);
+    freeCuda_GIGIST(m_paramsLJ);
+    freeCuda_GIGIST(m_resultW);
+    freeCuda_GIGIST(m_resultS);
+    freeCuda_GIGIST(m_resultO);
+    freeCuda_GIGIST(m_resultN);
+    freeCuda_GIGIST(m_neighbourType);
+    m_nbIndex = nullptr;
+    m_atoms = nullptr;
+    m_paramsLJ = nullptr;
+    m_resultW = nullptr;
+    m_resultS = nullptr;
+    m_resultO = nullptr;
+    m_resultN = nullptr;
+    m_neighbourType = nullptr;
+  }
+
+  bool m_hasNeighbours = false;
+  std::vector<double> m_xyz;
+  int *m_nbIndex = nullptr;
+  void *m_atoms = nullptr;
+  void *m_paramsLJ = nullptr;
+  float *m_resultW = nullptr;
+  float *m_resultS = nullptr;
+  int *m_resultO = nullptr;
+  int *m_resultN = nullptr;
+  int *m_neighbourType = nullptr;
+};
+#endif
+
+/**
+ * @return: The names of the backends available in this build.
+ */
+inline std::vector<std::string> backendNames()
+{
+#ifdef CUDA
+  return { "cpu", "tiled", "reference", "pme", "cuda" };
+#else
+  return { "cpu", "tiled", "reference", "pme" };
+#endif
+}
+
+/**
+ * Creates a backend by its name.
+ * @param name: One of backendNames().
+ * @param options: Settings of the backend.
+ * @return: The backend, nullptr if the name is unknown.
+ */
+inline std::unique_ptr<Backend> createBackend(const std::string &name, const Options &options = Options())
+{
+  if (name == "cpu") {
+    return std::unique_ptr<Backend>(new ThreadedBackend());
+  }
+  if (name == "tiled") {
+    return std::unique_ptr<Backend>(new TiledBackend());
+  }
+  if (name == "reference") {
+    return std::unique_ptr<Backend>(new ReferenceBackend());
+  }
+  if (name == "pme") {
+    return std::unique_ptr<Backend>(new PmeBackend(options));
+  }
+#ifdef CUDA
+  if (name == "cuda") {
+    return std::unique_ptr<Backend>(new CudaBackend());
+  }
+#endif
+  return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Small complex-to-complex FFT for three dimensional grids, as needed for the
+ * particle mesh Ewald sum. Every dimension has to be a power of two. Neither
+ * direction is normalized, a forward and backward transform multiply the data
+ * by the number of grid points.
+ */
+class Fft3D {
+public:
+  using Complex = std::complex<double>;
+
+  Fft3D(int n1 = 1, int n2 = 1, int n3 = 1)
+  {
+    resize(n1, n2, n3);
+  }
+
+  /**
+   * @return: The smallest power of two that is at least n.
+   */
+  static int nextPowerOfTwo(int n)
+  {
+    int p{ 1 };
+    while (p < n) {
+      p *= 2;
+    }
+    return p;
+  }
+
+  /**
+   * Sets the size of the grid, the data is stored with the third index
+   * running fastest.
+   * @return: false if one of the dimensions is not a power of two.
+   */
+  bool resize(int n1, int n2, int n3)
+  {
+    m_dims[0] = n1;
+    m_dims[1] = n2;
+    m_dims[2] = n3;
+    for (int d = 0; d < 3; ++d) {
+      if (m_dims[d] < 1 || nextPowerOfTwo(m_dims[d]) != m_dims[d]) {
+        return false;
+      }
+      m_twiddles[d].resize(m_dims[d] / 2);
+      for (int k = 0; k < m_dims[d] / 2; ++k) {
+        double angle{ -2.0 * M_PI * k / m_dims[d] };
+        m_twiddles[d][k] = Complex(std::cos(angle), std::sin(angle));
+      }
+    }
+    return true;
+  }
+
+  int dim(int d) const { return m_dims[d]; }
+  int size() const { return m_dims[0] * m_dims[1] * m_dims[2]; }
+
+  /**
+   * Transforms with exp(-2 pi i k m / n).
+   */
+  void forward(std::vector<Complex> &data) const { transform(data, false); }
+
+  /**
+   * Transforms with exp(+2 pi i k m / n).
+   */
+  void backward(std::vector<Complex> &data) const { transform(data, true); }
+
+private:
+  void transform(std::vector<Complex> &data, bool inverse) const
+  {
+    const int strides[3]{ m_dims[1] * m_dims[2], m_dims[2], 1 };
+    for (int d = 0; d < 3; ++d) {
+      const int n{ m_dims[d] };
+      if (n == 1) {
+        continue;
+      }
+      // All lines along dimension d, identified by their first element.
+      const int nLines{ size() / n };
+      const int inner{ strides[d] };
+      #pragma omp parallel
+      {
+      std::vector<Complex> line(n);
+      #pragma omp for
+      for (int l = 0; l < nLines; ++l) {
+        int start{ (l / inner) * inner * n + l % inner };
+        for (int k = 0; k < n; ++k) {
+          line[k] = data[start + k * strides[d]];
+        }
+        transform1D(line, d, inverse);
+        for (int k = 0; k < n; ++k) {
+          data[start + k * strides[d]] = line[k];
+        }
+      }
+      }
+    }
+  }
+
+  /**
+   * Iterative radix-2 transform of a single line.
+   */
+  void transform1D(std::vector<Complex> &line, int d, bool inverse) const
+  {
+    const int n{ static_cast<int>( line.size() ) };
+    for (int i = 1, j = 0; i < n; ++i) {
+      int bit{ n >> 1 };
+      for (; j & bit; bit >>= 1) {
+        j ^= bit;
+      }
+      j ^= bit;
+      if (i < j) {
+        std::swap(line[i], line[j]);
+      }
+    }
+    for (int len = 2; len <= n; len *= 2) {
+      const int step{ n / len };
+      for (int i = 0; i < n; i += len) {
+        for (int k = 0; k < len / 2; ++k) {
+          Complex w{ m_twiddles[d][k * step] };
+          if (inverse) {
+            w = std::conj(w);
+          }
+          Complex u{ line[i + k] };
+          Complex v{ line[i + k + len / 2] * w };
+          line[i + k] = u + v;
+          line[i + k + len / 2] = u - v;
+        }
+      }
+    }
+  }
+
+  int m_dims[3];
+  std::vector<Complex> m_twiddles[3];
+};
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef HYDRATION_SITES_H
+#define HYDRATION_SITES_H
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+/**
+ * Finds hydration sites on a density grid, as a parallel alternative to the
+ * serial FEBISS placement.
+ *
+ * Every voxel above the density threshold points to its densest neighbour
+ * (26 neighbours, ties broken by the lower index). The local maxima point to
+ * themselves and are the roots of a forest, whose trees are resolved by
+ * pointer jumping. Every tree is a site, i.e., the connected region above the
+ * threshold is split at the density minima between its maxima. The free
+ * energy of a site is integrated over spherical shells around its maximum,
+ * until the shells hold one molecule.
+ *
+ * Data is stored with the third index running fastest, as in the dx files.
+ */
+class HydrationSites {
+public:
+  struct Site {
+    // The voxel of the density maximum and the density there.
+    int voxel = -1;
+    double density = 0.0;
+    // Number of voxels assigned to the site and the molecules in them.
+    int nVoxels = 0;
+    double population = 0.0;
+    // Molecules in the integrated shells, at most one, and their free energy.
+    double occupancy = 0.0;
+    double deltaG = 0.0;
+  };
+
+  HydrationSites(int nx = 1, int ny = 1, int nz = 1, double radius = 3.0)
+  {
+    resize(nx, ny, nz);
+    setRadius(radius);
+  }
+
+  void resize(int nx, int ny, int nz)
+  {
+    m_dims[0] = nx;
+    m_dims[1] = ny;
+    m_dims[2] = nz;
+    m_siteOf.assign(static_cast<std::size_t>(nx) * ny * nz, -1);
+  }
+
+  /**
+   * Sets the shell stencil used for the integration of the free energy.
+   * @param radius: The largest shell radius in voxels.
+   */
+  void setRadius(double radius)
+  {
+    int r{ static_cast<int>(radius) };
+    // A radius exactly on a shell, e.g. sqrt(3), includes that shell.
+    double radius2{ radius * radius + 1e-9 };
+    std::vector<std::pair<int, Offset> > offsets{};
+    for (int di = -r; di <= r; ++di) {
+      for (int dj = -r; dj <= r; ++dj) {
+        for (int dk = -r; dk <= r; ++dk) {
+          int d2{ di * di + dj * dj + dk * dk };
+          if (d2 <= radius2) {
+            offsets.push_back({ d2, Offset{ { di, dj, dk } } });
+          }
+        }
+      }
+    }
+    std::sort(offsets.begin(), offsets.end());
+    m_shells.clear();
+    int last{ -1 };
+    for (const auto &offset : offsets) {
+      if (offset.first != last) {
+        m_shells.push_back({});
+        last = offset.first;
+      }
+      m_shells.back().push_back(offset.second);
+    }
+  }
+
+  int shells() const { return static_cast<int>(m_shells.size()); }
+
+  /**
+   * Finds the sites.
+   * @param density: The density of every voxel, relative to the bulk.
+   * @param molecules: The mean number of molecules in every voxel.
+   * @param deltaG: The free energy of a molecule in every voxel.
+   * @param threshold: Only voxels with a higher density belong to a site.
+   * @return: The sites, ordered by decreasing density of their maximum.
+   */
+  std::vector<Site> find(
+    const std::vector<double> &density,
+    const std::vector<double> &molecules,
+    const std::vector<double> &deltaG,
+    double threshold)
+  {
+    const int nVoxels{ static_cast<int>(m_siteOf.size()) };
+    std::vector<int> parent(nVoxels, -1);
+    #pragma omp parallel for
+    for (int voxel = 0; voxel < nVoxels; ++voxel) {
+      if (density[voxel] <= threshold) {
+        continue;
+      }
+      int best{ voxel };
+      int i{}, j{}, k{};
+      ijk(voxel, i, j, k);
+      for (int di = -1; di <= 1; ++di) {
+        for (int dj = -1; dj <= 1; ++dj) {
+          for (int dk = -1; dk <= 1; ++dk) {
+            int other{ index(i + di, j + dj, k + dk) };
+            if (other != -1 && denser(density, other, best)) {
+              best = other;
+            }
+          }
+        }
+      }
+      parent[voxel] = best;
+    }
+
+    // Pointer jumping, the path to the root halves in every pass.
+    std::vector<int> next(parent);
+    bool changed{ true };
+    while (changed) {
+      changed = false;
+      #pragma omp parallel for reduction(||:changed)
+      for (int voxel = 0; voxel < nVoxels; ++voxel) {
+        if (parent[voxel] != -1) {
+          next[voxel] = parent[parent[voxel]];
+          changed = changed || next[voxel] != parent[voxel];
+        }
+      }
+      parent.swap(next);
+    }
+
+    std::vector<Site> sites{};
+    for (int voxel = 0; voxel < nVoxels; ++voxel) {
+      if (parent[voxel] == voxel) {
+        Site site{};
+        site.voxel = voxel;
+        site.density = density[voxel];
+        sites.push_back(site);
+      }
+    }
+    std::sort(sites.begin(), sites.end(), [&density](const Site &a, const Site &b) {
+      return denser(density, a.voxel, b.voxel);
+    });
+    std::vector<int> siteOfRoot(nVoxels, -1);
+    for (int s = 0; s < static_cast<int>(sites.size()); ++s) {
+      siteOfRoot[sites[s].voxel] = s;
+    }
+    for (int voxel = 0; voxel < nVoxels; ++voxel) {
+      m_siteOf[voxel] = parent[voxel] == -1 ? -1 : siteOfRoot[parent[voxel]];
+      if (m_siteOf[voxel] != -1) {
+        Site &site = sites[m_siteOf[voxel]];
+        ++site.nVoxels;
+        site.population += molecules[voxel];
+      }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < static_cast<int>(sites.size()); ++s) {
+      integrate(sites[s], s, molecules, deltaG);
+    }
+    return sites;
+  }
+
+  /**
+   * @return: The site of a voxel in the last call to find, -1 if the voxel
+   *          does not belong to a site.
+   */
+  int site(int voxel) const { return m_siteOf.at(voxel); }
+
+private:
+  using Offset = std::array<int, 3>;
+
+  // Higher density first, the lower index wins ties.
+  static bool denser(const std::vector<double> &density, int a, int b)
+  {
+    return density[a] > density[b] || (density[a] == density[b] && a < b);
+  }
+
+  void ijk(int voxel, int &i, int &j, int &k) const
+  {
+    k = voxel % m_dims[2];
+    j = (voxel / m_dims[2]) % m_dims[1];
+    i = voxel / (m_dims[1] * m_dims[2]);
+  }
+
+  // @return: The index of the voxel, -1 if it is outside of the grid.
+  int index(int i, int j, int k) const
+  {
+    if (i < 0 || j < 0 || k < 0 || i >= m_dims[0] || j >= m_dims[1] || k >= m_dims[2]) {
+      return -1;
+    }
+    return (i * m_dims[1] + j) * m_dims[2] + k;
+  }
+
+  /**
+   * Adds the shells around the maximum of a site until they hold one molecule,
+   * only a fraction of the last shell is used. Voxels of other sites are
+   * skipped.
+   */
+  void integrate(Site &site, int s, const std::vector<double> &molecules, const std::vector<double> &deltaG) const
+  {
+    int i{}, j{}, k{};
+    ijk(site.voxel, i, j, k);
+    for (const std::vector<Offset> &shell : m_shells) {
+      double shellMolecules{ 0.0 };
+      double shellG{ 0.0 };
+      for (const Offset &offset : shell) {
+        int voxel{ index(i + offset[0], j + offset[1], k + offset[2]) };
+        if (voxel != -1 && m_siteOf[voxel] == s) {
+          shellMolecules += molecules[voxel];
+          shellG += molecules[voxel] * deltaG[voxel];
+        }
+      }
+      double fraction{ 1.0 };
+      if (site.occupancy + shellMolecules > 1.0) {
+        fraction = (1.0 - site.occupancy) / shellMolecules;
+      }
+      site.occupancy += fraction * shellMolecules;
+      site.deltaG += fraction * shellG;
+      if (fraction < 1.0) {
+        break;
+      }
+    }
+  }
+
+  int m_dims[3];
+  std::vector<std::vector<Offset> > m_shells;
+  std::vector<int> m_siteOf;
+};
+
+#endif
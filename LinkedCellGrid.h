@@ -167,6 +167,40 @@ public:
         return m_data.size();
     }
 
+    /**
+     * The stored elements, each with the index of the next element of its
+     * cell. After compact(), the elements of a cell are the ones from its
+     * start to its end index, both are -1 for empty cells.
+     */
+    const std::pair<int, T> *data() const { return m_data.data(); }
+    const std::vector<int> &startIndices() const { return m_startIndices; }
+    const std::vector<int> &endIndices() const { return m_endIndices; }
+
+    /**
+     * Reorders the data, so that the elements of every cell are stored
+     * contiguously and the cells follow each other. The order within a cell
+     * is kept, all iterators are invalidated.
+     */
+    void compact()
+    {
+        std::vector<std::pair<int, T>> data;
+        data.reserve(m_data.size());
+        for (size_t cell = 0; cell < m_startIndices.size(); ++cell) {
+            int next = m_startIndices[cell];
+            if (next == -1) {
+                continue;
+            }
+            m_startIndices[cell] = data.size();
+            while (next != -1) {
+                data.push_back({static_cast<int>(data.size()) + 1, std::move(m_data[next].second)});
+                next = m_data[next].first;
+            }
+            data.back().first = -1;
+            m_endIndices[cell] = data.size() - 1;
+        }
+        m_data.swap(data);
+    }
+
     void push_back(int idx, T value)
     {
         int pos = m_data.size();
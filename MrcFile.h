@@ -0,0 +1,161 @@
+#ifndef MRC_FILE_H
+#define MRC_FILE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CompressedStream.h"
+
+/**
+ * Writes grids as binary MRC2014 (CCP4) maps with 32 bit floats. Several
+ * volumes of the same geometry are written as a volume stack into a single
+ * file, their names are stored as 80 character records in the extended
+ * header (type "GIST"), which readers that do not know it skip.
+ *
+ * Volumes are added in the order of the dx files (third index fastest) and
+ * stored with the first index fastest, as most readers expect. The header and
+ * the data of all volumes are assembled in memory and each written with a
+ * single call, file names ending in .gz or .zst are compressed.
+ */
+class MrcFile {
+public:
+  static constexpr int HEADER_SIZE = 1024;
+  static constexpr int NAME_SIZE = 80;
+
+  /**
+   * @param dims: The number of voxels along x, y and z.
+   * @param origin: The corner of the grid, as in the dx files.
+   * @param spacing: The edge length of a voxel.
+   */
+  MrcFile(const std::array<int, 3> &dims, const std::array<double, 3> &origin, double spacing)
+    : m_dims(dims), m_origin(origin), m_spacing(spacing)
+  {}
+
+  /**
+   * Adds a volume, converted to float.
+   * @param name: The name of the volume, at most 80 characters are kept.
+   * @param value: Gives the value of a voxel index in dx order.
+   */
+  template<class Func>
+  void add(const std::string &name, Func value)
+  {
+    const std::size_t n{ voxels() };
+    const std::size_t begin{ m_data.size() };
+    m_data.resize(begin + n);
+    m_names.push_back(name.substr(0, NAME_SIZE));
+    const int nx{ m_dims[0] }, ny{ m_dims[1] }, nz{ m_dims[2] };
+    float *out{ m_data.data() + begin };
+    #pragma omp parallel for
+    for (int i = 0; i < nx; ++i) {
+      for (int j = 0; j < ny; ++j) {
+        for (int k = 0; k < nz; ++k) {
+          out[(static_cast<std::size_t>(k) * ny + j) * nx + i] =
+            static_cast<float>(value((static_cast<std::size_t>(i) * ny + j) * nz + k));
+        }
+      }
+    }
+  }
+
+  void add(const std::string &name, const std::vector<double> &data)
+  {
+    add(name, [&data](std::size_t voxel) { return data[voxel]; });
+  }
+
+  int volumes() const { return static_cast<int>(m_names.size()); }
+
+  std::size_t voxels() const
+  {
+    return static_cast<std::size_t>(m_dims[0]) * m_dims[1] * m_dims[2];
+  }
+
+  /**
+   * Writes all volumes, a single volume as a map, several as a stack.
+   * @return: false if there are no volumes or the file could not be written.
+   */
+  bool write(const std::string &fileName) const
+  {
+    const int nVolumes{ volumes() };
+    if (nVolumes == 0) {
+      return false;
+    }
+    const std::size_t extended{ static_cast<std::size_t>(nVolumes) * NAME_SIZE };
+    std::vector<char> buffer(HEADER_SIZE + extended, '\0');
+    // Header words, 1-based as in the format description.
+    auto setInt = [&buffer](int word, std::int32_t value) { std::memcpy(&buffer[4 * (word - 1)], &value, 4); };
+    auto setFloat = [&buffer](int word, double value) {
+      float f{ static_cast<float>(value) };
+      std::memcpy(&buffer[4 * (word - 1)], &f, 4);
+    };
+
+    // Columns, rows, sections; a stack has the volumes after each other along z.
+    setInt(1, m_dims[0]);
+    setInt(2, m_dims[1]);
+    setInt(3, m_dims[2] * nVolumes);
+    setInt(4, 2);
+    setInt(8, m_dims[0]);
+    setInt(9, m_dims[1]);
+    setInt(10, m_dims[2]);
+    for (int i = 0; i < 3; ++i) {
+      setFloat(11 + i, m_dims[i] * m_spacing);
+      setFloat(14 + i, 90.0);
+      setInt(17 + i, i + 1);
+    }
+    float low{ 0.0f }, high{ 0.0f };
+    double sum{ 0.0 }, sum2{ 0.0 };
+    if (!m_data.empty()) {
+      low = *std::min_element(m_data.begin(), m_data.end());
+      high = *std::max_element(m_data.begin(), m_data.end());
+      for (float value : m_data) {
+        sum += value;
+        sum2 += static_cast<double>(value) * value;
+      }
+    }
+    const double mean{ m_data.empty() ? 0.0 : sum / m_data.size() };
+    setFloat(20, low);
+    setFloat(21, high);
+    setFloat(22, mean);
+    setInt(23, nVolumes > 1 ? 401 : 1);
+    setInt(24, static_cast<std::int32_t>(extended));
+    std::memcpy(buffer.data() + 104, "GIST", 4);
+    setInt(28, 20140);
+    for (int i = 0; i < 3; ++i) {
+      setFloat(50 + i, m_origin[i]);
+    }
+    std::memcpy(buffer.data() + 208, "MAP ", 4);
+    // Machine stamp of little (0x44 0x44) or big (0x11 0x11) endian data.
+    const std::uint16_t one{ 1 };
+    const char stamp{ static_cast<char>(*reinterpret_cast<const unsigned char *>(&one) == 1 ? 0x44 : 0x11) };
+    buffer[212] = stamp;
+    buffer[213] = stamp;
+    setFloat(55, m_data.empty() ? 0.0 : std::sqrt(std::max(0.0, sum2 / m_data.size() - mean * mean)));
+    setInt(56, 1);
+    const std::string label{ "gigist: " + (nVolumes == 1 ? m_names.front() : std::to_string(nVolumes) + " volumes") };
+    std::memcpy(buffer.data() + 224, label.data(), std::min<std::size_t>(label.size(), NAME_SIZE));
+    for (int v = 0; v < nVolumes; ++v) {
+      std::memcpy(buffer.data() + HEADER_SIZE + v * NAME_SIZE, m_names[v].data(), m_names[v].size());
+    }
+
+    CompressedStream file{};
+    if (!file.open(fileName)) {
+      return false;
+    }
+    file.write(buffer.data(), buffer.size());
+    file.write(reinterpret_cast<const char *>(m_data.data()), m_data.size() * sizeof(float));
+    return static_cast<bool>(file) && file.close();
+  }
+
+private:
+  std::array<int, 3> m_dims;
+  std::array<double, 3> m_origin;
+  double m_spacing;
+  std::vector<std::string> m_names;
+  // All volumes after each other, first index fastest.
+  std::vector<float> m_data;
+};
+
+#endif
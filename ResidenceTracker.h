@@ -0,0 +1,129 @@
+#ifndef RESIDENCE_TRACKER_H
+#define RESIDENCE_TRACKER_H
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Streaming residence time statistics of molecules in voxels.
+ *
+ * For every molecule, only the voxel it currently resides in and the first
+ * and last frame of its current run are stored. Once a run ends (the molecule
+ * moved to a different voxel, left the grid, or was not seen in a frame), its
+ * length is added to the statistics of the voxel. The memory needed is thus
+ * O(molecules + voxels * maxLength), independent of the number of frames.
+ */
+class ResidenceTracker {
+public:
+  ResidenceTracker(int nVoxels = 0, int maxLength = 20)
+  {
+    resize(nVoxels, maxLength);
+  }
+
+  /**
+   * Resizes the tracker and removes all statistics.
+   * @param nVoxels: The number of voxels of the grid.
+   * @param maxLength: Number of bins of the run length histogram. Runs of
+   *                   maxLength frames or longer are put into the last bin.
+   */
+  void resize(int nVoxels, int maxLength)
+  {
+    m_maxLength = std::max(1, maxLength);
+    m_runs.assign(nVoxels, 0);
+    m_totalLength.assign(nVoxels, 0);
+    m_histogram.assign(static_cast<std::size_t>(nVoxels) * m_maxLength, 0);
+    m_molecules.clear();
+  }
+
+  /**
+   * Records the voxel of a molecule in a frame. Frames have to be passed in
+   * ascending order for each molecule.
+   * @param molecule: The index of the molecule.
+   * @param voxel: The voxel the molecule resides in, -1 if it is not on the grid.
+   * @param frame: The index of the frame.
+   */
+  void update(int molecule, int voxel, int frame)
+  {
+    if (molecule >= static_cast<int>(m_molecules.size())) {
+      m_molecules.resize(molecule + 1);
+    }
+    Run &run = m_molecules[molecule];
+    if (run.voxel == voxel && voxel != -1 && frame == run.last + 1) {
+      run.last = frame;
+      return;
+    }
+    closeRun(run);
+    run.voxel = voxel;
+    run.first = frame;
+    run.last = frame;
+  }
+
+  /**
+   * Ends all open runs, should be called after the last frame.
+   */
+  void finish()
+  {
+    for (Run &run : m_molecules) {
+      closeRun(run);
+    }
+  }
+
+  /**
+   * @return The number of finished runs in the voxel.
+   */
+  long runs(int voxel) const { return m_runs.at(voxel); }
+
+  /**
+   * @return The mean residence time in the voxel in frames, 0 if no molecule
+   *         ever resided there.
+   */
+  double meanResidence(int voxel) const
+  {
+    return m_runs.at(voxel) == 0 ? 0.0 : static_cast<double>(m_totalLength.at(voxel)) / m_runs.at(voxel);
+  }
+
+  /**
+   * @return The fraction of runs in the voxel that lasted at least length
+   *         frames. Only defined for lengths up to maxLength.
+   */
+  double survival(int voxel, int length) const
+  {
+    if (m_runs.at(voxel) == 0) {
+      return 0.0;
+    }
+    long longer{ 0 };
+    for (int i = std::max(1, length) - 1; i < m_maxLength; ++i) {
+      longer += m_histogram.at(static_cast<std::size_t>(voxel) * m_maxLength + i);
+    }
+    return static_cast<double>(longer) / m_runs.at(voxel);
+  }
+
+  int maxLength() const { return m_maxLength; }
+
+private:
+  struct Run {
+    int voxel = -1;
+    int first = 0;
+    int last = 0;
+  };
+
+  void closeRun(Run &run)
+  {
+    if (run.voxel == -1) {
+      return;
+    }
+    int length{ run.last - run.first + 1 };
+    m_runs[run.voxel] += 1;
+    m_totalLength[run.voxel] += length;
+    m_histogram[static_cast<std::size_t>(run.voxel) * m_maxLength + std::min(length, m_maxLength) - 1] += 1;
+    run.voxel = -1;
+  }
+
+  int m_maxLength = 1;
+  std::vector<long> m_runs;
+  std::vector<long> m_totalLength;
+  std::vector<long> m_histogram;
+  std::vector<Run> m_molecules;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "../AdaptiveOctree.h"
+#include <gtest/gtest.h>
+
+
+/**
+ * Places points on a regular lattice inside the box from low to high.
+ * @param n: The number of points along each axis.
+ */
+static void addLattice(std::vector<AdaptiveOctree::Point> &points, const AdaptiveOctree::Point &low,
+                       const AdaptiveOctree::Point &high, const AdaptiveOctree::Index &n)
+{
+    for (int i = 0; i < n[0]; ++i) {
+        for (int j = 0; j < n[1]; ++j) {
+            for (int k = 0; k < n[2]; ++k) {
+                points.push_back({ { low[0] + (i + 0.5) * (high[0] - low[0]) / n[0],
+                                     low[1] + (j + 0.5) * (high[1] - low[1]) / n[1],
+                                     low[2] + (k + 0.5) * (high[2] - low[2]) / n[2] } });
+            }
+        }
+    }
+}
+
+TEST(AdaptiveOctree, BulkTest)
+{
+    // 64 points per voxel everywhere, as in the bulk.
+    AdaptiveOctree tree{ 3, 3, 3, 2 };
+    std::vector<AdaptiveOctree::Point> points{};
+    addLattice(points, { { 0.0, 0.0, 0.0 } }, { { 3.0, 3.0, 3.0 } }, { { 12, 12, 12 } });
+    tree.build(points, 64.0, 1.5, 1.0);
+    EXPECT_EQ(tree.refinedCells(0), 0);
+    EXPECT_EQ(tree.refinedCells(1), 0);
+    AdaptiveOctree::Index low{}, high{};
+    EXPECT_FALSE(tree.bounds(0, low, high));
+    EXPECT_EQ(tree.leafLevel({ { 1.5, 1.5, 1.5 } }), 0);
+    EXPECT_EQ(tree.leafLevel({ { 3.5, 1.5, 1.5 } }), -1);
+}
+
+TEST(AdaptiveOctree, PeakTest)
+{
+    // All points in one octant of voxel (1, 2, 0), four times the bulk there.
+    AdaptiveOctree tree{ 4, 4, 4, 2 };
+    std::vector<AdaptiveOctree::Point> points{};
+    addLattice(points, { { 1.0, 2.0, 0.0 } }, { { 1.5, 2.5, 0.5 } }, { { 4, 4, 4 } });
+    tree.build(points, 128.0, 1.5, 100.0);
+    // The voxel itself has half the bulk density, but on level 1 the octant
+    // is four times as dense as the bulk.
+    EXPECT_EQ(tree.refinedCells(0), 0);
+
+    tree.build(points, 128.0, 1.5, 1.0);
+    EXPECT_EQ(tree.refinedCells(0), 1);
+    EXPECT_TRUE(tree.refined(0, 1, 2, 0));
+    EXPECT_EQ(tree.refinedCells(1), 1);
+    EXPECT_TRUE(tree.refined(1, 2, 4, 0));
+    AdaptiveOctree::Index low{}, high{};
+    ASSERT_TRUE(tree.bounds(1, low, high));
+    EXPECT_EQ(low, (AdaptiveOctree::Index{ { 2, 4, 0 } }));
+    EXPECT_EQ(high, (AdaptiveOctree::Index{ { 2, 4, 0 } }));
+    EXPECT_EQ(tree.dims(2), (AdaptiveOctree::Index{ { 16, 16, 16 } }));
+    EXPECT_EQ(tree.leafLevel({ { 1.2, 2.2, 0.2 } }), 2);
+    EXPECT_EQ(tree.leafLevel({ { 1.7, 2.2, 0.2 } }), 1);
+    EXPECT_EQ(tree.leafLevel({ { 0.5, 0.5, 0.5 } }), 0);
+}
+
+TEST(AdaptiveOctree, InterfaceTest)
+{
+    // Bulk density below z = 1.5, vacuum above: only the voxels at the
+    // interface have children of different density.
+    AdaptiveOctree tree{ 2, 2, 4, 1 };
+    std::vector<AdaptiveOctree::Point> points{};
+    addLattice(points, { { 0.0, 0.0, 0.0 } }, { { 2.0, 2.0, 1.5 } }, { { 8, 8, 6 } });
+    tree.build(points, 64.0, 1.5, 0.5);
+    EXPECT_EQ(tree.refinedCells(0), 4);
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            EXPECT_FALSE(tree.refined(0, i, j, 0));
+            EXPECT_TRUE(tree.refined(0, i, j, 1));
+            EXPECT_FALSE(tree.refined(0, i, j, 2));
+            EXPECT_FALSE(tree.refined(0, i, j, 3));
+        }
+    }
+}
+
+TEST(AdaptiveOctree, BorderTest)
+{
+    // A 6 x 6 x 6 refinement grid, only the voxels with i < 4 are active.
+    const AdaptiveOctree::Index dims{ { 6, 6, 6 } };
+    auto voxel = [](int i, int j, int k) { return static_cast<long>((i * 6 + j) * 6 + k); };
+    std::vector<char> active(6 * 6 * 6, 0);
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 6; ++j) {
+            for (int k = 0; k < 6; ++k) {
+                active[voxel(i, j, k)] = 1;
+            }
+        }
+    }
+    // Without a mask, only the faces of the grid are border.
+    EXPECT_TRUE(AdaptiveOctree::atBorder(dims, {}, voxel(0, 2, 2)));
+    EXPECT_TRUE(AdaptiveOctree::atBorder(dims, {}, voxel(2, 2, 5)));
+    EXPECT_FALSE(AdaptiveOctree::atBorder(dims, {}, voxel(3, 2, 2)));
+    // The last active layer at the edge of the mask is border as well.
+    EXPECT_TRUE(AdaptiveOctree::atBorder(dims, active, voxel(3, 2, 2)));
+    EXPECT_FALSE(AdaptiveOctree::atBorder(dims, active, voxel(2, 2, 2)));
+    EXPECT_FALSE(AdaptiveOctree::atBorder(dims, active, voxel(1, 4, 1)));
+    EXPECT_TRUE(AdaptiveOctree::atBorder(dims, active, voxel(2, 5, 2)));
+}
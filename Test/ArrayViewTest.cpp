@@ -0,0 +1,57 @@
+#include "../ArrayView.h"
+#include "../LinkedCellGrid.h"
+#include <array>
+#include <tuple>
+#include <gtest/gtest.h>
+
+
+TEST(ArrayView, ContiguousTest)
+{
+    // A 2 x 3 x 4 grid in dx order.
+    std::vector<float> grid(24);
+    for (std::size_t i = 0; i < grid.size(); ++i) {
+        grid[i] = static_cast<float>(i);
+    }
+    ArrayView view{ ArrayView::contiguous(grid.data(), { 2, 3, 4 }) };
+    EXPECT_EQ(view.format, 'f');
+    EXPECT_EQ(view.itemSize, sizeof(float));
+    EXPECT_EQ(view.strides, (std::vector<std::ptrdiff_t>{ 48, 16, 4 }));
+    EXPECT_EQ(view.size(), 24u);
+    EXPECT_EQ(view.at<float>({ 1, 2, 3 }), 23.0f);
+    EXPECT_EQ(view.at<float>({ 1, 0, 2 }), 14.0f);
+}
+
+TEST(ArrayView, FieldTest)
+{
+    // Samples as stored in a compacted LinkedCellGrid: a position, a
+    // weight and a frame per record.
+    using Sample = std::tuple<std::array<double, 3>, float, int>;
+    LinkedCellGrid<Sample> samples{ 3, 4 };
+    samples.push_back(2, Sample{ { { 1.0, 2.0, 3.0 } }, 0.5f, 7 });
+    samples.push_back(0, Sample{ { { 4.0, 5.0, 6.0 } }, 1.5f, 8 });
+    samples.push_back(2, Sample{ { { 7.0, 8.0, 9.0 } }, 2.5f, 9 });
+    samples.compact();
+    using Record = std::pair<int, Sample>;
+    const std::size_t n{ samples.getTotalDataSize() };
+
+    ArrayView centers{ ArrayView::field<double>(samples.data(), n, [](const Record &r) {
+        return std::get<0>(r.second).data(); }, 3) };
+    EXPECT_EQ(centers.shape, (std::vector<std::size_t>{ 3, 3 }));
+    EXPECT_EQ(centers.strides, (std::vector<std::ptrdiff_t>{ sizeof(Record), sizeof(double) }));
+    ArrayView frames{ ArrayView::field<int>(samples.data(), n, [](const Record &r) { return &std::get<2>(r.second); }) };
+    EXPECT_EQ(frames.format, 'i');
+    EXPECT_EQ(frames.shape, (std::vector<std::size_t>{ 3 }));
+
+    // Cell 0 comes first, then both samples of cell 2 in their order.
+    EXPECT_EQ(samples.startIndices(), (std::vector<int>{ 0, -1, 1 }));
+    EXPECT_EQ(samples.endIndices(), (std::vector<int>{ 0, -1, 2 }));
+    EXPECT_EQ(centers.at<double>({ 0, 1 }), 5.0);
+    EXPECT_EQ(centers.at<double>({ 2, 2 }), 9.0);
+    EXPECT_EQ(frames.at<int>({ 1 }), 7);
+    EXPECT_EQ(frames.at<int>({ 2 }), 9);
+
+    ArrayView empty{ ArrayView::field<int>(static_cast<const Record *>(nullptr), 0, [](const Record &r) {
+        return &std::get<2>(r.second); }) };
+    EXPECT_EQ(empty.data, nullptr);
+    EXPECT_EQ(empty.size(), 0u);
+}
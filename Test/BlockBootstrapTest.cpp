@@ -0,0 +1,73 @@
+#include "../BlockBootstrap.h"
+#include <gtest/gtest.h>
+
+
+TEST(BlockBootstrap, StrideTest)
+{
+    FrameSubset all{};
+    EXPECT_TRUE(all.all());
+    EXPECT_EQ(all.weight(7), 1);
+    EXPECT_EQ(all.distinctFrames(10), 10);
+
+    FrameSubset subset{};
+    subset.stride = 4;
+    EXPECT_FALSE(subset.all());
+    // Frames 1, 5 and 9.
+    EXPECT_EQ(subset.weight(1), 1);
+    EXPECT_EQ(subset.weight(4), 0);
+    EXPECT_EQ(subset.weight(9), 1);
+    EXPECT_EQ(subset.distinctFrames(10), 3);
+    EXPECT_EQ(subset.weightedFrames(10), 3);
+}
+
+TEST(BlockBootstrap, ReplicateTest)
+{
+    // 25 frames in blocks of 10, the last block holds 5 frames.
+    BlockBootstrap bootstrap{ 25, 10, 3 };
+    EXPECT_EQ(bootstrap.blocks(), 3);
+    EXPECT_EQ(bootstrap.block(10), 0);
+    EXPECT_EQ(bootstrap.block(11), 1);
+    for (int replicate = 0; replicate < 20; ++replicate) {
+        FrameSubset subset{ bootstrap.replicate(replicate) };
+        ASSERT_EQ(subset.blockWeights.size(), 3u);
+        EXPECT_EQ(subset.blockWeights[0] + subset.blockWeights[1] + subset.blockWeights[2], 3);
+        EXPECT_EQ(subset.weight(5), subset.blockWeights[0]);
+        EXPECT_EQ(subset.weight(25), subset.blockWeights[2]);
+        EXPECT_EQ(subset.weight(31), 0);
+        EXPECT_EQ(subset.weightedFrames(25),
+                  10 * subset.blockWeights[0] + 10 * subset.blockWeights[1] + 5 * subset.blockWeights[2]);
+        int distinct{ 0 };
+        for (int frame = 1; frame <= 25; ++frame) {
+            distinct += subset.weight(frame) > 0;
+        }
+        EXPECT_EQ(subset.distinctFrames(25), distinct);
+        // The draws only depend on the seed and the index.
+        EXPECT_EQ(bootstrap.replicate(replicate).blockWeights, subset.blockWeights);
+    }
+}
+
+TEST(BlockBootstrap, StandardErrorTest)
+{
+    EXPECT_EQ(BlockBootstrap::standardError({ 2.0 }), 0.0);
+    EXPECT_DOUBLE_EQ(BlockBootstrap::standardError({ 1.0, 2.0, 3.0, 4.0 }), std::sqrt(5.0 / 3.0));
+
+    // The error of the mean of independent blocks is their spread over the
+    // square root of their number.
+    const int nBlocks{ 50 };
+    BlockBootstrap bootstrap{ nBlocks, 1, 11 };
+    std::vector<double> blockValues(nBlocks);
+    for (int block = 0; block < nBlocks; ++block) {
+        blockValues[block] = (block * 37) % nBlocks;
+    }
+    std::vector<double> means{};
+    for (int replicate = 0; replicate < 2000; ++replicate) {
+        FrameSubset subset{ bootstrap.replicate(replicate) };
+        double mean{ 0.0 };
+        for (int block = 0; block < nBlocks; ++block) {
+            mean += subset.blockWeights[block] * blockValues[block];
+        }
+        means.push_back(mean / nBlocks);
+    }
+    const double expected{ BlockBootstrap::standardError(blockValues) * std::sqrt((nBlocks - 1.0) / nBlocks) / std::sqrt(nBlocks) };
+    EXPECT_NEAR(BlockBootstrap::standardError(means), expected, 0.1 * expected);
+}
@@ -0,0 +1,85 @@
+#include "../CompressedStream.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <gtest/gtest.h>
+
+
+static std::string readFile(const std::string &name)
+{
+    std::ifstream file{ name.c_str(), std::ios::binary };
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+/**
+ * Text of several blocks, so that the compressed file holds several members.
+ */
+static std::string sampleText()
+{
+    std::string text{};
+    for (int voxel = 0; static_cast<int>(text.size()) < 3 * CompressedBuffer::BLOCK_SIZE + 1000; ++voxel) {
+        text += std::to_string(voxel) + " " + std::to_string(voxel * 0.25) + " 1.5e-3\n";
+    }
+    return text;
+}
+
+TEST(CompressedStream, FormatTest)
+{
+    EXPECT_EQ(CompressedBuffer::formatOf("out.dat"), CompressedBuffer::Format::PLAIN);
+    EXPECT_EQ(CompressedBuffer::formatOf("out.dat.gz"), CompressedBuffer::Format::GZIP);
+    EXPECT_EQ(CompressedBuffer::formatOf("population.dx.zst"), CompressedBuffer::Format::ZSTD);
+    EXPECT_EQ(CompressedBuffer::compressionSuffix("out.dat.gz"), ".gz");
+    EXPECT_EQ(CompressedBuffer::compressionSuffix("gz"), "");
+    EXPECT_TRUE(CompressedBuffer::supported(CompressedBuffer::Format::PLAIN));
+}
+
+TEST(CompressedStream, PlainTest)
+{
+    const std::string name{ "CompressedStreamTest.dat" };
+    const std::string text{ sampleText() };
+    {
+        CompressedStream file{ name };
+        ASSERT_TRUE(static_cast<bool>(file));
+        file.Printf("%d %s\n", 42, "voxels");
+        file << text;
+        EXPECT_TRUE(file.close());
+    }
+    EXPECT_EQ(readFile(name), "42 voxels\n" + text);
+    std::remove(name.c_str());
+}
+
+#ifdef HASGZ
+TEST(CompressedStream, GzipTest)
+{
+    const std::string name{ "CompressedStreamTest.dat.gz" };
+    const std::string text{ sampleText() };
+    {
+        CompressedStream file{ name };
+        ASSERT_TRUE(static_cast<bool>(file));
+        file.Printf("GIST output, n_frames = %d\n", 10);
+        file << text;
+        EXPECT_TRUE(file.close());
+    }
+    EXPECT_LT(readFile(name).size(), text.size() / 2);
+
+    // gzread continues across the concatenated members.
+    gzFile gz{ gzopen(name.c_str(), "rb") };
+    ASSERT_NE(gz, nullptr);
+    std::string decompressed{};
+    char buffer[65536];
+    int length{ 0 };
+    while ((length = gzread(gz, buffer, sizeof(buffer))) > 0) {
+        decompressed.append(buffer, length);
+    }
+    gzclose(gz);
+    std::remove(name.c_str());
+    EXPECT_EQ(decompressed, "GIST output, n_frames = 10\n" + text);
+}
+#else
+TEST(CompressedStream, UnavailableTest)
+{
+    CompressedStream file{};
+    EXPECT_FALSE(file.open("CompressedStreamTest.dat.gz"));
+    EXPECT_FALSE(static_cast<bool>(file));
+}
+#endif
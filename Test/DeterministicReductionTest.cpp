@@ -0,0 +1,68 @@
+#include "../DeterministicReduction.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+
+
+TEST(DeterministicReduction, NumberOfBlocksTest)
+{
+    EXPECT_EQ(DeterministicReduction::numberOfBlocks(0), 0);
+    EXPECT_EQ(DeterministicReduction::numberOfBlocks(1), 1);
+    EXPECT_EQ(DeterministicReduction::numberOfBlocks(DeterministicReduction::BLOCK_SIZE), 1);
+    EXPECT_EQ(DeterministicReduction::numberOfBlocks(DeterministicReduction::BLOCK_SIZE + 1), 2);
+}
+
+TEST(DeterministicReduction, PairwiseSumTest)
+{
+    std::vector<double> values{ 1.0, 2.0, 3.0, 4.0, 5.0 };
+    EXPECT_DOUBLE_EQ(DeterministicReduction::pairwiseSum(values), 15.0);
+    EXPECT_DOUBLE_EQ(DeterministicReduction::pairwiseSum(std::vector<double>{}), 0.0);
+    // ((1e16 + 1) + (-1e16 + 1)) is evaluated in this fixed tree order.
+    std::vector<double> cancel{ 1e16, 1.0, -1e16, 1.0 };
+    EXPECT_DOUBLE_EQ(DeterministicReduction::pairwiseSum(cancel), (1e16 + 1.0) + (-1e16 + 1.0));
+}
+
+TEST(DeterministicReduction, NearestNeighborsTest)
+{
+    DeterministicReduction::NearestNeighbors<4> nearest{};
+    EXPECT_EQ(nearest.index(0), -1);
+    nearest.insert(3.0, 30);
+    nearest.insert(1.0, 10);
+    nearest.insert(5.0, 50);
+    nearest.insert(2.0, 20);
+    nearest.insert(4.0, 40);
+    EXPECT_EQ(nearest.index(0), 10);
+    EXPECT_EQ(nearest.index(1), 20);
+    EXPECT_EQ(nearest.index(2), 30);
+    EXPECT_EQ(nearest.index(3), 40);
+    EXPECT_DOUBLE_EQ(nearest.distance(3), 4.0);
+}
+
+TEST(DeterministicReduction, NearestNeighborsOrderIndependentTest)
+{
+    // Many ties, the result has to be the same for every insertion order and
+    // for every split into blocks.
+    std::vector<std::pair<double, int> > points{};
+    for (int i = 0; i < 40; ++i) {
+        points.push_back({ static_cast<double>(i % 3), i });
+    }
+    DeterministicReduction::NearestNeighbors<4> reference{};
+    for (const auto &p : points) {
+        reference.insert(p.first, p.second);
+    }
+    std::mt19937 gen{ 42 };
+    for (int run = 0; run < 10; ++run) {
+        std::shuffle(points.begin(), points.end(), gen);
+        DeterministicReduction::NearestNeighbors<4> first{};
+        DeterministicReduction::NearestNeighbors<4> second{};
+        for (unsigned int i = 0; i < points.size(); ++i) {
+            (i < 17 ? first : second).insert(points[i].first, points[i].second);
+        }
+        first.merge(second);
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_EQ(first.index(i), reference.index(i));
+        }
+    }
+    EXPECT_EQ(reference.index(0), 0);
+    EXPECT_EQ(reference.index(3), 9);
+}
@@ -0,0 +1,50 @@
+#include "../DistanceTransform.h"
+#include <random>
+#include <gtest/gtest.h>
+
+
+TEST(DistanceTransform, SingleSeedTest)
+{
+    const std::array<int, 3> dims{ { 4, 5, 6 } };
+    // Voxel (1, 2, 3).
+    std::vector<double> field{ DistanceTransform::squared(dims, { (1 * 5 + 2) * 6 + 3 }) };
+    ASSERT_EQ(field.size(), 120u);
+    EXPECT_EQ(field[(1 * 5 + 2) * 6 + 3], 0.0);
+    EXPECT_EQ(field[(3 * 5 + 0) * 6 + 5], 4.0 + 4.0 + 4.0);
+    EXPECT_EQ(field[(0 * 5 + 4) * 6 + 0], 1.0 + 4.0 + 9.0);
+}
+
+TEST(DistanceTransform, BruteForceTest)
+{
+    const std::array<int, 3> dims{ { 7, 9, 8 } };
+    std::mt19937 rng{ 7 };
+    std::uniform_int_distribution<int> voxel(0, 7 * 9 * 8 - 1);
+    std::vector<int> seeds{};
+    for (int s = 0; s < 6; ++s) {
+        seeds.push_back(voxel(rng));
+    }
+    seeds.push_back(seeds.front());
+    std::vector<double> field{ DistanceTransform::squared(dims, seeds) };
+    for (int i = 0; i < dims[0]; ++i) {
+        for (int j = 0; j < dims[1]; ++j) {
+            for (int k = 0; k < dims[2]; ++k) {
+                double best{ DistanceTransform::FAR };
+                for (int seed : seeds) {
+                    int di{ seed / (dims[1] * dims[2]) - i };
+                    int dj{ (seed / dims[2]) % dims[1] - j };
+                    int dk{ seed % dims[2] - k };
+                    best = std::min(best, static_cast<double>(di * di + dj * dj + dk * dk));
+                }
+                EXPECT_EQ(field[(i * dims[1] + j) * dims[2] + k], best);
+            }
+        }
+    }
+}
+
+TEST(DistanceTransform, NoSeedTest)
+{
+    std::vector<double> field{ DistanceTransform::squared({ { 3, 3, 3 } }, { -1, 27 }) };
+    for (double d : field) {
+        EXPECT_GE(d, double{ DistanceTransform::FAR });
+    }
+}
@@ -0,0 +1,384 @@
+#include "../EnergyBackend.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <complex>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+
+/**
+ * Builds a box of three-site molecules. The first nSolute molecules are solute,
+ * atom type 0 is the center atom, type 1 the other atoms.
+ */
+static GistEnergy::Topology makeTopology(int nMolecules, int nSolute)
+{
+    GistEnergy::Topology top{};
+    for (int mol = 0; mol < nMolecules; ++mol) {
+        for (int i = 0; i < 3; ++i) {
+            top.charges.push_back(i == 0 ? -0.834 : 0.417);
+            top.types.push_back(i == 0 ? 0 : 1);
+            top.molecules.push_back(mol);
+            top.solvent.push_back(mol >= nSolute);
+            top.neighbourType.push_back(i == 0 && mol >= nSolute ? 0 : -1);
+        }
+    }
+    top.nTypes = 2;
+    top.ljA = { 582000.0, 0.0, 0.0, 0.0 };
+    top.ljB = { 595.0, 0.0, 0.0, 0.0 };
+    top.neighbourCutoff2 = 3.5 * 3.5;
+    return top;
+}
+
+static GistEnergy::Coordinates makeCoordinates(int nMolecules, double length, unsigned int seed)
+{
+    std::mt19937 gen{ seed };
+    std::uniform_real_distribution<double> offset{ -0.6, 0.6 };
+    std::vector<double> xyz{};
+    // Molecules on a jittered lattice, so that no two atoms overlap.
+    int perSide{ static_cast<int>( std::ceil(std::cbrt(nMolecules)) ) };
+    double spacing{ length / perSide };
+    for (int mol = 0; mol < nMolecules; ++mol) {
+        double center[3]{ (mol % perSide + 0.5) * spacing,
+                          ((mol / perSide) % perSide + 0.5) * spacing,
+                          (mol / (perSide * perSide) + 0.5) * spacing };
+        for (int i = 0; i < 3; ++i) {
+            for (int d = 0; d < 3; ++d) {
+                xyz.push_back(center[d] + (i == 0 ? 0.3 : 1.0) * offset(gen));
+            }
+        }
+    }
+    GistEnergy::Coordinates coords{};
+    coords.assign(xyz.data(), 3 * nMolecules);
+    coords.box.type = GistEnergy::BoxType::ORTHO;
+    coords.box.ucell[0] = length;
+    coords.box.ucell[4] = length;
+    coords.box.ucell[8] = length;
+    return coords;
+}
+
+static std::vector<int> allAtoms(int nAtoms)
+{
+    std::vector<int> atoms(nAtoms);
+    for (int i = 0; i < nAtoms; ++i) {
+        atoms[i] = i;
+    }
+    return atoms;
+}
+
+static void expectSameResults(const GistEnergy::Result &a, const GistEnergy::Result &b, double tolerance)
+{
+    ASSERT_EQ(a.eww.size(), b.eww.size());
+    for (unsigned int i = 0; i < a.eww.size(); ++i) {
+        EXPECT_NEAR(a.eww[i], b.eww[i], tolerance * (1.0 + std::abs(a.eww[i])));
+        EXPECT_NEAR(a.esw[i], b.esw[i], tolerance * (1.0 + std::abs(a.esw[i])));
+        EXPECT_EQ(a.neighbours[i], b.neighbours[i]);
+    }
+    EXPECT_EQ(a.nearest, b.nearest);
+}
+
+TEST(EnergyBackend, TwoAtomsTest)
+{
+    // Two ions 4 Angstrom apart, the second one being solvent.
+    GistEnergy::Topology top{};
+    top.charges = { 1.0, -1.0 };
+    top.types = { 0, 0 };
+    top.molecules = { 0, 1 };
+    top.solvent = { 0, 1 };
+    top.neighbourType = { -1, 0 };
+    top.nTypes = 1;
+    top.ljA = { 4096.0 };
+    top.ljB = { 64.0 };
+    top.coulombFactor = 332.0;
+    top.neighbourCutoff2 = 25.0;
+    double xyz[6]{ 0, 0, 0, 4, 0, 0 };
+    GistEnergy::Coordinates coords{};
+    coords.assign(xyz, 2);
+    double expected{ -332.0 / 4.0 + 4096.0 / std::pow(4.0, 12) - 64.0 / std::pow(4.0, 6) };
+
+    for (const std::string &name : GistEnergy::backendNames()) {
+        if (name == "cuda") {
+            continue;
+        }
+        std::unique_ptr<GistEnergy::Backend> backend{ GistEnergy::createBackend(name) };
+        ASSERT_TRUE(backend->setup(top));
+        GistEnergy::Result result{};
+        backend->calculate(coords, allAtoms(2), result);
+        // The solute atom only sees solvent, the solvent atom only solute.
+        EXPECT_NEAR(result.eww[0], 0.5 * expected, 1e-12) << name;
+        EXPECT_NEAR(result.esw[1], expected, 1e-12) << name;
+        EXPECT_DOUBLE_EQ(result.esw[0], 0.0);
+        EXPECT_DOUBLE_EQ(result.eww[1], 0.0);
+        EXPECT_EQ(result.neighbours[1], 0);
+        EXPECT_EQ(result.nearest[4], -1);
+    }
+    EXPECT_EQ(GistEnergy::createBackend("none"), nullptr);
+}
+
+TEST(EnergyBackend, MinimumImageTest)
+{
+    GistEnergy::Box box{};
+    box.type = GistEnergy::BoxType::ORTHO;
+    box.ucell[0] = 10.0;
+    box.ucell[4] = 20.0;
+    box.ucell[8] = 30.0;
+    EXPECT_DOUBLE_EQ(GistEnergy::minimumImage2(box, 9.0, 0.0, 0.0), 1.0);
+    EXPECT_DOUBLE_EQ(GistEnergy::minimumImage2(box, 0.0, -19.0, 16.0), 1.0 + 196.0);
+
+    // The same box written as a general cell gives the same distances.
+    GistEnergy::Box general{};
+    general.type = GistEnergy::BoxType::NONORTHO;
+    general.ucell[0] = 10.0;
+    general.ucell[4] = 20.0;
+    general.ucell[8] = 30.0;
+    general.recip[0] = 0.1;
+    general.recip[4] = 0.05;
+    general.recip[8] = 1.0 / 30.0;
+    EXPECT_NEAR(GistEnergy::minimumImage2(general, 9.0, 0.0, 0.0), 1.0, 1e-12);
+    EXPECT_NEAR(GistEnergy::minimumImage2(general, 0.0, -19.0, 16.0), 197.0, 1e-12);
+}
+
+TEST(EnergyBackend, BackendsAgreeTest)
+{
+    const int nMolecules{ 216 };
+    GistEnergy::Topology top{ makeTopology(nMolecules, 8) };
+    GistEnergy::Coordinates coords{ makeCoordinates(nMolecules, 18.6, 7) };
+    std::vector<int> active{};
+    // Only a part of the atoms is needed, as in the action.
+    for (int i = 0; i < top.nAtoms(); i += 2) {
+        active.push_back(i);
+    }
+    GistEnergy::ReferenceBackend reference{};
+    GistEnergy::ThreadedBackend threaded{};
+    ASSERT_TRUE(reference.setup(top));
+    ASSERT_TRUE(threaded.setup(top));
+
+    for (GistEnergy::BoxType type : { GistEnergy::BoxType::NONE, GistEnergy::BoxType::ORTHO, GistEnergy::BoxType::NONORTHO }) {
+        coords.box.type = type;
+        for (int i = 0; i < 3; ++i) {
+            coords.box.recip[4 * i] = 1.0 / coords.box.ucell[4 * i];
+        }
+        GistEnergy::Result expected{};
+        GistEnergy::Result result{};
+        double expectedPairs{ 0 };
+        double pairs{ 0 };
+        std::mutex mutex{};
+        reference.calculate(coords, active, expected, [&](int, int, double e) { expectedPairs += e; });
+        threaded.calculate(coords, active, result, [&](int, int, double e) {
+            std::lock_guard<std::mutex> lock{ mutex };
+            pairs += e;
+        });
+        expectSameResults(expected, result, 1e-9);
+        EXPECT_NEAR(expectedPairs, pairs, 1e-8 * std::abs(expectedPairs));
+        // Atoms that were not requested stay empty.
+        EXPECT_DOUBLE_EQ(result.eww[1], 0.0);
+        EXPECT_EQ(result.nearest[4], -1);
+        // Solvent centers have neighbours in a box of water density.
+        EXPECT_GT(result.neighbours[3 * 100], 0);
+        EXPECT_NE(result.nearest[4 * 3 * 100 + 3], -1);
+    }
+}
+
+TEST(EnergyBackend, TiledTest)
+{
+    // More than one column tile, and row tiles that are not filled.
+    const int nMolecules{ 400 };
+    GistEnergy::Topology top{ makeTopology(nMolecules, 30) };
+    GistEnergy::Coordinates coords{ makeCoordinates(nMolecules, 23.0, 5) };
+    std::vector<int> active{};
+    for (int i = 1; i < top.nAtoms(); i += 3) {
+        active.push_back(i - 1);
+        if (i % 7 == 0) {
+            active.push_back(i);
+        }
+    }
+    GistEnergy::ThreadedBackend threaded{};
+    GistEnergy::TiledBackend tiled{};
+    ASSERT_TRUE(threaded.setup(top));
+    ASSERT_TRUE(tiled.setup(top));
+
+    for (GistEnergy::BoxType type : { GistEnergy::BoxType::NONE, GistEnergy::BoxType::ORTHO, GistEnergy::BoxType::NONORTHO }) {
+        coords.box.type = type;
+        for (int i = 0; i < 3; ++i) {
+            coords.box.recip[4 * i] = 1.0 / coords.box.ucell[4 * i];
+        }
+        GistEnergy::Result expected{};
+        GistEnergy::Result result{};
+        std::vector<double> expectedPairs(top.nAtoms(), 0.0);
+        std::vector<double> pairs(top.nAtoms(), 0.0);
+        std::mutex mutex{};
+        threaded.calculate(coords, active, expected, [&](int atom1, int, double e) {
+            std::lock_guard<std::mutex> lock{ mutex };
+            expectedPairs[atom1] += e;
+        });
+        tiled.calculate(coords, active, result, [&](int atom1, int, double e) {
+            std::lock_guard<std::mutex> lock{ mutex };
+            pairs[atom1] += e;
+        });
+        // Both sum in the same order.
+        EXPECT_EQ(expected.eww, result.eww);
+        EXPECT_EQ(expected.esw, result.esw);
+        EXPECT_EQ(expected.nearest, result.nearest);
+        EXPECT_EQ(expected.neighbours, result.neighbours);
+        for (int atom : active) {
+            EXPECT_NEAR(expectedPairs[atom], pairs[atom], 1e-9 * (1.0 + std::abs(pairs[atom])));
+        }
+    }
+}
+
+TEST(EnergyBackend, BenchmarkTest)
+{
+    const int nMolecules{ 1000 };
+    GistEnergy::Topology top{ makeTopology(nMolecules, 20) };
+    GistEnergy::Coordinates coords{ makeCoordinates(nMolecules, 31.0, 11) };
+    // One tenth of the molecules is on the grid.
+    std::vector<int> active(allAtoms(top.nAtoms() / 10));
+    GistEnergy::Result reference{};
+    for (const std::string &name : GistEnergy::backendNames()) {
+        std::unique_ptr<GistEnergy::Backend> backend{ GistEnergy::createBackend(name) };
+        if (!backend->setup(top)) {
+            continue;
+        }
+        GistEnergy::Result result{};
+        const int repeats{ 5 };
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; ++i) {
+            backend->calculate(coords, active, result);
+        }
+        std::chrono::duration<double, std::milli> time{ std::chrono::steady_clock::now() - start };
+        std::cout << "[ BENCHMARK ] " << name << ": " << time.count() / repeats << " ms per frame ("
+                  << active.size() << " of " << top.nAtoms() << " atoms)" << std::endl;
+        if (name == "pme") {
+            // Periodic electrostatics, not comparable to the minimum image sums.
+            continue;
+        }
+        if (reference.eww.empty()) {
+            reference = result;
+        } else {
+            // The GPU works in single precision.
+            for (int atom : active) {
+                EXPECT_NEAR(reference.eww[atom], result.eww[atom], 1e-4 * (1.0 + std::abs(reference.eww[atom])));
+                EXPECT_NEAR(reference.esw[atom], result.esw[atom], 1e-4 * (1.0 + std::abs(reference.esw[atom])));
+            }
+        }
+    }
+}
+
+/**
+ * Ewald sum with explicit reciprocal vectors, split into the potential of the
+ * solvent (0) and the solute (1) at every atom, without Lennard-Jones.
+ */
+static std::vector<double> directEwald(const GistEnergy::Topology &top, const GistEnergy::Coordinates &coords,
+                                       double length, double beta, double cutoff)
+{
+    const int n{ top.nAtoms() };
+    const double volume{ length * length * length };
+    std::vector<double> phi(2 * n, 0.0);
+    double totalCharge[2]{ 0.0, 0.0 };
+    for (int j = 0; j < n; ++j) {
+        totalCharge[top.solvent[j] ? 0 : 1] += top.charges[j];
+    }
+    const int mMax{ static_cast<int>( std::ceil(6.0 * beta * length / M_PI) ) };
+    for (int m1 = -mMax; m1 <= mMax; ++m1) {
+        for (int m2 = -mMax; m2 <= mMax; ++m2) {
+            for (int m3 = -mMax; m3 <= mMax; ++m3) {
+                if (m1 == 0 && m2 == 0 && m3 == 0) {
+                    continue;
+                }
+                double m_2{ (m1 * m1 + m2 * m2 + m3 * m3) / (length * length) };
+                double kernel{ std::exp(-M_PI * M_PI * m_2 / (beta * beta)) / (M_PI * volume * m_2) };
+                std::complex<double> structure[2]{};
+                for (int j = 0; j < n; ++j) {
+                    double phase{ 2.0 * M_PI * (m1 * coords.x[j] + m2 * coords.y[j] + m3 * coords.z[j]) / length };
+                    structure[top.solvent[j] ? 0 : 1] += top.charges[j] * std::complex<double>(std::cos(phase), std::sin(phase));
+                }
+                for (int i = 0; i < n; ++i) {
+                    double phase{ 2.0 * M_PI * (m1 * coords.x[i] + m2 * coords.y[i] + m3 * coords.z[i]) / length };
+                    std::complex<double> atom{ std::cos(phase), -std::sin(phase) };
+                    phi[2 * i] += kernel * (structure[0] * atom).real();
+                    phi[2 * i + 1] += kernel * (structure[1] * atom).real();
+                }
+            }
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int s = 0; s < 2; ++s) {
+            phi[2 * i + s] -= M_PI * totalCharge[s] / (beta * beta * volume);
+        }
+        phi[2 * i + (top.solvent[i] ? 0 : 1)] -= 2.0 * beta / std::sqrt(M_PI) * top.charges[i];
+        for (int j = 0; j < n; ++j) {
+            if (j == i) {
+                continue;
+            }
+            double r{ std::sqrt(GistEnergy::minimumImage2(coords.box, coords.x[j] - coords.x[i],
+                                                          coords.y[j] - coords.y[i], coords.z[j] - coords.z[i])) };
+            int source{ top.solvent[j] ? 0 : 1 };
+            if (top.molecules[i] == top.molecules[j]) {
+                phi[2 * i + source] -= top.charges[j] * std::erf(beta * r) / r;
+            } else if (r < cutoff) {
+                phi[2 * i + source] += top.charges[j] * std::erfc(beta * r) / r;
+            }
+        }
+    }
+    return phi;
+}
+
+TEST(EnergyBackend, BsplineTest)
+{
+    // Cubic B-spline (order 4): 1/6, 2/3, 1/6 at the integers.
+    double weights[4];
+    GistEnergy::bsplineWeights(0.0, 4, weights);
+    EXPECT_NEAR(weights[0], 0.0, 1e-15);
+    EXPECT_NEAR(weights[1], 1.0 / 6.0, 1e-15);
+    EXPECT_NEAR(weights[2], 2.0 / 3.0, 1e-15);
+    EXPECT_NEAR(weights[3], 1.0 / 6.0, 1e-15);
+    // The weights always sum up to one.
+    double sixth[6];
+    GistEnergy::bsplineWeights(0.37, 6, sixth);
+    double sum{ 0 };
+    for (double w : sixth) {
+        sum += w;
+    }
+    EXPECT_NEAR(sum, 1.0, 1e-14);
+    EXPECT_NEAR(std::erfc(GistEnergy::ewaldCoefficient(9.0, 1e-5) * 9.0), 1e-5, 1e-10);
+}
+
+TEST(EnergyBackend, PmeTest)
+{
+    const int nMolecules{ 27 };
+    const double length{ 9.3 };
+    GistEnergy::Topology top{ makeTopology(nMolecules, 3) };
+    // A charged solute, so that the neutralizing background is tested as well.
+    top.charges[0] += 1.0;
+    top.ljA = { 0.0, 0.0, 0.0, 0.0 };
+    top.ljB = { 0.0, 0.0, 0.0, 0.0 };
+    top.neighbourCutoff2 = 3.5 * 3.5;
+    GistEnergy::Coordinates coords{ makeCoordinates(nMolecules, length, 5) };
+    GistEnergy::Options options{};
+    options.cutoff = 4.5;
+    options.gridSpacing = 0.3;
+    options.order = 6;
+    std::unique_ptr<GistEnergy::Backend> pme{ GistEnergy::createBackend("pme", options) };
+    ASSERT_TRUE(pme->setup(top));
+    EXPECT_FALSE(pme->supportsPairs());
+    GistEnergy::Result result{};
+    std::vector<int> active{ allAtoms(top.nAtoms()) };
+    pme->calculate(coords, active, result);
+
+    double beta{ GistEnergy::ewaldCoefficient(options.cutoff, options.tolerance) };
+    std::vector<double> phi{ directEwald(top, coords, length, beta, options.cutoff) };
+    for (int i = 0; i < top.nAtoms(); ++i) {
+        double q{ top.coulombFactor * top.charges[i] };
+        EXPECT_NEAR(result.eww[i], 0.5 * q * phi[2 * i], 1e-3) << i;
+        EXPECT_NEAR(result.esw[i], q * phi[2 * i + 1], 1e-3) << i;
+    }
+
+    // The neighbours within the real space cutoff are the same as with minimum image.
+    GistEnergy::ReferenceBackend reference{};
+    ASSERT_TRUE(reference.setup(top));
+    GistEnergy::Result expected{};
+    reference.calculate(coords, active, expected);
+    EXPECT_EQ(result.neighbours, expected.neighbours);
+    EXPECT_EQ(result.nearest, expected.nearest);
+}
@@ -0,0 +1,54 @@
+#include "../Fft.h"
+#include <gtest/gtest.h>
+#include <random>
+
+
+TEST(Fft3D, PowerOfTwoTest)
+{
+    EXPECT_EQ(Fft3D::nextPowerOfTwo(1), 1);
+    EXPECT_EQ(Fft3D::nextPowerOfTwo(5), 8);
+    EXPECT_EQ(Fft3D::nextPowerOfTwo(64), 64);
+    Fft3D fft{};
+    EXPECT_TRUE(fft.resize(4, 8, 2));
+    EXPECT_EQ(fft.size(), 64);
+    EXPECT_FALSE(fft.resize(4, 6, 2));
+}
+
+TEST(Fft3D, NaiveDftTest)
+{
+    const int n[3]{ 4, 8, 2 };
+    Fft3D fft{ n[0], n[1], n[2] };
+    std::mt19937 gen{ 3 };
+    std::uniform_real_distribution<double> dist{ -1.0, 1.0 };
+    std::vector<Fft3D::Complex> data(fft.size());
+    for (Fft3D::Complex &value : data) {
+        value = Fft3D::Complex(dist(gen), dist(gen));
+    }
+    std::vector<Fft3D::Complex> transformed{ data };
+    fft.forward(transformed);
+    for (int m1 = 0; m1 < n[0]; ++m1) {
+        for (int m2 = 0; m2 < n[1]; ++m2) {
+            for (int m3 = 0; m3 < n[2]; ++m3) {
+                Fft3D::Complex sum{};
+                for (int k1 = 0; k1 < n[0]; ++k1) {
+                    for (int k2 = 0; k2 < n[1]; ++k2) {
+                        for (int k3 = 0; k3 < n[2]; ++k3) {
+                            double phase{ -2.0 * M_PI * (double(m1 * k1) / n[0] + double(m2 * k2) / n[1] + double(m3 * k3) / n[2]) };
+                            sum += data[(k1 * n[1] + k2) * n[2] + k3] * Fft3D::Complex(std::cos(phase), std::sin(phase));
+                        }
+                    }
+                }
+                Fft3D::Complex value{ transformed[(m1 * n[1] + m2) * n[2] + m3] };
+                EXPECT_NEAR(value.real(), sum.real(), 1e-10);
+                EXPECT_NEAR(value.imag(), sum.imag(), 1e-10);
+            }
+        }
+    }
+
+    // Forward and backward transforms scale by the number of grid points.
+    fft.backward(transformed);
+    for (unsigned int i = 0; i < data.size(); ++i) {
+        EXPECT_NEAR(transformed[i].real(), fft.size() * data[i].real(), 1e-10);
+        EXPECT_NEAR(transformed[i].imag(), fft.size() * data[i].imag(), 1e-10);
+    }
+}
@@ -0,0 +1,94 @@
+#include "../HydrationSites.h"
+#include <cmath>
+#include <gtest/gtest.h>
+
+namespace {
+
+int index(int i, int j, int k, int n)
+{
+    return (i * n + j) * n + k;
+}
+
+// Two Gaussian peaks of different height on a 12^3 grid.
+void twoPeaks(std::vector<double> &density, int n)
+{
+    density.assign(n * n * n, 0.0);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            for (int k = 0; k < n; ++k) {
+                double r1 = (i - 3) * (i - 3) + (j - 3) * (j - 3) + (k - 3) * (k - 3);
+                double r2 = (i - 8) * (i - 8) + (j - 7) * (j - 7) + (k - 8) * (k - 8);
+                density[index(i, j, k, n)] = 6.0 * std::exp(-0.5 * r1) + 4.0 * std::exp(-0.5 * r2);
+            }
+        }
+    }
+}
+
+}
+
+TEST(HydrationSites, StencilTest)
+{
+    HydrationSites sites{ 4, 4, 4, 1.0 };
+    // The voxel itself and the six face neighbours.
+    EXPECT_EQ(sites.shells(), 2);
+    sites.setRadius(std::sqrt(3.0));
+    EXPECT_EQ(sites.shells(), 4);
+}
+
+TEST(HydrationSites, TwoPeaksTest)
+{
+    const int n = 12;
+    std::vector<double> density;
+    twoPeaks(density, n);
+    std::vector<double> molecules(density.size());
+    std::vector<double> deltaG(density.size(), -2.0);
+    for (unsigned int v = 0; v < density.size(); ++v) {
+        molecules[v] = 0.1 * density[v];
+    }
+    HydrationSites finder{ n, n, n, 3.0 };
+    std::vector<HydrationSites::Site> sites = finder.find(density, molecules, deltaG, 1.0);
+    ASSERT_EQ(sites.size(), 2u);
+    EXPECT_EQ(sites[0].voxel, index(3, 3, 3, n));
+    EXPECT_EQ(sites[1].voxel, index(8, 7, 8, n));
+    EXPECT_NEAR(sites[0].density, 6.0, 1e-12);
+    EXPECT_EQ(finder.site(index(4, 3, 3, n)), 0);
+    EXPECT_EQ(finder.site(index(8, 8, 8, n)), 1);
+    EXPECT_EQ(finder.site(0), -1);
+    int assigned = 0;
+    for (unsigned int v = 0; v < density.size(); ++v) {
+        if (finder.site(v) != -1) {
+            ++assigned;
+            EXPECT_GT(density[v], 1.0);
+        }
+    }
+    EXPECT_EQ(assigned, sites[0].nVoxels + sites[1].nVoxels);
+    for (const HydrationSites::Site &site : sites) {
+        // Enough density for one molecule, the energy is weighted by it.
+        EXPECT_NEAR(site.occupancy, 1.0, 1e-12);
+        EXPECT_NEAR(site.deltaG, -2.0, 1e-12);
+        EXPECT_GT(site.population, 1.0);
+    }
+}
+
+TEST(HydrationSites, PlateauAndLowDensityTest)
+{
+    const int n = 5;
+    std::vector<double> density(n * n * n, 0.0);
+    // A flat plateau is a single site at its lowest index.
+    density[index(2, 2, 2, n)] = 3.0;
+    density[index(2, 2, 3, n)] = 3.0;
+    std::vector<double> molecules(density.size(), 0.0);
+    molecules[index(2, 2, 2, n)] = 0.25;
+    molecules[index(2, 2, 3, n)] = 0.25;
+    std::vector<double> deltaG(density.size(), 0.0);
+    deltaG[index(2, 2, 2, n)] = -1.0;
+    deltaG[index(2, 2, 3, n)] = -3.0;
+    HydrationSites finder{ n, n, n, 2.0 };
+    std::vector<HydrationSites::Site> sites = finder.find(density, molecules, deltaG, 1.0);
+    ASSERT_EQ(sites.size(), 1u);
+    EXPECT_EQ(sites[0].voxel, index(2, 2, 2, n));
+    EXPECT_EQ(sites[0].nVoxels, 2);
+    // Not enough molecules, everything is integrated.
+    EXPECT_DOUBLE_EQ(sites[0].occupancy, 0.5);
+    EXPECT_DOUBLE_EQ(sites[0].deltaG, -1.0);
+}
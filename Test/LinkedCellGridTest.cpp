@@ -59,4 +59,29 @@ TEST(LinkedCellGrid, PushBackTest)
     EXPECT_EQ( results2.at(1), 2 );
     EXPECT_EQ( results2.at(2), 3 );
     EXPECT_EQ( results2.at(3), 4 );
-}
\ No newline at end of file
+}
+TEST(LinkedCellGrid, CompactTest)
+{
+    LinkedCellGrid<int> grid{ 4, 10 };
+    grid.push_back(2, 1);
+    grid.push_back(0, 2);
+    grid.push_back(2, 3);
+    grid.push_back(3, 4);
+    grid.push_back(0, 5);
+    grid.compact();
+    std::vector<std::vector<int>> cells(4);
+    for (LinkedCellGrid<int>::OuterIterator i : grid) {
+        for (auto j : i) {
+            cells.at(i.getIndex()).push_back(j);
+        }
+    }
+    EXPECT_EQ(cells.at(0), std::vector<int>({ 2, 5 }));
+    EXPECT_TRUE(cells.at(1).empty());
+    EXPECT_EQ(cells.at(2), std::vector<int>({ 1, 3 }));
+    EXPECT_EQ(cells.at(3), std::vector<int>({ 4 }));
+    EXPECT_EQ(grid.at(0, 1), 5);
+    EXPECT_EQ(grid.at(2, 1), 3);
+    grid.push_back(0, 6);
+    EXPECT_EQ(grid.at(0, 2), 6);
+    EXPECT_EQ(grid.getTotalDataSize(), 6);
+}
@@ -0,0 +1,94 @@
+#include "../MrcFile.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <gtest/gtest.h>
+
+
+static std::vector<char> readFile(const std::string &name)
+{
+    std::ifstream file{ name.c_str(), std::ios::binary };
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static int intWord(const std::vector<char> &bytes, int word)
+{
+    std::int32_t value{};
+    std::memcpy(&value, &bytes[4 * (word - 1)], 4);
+    return value;
+}
+
+static float floatAt(const std::vector<char> &bytes, std::size_t offset)
+{
+    float value{};
+    std::memcpy(&value, &bytes[offset], 4);
+    return value;
+}
+
+TEST(MrcFile, SingleVolumeTest)
+{
+    // Values in dx order: voxel (i, j, k) holds 100 i + 10 j + k.
+    const std::array<int, 3> dims{ { 2, 3, 4 } };
+    std::vector<double> data{};
+    for (int i = 0; i < dims[0]; ++i) {
+        for (int j = 0; j < dims[1]; ++j) {
+            for (int k = 0; k < dims[2]; ++k) {
+                data.push_back(100 * i + 10 * j + k);
+            }
+        }
+    }
+    MrcFile mrc{ dims, { { -1.0, 2.0, 0.5 } }, 0.5 };
+    mrc.add("population", data);
+    const std::string name{ "MrcFileTest_single.mrc" };
+    ASSERT_TRUE(mrc.write(name));
+    std::vector<char> bytes{ readFile(name) };
+    std::remove(name.c_str());
+
+    ASSERT_EQ(bytes.size(), MrcFile::HEADER_SIZE + MrcFile::NAME_SIZE + 24 * sizeof(float));
+    EXPECT_EQ(intWord(bytes, 1), 2);
+    EXPECT_EQ(intWord(bytes, 2), 3);
+    EXPECT_EQ(intWord(bytes, 3), 4);
+    EXPECT_EQ(intWord(bytes, 4), 2);
+    EXPECT_EQ(intWord(bytes, 23), 1);
+    EXPECT_EQ(intWord(bytes, 24), int{ MrcFile::NAME_SIZE });
+    EXPECT_FLOAT_EQ(floatAt(bytes, 4 * 10), 1.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, 4 * 12), 2.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, 4 * 49), -1.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, 4 * 20), 123.0f);
+    EXPECT_EQ(std::string(&bytes[208], 4), "MAP ");
+    EXPECT_EQ(std::string(&bytes[MrcFile::HEADER_SIZE]), "population");
+
+    // The first index runs fastest in the file.
+    const std::size_t first{ MrcFile::HEADER_SIZE + MrcFile::NAME_SIZE };
+    EXPECT_FLOAT_EQ(floatAt(bytes, first), 0.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, first + 4), 100.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, first + 4 * 2), 10.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, first + 4 * 6), 1.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, first + 4 * 23), 123.0f);
+}
+
+TEST(MrcFile, StackTest)
+{
+    const std::array<int, 3> dims{ { 2, 2, 2 } };
+    MrcFile mrc{ dims, { { 0.0, 0.0, 0.0 } }, 1.0 };
+    mrc.add("g_O", [](std::size_t) { return 1.0; });
+    mrc.add("g_H", [](std::size_t voxel) { return voxel == 7 ? 3.0 : 0.0; });
+    EXPECT_EQ(mrc.volumes(), 2);
+    const std::string name{ "MrcFileTest_stack.mrc" };
+    ASSERT_TRUE(mrc.write(name));
+    std::vector<char> bytes{ readFile(name) };
+    std::remove(name.c_str());
+
+    ASSERT_EQ(bytes.size(), MrcFile::HEADER_SIZE + 2 * MrcFile::NAME_SIZE + 16 * sizeof(float));
+    EXPECT_EQ(intWord(bytes, 3), 4);
+    EXPECT_EQ(intWord(bytes, 10), 2);
+    EXPECT_EQ(intWord(bytes, 23), 401);
+    EXPECT_EQ(std::string(&bytes[MrcFile::HEADER_SIZE + MrcFile::NAME_SIZE]), "g_H");
+    const std::size_t data{ MrcFile::HEADER_SIZE + 2 * MrcFile::NAME_SIZE };
+    EXPECT_FLOAT_EQ(floatAt(bytes, data + 4 * 7), 1.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, data + 4 * 15), 3.0f);
+    EXPECT_FLOAT_EQ(floatAt(bytes, 4 * 20), 3.0f);
+
+    MrcFile empty{ dims, { { 0.0, 0.0, 0.0 } }, 1.0 };
+    EXPECT_FALSE(empty.write(name));
+}
@@ -0,0 +1,52 @@
+#include "../ResidenceTracker.h"
+#include <gtest/gtest.h>
+
+
+TEST(ResidenceTracker, SingleRunTest)
+{
+    ResidenceTracker tracker{ 4, 5 };
+    for (int frame = 1; frame <= 3; ++frame) {
+        tracker.update(0, 2, frame);
+    }
+    EXPECT_EQ(tracker.runs(2), 0);
+    tracker.finish();
+    EXPECT_EQ(tracker.runs(2), 1);
+    EXPECT_DOUBLE_EQ(tracker.meanResidence(2), 3.0);
+    EXPECT_DOUBLE_EQ(tracker.survival(2, 1), 1.0);
+    EXPECT_DOUBLE_EQ(tracker.survival(2, 3), 1.0);
+    EXPECT_DOUBLE_EQ(tracker.survival(2, 4), 0.0);
+    EXPECT_DOUBLE_EQ(tracker.meanResidence(1), 0.0);
+}
+
+TEST(ResidenceTracker, VoxelChangeAndGapTest)
+{
+    ResidenceTracker tracker{ 3, 10 };
+    // Molecule 0: voxel 0 for frames 1-2, voxel 1 for frame 3, off grid in 4,
+    // voxel 1 again in frame 5, which is a new visit.
+    tracker.update(0, 0, 1);
+    tracker.update(0, 0, 2);
+    tracker.update(0, 1, 3);
+    tracker.update(0, 1, 5);
+    // Molecule 3 stays in voxel 0 for four frames.
+    for (int frame = 1; frame <= 4; ++frame) {
+        tracker.update(3, 0, frame);
+    }
+    tracker.finish();
+    EXPECT_EQ(tracker.runs(0), 2);
+    EXPECT_DOUBLE_EQ(tracker.meanResidence(0), 3.0);
+    EXPECT_DOUBLE_EQ(tracker.survival(0, 3), 0.5);
+    EXPECT_EQ(tracker.runs(1), 2);
+    EXPECT_DOUBLE_EQ(tracker.meanResidence(1), 1.0);
+}
+
+TEST(ResidenceTracker, LongRunsInLastBinTest)
+{
+    ResidenceTracker tracker{ 1, 2 };
+    for (int frame = 1; frame <= 7; ++frame) {
+        tracker.update(0, 0, frame);
+    }
+    tracker.update(1, 0, 1);
+    tracker.finish();
+    EXPECT_DOUBLE_EQ(tracker.meanResidence(0), 4.0);
+    EXPECT_DOUBLE_EQ(tracker.survival(0, 2), 0.5);
+}
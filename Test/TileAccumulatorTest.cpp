@@ -0,0 +1,54 @@
+#include "../TileAccumulator.h"
+#include <cmath>
+#include <random>
+#include <gtest/gtest.h>
+
+
+TEST(TileAccumulator, ChannelsTest)
+{
+    TileAccumulator sums{ 3000, 3, 4 };
+    for (int frame = 0; frame < 10; ++frame) {
+        sums.add(0, 0, 1.0);
+        sums.add(2999, 2, 0.5);
+        sums.add(1500, 1, -2.0);
+        sums.endFrame();
+    }
+    // Two frames are not flushed yet, but still part of the value.
+    EXPECT_DOUBLE_EQ(sums.value(0, 0), 10.0);
+    EXPECT_DOUBLE_EQ(sums.value(2999, 2), 5.0);
+    EXPECT_DOUBLE_EQ(sums.value(1500, 1), -20.0);
+    EXPECT_DOUBLE_EQ(sums.value(1500, 0), 0.0);
+    TileAccumulator copy{ sums };
+    sums.flush();
+    EXPECT_DOUBLE_EQ(sums.value(0, 0), 10.0);
+    EXPECT_DOUBLE_EQ(copy.value(2999, 2), 5.0);
+    sums.resize(10, 2, 4);
+    EXPECT_DOUBLE_EQ(sums.value(0, 0), 0.0);
+}
+
+// Sums 10^6 energies of a single voxel as the float grids do and with the
+// tiles. The float sum drifts once the total is much larger than a single
+// value, the tiles stay close to the double precision sum.
+TEST(TileAccumulator, AccuracyTest)
+{
+    const int nFrames = 1000000;
+    std::mt19937 engine{ 42 };
+    std::uniform_real_distribution<double> energy{ -12.0, -8.0 };
+    TileAccumulator sums{ 1, 1, 100 };
+    float floatSum{ 0.0f };
+    double exact{ 0.0 };
+    for (int frame = 0; frame < nFrames; ++frame) {
+        double value{ energy(engine) };
+        exact += value;
+        floatSum += static_cast<float>(value);
+        sums.add(0, 0, value);
+        sums.endFrame();
+    }
+    double floatError{ std::fabs(floatSum - exact) / std::fabs(exact) };
+    double tileError{ std::fabs(sums.value(0, 0) - exact) / std::fabs(exact) };
+    std::cout << "[ ACCURACY  ] relative error float grid: " << floatError
+              << ", tiles: " << tileError << std::endl;
+    EXPECT_GT(floatError, 1e-6);
+    EXPECT_LT(tileError, 1e-7);
+    EXPECT_LT(tileError * 100, floatError);
+}
@@ -0,0 +1,86 @@
+#include "../VoxelPairMatrix.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+
+TEST(VoxelPairMatrix, SymmetricAddTest)
+{
+    VoxelPairMatrix matrix{ 2 };
+    matrix.add(0, 3, 7, 1.5);
+    matrix.add(1, 7, 3, 0.5);
+    matrix.add(1, 4, 4, -2.0);
+    EXPECT_EQ(matrix.size(), 0);
+    matrix.merge();
+    EXPECT_EQ(matrix.size(), 2);
+    EXPECT_DOUBLE_EQ(matrix.get(3, 7), 2.0);
+    EXPECT_DOUBLE_EQ(matrix.get(7, 3), 2.0);
+    EXPECT_DOUBLE_EQ(matrix.get(4, 4), -2.0);
+    EXPECT_DOUBLE_EQ(matrix.get(1, 2), 0.0);
+}
+
+TEST(VoxelPairMatrix, MergeAccumulatesTest)
+{
+    VoxelPairMatrix matrix{ 3 };
+    for (int frame = 0; frame < 4; ++frame) {
+        for (int thread = 0; thread < 3; ++thread) {
+            matrix.add(thread, 0, 1, 1.0);
+        }
+        matrix.merge();
+    }
+    EXPECT_EQ(matrix.size(), 1);
+    EXPECT_DOUBLE_EQ(matrix.get(1, 0), 12.0);
+}
+
+TEST(VoxelPairMatrix, BinaryRoundTripTest)
+{
+    VoxelPairMatrix matrix{};
+    matrix.add(0, 10, 2, 4.0);
+    matrix.add(0, 5, 5, -8.0);
+    matrix.merge();
+    int dims[3]{ 4, 5, 6 };
+    std::stringstream stream{};
+    ASSERT_TRUE(matrix.writeBinary(stream, dims, 0.5f, 2, 2.0));
+    // Header of 32 bytes and 12 bytes per pair.
+    EXPECT_EQ(stream.str().size(), 32 + 2 * 12);
+
+    VoxelPairMatrix read{};
+    int readDims[3]{};
+    float spacing{};
+    int nFrames{};
+    ASSERT_TRUE(read.readBinary(stream, readDims, spacing, nFrames));
+    EXPECT_EQ(readDims[0], 4);
+    EXPECT_EQ(readDims[1], 5);
+    EXPECT_EQ(readDims[2], 6);
+    EXPECT_FLOAT_EQ(spacing, 0.5f);
+    EXPECT_EQ(nFrames, 2);
+    EXPECT_EQ(read.size(), 2);
+    EXPECT_DOUBLE_EQ(read.get(2, 10), 2.0);
+    EXPECT_DOUBLE_EQ(read.get(5, 5), -4.0);
+}
+
+TEST(VoxelPairMatrix, InvalidBinaryTest)
+{
+    std::stringstream stream{ "NOPE" };
+    VoxelPairMatrix matrix{};
+    int dims[3]{};
+    float spacing{};
+    int nFrames{};
+    EXPECT_FALSE(matrix.readBinary(stream, dims, spacing, nFrames));
+}
+
+TEST(VoxelPairMatrix, OrderIndependentTest)
+{
+    // The same energies, added in a different order and by different threads.
+    std::vector<double> energies{ 1e-3, 0.1, -7.25, 3.3333333, 1e4, -1e4, 0.7 };
+    VoxelPairMatrix forward{ 2 };
+    VoxelPairMatrix backward{ 3 };
+    for (unsigned int i = 0; i < energies.size(); ++i) {
+        forward.add(i % 2, 1, 2, energies[i]);
+        backward.add(i % 3, 2, 1, energies[energies.size() - 1 - i]);
+    }
+    forward.merge();
+    backward.merge();
+    EXPECT_EQ(forward.get(1, 2), backward.get(1, 2));
+    EXPECT_NEAR(forward.get(1, 2), -3.1156667, 1e-6);
+}
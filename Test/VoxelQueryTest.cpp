@@ -0,0 +1,82 @@
+#include "../VoxelQuery.h"
+#include <gtest/gtest.h>
+
+
+TEST(VoxelQuery, ParseLineTest)
+{
+    VoxelQuery::Entry entry{};
+    EXPECT_EQ(VoxelQuery::parseLine("", entry), VoxelQuery::Line::SKIP);
+    EXPECT_EQ(VoxelQuery::parseLine("   ", entry), VoxelQuery::Line::SKIP);
+    EXPECT_EQ(VoxelQuery::parseLine("# voxel or x y z", entry), VoxelQuery::Line::SKIP);
+
+    EXPECT_EQ(VoxelQuery::parseLine("  42", entry), VoxelQuery::Line::ENTRY);
+    EXPECT_EQ(entry.voxel, 42);
+
+    EXPECT_EQ(VoxelQuery::parseLine("1.5 -2 3e1", entry), VoxelQuery::Line::ENTRY);
+    EXPECT_EQ(entry.voxel, -1);
+    EXPECT_DOUBLE_EQ(entry.point[0], 1.5);
+    EXPECT_DOUBLE_EQ(entry.point[1], -2.0);
+    EXPECT_DOUBLE_EQ(entry.point[2], 30.0);
+
+    // Neither a non-negative integer nor three coordinates.
+    EXPECT_EQ(VoxelQuery::parseLine("-1", entry), VoxelQuery::Line::MALFORMED);
+    EXPECT_EQ(VoxelQuery::parseLine("2.5", entry), VoxelQuery::Line::MALFORMED);
+    EXPECT_EQ(VoxelQuery::parseLine("1 2", entry), VoxelQuery::Line::MALFORMED);
+    EXPECT_EQ(VoxelQuery::parseLine("1 2 3 4", entry), VoxelQuery::Line::MALFORMED);
+    EXPECT_EQ(VoxelQuery::parseLine("1 2 3 # point", entry), VoxelQuery::Line::MALFORMED);
+    EXPECT_EQ(VoxelQuery::parseLine("voxel 3", entry), VoxelQuery::Line::MALFORMED);
+}
+
+TEST(VoxelQuery, ReadTest)
+{
+    std::istringstream good("# query\n7\n\n0.5 0.5 0.5\n");
+    std::vector<VoxelQuery::Entry> entries{};
+    int badLine{ 0 };
+    EXPECT_TRUE(VoxelQuery::read(good, entries, badLine));
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[0].voxel, 7);
+    EXPECT_EQ(entries[1].voxel, -1);
+    EXPECT_DOUBLE_EQ(entries[1].point[2], 0.5);
+
+    std::istringstream bad("7\n# fine\n1 2\n8\n");
+    entries.clear();
+    EXPECT_FALSE(VoxelQuery::read(bad, entries, badLine));
+    EXPECT_EQ(badLine, 3);
+    EXPECT_EQ(entries.size(), 1u);
+}
+
+TEST(VoxelQuery, VoxelOfTest)
+{
+    const std::array<int, 3> dims{{ 2, 3, 4 }};
+    const std::array<double, 3> corner{{ -1.0, 0.0, 10.0 }};
+    const double spacing{ 0.5 };
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -1.0, 0.0, 10.0 }}), 0);
+    // Voxel (1, 2, 3), the last one.
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -0.25, 1.25, 11.75 }}), 23);
+    // Voxel (0, 1, 2).
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -0.9, 0.6, 11.1 }}), 6);
+    // The far faces belong to the next, nonexistent voxel.
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ 0.0, 0.0, 10.0 }}), -1);
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -1.0, 1.5, 10.0 }}), -1);
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -1.0, 0.0, 9.99 }}), -1);
+    EXPECT_EQ(VoxelQuery::voxelOf(dims, corner, spacing, {{ -1.0, 0.0, NAN }}), -1);
+}
+
+TEST(VoxelQuery, CacheTest)
+{
+    VoxelCache<double> cache{};
+    int calls{ 0 };
+    const auto calc = [&calls](int voxel) { ++calls; return 2.0 * voxel; };
+    EXPECT_FALSE(cache.contains(3));
+    EXPECT_DOUBLE_EQ(cache.get(3, calc), 6.0);
+    EXPECT_DOUBLE_EQ(cache.get(3, calc), 6.0);
+    EXPECT_EQ(calls, 1);
+    EXPECT_TRUE(cache.contains(3));
+    EXPECT_DOUBLE_EQ(cache.get(5, calc), 10.0);
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(cache.size(), 2u);
+    cache.clear();
+    EXPECT_FALSE(cache.contains(3));
+    EXPECT_DOUBLE_EQ(cache.get(3, calc), 6.0);
+    EXPECT_EQ(calls, 3);
+}
@@ -0,0 +1,172 @@
+#ifndef TILE_ACCUMULATOR_H
+#define TILE_ACCUMULATOR_H
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * Sums per voxel values over many frames. Every thread adds into its own
+ * single precision tiles, which are added to a double precision master grid
+ * every flushInterval frames. The float sums thus only cover a few frames,
+ * while the totals keep double precision. Adding needs no synchronization.
+ *
+ * Tiles are allocated when a thread first writes into them, so threads only
+ * hold the parts of the grid they actually touch. The channels of a voxel are
+ * stored next to each other.
+ */
+class TileAccumulator {
+public:
+  // Number of floats in one tile.
+  static constexpr int TILE_SIZE = 1024;
+
+  TileAccumulator(int nVoxels = 0, int nChannels = 1, int flushInterval = 100)
+  {
+    resize(nVoxels, nChannels, flushInterval);
+  }
+
+  TileAccumulator(const TileAccumulator &other)
+  {
+    *this = other;
+  }
+
+  TileAccumulator &operator=(const TileAccumulator &other)
+  {
+    if (this == &other) {
+      return *this;
+    }
+    m_nChannels = other.m_nChannels;
+    m_flushInterval = other.m_flushInterval;
+    m_frames = other.m_frames;
+    m_nTiles = other.m_nTiles;
+    m_master = other.m_master;
+    m_tiles.clear();
+    m_tiles.resize(other.m_tiles.size());
+    for (std::size_t thread = 0; thread < m_tiles.size(); ++thread) {
+      m_tiles[thread].resize(m_nTiles);
+      for (int t = 0; t < m_nTiles; ++t) {
+        if (other.m_tiles[thread][t]) {
+          m_tiles[thread][t].reset(new float[TILE_SIZE]);
+          std::copy(other.m_tiles[thread][t].get(), other.m_tiles[thread][t].get() + TILE_SIZE, m_tiles[thread][t].get());
+        }
+      }
+    }
+    return *this;
+  }
+
+  TileAccumulator(TileAccumulator &&) = default;
+  TileAccumulator &operator=(TileAccumulator &&) = default;
+
+  /**
+   * Resizes the accumulator and sets all sums to zero.
+   * @param nVoxels: The number of voxels.
+   * @param nChannels: The number of values summed per voxel.
+   * @param flushInterval: Number of frames between two flushes.
+   */
+  void resize(int nVoxels, int nChannels, int flushInterval)
+  {
+    m_nChannels = std::max(1, nChannels);
+    m_flushInterval = std::max(1, flushInterval);
+    m_frames = 0;
+    m_master.assign(static_cast<std::size_t>(nVoxels) * m_nChannels, 0.0);
+    m_nTiles = static_cast<int>((m_master.size() + TILE_SIZE - 1) / TILE_SIZE);
+#ifdef _OPENMP
+    int nThreads{ omp_get_max_threads() };
+#else
+    int nThreads{ 1 };
+#endif
+    m_tiles.clear();
+    m_tiles.resize(nThreads);
+    for (auto &tiles : m_tiles) {
+      tiles.resize(m_nTiles);
+    }
+  }
+
+  /**
+   * Adds a value, can be called from several threads at the same time.
+   */
+  void add(int voxel, int channel, double value)
+  {
+#ifdef _OPENMP
+    std::vector<std::unique_ptr<float[]> > &tiles = m_tiles[omp_get_thread_num()];
+#else
+    std::vector<std::unique_ptr<float[]> > &tiles = m_tiles[0];
+#endif
+    std::size_t index{ static_cast<std::size_t>(voxel) * m_nChannels + channel };
+    std::unique_ptr<float[]> &tile = tiles[index / TILE_SIZE];
+    if (!tile) {
+      tile.reset(new float[TILE_SIZE]());
+    }
+    tile[index % TILE_SIZE] += static_cast<float>(value);
+  }
+
+  /**
+   * Has to be called once per frame, outside of parallel regions. Flushes
+   * the tiles every flushInterval frames.
+   */
+  void endFrame()
+  {
+    if (++m_frames % m_flushInterval == 0) {
+      flush();
+    }
+  }
+
+  /**
+   * Adds all tiles to the master grid and sets them to zero.
+   */
+  void flush()
+  {
+    const std::size_t size{ m_master.size() };
+    #pragma omp parallel for
+    for (int t = 0; t < m_nTiles; ++t) {
+      std::size_t begin{ static_cast<std::size_t>(t) * TILE_SIZE };
+      std::size_t end{ std::min(begin + TILE_SIZE, size) };
+      for (auto &tiles : m_tiles) {
+        float *tile{ tiles[t].get() };
+        if (tile == nullptr) {
+          continue;
+        }
+        for (std::size_t i = begin; i < end; ++i) {
+          m_master[i] += tile[i - begin];
+          tile[i - begin] = 0.0f;
+        }
+      }
+    }
+  }
+
+  /**
+   * @return: The sum of a channel of a voxel, including values that are not
+   *          flushed yet.
+   */
+  double value(int voxel, int channel) const
+  {
+    std::size_t index{ static_cast<std::size_t>(voxel) * m_nChannels + channel };
+    double sum{ m_master.at(index) };
+    for (const auto &tiles : m_tiles) {
+      const float *tile{ tiles[index / TILE_SIZE].get() };
+      if (tile != nullptr) {
+        sum += tile[index % TILE_SIZE];
+      }
+    }
+    return sum;
+  }
+
+  int channels() const { return m_nChannels; }
+  int voxels() const { return static_cast<int>(m_master.size() / m_nChannels); }
+  int flushInterval() const { return m_flushInterval; }
+
+private:
+  int m_nChannels = 1;
+  int m_flushInterval = 100;
+  int m_frames = 0;
+  int m_nTiles = 0;
+  std::vector<double> m_master;
+  // Tiles of every thread, nullptr if the thread never wrote into the tile.
+  std::vector<std::vector<std::unique_ptr<float[]> > > m_tiles;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef VOXEL_PAIR_MATRIX_H
+#define VOXEL_PAIR_MATRIX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Sparse, symmetric matrix of the water-water interaction energy between
+ * pairs of voxels.
+ *
+ * The full nVoxels x nVoxels matrix can not be stored for usual grids, only
+ * pairs that actually interact are kept. Every thread adds into its own hash
+ * table, so that no locking is needed inside the pair loop, the tables are
+ * merged by a call to merge() at the end of each frame. Energies are summed in
+ * fixed point (2^-28 kcal/mol), so the sums do not depend on the order of the
+ * additions and thus not on the distribution of the pairs onto the threads.
+ */
+class VoxelPairMatrix {
+public:
+  VoxelPairMatrix(int nThreads = 1)
+  : m_threadPairs(std::max(1, nThreads))
+  {}
+
+  /**
+   * Adds an energy to the pair of voxels. The order of the voxels does not
+   * matter.
+   * @param thread: The thread calling this function.
+   * @param voxel1: The voxel of the first molecule.
+   * @param voxel2: The voxel of the second molecule.
+   * @param energy: The energy to add.
+   */
+  void add(int thread, int voxel1, int voxel2, double energy)
+  {
+    m_threadPairs[thread][key(voxel1, voxel2)] += toFixed(energy);
+  }
+
+  /**
+   * Merges the per-thread tables into the matrix.
+   */
+  void merge()
+  {
+    for (auto &pairs : m_threadPairs) {
+      for (const auto &pair : pairs) {
+        m_pairs[pair.first] += pair.second;
+      }
+      pairs.clear();
+    }
+  }
+
+  /**
+   * @return The merged energy of a pair of voxels, 0 if they never interacted.
+   */
+  double get(int voxel1, int voxel2) const
+  {
+    auto it = m_pairs.find(key(voxel1, voxel2));
+    return it == m_pairs.end() ? 0.0 : toDouble(it->second);
+  }
+
+  /**
+   * @return The number of stored voxel pairs.
+   */
+  std::size_t size() const { return m_pairs.size(); }
+
+  /**
+   * Writes the matrix in a compact binary format. After the header
+   *   char[4] "GVPM", int32 nx, ny, nz, float spacing, int32 nFrames, uint64 nPairs
+   * follow nPairs entries of int32 voxel1, int32 voxel2 (voxel1 <= voxel2) and
+   * float32 energy, sorted by voxel1 and voxel2. The energy is divided by the
+   * given scaling factor (usually the number of frames). Voxel indices follow
+   * the order of the dx files, i.e., z runs fastest. Native byte order is used.
+   * @param os: The stream to write to, should be opened in binary mode.
+   * @param dimensions: The dimensions of the grid.
+   * @param spacing: The grid spacing.
+   * @param nFrames: The number of frames, stored in the header.
+   * @param scale: The energies are divided by this value.
+   * @return true if the stream is still good after writing.
+   */
+  bool writeBinary(std::ostream &os, const int dimensions[3], float spacing, int nFrames, double scale) const
+  {
+    std::vector<std::pair<std::uint64_t, std::int64_t> > sorted(m_pairs.begin(), m_pairs.end());
+    std::sort(sorted.begin(), sorted.end());
+    os.write("GVPM", 4);
+    for (int i = 0; i < 3; ++i) {
+      std::int32_t dim = dimensions[i];
+      os.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+    }
+    os.write(reinterpret_cast<const char *>(&spacing), sizeof(spacing));
+    std::int32_t frames = nFrames;
+    os.write(reinterpret_cast<const char *>(&frames), sizeof(frames));
+    std::uint64_t nPairs = sorted.size();
+    os.write(reinterpret_cast<const char *>(&nPairs), sizeof(nPairs));
+    for (const auto &pair : sorted) {
+      std::int32_t voxel1 = static_cast<std::int32_t>(pair.first >> 32);
+      std::int32_t voxel2 = static_cast<std::int32_t>(pair.first & 0xffffffffu);
+      float energy = static_cast<float>(toDouble(pair.second) / scale);
+      os.write(reinterpret_cast<const char *>(&voxel1), sizeof(voxel1));
+      os.write(reinterpret_cast<const char *>(&voxel2), sizeof(voxel2));
+      os.write(reinterpret_cast<const char *>(&energy), sizeof(energy));
+    }
+    return os.good();
+  }
+
+  /**
+   * Reads a matrix written by writeBinary, replacing the current content.
+   * @param is: The stream to read from.
+   * @param dimensions: Set to the dimensions of the grid.
+   * @param spacing: Set to the grid spacing.
+   * @param nFrames: Set to the number of frames.
+   * @return false if the stream does not hold a valid matrix.
+   */
+  bool readBinary(std::istream &is, int dimensions[3], float &spacing, int &nFrames)
+  {
+    char magic[4];
+    is.read(magic, 4);
+    if (!is || !std::equal(magic, magic + 4, "GVPM")) {
+      return false;
+    }
+    for (int i = 0; i < 3; ++i) {
+      std::int32_t dim;
+      is.read(reinterpret_cast<char *>(&dim), sizeof(dim));
+      dimensions[i] = dim;
+    }
+    is.read(reinterpret_cast<char *>(&spacing), sizeof(spacing));
+    std::int32_t frames;
+    is.read(reinterpret_cast<char *>(&frames), sizeof(frames));
+    nFrames = frames;
+    std::uint64_t nPairs;
+    is.read(reinterpret_cast<char *>(&nPairs), sizeof(nPairs));
+    if (!is) {
+      return false;
+    }
+    m_pairs.clear();
+    for (std::uint64_t i = 0; i < nPairs; ++i) {
+      std::int32_t voxel1, voxel2;
+      float energy;
+      is.read(reinterpret_cast<char *>(&voxel1), sizeof(voxel1));
+      is.read(reinterpret_cast<char *>(&voxel2), sizeof(voxel2));
+      is.read(reinterpret_cast<char *>(&energy), sizeof(energy));
+      if (!is) {
+        return false;
+      }
+      m_pairs[key(voxel1, voxel2)] = toFixed(energy);
+    }
+    return true;
+  }
+
+private:
+  static constexpr double FIXED_SCALE = 268435456.0;
+
+  static std::int64_t toFixed(double energy)
+  {
+    return static_cast<std::int64_t>(std::llround(energy * FIXED_SCALE));
+  }
+
+  static double toDouble(std::int64_t energy)
+  {
+    return static_cast<double>(energy) / FIXED_SCALE;
+  }
+
+  static std::uint64_t key(int voxel1, int voxel2)
+  {
+    if (voxel1 > voxel2) {
+      std::swap(voxel1, voxel2);
+    }
+    return (static_cast<std::uint64_t>(voxel1) << 32) | static_cast<std::uint32_t>(voxel2);
+  }
+
+  std::vector<std::unordered_map<std::uint64_t, std::int64_t> > m_threadPairs;
+  std::unordered_map<std::uint64_t, std::int64_t> m_pairs;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef VOXEL_QUERY_H
+#define VOXEL_QUERY_H
+
+#include <array>
+#include <cmath>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Parsing of query files and lookup of the queried voxels. Every line of a
+ * query file holds either a voxel index or the x y z coordinates of a point.
+ * Empty lines and lines starting with '#' are skipped.
+ */
+class VoxelQuery {
+public:
+  // A voxel index, or a point if voxel is -1.
+  struct Entry {
+    int voxel = -1;
+    std::array<double, 3> point{};
+  };
+
+  enum class Line { SKIP, ENTRY, MALFORMED };
+
+  /**
+   * @param line: A line of a query file.
+   * @param entry: Set to the entry of the line, if it holds one.
+   * @return: Whether the line holds an entry, is skipped or is malformed.
+   */
+  static Line parseLine(const std::string &line, Entry &entry)
+  {
+    std::istringstream stream(line);
+    std::vector<double> numbers{};
+    double number{};
+    while (stream >> number) {
+      numbers.push_back(number);
+    }
+    std::string rest{};
+    stream.clear();
+    stream >> rest;
+    if (numbers.empty() && (rest.empty() || rest[0] == '#')) {
+      return Line::SKIP;
+    }
+    entry = Entry{};
+    if (rest.empty() && numbers.size() == 1 && numbers[0] >= 0 && numbers[0] == std::floor(numbers[0])) {
+      entry.voxel = static_cast<int>( numbers[0] );
+    } else if (rest.empty() && numbers.size() == 3) {
+      entry.point = {{ numbers[0], numbers[1], numbers[2] }};
+    } else {
+      return Line::MALFORMED;
+    }
+    return Line::ENTRY;
+  }
+
+  /**
+   * @param input: The query file.
+   * @param entries: The entries of the file are appended.
+   * @param badLine: Set to the first malformed line, counted from 1.
+   * @return: false if a line is malformed.
+   */
+  static bool read(std::istream &input, std::vector<Entry> &entries, int &badLine)
+  {
+    std::string line{};
+    int lineNumber{ 0 };
+    while (std::getline(input, line)) {
+      ++lineNumber;
+      Entry entry{};
+      switch (parseLine(line, entry)) {
+        case Line::SKIP:
+          break;
+        case Line::ENTRY:
+          entries.push_back(entry);
+          break;
+        case Line::MALFORMED:
+          badLine = lineNumber;
+          return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @param dims: The number of voxels along each axis.
+   * @param corner: The outer corner of the first voxel.
+   * @param spacing: The edge length of the voxels.
+   * @param point: The point to look up.
+   * @return: The index of the voxel containing the point, -1 if it is not
+   *          on the grid. The third index runs fastest.
+   */
+  static int voxelOf(const std::array<int, 3> &dims, const std::array<double, 3> &corner,
+                     double spacing, const std::array<double, 3> &point)
+  {
+    int index{ 0 };
+    for (int d = 0; d < 3; ++d) {
+      const double cell{ std::floor((point[d] - corner[d]) / spacing) };
+      if (!(cell >= 0 && cell < dims[d])) {
+        return -1;
+      }
+      index = index * dims[d] + static_cast<int>( cell );
+    }
+    return index;
+  }
+};
+
+/**
+ * Values of voxels that are only calculated on request, each at most once.
+ */
+template <class T>
+class VoxelCache {
+public:
+  /**
+   * @param voxel: The voxel.
+   * @param calc: Called with the voxel to calculate its value, only if it is
+   *              not cached yet.
+   * @return: The cached value.
+   */
+  template <class Calc>
+  const T &get(int voxel, Calc calc)
+  {
+    auto cached = m_values.find(voxel);
+    if (cached == m_values.end()) {
+      cached = m_values.emplace(voxel, calc(voxel)).first;
+    }
+    return cached->second;
+  }
+
+  bool contains(int voxel) const { return m_values.count(voxel) > 0; }
+  std::size_t size() const { return m_values.size(); }
+  void clear() { m_values.clear(); }
+
+private:
+  std::map<int, T> m_values;
+};
+
+#endif
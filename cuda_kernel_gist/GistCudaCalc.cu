@@ -361,7 +361,7 @@ bool isOnGrid_GIGIST(float *vec, float *min, float *max) {
 __global__
 void cudaCalcEnergy_GIGIST(Coordinates_GPU *coords, int *NBindex, int ntypes, ParamsLJ *parameterLJ, AtomProperties *atomProps, 
                           BoxInfo recip_o_box, UnitCell ucell, int maxAtoms, float *result_ww, float *result_sw, 
-                          float *min, float *max, int headAtomType, float neighbourCut2, int *result_O, int *result_N) {
+                          float *min, float *max, int *neighbourType, float neighbourCut2, int *result_O, int *result_N) {
   
 
   int a1 = blockIdx.x * blockDim.x + threadIdx.x;
@@ -415,11 +415,13 @@ void cudaCalcEnergy_GIGIST(Coordinates_GPU *coords, int *NBindex, int ntypes, Pa
  * @param result_sw: The result of the solute - water interactions.
  * @param min: The minimum values of the grid.
  * @param max: The maximum values of the grid.
+ * @param neighbourType: Per atom, the atom type counted as its neighbour (the
+ *                       center atom of its species), -1 for none.
  */
 __global__
 void cudaCalcEnergySlow_GIGIST(Coordinates_GPU *coords, int *NBindex, int ntypes, ParamsLJ *parameterLJ, AtomProperties *atomProps, 
   BoxInfo recip_o_box, UnitCell ucell, int maxAtoms, float *result_ww, float *result_sw,
-  float *min, float *max, int headAtomType, float neighbourCut2, int *result_O, int *result_N) {
+  float *min, float *max, int *neighbourType, float neighbourCut2, int *result_O, int *result_N) {
   
   int a1 = blockIdx.x * blockDim.x + threadIdx.x;
   
@@ -428,6 +430,8 @@ void cudaCalcEnergySlow_GIGIST(Coordinates_GPU *coords, int *NBindex, int ntypes
   }
   
   AtomProperties atom1 = atomProps[a1];
+  // The center atom type of the species of atom1, -1 if it has no neighbours.
+  int headAtomType = neighbourType[a1];
   float distances[4] = {HUGE_C, HUGE_C, HUGE_C, HUGE_C};
   result_N[a1] = 0;
   result_O[4 * a1 + 3] = 0;
@@ -445,7 +449,7 @@ void cudaCalcEnergySlow_GIGIST(Coordinates_GPU *coords, int *NBindex, int ntypes
       float vec2[3] = {t2.x, t2.y, t2.z};
       float r_2 = calcDist_GIGIST(vec1, vec2, recip_o_box, ucell);
       float energy = calcTotalEnergy_GIGIST(atom1.charge, atom2.charge, lj.A, lj.B, r_2);
-      if ((atom2.atomType == headAtomType) && atom2.solvent && atom1.solvent) {
+      if ((headAtomType != -1) && (atom2.atomType == headAtomType) && atom2.solvent && atom1.solvent) {
         if (r_2 < distances[0]) {
           distances[3] = distances[2];
           distances[2] = distances[1];
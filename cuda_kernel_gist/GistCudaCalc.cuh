@@ -240,7 +240,7 @@ __device__ bool isOnGrid_GIGIST(float *, float *, float *);
 __device__ float calcDist_GIGIST(float *, float *, const BoxInfo &, const UnitCell &);
 
 // Global functions
-__global__ void cudaCalcEnergy_GIGIST    (Coordinates_GPU *, int *, int, ParamsLJ *, AtomProperties *, BoxInfo, UnitCell, int, float *, float *, float *, float *, int, float, int *, int *);
-__global__ void cudaCalcEnergySlow_GIGIST(Coordinates_GPU *, int *, int, ParamsLJ *, AtomProperties *, BoxInfo, UnitCell, int, float *, float *,	float *, float *, int, float, int *, int *);
+__global__ void cudaCalcEnergy_GIGIST    (Coordinates_GPU *, int *, int, ParamsLJ *, AtomProperties *, BoxInfo, UnitCell, int, float *, float *, float *, float *, int *, float, int *, int *);
+__global__ void cudaCalcEnergySlow_GIGIST(Coordinates_GPU *, int *, int, ParamsLJ *, AtomProperties *, BoxInfo, UnitCell, int, float *, float *,	float *, float *, int *, float, int *, int *);
 __global__ void calculateEntropy_GIGIST(EntropyCalculator entCalc, float *, float *, float *);
 #endif
\ No newline at end of file
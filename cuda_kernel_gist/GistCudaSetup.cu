@@ -112,7 +112,7 @@ void freeCuda_GIGIST(void *array) {
  */
 __host__
 EnergyReturn doActionCudaEnergy_GIGIST(const double *coords, int *NBindex_c, int ntypes, void *parameter, void *molecule_c,
-                            int boxinfo, float *recip_o_box, float *ucell, int maxAtoms, int headAtomType, 
+                            int boxinfo, float *recip_o_box, float *ucell, int maxAtoms, int *neighbourType_c, 
                             float neighbourCut2, int *result_o, int *result_n, float *result_w_c, float *result_s_c,
                             int *result_O_c, int *result_N_c, bool doorder) {
   Coordinates_GPU *coords_c   = NULL;
@@ -179,7 +179,7 @@ EnergyReturn doActionCudaEnergy_GIGIST(const double *coords, int *NBindex_c, int
   if (doorder) {
     cudaCalcEnergySlow_GIGIST<<< (maxAtoms + SLOW_BLOCKSIZE) / SLOW_BLOCKSIZE, SLOW_BLOCKSIZE >>> (coords_c, NBindex_c, ntypes, lennardJonesParams, sender,
                                                                                             boxinf, ucellN, maxAtoms, result_w_c, result_s_c, nullptr, nullptr,
-                                                                                            headAtomType, neighbourCut2, result_O_c, result_N_c);
+                                                                                            neighbourType_c, neighbourCut2, result_O_c, result_N_c);
   } else {
     // Uses a 2D array, which is nice for memory access.
     dim3 threadsPerBlock(BLOCKSIZE, BLOCKSIZE);
@@ -187,7 +187,7 @@ EnergyReturn doActionCudaEnergy_GIGIST(const double *coords, int *NBindex_c, int
     // The actual call of the device function
     cudaCalcEnergy_GIGIST<<<numBlocks, threadsPerBlock>>> (coords_c, NBindex_c, ntypes, lennardJonesParams, sender,
                                                                       boxinf, ucellN, maxAtoms, result_w_c, result_s_c, nullptr, nullptr,
-                                                                      headAtomType, neighbourCut2, result_O_c, result_N_c);
+                                                                      neighbourType_c, neighbourCut2, result_O_c, result_N_c);
     // Check if there was an error.
     cudaError_t cudaError = cudaGetLastError();
     if (cudaError != cudaSuccess) {
@@ -0,0 +1,132 @@
+/**
+ * Python bindings of gigist, built against libcpptraj (see README.md).
+ *
+ *   import gigist
+ *   session = gigist.Session()
+ *   session.run("""parm system.prmtop
+ *                  trajin md.nc
+ *                  gigist griddim 40 40 40 gridcntr 0 0 0 refdens 0.0329 keep
+ *                  run""")
+ *   result = session.results()[0]
+ *   population = result.array(0, "population")   # numpy, shape (40, 40, 40)
+ *
+ * The arrays are read-only views of the memory of gigist and of the data
+ * sets of cpptraj; each keeps its result (and with it the session) alive.
+ */
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "Command.h"
+#include "CpptrajState.h"
+#include "Action_GIGIST.h"
+
+namespace py = pybind11;
+
+namespace {
+
+/**
+ * A cpptraj state that commands are run in. It owns the data sets the
+ * arrays of its results point into.
+ */
+class Session {
+public:
+  /**
+   * Runs cpptraj commands, one per line.
+   * @return: The number of gigist actions kept by these commands.
+   */
+  int run(const std::string &commands)
+  {
+    const std::size_t before{ Action_GIGist::kept().size() };
+    std::istringstream lines{ commands };
+    std::string line{};
+    while (std::getline(lines, line)) {
+      if (line.find_first_not_of(" \t") == std::string::npos) {
+        continue;
+      }
+      if (Command::Dispatch(m_state, line) == CpptrajState::ERR) {
+        throw std::runtime_error("cpptraj failed at: " + line);
+      }
+    }
+    // Hand the actions kept by this state over to the session.
+    std::vector<std::shared_ptr<Action_GIGist> > &kept = Action_GIGist::kept();
+    const int added{ static_cast<int>( kept.size() - before ) };
+    m_results.insert(m_results.end(), kept.begin() + before, kept.end());
+    kept.erase(kept.begin() + before, kept.end());
+    return added;
+  }
+
+  CpptrajState m_state;
+  std::vector<std::shared_ptr<Action_GIGist> > m_results;
+};
+
+/**
+ * The kept state of one gigist action, holds its session, as the data sets
+ * belong to the session.
+ */
+struct Result {
+  std::shared_ptr<Session> session;
+  std::shared_ptr<Action_GIGist> action;
+};
+
+py::array toNumpy(const ArrayView &view, py::handle owner)
+{
+  std::vector<py::ssize_t> shape(view.shape.begin(), view.shape.end());
+  std::vector<py::ssize_t> strides(view.strides.begin(), view.strides.end());
+  py::array array{ py::dtype(std::string(1, view.format)), shape, strides, view.data, owner };
+  array.attr("flags").attr("writeable") = false;
+  return array;
+}
+
+}
+
+PYBIND11_MODULE(gigist, m)
+{
+  m.doc() = "Zero-copy access to the grids and samples of the cpptraj gigist action.";
+  Command::Init();
+
+  py::class_<Session, std::shared_ptr<Session> >(m, "Session")
+    .def(py::init<>())
+    .def("run", &Session::run, py::arg("commands"),
+         "Runs cpptraj commands, one per line, gigist needs the keep keyword.")
+    .def("results", [](const std::shared_ptr<Session> &session) {
+      std::vector<Result> results{};
+      for (const std::shared_ptr<Action_GIGist> &action : session->m_results) {
+        results.push_back(Result{ session, action });
+      }
+      return results;
+    });
+
+  py::class_<Result>(m, "Result")
+    .def_property_readonly("grids", [](const Result &r) { return r.action->gridCount(); })
+    .def("names", [](const Result &r, int grid) { return r.action->arrayNames(grid); }, py::arg("grid") = 0)
+    .def("geometry", [](const Result &r, int grid) {
+      std::array<int, 3> dims{};
+      std::array<double, 3> origin{};
+      double spacing{ 0.0 };
+      if (!r.action->gridGeometry(grid, dims, origin, spacing)) {
+        throw py::index_error("No grid " + std::to_string(grid));
+      }
+      return py::make_tuple(dims, origin, spacing);
+    }, py::arg("grid") = 0, "Dimensions, corner and spacing of a grid.")
+    .def("array", [](py::object self, int grid, const std::string &name) {
+      const Result &r = self.cast<const Result &>();
+      ArrayView view{};
+      if (!r.action->array(grid, name, view)) {
+        throw py::key_error(name);
+      }
+      return toNumpy(view, self);
+    }, py::arg("grid"), py::arg("name"))
+    .def("entropy", [](const Result &r, int grid) {
+      py::gil_scoped_release release{};
+      return r.action->calculateEntropy(grid);
+    }, py::arg("grid") = 0, "Calculates the entropies of all voxels, e.g., after queryonly.")
+    .def("febiss", [](const Result &r, int grid) {
+      py::gil_scoped_release release{};
+      return r.action->placeFebiss(grid);
+    }, py::arg("grid") = 0, "Places the FEBISS waters, see the array febiss.");
+}